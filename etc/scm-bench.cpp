@@ -0,0 +1,422 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+// scm-bench -- Replay a camera path through an SCM scene and report timing
+//
+// usage: scm-bench [options] vert.glsl frag.glsl path.txt name=file.tif ...
+//
+//   -w n  Render width  (default 1920)
+//   -h n  Render height (default 1080)
+//   -d n  Sphere page detail in vertices (default 32)
+//   -l n  Sphere page subdivision limit in pixels (default 256)
+//   -m s  Cache mode: sync, async, or both (default both)
+//   -j k  Jump threshold, as a fraction of viewer distance (default 0.1)
+//   -H n  Frames to hold each jump awaiting full resolution (default 300)
+//
+// The scene is given by a vertex and fragment shader and any number of SCM
+// images, each with the GLSL name by which the shaders sample it. The path
+// file gives one state per frame, as one line of twelve numbers: the viewer
+// position vector (3), orientation quaternion (4), light vector (3), viewer
+// distance, and zoom. Lines beginning with # are ignored.
+//
+// The path is replayed in a hidden window once per cache mode, and the
+// results of each replay are written to stdout as one line of JSON. A jump is
+// a step between frames longer than the jump threshold. Time to full
+// resolution is measured from the start of the frame of the jump to the end
+// of the first frame with no cache misses and no loads in flight.
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <vector>
+#include <string>
+
+#include <SDL.h>
+
+#include "util3d/math3d.h"
+
+#include "scm-system.hpp"
+#include "scm-scene.hpp"
+#include "scm-image.hpp"
+#include "scm-state.hpp"
+#include "scm-stats.hpp"
+
+//------------------------------------------------------------------------------
+
+struct options
+{
+    options() : w(1920), h(1080), d(32), l(256), mode("both"),
+                jump(0.1), hold(300) { }
+
+    int         w;
+    int         h;
+    int         d;
+    int         l;
+    std::string mode;
+    double      jump;
+    int         hold;
+
+    std::string vert;
+    std::string frag;
+    std::string path;
+
+    std::vector<std::string> images;
+};
+
+struct result
+{
+    result() : frames(0), jumps(0), unresolved(0), seconds(0) { }
+
+    std::vector<double> times;  // Frame times in milliseconds
+    std::vector<double> fulls;  // Times to full resolution in milliseconds
+
+    int    frames;
+    int    jumps;
+    int    unresolved;
+    double seconds;
+
+    scm_stats::snapshot stats;
+};
+
+//------------------------------------------------------------------------------
+
+// Read a path file, giving one state per frame.
+
+static bool read_path(const std::string& name, std::vector<scm_state>& v)
+{
+    std::ifstream file(name.c_str());
+    std::string   line;
+
+    if (!file)
+        return false;
+
+    while (std::getline(file, line))
+    {
+        std::istringstream in(line);
+
+        double p[3], q[4], l[3], d, z;
+
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        if (in >> p[0] >> p[1] >> p[2]
+               >> q[0] >> q[1] >> q[2] >> q[3]
+               >> l[0] >> l[1] >> l[2] >> d >> z)
+        {
+            scm_state s;
+
+            s.set_position   (p);
+            s.set_orientation(q);
+            s.set_light      (l);
+            s.set_distance   (d);
+            s.set_zoom       (z);
+
+            v.push_back(s);
+        }
+    }
+    return !v.empty();
+}
+
+// Compute a column-major perspective projection with a 60 degree vertical
+// field of view, with near and far planes suited to the given state.
+
+static void get_projection(double *P, const scm_state& s, int w, int h)
+{
+    const double d = s.get_distance();
+    const double g = s.get_minimum_ground();
+    const double n = std::max(0.5 * (d - g), 1e-6 * d);
+    const double f = 2.0 * d + g;
+    const double y = 1.0 / tan(radians(30.0)) * s.get_zoom();
+    const double x = y * h / w;
+
+    memset(P, 0, 16 * sizeof (double));
+
+    P[ 0] =  x;
+    P[ 5] =  y;
+    P[10] = -(f + n) / (f - n);
+    P[11] = -1.0;
+    P[14] = -2.0 * f * n / (f - n);
+}
+
+// Return the current time in milliseconds.
+
+static double now()
+{
+    return 1000.0 * double(SDL_GetPerformanceCounter())
+                  / double(SDL_GetPerformanceFrequency());
+}
+
+// Return percentile p of the sorted values v.
+
+static double percentile(const std::vector<double>& v, double p)
+{
+    if (v.empty())
+        return 0.0;
+    else
+        return v[std::min(v.size() - 1, size_t(p * (v.size() - 1) + 0.5))];
+}
+
+// Return true if the frame of snapshot s was drawn at full resolution.
+
+static bool is_full(const scm_stats::snapshot& s)
+{
+    return s.count[scm_stats::cache_misses] == 0
+        && s.level[scm_stats::need_depth]   == 0
+        && s.level[scm_stats::load_depth]   == 0;
+}
+
+//------------------------------------------------------------------------------
+
+// Create a system and scene, replay the path, and gather the results.
+
+static bool replay(const options& o, SDL_Window *window, bool sync, result& r)
+{
+    scm_system *sys = new scm_system(o.w, o.h, o.d, o.l);
+
+    sys->set_synchronous(sync);
+
+    scm_scene *scene = sys->get_scene(sys->add_scene(0));
+
+    for (size_t k = 0; k < o.images.size(); ++k)
+    {
+        const std::string& s = o.images[k];
+        const size_t       e = s.find('=');
+
+        scm_image *image = scene->get_image(scene->add_image(int(k)));
+
+        image->set_name(s.substr(0, e));
+        image->set_scm (s.substr(e + 1));
+    }
+    scene->set_vert(o.vert);
+    scene->set_frag(o.frag);
+
+    // Await the opening of all files.
+
+    while (sys->get_pending_count())
+    {
+        sys->update_cache();
+        SDL_Delay(1);
+    }
+
+    std::vector<scm_state> states;
+
+    if (!read_path(o.path, states))
+    {
+        fprintf(stderr, "scm-bench: cannot read path %s\n", o.path.c_str());
+        delete sys;
+        return false;
+    }
+
+    // Replay the path, holding each jump until it resolves.
+
+    const double t0 = now();
+
+    for (size_t k = 0; k < states.size(); ++k)
+    {
+        scm_state& s = states[k];
+
+        s.set_foreground0(scene);
+
+        const bool jump = (k > 0 && (s - states[k - 1])
+                                  > o.jump * s.get_distance());
+        double P[16];
+        double V[16];
+        double M[16];
+
+        get_projection(P, s, o.w, o.h);
+        s.get_matrix(V);
+        minvert(M, V);
+
+        const double j0 = now();
+
+        for (int n = 0; n <= (jump ? o.hold : 0); ++n)
+        {
+            const double f0 = now();
+
+            glViewport(0, 0, o.w, o.h);
+            sys->render_sphere(&s, P, M, 0);
+            sys->update_cache();
+            glFinish();
+            SDL_GL_SwapWindow(window);
+
+            const double f1 = now();
+
+            r.times.push_back(f1 - f0);
+            r.frames++;
+
+            const scm_stats::snapshot& t = sys->get_stats();
+
+            if (jump && is_full(t))
+            {
+                r.fulls.push_back(f1 - j0);
+                break;
+            }
+            if (jump && n == o.hold)
+                r.unresolved++;
+        }
+        if (jump)
+            r.jumps++;
+    }
+
+    r.seconds = (now() - t0) / 1000.0;
+    r.stats   = sys->get_stats();
+
+    std::sort(r.times.begin(), r.times.end());
+    std::sort(r.fulls.begin(), r.fulls.end());
+
+    delete sys;
+    return true;
+}
+
+// Write the results of one replay as one line of JSON.
+
+static void report(const char *mode, const result& r)
+{
+    const long long *T = r.stats.total;
+
+    const double hits   = double(T[scm_stats::cache_hits]);
+    const double misses = double(T[scm_stats::cache_misses]);
+    const double s      = std::max(r.seconds, 1e-6);
+
+    printf("{\"mode\":\"%s\",\"frames\":%d,\"seconds\":%.3f,"
+           "\"frame_ms\":{\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,"
+           "\"max\":%.3f},"
+           "\"jumps\":%d,\"unresolved\":%d,"
+           "\"full_ms\":{\"p50\":%.3f,\"p90\":%.3f,\"max\":%.3f},"
+           "\"hit_rate\":%.4f,\"pages_read\":%lld,\"pages_per_s\":%.1f,"
+           "\"upload_mb_per_s\":%.2f,\"need_rejects\":%lld,"
+           "\"ejects\":%lld}\n",
+           mode, r.frames, r.seconds,
+           percentile(r.times, 0.50), percentile(r.times, 0.90),
+           percentile(r.times, 0.99), percentile(r.times, 1.00),
+           r.jumps, r.unresolved,
+           percentile(r.fulls, 0.50), percentile(r.fulls, 0.90),
+           percentile(r.fulls, 1.00),
+           (hits + misses > 0) ? hits / (hits + misses) : 1.0,
+           T[scm_stats::loader_pages],
+           T[scm_stats::loader_pages] / s,
+           T[scm_stats::cache_bytes] / s / (1024.0 * 1024.0),
+           T[scm_stats::need_rejects],
+           T[scm_stats::cache_ejects]);
+    fflush(stdout);
+}
+
+//------------------------------------------------------------------------------
+
+static int usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-w W] [-h H] [-d D] [-l L] [-m sync|async|both]"
+                    " [-j K] [-H N]\n"
+                    "       vert.glsl frag.glsl path.txt name=file.tif ...\n",
+                    name);
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char *argv[])
+{
+    options o;
+    int     a;
+
+    for (a = 1; a < argc && argv[a][0] == '-'; a += 2)
+    {
+        if (a + 1 >= argc)
+            return usage(argv[0]);
+
+        const char *v = argv[a + 1];
+
+        switch (argv[a][1])
+        {
+            case 'w': o.w    = atoi(v); break;
+            case 'h': o.h    = atoi(v); break;
+            case 'd': o.d    = atoi(v); break;
+            case 'l': o.l    = atoi(v); break;
+            case 'm': o.mode =      v;  break;
+            case 'j': o.jump = atof(v); break;
+            case 'H': o.hold = atoi(v); break;
+            default : return usage(argv[0]);
+        }
+    }
+    if (argc - a < 4)
+        return usage(argv[0]);
+
+    o.vert = argv[a++];
+    o.frag = argv[a++];
+    o.path = argv[a++];
+
+    for (; a < argc; ++a)
+        if (strchr(argv[a], '='))
+            o.images.push_back(argv[a]);
+        else
+            return usage(argv[0]);
+
+    // Create a hidden window and its OpenGL context.
+
+    if (SDL_Init(SDL_INIT_VIDEO) != 0)
+    {
+        fprintf(stderr, "scm-bench: %s\n", SDL_GetError());
+        return EXIT_FAILURE;
+    }
+
+    SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
+    SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE,  24);
+
+    SDL_Window *window = SDL_CreateWindow("scm-bench", SDL_WINDOWPOS_UNDEFINED,
+                                                       SDL_WINDOWPOS_UNDEFINED,
+                                          o.w, o.h, SDL_WINDOW_OPENGL
+                                                  | SDL_WINDOW_HIDDEN);
+    SDL_GLContext context = window ? SDL_GL_CreateContext(window) : 0;
+
+    if (context == 0 || glewInit() != GLEW_OK)
+    {
+        fprintf(stderr, "scm-bench: %s\n", SDL_GetError());
+        SDL_Quit();
+        return EXIT_FAILURE;
+    }
+    SDL_GL_SetSwapInterval(0);
+
+    // Replay in each requested mode.
+
+    int status = EXIT_SUCCESS;
+
+    if (o.mode == "sync" || o.mode == "both")
+    {
+        result r;
+
+        if (replay(o, window, true, r))
+            report("sync", r);
+        else
+            status = EXIT_FAILURE;
+    }
+    if (o.mode == "async" || o.mode == "both")
+    {
+        result r;
+
+        if (replay(o, window, false, r))
+            report("async", r);
+        else
+            status = EXIT_FAILURE;
+    }
+
+    SDL_GL_DeleteContext(context);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+
+    return status;
+}
+
+//------------------------------------------------------------------------------
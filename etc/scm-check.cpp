@@ -0,0 +1,248 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+// scm-check -- Compare the pages decoded by scm_reader with those of libtiff
+//
+// usage: scm-check input.tif [input.tif ...]
+//
+// Every page of each file is read both by scm_reader and strip by strip with
+// TIFFReadEncodedStrip, and the two results are compared byte for byte. The
+// pages are those of the page offset table, or lacking one, every directory in
+// the file's chain. Pages in formats that scm_reader does not support, which
+// the loaders pass to libtiff instead, are counted but not compared. The exit
+// status is failure if any page differs or fails to read.
+//
+// Each page is read a second time by an scm_reader on an scm_source giving
+// positioned reads of the local file, as a remote file is read, and that read
+// must both match and be made through the source rather than by libtiff.
+//
+// The codecs, predictors, byte orders, and offset sizes that scm_reader
+// handles may be covered by rewriting a file with tiffcp, for example:
+//
+//   tiffcp -c lzw:2    in.tif out.tif    LZW with horizontal differencing
+//   tiffcp -c zip      in.tif out.tif    Deflate
+//   tiffcp -c packbits in.tif out.tif    PackBits
+//   tiffcp -8 -B       in.tif out.tif    Big-endian BigTIFF
+//
+// tiffcp drops the SCM page catalog tags, so such copies are checked by
+// directory chain.
+
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <vector>
+
+#include <tiffio.h>
+
+#include "scm-reader.hpp"
+#include "scm-source.hpp"
+
+//------------------------------------------------------------------------------
+
+// A local_source reads a local file through the scm_source interface, counting
+// its reads. It is read by one thread only.
+
+class local_source : public scm_source
+{
+public:
+
+    local_source(const char *name) : fp(fopen(name, "rb")), size(0), reads(0)
+    {
+        if (fp && fseeko(fp, 0, SEEK_END) == 0)
+            size = uint64(ftello(fp));
+    }
+   ~local_source() { if (fp) fclose(fp); }
+
+    bool   is_open()  const { return (fp != 0); }
+    uint64 get_size() const { return size; }
+    uint64 get_time() const { return 0; }
+
+    std::string get_local() const { return std::string(); }
+
+    bool read(uint64 o, size_t n, void *p)
+    {
+        reads++;
+        return (fp && fseeko(fp, off_t(o), SEEK_SET) == 0
+                   && fread(p, 1, n, fp) == n);
+    }
+
+    long get_reads() const { return reads; }
+
+private:
+
+    FILE  *fp;
+    uint64 size;
+    long   reads;
+};
+
+//------------------------------------------------------------------------------
+
+// Return true if scm_reader decodes pages of the current directory of T.
+
+static bool supported(TIFF *T)
+{
+    uint16 b = 1;
+    uint16 z = COMPRESSION_NONE;
+    uint16 d = PREDICTOR_NONE;
+    uint16 q = PLANARCONFIG_CONTIG;
+
+    TIFFGetFieldDefaulted(T, TIFFTAG_BITSPERSAMPLE, &b);
+    TIFFGetFieldDefaulted(T, TIFFTAG_COMPRESSION,   &z);
+    TIFFGetFieldDefaulted(T, TIFFTAG_PREDICTOR,     &d);
+    TIFFGetFieldDefaulted(T, TIFFTAG_PLANARCONFIG,  &q);
+
+    return (b == 8 || b == 16 || b == 32)
+        && (z == COMPRESSION_NONE     || z == COMPRESSION_LZW     ||
+            z == COMPRESSION_PACKBITS || z == COMPRESSION_DEFLATE ||
+            z == COMPRESSION_ADOBE_DEFLATE)
+        && (d == PREDICTOR_NONE || d == PREDICTOR_HORIZONTAL)
+        && (q == PLANARCONFIG_CONTIG);
+}
+
+// Compare the page with the IFD at offset o as read by R and by T. Return true
+// if they agree.
+
+static bool compare(scm_reader& R, TIFF *T, uint64 o)
+{
+    uint32 w = 0;
+    uint32 h = 0;
+    uint16 c = 1;
+    uint16 b = 1;
+
+    TIFFGetField         (T, TIFFTAG_IMAGEWIDTH,      &w);
+    TIFFGetField         (T, TIFFTAG_IMAGELENGTH,     &h);
+    TIFFGetFieldDefaulted(T, TIFFTAG_SAMPLESPERPIXEL, &c);
+    TIFFGetFieldDefaulted(T, TIFFTAG_BITSPERSAMPLE,   &b);
+
+    const size_t z = size_t(w) * size_t(h) * size_t(c) * size_t(b) / 8;
+
+    if (z == 0)
+        return false;
+
+    std::vector<uint8> A(z, 0);
+    std::vector<uint8> B(z, 0);
+
+    if (!R.read_page(o, int(w), int(h), int(c), int(b), &A.front(), 0))
+        return false;
+
+    size_t k = 0;
+
+    for (tstrip_t s = 0; s < TIFFNumberOfStrips(T) && k < z; ++s)
+    {
+        tmsize_t r = TIFFReadEncodedStrip(T, s, &B[k], tmsize_t(z - k));
+
+        if (r < 0)
+            return false;
+
+        k += size_t(r);
+    }
+    return (k == z && memcmp(&A.front(), &B.front(), z) == 0);
+}
+
+// Check every page of the named file, reporting the results. Return true if
+// no page differs.
+
+static bool check(const char *name)
+{
+    TIFF *T = TIFFOpen(name, "r");
+
+    if (T == 0)
+    {
+        fprintf(stderr, "%s: failed to open\n", name);
+        return false;
+    }
+
+    scm_reader   R((std::string(name)));
+    local_source S(name);
+    scm_reader   Q(&S);
+
+    // Find the directory offset of every page.
+
+    std::vector<uint64> ov;
+    uint64              n = 0;
+    void               *p = 0;
+
+    if (TIFFGetField(T, 0xFFB2, &n, &p) && n > 0)
+        ov.assign((uint64 *) p, (uint64 *) p + n);
+    else
+        do
+            ov.push_back(TIFFCurrentDirOffset(T));
+        while (TIFFReadDirectory(T));
+
+    // Compare each page.
+
+    int same = 0;
+    int diff = 0;
+    int skip = 0;
+
+    for (size_t i = 0; i < ov.size(); ++i)
+    {
+        if (!TIFFSetSubDirectory(T, ov[i]))
+        {
+            fprintf(stderr, "%s: page %d at %llu failed to load\n",
+                    name, int(i), (unsigned long long) ov[i]);
+            diff++;
+        }
+        else if (!supported(T))
+            skip++;
+
+        else if (!compare(R, T, ov[i]))
+        {
+            fprintf(stderr, "%s: page %d at %llu differs\n",
+                    name, int(i), (unsigned long long) ov[i]);
+            diff++;
+        }
+        else
+        {
+            const long r = S.get_reads();
+
+            if (compare(Q, T, ov[i]) && S.get_reads() > r)
+                same++;
+            else
+            {
+                fprintf(stderr, "%s: page %d at %llu differs by source\n",
+                        name, int(i), (unsigned long long) ov[i]);
+                diff++;
+            }
+        }
+    }
+    TIFFClose(T);
+
+    printf("%s: %d pages match, %d differ, %d unsupported\n",
+           name, same, diff, skip);
+
+    return (diff == 0);
+}
+
+//------------------------------------------------------------------------------
+
+static int usage(const char *name)
+{
+    fprintf(stderr, "usage: %s input.tif [input.tif ...]\n", name);
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+        return usage(argv[0]);
+
+    bool ok = true;
+
+    for (int a = 1; a < argc; ++a)
+        if (!check(argv[a]))
+            ok = false;
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//------------------------------------------------------------------------------
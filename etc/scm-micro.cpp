@@ -0,0 +1,550 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+// scm-micro -- Time the hot primitives of the SCM page system
+//
+// usage: scm-micro [options]
+//
+//   -d n  Page tree depth of the synthetic page mix (default 12)
+//   -f n  Frames of the synthetic page mix (default 600)
+//   -r n  Repetitions of each case, the fastest reported (default 5)
+//   -t n  Maximum producer and consumer thread count (default 8)
+//   -i s  Read the page mix from a file of page indices, one per line
+//
+// Each case is written to stdout as one line of JSON giving its name, the
+// operation count, the nanoseconds per operation of the fastest repetition,
+// and a checksum of the results, which must agree between builds compared.
+// The service order of scm_queue is verified first, and scm-micro fails if it
+// is not by level, then by order of insertion within a level.
+//
+// The page mix resembles that of scm_sphere::prep: each frame selects the
+// pages about a point of interest, at every level down to the depth, while
+// the point drifts across the sphere. A mix recorded from a real prep may be
+// given instead, with frames separated by blank lines.
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <vector>
+#include <string>
+
+#include <SDL.h>
+
+#include "scm-index.hpp"
+#include "scm-search.hpp"
+#include "scm-queue.hpp"
+#include "scm-set.hpp"
+
+//------------------------------------------------------------------------------
+
+struct options
+{
+    options() : d(12), f(600), r(5), t(8) { }
+
+    int         d;
+    int         f;
+    int         r;
+    int         t;
+    std::string i;
+};
+
+typedef std::vector<long long> frame;
+typedef std::vector<frame>     mix;
+
+// A queue item with the fields an scm_queue prioritizes by.
+
+struct item
+{
+    item()                    : i(-1), a(false) { }
+    item(long long i, bool a) : i( i), a(     a) { }
+
+    long long i;
+    bool      a;
+};
+
+//------------------------------------------------------------------------------
+
+static double now()
+{
+    return double(SDL_GetPerformanceCounter())
+         / double(SDL_GetPerformanceFrequency());
+}
+
+static void report(const char *name, long long n, double t,
+                   unsigned long long check)
+{
+    printf("{\"bench\":\"%s\",\"ops\":%lld,\"ns_per_op\":%.3f,"
+           "\"check\":%llu}\n", name, n, 1e9 * t / std::max(n, 1LL), check);
+    fflush(stdout);
+}
+
+//------------------------------------------------------------------------------
+
+// Append to f the pages within two rows or columns of face position (y, x)
+// on root a, at every level of the tree to depth d.
+
+static void gather(frame& f, long long a, double y, double x, int d)
+{
+    for (long long l = 0; l < d; ++l)
+    {
+        const long long n = 1LL << l;
+        const long long r = std::min(n - 1, (long long) (y * n));
+        const long long c = std::min(n - 1, (long long) (x * n));
+
+        const long long r0 = std::max(0LL, r - 2), r1 = std::min(n - 1, r + 2);
+        const long long c0 = std::max(0LL, c - 2), c1 = std::min(n - 1, c + 2);
+
+        for     (long long i = r0; i <= r1; ++i)
+            for (long long j = c0; j <= c1; ++j)
+                f.push_back(scm_page_index(a, l, i, j));
+    }
+}
+
+// Generate a page mix following a point along a great circle.
+
+static void synthesize(mix& m, const options& o)
+{
+    for (int k = 0; k < o.f; ++k)
+    {
+        const double p = 2.0 * M_PI * k / o.f;
+        const double q = 0.3 * sin(7.0 * p);
+
+        double    v[3] = { cos(p) * cos(q), sin(q), sin(p) * cos(q) };
+        double    x;
+        double    y;
+        long long a;
+
+        scm_locate(&a, &y, &x, v);
+
+        m.push_back(frame());
+        gather(m.back(), a, y, x, o.d);
+    }
+}
+
+// Read a recorded page mix, one index per line and one frame per paragraph.
+
+static bool load(mix& m, const std::string& name)
+{
+    std::ifstream in(name.c_str());
+    std::string   line;
+
+    m.push_back(frame());
+
+    while (std::getline(in, line))
+    {
+        std::istringstream s(line);
+        long long          i;
+
+        if (s >> i)
+            m.back().push_back(i);
+        else if (!m.back().empty())
+            m.push_back(frame());
+    }
+    if (m.back().empty())
+        m.pop_back();
+
+    return !m.empty();
+}
+
+//------------------------------------------------------------------------------
+
+// Time the inline index arithmetic of scm-index.hpp.
+
+static void bench_index(const mix& m, const options& o)
+{
+    double             best = HUGE_VAL;
+    long long          n    = 0;
+    unsigned long long s    = 0;
+
+    for (int r = 0; r < o.r; ++r)
+    {
+        const double t0 = now();
+
+        n = 0;
+        s = 0;
+
+        for (size_t k = 0; k < m.size(); ++k)
+            for (size_t j = 0; j < m[k].size(); ++j)
+            {
+                const long long i = m[k][j];
+
+                s += scm_page_row(i) * 3 + scm_page_col(i);
+                s += scm_page_child(i, j & 3);
+
+                if (i > 5)
+                    s += scm_page_parent(i);
+                n++;
+            }
+
+        best = std::min(best, now() - t0);
+    }
+    report("index", n, best, s);
+}
+
+// Time the neighbor functions of scm-index.cpp.
+
+static void bench_neighbor(const mix& m, const options& o)
+{
+    double             best = HUGE_VAL;
+    long long          n    = 0;
+    unsigned long long s    = 0;
+
+    for (int r = 0; r < o.r; ++r)
+    {
+        const double t0 = now();
+
+        n = 0;
+        s = 0;
+
+        for (size_t k = 0; k < m.size(); ++k)
+            for (size_t j = 0; j < m[k].size(); ++j)
+            {
+                const long long i = m[k][j];
+
+                s += scm_page_north(i);
+                s += scm_page_south(i) * 3;
+                s += scm_page_east (i) * 5;
+                s += scm_page_west (i) * 7;
+                n++;
+            }
+
+        best = std::min(best, now() - t0);
+    }
+    report("neighbor", n, best, s);
+}
+
+// Time the catalog search behind scm_file::toindex. The catalog holds every
+// page of the upper levels, as a large file would, plus the deeper pages of
+// the mix, but lacks every third page, so that some searches miss.
+
+static void bench_search(const mix& m, const options& o)
+{
+    std::vector<uint64> v;
+
+    for (long long i = 0; i < scm_page_count(std::min(o.d, 9)); ++i)
+        v.push_back(uint64(i));
+
+    for (size_t k = 0; k < m.size(); ++k)
+        for (size_t j = 0; j < m[k].size(); ++j)
+            v.push_back(uint64(m[k][j]));
+
+    std::sort(v.begin(), v.end());
+    v.erase(std::unique(v.begin(), v.end()), v.end());
+
+    size_t w = 0;
+
+    for (size_t j = 0; j < v.size(); ++j)
+        if (v[j] % 3)
+            v[w++] = v[j];
+
+    v.resize(w);
+
+    scm_search S(&v[0], uint64(v.size()));
+
+    double             best = HUGE_VAL;
+    long long          n    = 0;
+    unsigned long long s    = 0;
+
+    for (int r = 0; r < o.r; ++r)
+    {
+        const double t0 = now();
+
+        n = 0;
+        s = 0;
+
+        for (size_t k = 0; k < m.size(); ++k)
+            for (size_t j = 0; j < m[k].size(); ++j)
+            {
+                s += S.find(uint64(m[k][j]));
+                n++;
+            }
+
+        best = std::min(best, now() - t0);
+    }
+    report("toindex", n, best, s);
+}
+
+// Time scm_set as the page set of a full atlas of g by g lines, as used by
+// scm_cache::get_page: a hit is touched, a miss takes a free line or ejects.
+
+static void bench_set(const mix& m, const options& o, int g, const char *name)
+{
+    const int L = g * g;
+
+    double             best = HUGE_VAL;
+    long long          n    = 0;
+    unsigned long long s    = 0;
+
+    for (int r = 0; r < o.r; ++r)
+    {
+        scm_set set;
+        int     size = 0;
+
+        const double t0 = now();
+
+        n = 0;
+        s = 0;
+
+        for (size_t k = 0; k < m.size(); ++k)
+        {
+            const int t = int(k) + 1;
+
+            for (size_t j = 0; j < m[k].size(); ++j)
+            {
+                const long long i = m[k][j];
+
+                scm_page page = set.search(scm_page(0, i), t);
+
+                if (page.is_valid())
+                    s += page.l;
+                else
+                {
+                    int l = -1;
+
+                    if (size < L)
+                        l = ++size;
+                    else
+                    {
+                        scm_page victim = set.eject(t, i);
+
+                        if (victim.is_valid())
+                            l = victim.l;
+                    }
+                    if (l > 0)
+                    {
+                        set.insert(scm_page(0, i, l), t);
+                        s += l * 3;
+                    }
+                    else
+                        s += 7;
+                }
+                n++;
+            }
+        }
+
+        best = std::min(best, now() - t0);
+    }
+    report(name, n, best, s);
+}
+
+//------------------------------------------------------------------------------
+
+// Shared state of one queue trial. Each producer inserts every page of its
+// share of the mix, and the consumers remove the same number between them.
+
+struct trial
+{
+    scm_queue<item>         *queue;
+    const std::vector<item> *items;
+    int                      threads;
+    SDL_atomic_t             check;
+};
+
+struct worker
+{
+    trial *T;
+    int    k;
+};
+
+static int produce(void *data)
+{
+    worker *w = (worker *) data;
+    trial  *T = w->T;
+
+    for (size_t j = w->k; j < T->items->size(); j += T->threads)
+        T->queue->insert((*T->items)[j]);
+
+    return 0;
+}
+
+static int consume(void *data)
+{
+    worker *w = (worker *) data;
+    trial  *T = w->T;
+    int     s = 0;
+
+    for (size_t j = w->k; j < T->items->size(); j += T->threads)
+        s += int(T->queue->remove().i & 0xFFFF);
+
+    SDL_AtomicAdd(&T->check, s);
+    return 0;
+}
+
+// Insert the first pages of the mix into one queue and remove them all,
+// confirming that items come out by level, prefetches last, and in order of
+// insertion within each level. Return false on any violation.
+
+static bool check_queue(const mix& m)
+{
+    std::vector<item> items;
+
+    for (size_t k = 0; k < m.size() && items.size() < 4096; ++k)
+        for (size_t j = 0; j < m[k].size() && items.size() < 4096; ++j)
+            items.push_back(item(m[k][j], (j % 5) == 0));
+
+    scm_queue<item> queue(int(items.size()));
+
+    for (size_t j = 0; j < items.size(); ++j)
+        queue.try_insert(items[j]);
+
+    std::vector<size_t> next(64, 0);   // Next expected item of each rank
+
+    long long last = 0;
+    size_t    seen = 0;
+    item      d;
+
+    while (queue.try_remove(d))
+    {
+        const long long l = std::min(scm_page_level(d.i), 31LL);
+        const long long r = d.a ? 32 + l : l;
+
+        // The rank must not decrease, and within a rank the item must be the
+        // earliest inserted of those remaining.
+
+        size_t& j = next[size_t(r)];
+
+        while (j < items.size() && (items[j].a != d.a ||
+               std::min(scm_page_level(items[j].i), 31LL) != l))
+            j++;
+
+        if (r < last || j == items.size() || items[j].i != d.i)
+            break;
+
+        j++;
+        last = r;
+        seen++;
+    }
+
+    const bool ok = (seen == items.size());
+
+    printf("{\"bench\":\"queue_order\",\"ops\":%lld,\"ok\":%s}\n",
+           (long long) items.size(), ok ? "true" : "false");
+    fflush(stdout);
+
+    return ok;
+}
+
+// Time scm_queue insert and remove with p producers and p consumers running
+// concurrently through a queue of the size used by scm_file.
+
+static void bench_queue(const mix& m, const options& o, int p)
+{
+    std::vector<item> items;
+
+    for (size_t k = 0; k < m.size(); ++k)
+        for (size_t j = 0; j < m[k].size(); ++j)
+            items.push_back(item(m[k][j], (j % 5) == 0));
+
+    double             best = HUGE_VAL;
+    unsigned long long s    = 0;
+
+    for (int r = 0; r < o.r; ++r)
+    {
+        scm_queue<item> queue(64);
+        trial T;
+
+        T.queue   = &queue;
+        T.items   = &items;
+        T.threads = p;
+        SDL_AtomicSet(&T.check, 0);
+
+        std::vector<worker>       W(2 * p);
+        std::vector<SDL_Thread *> H(2 * p);
+
+        const double t0 = now();
+
+        for (int k = 0; k < p; ++k)
+        {
+            W[k    ].T = &T; W[k    ].k = k;
+            W[k + p].T = &T; W[k + p].k = k;
+
+            H[k    ] = SDL_CreateThread(consume, "consume", &W[k    ]);
+            H[k + p] = SDL_CreateThread(produce, "produce", &W[k + p]);
+        }
+        for (int k = 0; k < 2 * p; ++k)
+            SDL_WaitThread(H[k], 0);
+
+        best = std::min(best, now() - t0);
+        s    = (unsigned long long) SDL_AtomicGet(&T.check);
+    }
+
+    char name[32];
+    sprintf(name, "queue_%d", p);
+    report(name, (long long) items.size() * 2, best, s);
+}
+
+//------------------------------------------------------------------------------
+
+static int usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-d D] [-f F] [-r R] [-t T] [-i mix.txt]\n",
+                    name);
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char *argv[])
+{
+    options o;
+    int     a;
+
+    for (a = 1; a < argc && argv[a][0] == '-'; a += 2)
+    {
+        if (a + 1 >= argc)
+            return usage(argv[0]);
+
+        const char *v = argv[a + 1];
+
+        switch (argv[a][1])
+        {
+            case 'd': o.d = atoi(v); break;
+            case 'f': o.f = atoi(v); break;
+            case 'r': o.r = atoi(v); break;
+            case 't': o.t = atoi(v); break;
+            case 'i': o.i =      v;  break;
+            default : return usage(argv[0]);
+        }
+    }
+    if (a < argc || o.d < 1 || o.d > 16 || o.f < 1 || o.r < 1 || o.t < 1)
+        return usage(argv[0]);
+
+    mix m;
+
+    if (o.i.empty())
+        synthesize(m, o);
+    else if (!load(m, o.i))
+    {
+        fprintf(stderr, "%s: no pages\n", o.i.c_str());
+        return EXIT_FAILURE;
+    }
+
+    if (!check_queue(m))
+    {
+        fprintf(stderr, "scm_queue service order violated\n");
+        return EXIT_FAILURE;
+    }
+
+    bench_index   (m, o);
+    bench_neighbor(m, o);
+    bench_search  (m, o);
+    bench_set     (m, o, 16, "set_16x16");
+    bench_set     (m, o, 64, "set_64x64");
+
+    for (int p = 1; p <= o.t; p *= 2)
+        bench_queue(m, o, p);
+
+    return EXIT_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,417 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+// scm-synth -- Write a synthetic SCM TIFF for use by the benchmark
+//
+// usage: scm-synth [options] output.tif
+//
+//   -d n  Page tree depth in levels (default 4)
+//   -n n  Page size, excluding the border (default 256)
+//   -c n  Channels per sample, 1 to 4 (default 1)
+//   -b n  Bits per channel: 8, 16, or 32 for float (default 16)
+//
+// Every page of levels 0 through depth-1 is written, each filled from a smooth
+// function of the sphere, so that the pages of neighboring faces and levels
+// agree along their borders. Pages are uncompressed BigTIFF directories. The
+// first directory gives the index, offset, minimum, and maximum of every page
+// and duplicates the image of root page 0. The output is written sequentially
+// and the header is patched last, so a partial file has no first directory.
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <vector>
+
+#include "scm-index.hpp"
+
+//------------------------------------------------------------------------------
+
+typedef unsigned long long uint64;
+
+struct options
+{
+    options() : d(4), n(256), c(1), b(16) { }
+
+    int d;
+    int n;
+    int c;
+    int b;
+};
+
+// A BigTIFF directory entry with its value, or the offset of its value.
+
+struct entry
+{
+    unsigned short tag;
+    unsigned short type;
+    uint64         count;
+    uint64         value;
+};
+
+// The stored bounds of one page, per channel, as doubles.
+
+struct bounds
+{
+    std::vector<double> min;
+    std::vector<double> max;
+};
+
+static FILE  *fp  = 0;
+static uint64 pos = 0;
+
+//------------------------------------------------------------------------------
+
+// Write n bytes at the end of the output, returning their offset.
+
+static uint64 put(const void *p, size_t n)
+{
+    const uint64 o = pos;
+
+    if (fwrite(p, 1, n, fp) != n)
+    {
+        perror("scm-synth fwrite");
+        exit(EXIT_FAILURE);
+    }
+    pos += n;
+    return o;
+}
+
+// Append an entry with a single SHORT or LONG value. The value is left-
+// justified within the entry, as the byte order requires.
+
+static void inline_entry(std::vector<entry>& v, unsigned short tag,
+                         unsigned short type, uint64 count, uint64 value)
+{
+    entry e = { tag, type, count, 0 };
+
+    if (type == 3)
+    {
+        unsigned short t = (unsigned short) value;
+        memcpy(&e.value, &t, 2);
+    }
+    else
+    {
+        unsigned int   t = (unsigned int)   value;
+        memcpy(&e.value, &t, 4);
+    }
+    v.push_back(e);
+}
+
+// Append an entry, writing its values out of line if they do not fit.
+
+static void array_entry(std::vector<entry>& v, unsigned short tag,
+                        unsigned short type, uint64 count, const void *p,
+                        size_t size)
+{
+    entry e = { tag, type, count, 0 };
+
+    if (count * size <= 8)
+        memcpy(&e.value, p, size_t(count * size));
+    else
+        e.value = put(p, size_t(count * size));
+
+    v.push_back(e);
+}
+
+// Write a directory with the given entries, returning its offset.
+
+static uint64 put_directory(const std::vector<entry>& v)
+{
+    if (pos & 1)
+        put("", 1);
+
+    const uint64 o = pos;
+    const uint64 n = v.size();
+    const uint64 z = 0;
+
+    put(&n, 8);
+
+    for (size_t j = 0; j < v.size(); ++j)
+    {
+        put(&v[j].tag,   2);
+        put(&v[j].type,  2);
+        put(&v[j].count, 8);
+        put(&v[j].value, 8);
+    }
+    put(&z, 8);
+
+    return o;
+}
+
+//------------------------------------------------------------------------------
+
+// Evaluate channel k of the synthetic field in the direction v. This is a sum
+// of octaves of plane waves, each finer than the last, giving detail at depth.
+
+static double field(const double *v, int k)
+{
+    double s = 0.0;
+    double w = 0.0;
+
+    for (int o = 0; o < 10; ++o)
+    {
+        const double f = 3.0 * (1 << o);
+        const double a = 1.0 / (1 << o);
+
+        const double p = 1.7 * o + 0.9 * k;
+        const double x = cos(p),       y = sin(p * 1.3), z = sin(p * 0.7);
+        const double m = sqrt(x * x + y * y + z * z);
+
+        s += a * sin(f * (v[0] * x + v[1] * y + v[2] * z) / m + p);
+        w += a;
+    }
+    return 0.5 + 0.5 * s / w;
+}
+
+// Fill page i, of size n plus border, with c channels of b bits each, noting
+// the bounds of each channel.
+
+static void fill(std::vector<unsigned char>& data, bounds& B, long long i,
+                 const options& o)
+{
+    const long long a = scm_page_root (i);
+    const long long l = scm_page_level(i);
+    const long long r = scm_page_row  (i);
+    const long long c = scm_page_col  (i);
+
+    const int    m = o.n + 2;
+    const double s = 1.0 / double(1LL << l);
+
+    data.resize(size_t(m) * m * o.c * o.b / 8);
+
+    B.min.assign(o.c,  HUGE_VAL);
+    B.max.assign(o.c, -HUGE_VAL);
+
+    for (int y = 0; y < m; ++y)
+        for (int x = 0; x < m; ++x)
+        {
+            // Pixel centers, with the border one pixel beyond the page. The
+            // columns of a page are mirrored with respect to scm_vector.
+
+            const double yy = s * (r + (y - 0.5) / o.n);
+            const double xx = s * (c + (x - 0.5) / o.n);
+
+            double v[3];
+
+            scm_vector(a, yy, 1.0 - xx, v);
+
+            for (int k = 0; k < o.c; ++k)
+            {
+                const size_t j = (size_t(y) * m + x) * o.c + k;
+                const double f = field(v, k);
+                double       d = 0.0;
+
+                if (o.b == 8)
+                {
+                    unsigned char t = (unsigned char) (f * 255.0 + 0.5);
+                    data[j] = t;
+                    d = t;
+                }
+                if (o.b == 16)
+                {
+                    unsigned short t = (unsigned short) (f * 65535.0 + 0.5);
+                    memcpy(&data[j * 2], &t, 2);
+                    d = t;
+                }
+                if (o.b == 32)
+                {
+                    float t = float(f);
+                    memcpy(&data[j * 4], &t, 4);
+                    d = t;
+                }
+                B.min[k] = std::min(B.min[k], d);
+                B.max[k] = std::max(B.max[k], d);
+            }
+        }
+}
+
+// Append the bounds of one page to a buffer in the sample type.
+
+static void pack(std::vector<unsigned char>& v, const std::vector<double>& d,
+                 int b)
+{
+    for (size_t k = 0; k < d.size(); ++k)
+    {
+        const size_t j = v.size();
+
+        v.resize(j + b / 8);
+
+        if (b == 8)
+            v[j] = (unsigned char) d[k];
+        if (b == 16)
+        {
+            unsigned short t = (unsigned short) d[k];
+            memcpy(&v[j], &t, 2);
+        }
+        if (b == 32)
+        {
+            float t = float(d[k]);
+            memcpy(&v[j], &t, 4);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// Write the image data of one page and gather the entries describing it.
+
+static void put_image(std::vector<entry>& e,
+                      const std::vector<unsigned char>& data,
+                      const options& o)
+{
+    const int    m = o.n + 2;
+    const size_t w = size_t(m) * o.c * o.b / 8;
+    const int    h = std::max(1, int(8192 / w));
+    const int    S = (m + h - 1) / h;
+
+    std::vector<uint64> so(S);
+    std::vector<uint64> sc(S);
+
+    for (int j = 0; j < S; ++j)
+    {
+        const int y0 = j * h;
+        const int y1 = std::min(y0 + h, m);
+
+        sc[j] = uint64(y1 - y0) * w;
+        so[j] = put(&data[y0 * w], size_t(sc[j]));
+    }
+
+    std::vector<unsigned short> bps(o.c, o.b);
+    std::vector<unsigned short> fmt(o.c, o.b == 32 ? 3 : 1);
+    unsigned short              xs = 0;
+
+    inline_entry(e, 0x0100, 4, 1, m);
+    inline_entry(e, 0x0101, 4, 1, m);
+    array_entry (e, 0x0102, 3, o.c, &bps[0], 2);
+    inline_entry(e, 0x0103, 3, 1, 1);
+    inline_entry(e, 0x0106, 3, 1, o.c < 3 ? 1 : 2);
+    array_entry (e, 0x0111, 16, S, &so[0], 8);
+    inline_entry(e, 0x0115, 3, 1, o.c);
+    inline_entry(e, 0x0116, 4, 1, h);
+    array_entry (e, 0x0117, 16, S, &sc[0], 8);
+    inline_entry(e, 0x011C, 3, 1, 1);
+
+    if (o.c == 2 || o.c == 4)
+        array_entry(e, 0x0152, 3, 1, &xs, 2);
+
+    array_entry (e, 0x0153, 3, o.c, &fmt[0], 2);
+}
+
+static int usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-d D] [-n N] [-c 1|2|3|4] [-b 8|16|32]"
+                    " output.tif\n", name);
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char *argv[])
+{
+    options o;
+    int     a;
+
+    for (a = 1; a < argc && argv[a][0] == '-'; a += 2)
+    {
+        if (a + 1 >= argc)
+            return usage(argv[0]);
+
+        const int v = atoi(argv[a + 1]);
+
+        switch (argv[a][1])
+        {
+            case 'd': o.d = v; break;
+            case 'n': o.n = v; break;
+            case 'c': o.c = v; break;
+            case 'b': o.b = v; break;
+            default : return usage(argv[0]);
+        }
+    }
+    if (argc - a != 1 || o.d < 1 || o.d > 16 || o.n < 1 || o.c < 1 || o.c > 4
+                      || (o.b != 8 && o.b != 16 && o.b != 32))
+        return usage(argv[0]);
+
+    if ((fp = fopen(argv[a], "wb")) == 0)
+    {
+        perror(argv[a]);
+        return EXIT_FAILURE;
+    }
+
+    // Write a BigTIFF header in host byte order, with the first directory
+    // offset to be patched at the end.
+
+    const unsigned short one = 1;
+    const char *order = (*(const char *) &one) ? "II" : "MM";
+    const unsigned short version = 43;
+    const unsigned short width   =  8;
+    const unsigned short zero    =  0;
+    const uint64         first   =  0;
+
+    put(order,    2);
+    put(&version, 2);
+    put(&width,   2);
+    put(&zero,    2);
+    put(&first,   8);
+
+    // Write every page in index order, noting its directory offset and bounds.
+
+    std::vector<uint64>        xv;
+    std::vector<uint64>        ov;
+    std::vector<unsigned char> av;
+    std::vector<unsigned char> zv;
+    std::vector<entry>         root;
+    std::vector<unsigned char> data;
+
+    const long long count = scm_page_count(o.d);
+
+    for (long long i = 0; i < count; ++i)
+    {
+        std::vector<entry> e;
+        bounds             B;
+
+        fill(data, B, i, o);
+        put_image(e, data, o);
+
+        if (i == 0)
+            root = e;
+
+        xv.push_back(uint64(i));
+        ov.push_back(put_directory(e));
+
+        pack(av, B.min, o.b);
+        pack(zv, B.max, o.b);
+
+        fprintf(stderr, "\rscm-synth %lld / %lld", i + 1, count);
+    }
+    fprintf(stderr, "\n");
+
+    // Write the first directory: the image of root page 0 plus the catalog.
+
+    const unsigned short type = (o.b == 8) ? 1 : (o.b == 16) ? 3 : 11;
+    const uint64         n    = xv.size();
+
+    array_entry(root, 0xFFB1, 16, n,       &xv[0], 8);
+    array_entry(root, 0xFFB2, 16, n,       &ov[0], 8);
+    array_entry(root, 0xFFB3, type, n * o.c, &av[0], o.b / 8);
+    array_entry(root, 0xFFB4, type, n * o.c, &zv[0], o.b / 8);
+
+    const uint64 head = put_directory(root);
+
+    if (fseek(fp, 8, SEEK_SET) || fwrite(&head, 8, 1, fp) != 1 || fclose(fp))
+    {
+        perror(argv[a]);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
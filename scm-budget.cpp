@@ -0,0 +1,245 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "scm-budget.hpp"
+#include "scm-log.hpp"
+
+//------------------------------------------------------------------------------
+
+/// The number of frames between rebalances of the video memory budget.
+
+int    scm_budget::rebalance_frames = 30;
+
+/// The fraction by which each cache's grant exceeds its peak working set.
+
+double scm_budget::headroom         = 0.25;
+
+//------------------------------------------------------------------------------
+
+/// Create a budget with no target. Caches keep their full atlases.
+
+scm_budget::scm_budget() : target(0), last(0), dirty(false)
+{
+}
+
+/// Set the total size in bytes of all cache atlases. Zero restores each cache
+/// to its full capacity. The change takes effect at the next update.
+
+void scm_budget::set_target(size_t z)
+{
+    target = z;
+    dirty  = true;
+}
+
+/// Track the demand of the given caches during frame t, and rebalance them if
+/// the period has elapsed or the collection of caches has changed. This should
+/// be called by the render thread after each cache update.
+/// @see scm_system::update_cache
+
+void scm_budget::update(const scm_cache_v& v, int t)
+{
+    // Match the shares to the current caches, keeping any existing state.
+
+    if (v.size() != shares.size())
+        dirty = true;
+
+    std::vector<share> next;
+
+    for (size_t i = 0; i < v.size(); ++i)
+    {
+        size_t j;
+
+        for (j = 0; j < shares.size(); ++j)
+            if (shares[j].cache == v[i])
+                break;
+
+        if (j < shares.size())
+            next.push_back(shares[j]);
+        else
+        {
+            next.push_back(share(v[i]));
+            next.back().lines  = v[i]->get_lines();
+            next.back().ejects = v[i]->get_ejects();
+            dirty = true;
+        }
+    }
+    shares.swap(next);
+
+    // Accumulate the peak working set of each cache.
+
+    for (size_t i = 0; i < shares.size(); ++i)
+        shares[i].peak = std::max(shares[i].peak,
+                                  shares[i].cache->get_working());
+
+    if (dirty || t - last >= rebalance_frames)
+    {
+        rebalance();
+        dirty = false;
+        last  = t;
+    }
+}
+
+// Compute the demand of each cache and apportion the target among them.
+
+void scm_budget::rebalance()
+{
+    const size_t n = shares.size();
+
+    std::vector<int> g(n);
+
+    double want = 0.0;
+
+    // Determine each demand, in lines and in bytes.
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        share&     s = shares[i];
+        scm_cache *c = s.cache;
+
+        s.pressure = c->get_ejects() - s.ejects;
+        s.ejects   = c->get_ejects();
+
+        // A cache new to the budget keeps its capacity until measured.
+
+        if (target && s.demand)
+        {
+            s.demand = int(s.peak * (1.0 + headroom)) + 1;
+
+            if (s.pressure > 0)
+                s.demand = std::max(s.demand, c->get_lines()
+                                            + int(s.pressure));
+
+            s.demand = std::max(std::min(s.demand, c->get_max_lines()), 2);
+        }
+        else
+            s.demand = target ? c->get_lines() : c->get_max_lines();
+
+        g[i]  = s.demand;
+        want += double(s.demand) * c->get_line_bytes();
+    }
+
+    // Scale all demands down to fit the target, or distribute the surplus.
+
+    bool over = false;
+
+    if (target && want > double(target))
+    {
+        const double k = double(target) / want;
+
+        for (size_t i = 0; i < n; ++i)
+            g[i] = std::max(int(g[i] * k), 2);
+
+        over = true;
+    }
+    else if (target)
+    {
+        double left = double(target) - want;
+
+        // Keep the pages already held.
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            const scm_cache *c = shares[i].cache;
+            const double     z = double(c->get_line_bytes());
+
+            int d = std::max(c->get_used() + 1 - g[i], 0);
+                d = std::min(d, int(left / z));
+
+            g[i] += d;
+            left -= d * z;
+        }
+
+        // Grow the caches under eviction pressure.
+
+        long long p = 0;
+
+        for (size_t i = 0; i < n; ++i)
+            p += shares[i].pressure;
+
+        if (p > 0)
+        {
+            const double a = left;
+
+            for (size_t i = 0; i < n; ++i)
+            {
+                const scm_cache *c = shares[i].cache;
+                const double     z = double(c->get_line_bytes());
+
+                int d = int(a * shares[i].pressure / p / z);
+                    d = std::min(d, c->get_max_lines() - g[i]);
+
+                g[i] += d;
+            }
+        }
+    }
+
+    // Apply each grant that differs significantly from the current capacity.
+    // A cache that must shrink to meet the target shrinks by at least one
+    // sixteenth, and so is not reallocated again as its demand creeps upward
+    // until that margin is consumed. Without a target, every cache returns to
+    // its full capacity however small the difference.
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        scm_cache *c = shares[i].cache;
+
+        const int m = c->get_lines();
+
+        if (over && g[i] < m)
+            g[i] = std::min(g[i], m - std::max(m / 16, 1));
+
+        if ((over && g[i] < m) || (!target && g[i] != m)
+                               || 8 * std::abs(g[i] - m) > m)
+        {
+            scm_log("scm_budget rebalance %d peak %d pressure %lld : %d -> %d",
+                    int(i), shares[i].peak, shares[i].pressure, m, g[i]);
+
+            c->set_lines(g[i]);
+        }
+        shares[i].lines = c->get_lines();
+        shares[i].peak  = 0;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+/// Return the number of caches under this budget.
+
+int scm_budget::get_count() const
+{
+    return int(shares.size());
+}
+
+/// Return the state of the ith cache as of the last rebalance.
+
+const scm_budget::share& scm_budget::get_share(int i) const
+{
+    return shares[i];
+}
+
+/// Return the current total size in bytes of all cache atlases.
+
+size_t scm_budget::get_total() const
+{
+    size_t z = 0;
+
+    for (size_t i = 0; i < shares.size(); ++i)
+        z += size_t(shares[i].cache->get_lines())
+                  * shares[i].cache->get_line_bytes();
+
+    return z;
+}
+
+//------------------------------------------------------------------------------
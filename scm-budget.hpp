@@ -0,0 +1,87 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#ifndef SCM_BUDGET_HPP
+#define SCM_BUDGET_HPP
+
+#include <vector>
+
+#include "scm-cache.hpp"
+
+//------------------------------------------------------------------------------
+
+/// An scm_budget divides a total video memory target among all caches
+///
+/// Each cache is created with its full atlas. Once a target is set, the budget
+/// periodically resizes every atlas according to measured demand. A cache is
+/// granted its peak working set, the distinct resident pages used in any one
+/// frame, plus a fraction of headroom. A cache that ejected pages during the
+/// last period also asks to grow by the number ejected. If these demands
+/// exceed the target, all are scaled down in proportion. Otherwise, any
+/// surplus first preserves the pages each cache already holds, and then goes
+/// to the caches under eviction pressure. The rest is left unallocated.
+///
+/// A change smaller than one eighth of a cache's capacity is not applied, so
+/// that atlases are not reallocated in response to noise. A cache must shrink
+/// whenever the target is exceeded, but then shrinks by at least one sixteenth
+/// of its capacity, leaving a margin for demand to grow before the next change.
+/// A 2D atlas is sized in whole rows of pages, so the total may slightly exceed
+/// the target.
+/// @see scm_cache::set_lines
+
+class scm_budget
+{
+public:
+
+    static int    rebalance_frames;
+    static double headroom;
+
+    /// A share records the state and most recent allotment of one cache.
+
+    struct share
+    {
+        share(scm_cache *c = 0) : cache(c), lines(0), demand(0), peak(0),
+                                  ejects(0), pressure(0) { }
+
+        scm_cache *cache;     ///< Cache
+        int        lines;     ///< Capacity granted at the last rebalance
+        int        demand;    ///< Capacity wanted at the last rebalance
+        int        peak;      ///< Peak working set since the last rebalance
+        long long  ejects;    ///< Eject count at the last rebalance
+        long long  pressure;  ///< Pages ejected during the last period
+    };
+
+    scm_budget();
+
+    void         set_target(size_t);
+    size_t       get_target() const { return target; }
+
+    void         update(const scm_cache_v&, int);
+
+    int          get_count()      const;
+    const share& get_share(int)   const;
+    size_t       get_total()      const;
+
+private:
+
+    std::vector<share> shares;
+
+    size_t target;  // Total atlas size in bytes, or zero for no limit
+    int    last;    // Frame of the last rebalance
+    bool   dirty;   // Rebalance at the next update
+
+    void rebalance();
+};
+
+//------------------------------------------------------------------------------
+
+#endif
@@ -12,6 +12,7 @@
 
 #include <GL/glew.h>
 
+#include <algorithm>
 #include <cstdlib>
 #include <cassert>
 #include <limits>
@@ -19,6 +20,8 @@
 #include "scm-cache.hpp"
 #include "scm-system.hpp"
 #include "scm-index.hpp"
+#include "scm-stats.hpp"
+#include "scm-trace.hpp"
 #include "scm-log.hpp"
 
 //------------------------------------------------------------------------------
@@ -30,9 +33,10 @@
 
 int scm_cache::cache_size      = 16;
 
-/// The number of loader threads servicing page load requests for each cache.
+/// The number of loader threads in the pool servicing page load requests for
+/// all files. Zero selects one thread per processor. @see scm_loader
 
-int scm_cache::cache_threads   =  2;
+int scm_cache::cache_threads   =  0;
 
 /// The maximum number of page load requests allowed at any moment. (Requests
 /// from the render thread to the loader threads.) If this limit is exceeded
@@ -47,70 +51,209 @@ int scm_cache::need_queue_size = 32;
 int scm_cache::load_queue_size =  8;
 
 /// The maximum number of page load results that may be uploaded to the atlas
-/// by the render thread each frame. A large value may impact frame rate. A
-/// small value may increase frame latency and/or block the loader threads.
+/// by the render thread each frame, when no upload time budget is given. A
+/// large value may impact frame rate. A small value may increase frame latency
+/// and/or block the loader threads. @see scm_system::set_upload_budget
 
 int scm_cache::loads_per_cycle =  2;
 
+/// The number of frames a page request may go unwanted before it is dropped.
+/// A request is wanted each time its page is touched while it is waiting. A
+/// loader skips the decode of a stale request, and the render thread discards
+/// a stale result without uploading it or counting it against the upload
+/// budget.
+
+int scm_cache::stale_frames    =  8;
+
+/// The size in megabytes of the decoded page cache held in system memory for
+/// each cache format. Pages evicted from the atlas and later requested again
+/// are copied from here without file access or decoding. Zero disables it.
+/// @see scm_host
+
+int scm_cache::host_cache_size =  0;
+
+/// Store pages as the layers of a mipmapped array texture rather than as the
+/// tiles of a single 2D atlas. Each page receives a full mipmap chain computed
+/// by the loader threads, and anisotropic filtering is enabled where supported,
+/// eliminating the aliasing of distant pages and the bleeding of neighbouring
+/// tiles at mipmap levels. Ignored where array textures are not supported.
+/// The page capacity remains cache_size squared, but is further limited to the
+/// array layer count supported by the driver. A cache so limited logs the
+/// reduction, and get_max_lines gives the capacity actually available.
+
+bool scm_cache::cache_array    = false;
+
+/// The storage of caches of 32-bit float data, applying to caches created
+/// afterward. Zero stores the data as read. One converts each page to half
+/// float, preserving about three decimal digits. Two normalizes each page to
+/// 16-bit unsigned integers over the range of its own values, and the shader
+/// receives the offset and scale of each page. Either halves the memory and
+/// upload bandwidth of each page, doubling the page count of a given budget.
+/// The conversion is made by the loader threads. @see scm_image
+
+int scm_cache::float_storage   =  0;
+
 //------------------------------------------------------------------------------
 
 /// Create a new page cache with a queue for making page requests
 ///
 /// Initialize all OpenGL state including the texture atlas and a ring of
-/// pixel buffer objects for use in asynchronous upload of page data.
+/// pixel buffer slots for use in asynchronous upload of page data. Where
+/// ARB_buffer_storage is supported, the slots are carved from one buffer that
+/// remains mapped for the life of the cache, so loaders write into stable
+/// pointers. Otherwise each slot is a separate buffer mapped per request.
+///
+/// A block-compressed cache stores pages as BC1, BC4, or BC5 exactly as read
+/// from the file. Its atlas is given twice the grid size, holding four times
+/// as many pages. BC1 and BC4 take 4 bits per texel and BC5 takes 8, so this
+/// atlas takes 16 or 32 bits for each texel of page capacity. That is less
+/// than RGB data, but twice that of 8-bit one- or two-channel data.
 ///
 /// @param sys SCM system
 /// @param n   Page size in pixels
 /// @param c   Channels per pixel
 /// @param b   Bits per channel
+/// @param e   Block compression format, or zero
 
-scm_cache::scm_cache(scm_system *sys, int n, int c, int b) :
+scm_cache::scm_cache(scm_system *sys, int n, int c, int b, int e) :
     sys(sys),
     pages(),
-    waits(),
+    table(cache_size * cache_size + 2 * need_queue_size),
     loads(load_queue_size),
+    host(0),
+    arena(0),
+    span(0),
     texture(0),
+    target(GL_TEXTURE_2D),
     s(cache_size),
+    rows(cache_size),
     l(1),
+    lines(cache_size * cache_size),
+    max_lines(0),
+    levels(1),
     n(n),
     c(c),
-    b(b)
+    b(b),
+    e(e),
+    g(0),
+    hits(0),
+    misses(0),
+    ejects(0),
+    touched(0),
+    working(0),
+    query(0),
+    cost(1e-6)
 {
-    // Generate pixel buffer objects.
+    // Choose the atlas size and layout.
 
-    for (int i = 0; i < 2 * need_queue_size; ++i)
+    if (e)
     {
-        GLuint o;
-        glGenBuffers(1, &o);
-        pbos.push_back(o);
+        GLint z;
+
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &z);
+
+        s     = std::max(std::min(2 * s, int(z) / (n + 2)), s);
+        rows  = s;
+        lines = s * s;
     }
 
-    // Generate the array texture object.
+    if (cache_array && (GLEW_VERSION_3_0 || GLEW_EXT_texture_array))
+    {
+        GLint z;
+
+        glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &z);
 
-    GLenum i = scm_internal_form(c, b);
-    GLenum e = scm_external_form(c, b);
-    GLenum y = scm_external_type(c, b);
+        target = GL_TEXTURE_2D_ARRAY;
+        lines  = std::min(s * s, int(z));
 
-    glGenTextures  (1, &texture);
-    glBindTexture  (GL_TEXTURE_2D, texture);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        if (lines < s * s)
+            scm_log("* scm_cache array capacity %d of %d pages", lines, s * s);
+        rows   = lines;
+        levels = e ? 1 : scm_mipmap_count(n + 2);
+    }
 
-//  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-//  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 16);
-//  glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE);
+    max_lines = lines;
 
-    // Initialize it with a buffer of zeros.
+    // Choose the storage of float data, and the value range of each line.
 
-    const int m = s * (n + 2);
+    if (b == 32 && e == 0)
+        g = float_storage;
 
-    if (GLubyte *p = (GLubyte *) calloc(m * m, scm_pixel_size(c, b)))
+    if (g == 1 && !(GLEW_ARB_half_float_pixel || GLEW_VERSION_3_0))
+        g = 0;
+
+    if (g == 2)
     {
-        glTexImage2D(GL_TEXTURE_2D, 0, i, m, m, 0, e, y, p);
-        free(p);
+        ranges.resize(2 * max_lines, 0.f);
+
+        for (int k = 0; k < max_lines; ++k)
+            ranges[2 * k + 1] = 1.f;
+    }
+
+    // Generate the upload ring. Each slot receives a page and its mipmaps.
+
+    const int    r = 2 * need_queue_size;
+    const uint16 h = scm_storage_bits(b, g);
+
+    span = (scm_page_size(n + 2, c, h, e)
+         + scm_mipmap_size(n + 2, levels, c, h) + 255) & ~size_t(255);
+
+    buffers.resize(r, 0);
+    fences .resize(r, 0);
+    wants  .resize(r);
+
+    SDL_AtomicSet(&now, 0);
+
+    for (int k = 0; k < r; ++k)
+        SDL_AtomicSet(&wants[k], 0);
+
+    if (GLEW_ARB_buffer_storage)
+    {
+        const GLbitfield f = GL_MAP_WRITE_BIT
+                           | GL_MAP_PERSISTENT_BIT
+                           | GL_MAP_COHERENT_BIT;
+        GLuint o;
+
+        glGenBuffers(1, &o);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, o);
+        glBufferStorage(GL_PIXEL_UNPACK_BUFFER, span * r, 0, f);
+        arena = (GLubyte *) glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0,
+                                                         span * r, f);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        if (arena)
+            for (int k = 0; k < r; ++k)
+                buffers[k] = o;
+        else
+            glDeleteBuffers(1, &o);
     }
+    if (arena == 0)
+        glGenBuffers(r, &buffers.front());
 
-    scm_log("scm_cache constructor %d %d %d", n, c, b);
+    for (int k = 0; k < r; ++k)
+        pbos.enq(k);
+
+    // Create the upload timer queries, if supported.
+
+    for (int j = 0; j < queries_count; ++j)
+    {
+        queries[j] = 0;
+        timing [j] = 0;
+    }
+    if (GLEW_ARB_timer_query)
+        glGenQueries(queries_count, queries);
+
+    // Create the host page cache, if enabled.
+
+    if (host_cache_size > 0)
+        host = new scm_host(size_t(host_cache_size) << 20,
+                            scm_page_size(n + 2, c, b, e));
+
+    // Generate the texture object.
+
+    init_texture(rows);
+
+    scm_log("scm_cache constructor %d %d %d %d", n, c, b, e);
 }
 
 /// Destroy a page cache and finalize all OpenGL state
@@ -121,19 +264,31 @@ scm_cache::~scm_cache()
 
     // Drain any completed loads to ensure that the loaders aren't blocked.
 
-    update(0, true);
+    update(0, true, -1.0);
+
+    // Release the timer queries and the upload ring.
 
-    // Release the pixel buffer objects.
+    if (queries[0])
+        glDeleteQueries(queries_count, queries);
 
-    while (!pbos.empty())
+    for (size_t k = 0; k < fences.size(); ++k)
+        if (fences[k]) glDeleteSync(fences[k]);
+
+    if (arena)
     {
-        glDeleteBuffers(1, &pbos.back());
-        pbos.pop_back();
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers.front());
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(1, &buffers.front());
     }
+    else
+        glDeleteBuffers(GLsizei(buffers.size()), &buffers.front());
 
-    // Release the texture.
+    // Release the texture and host page cache.
 
     glDeleteTextures(1, &texture);
+
+    delete host;
 }
 
 /// Add a page request to the load queue
@@ -141,10 +296,203 @@ scm_cache::~scm_cache()
 void scm_cache::add_load(scm_task& task)
 {
     loads.insert(task);
+    scm_stats::add(scm_stats::load_depth, 1);
+}
+
+//------------------------------------------------------------------------------
+
+// Generate the atlas texture with r rows of pages, or r layers if the atlas is
+// an array, and clear it. Line zero, the blank filler, is always included.
+
+void scm_cache::init_texture(int r)
+{
+    const GLenum i = e ? scm_compressed_form(e) : scm_storage_form(c, b, g);
+    const GLenum x =     scm_external_form(c, b);
+    const GLenum y =     scm_storage_type (c, b, g);
+    const uint16 h =     scm_storage_bits (b, g);
+
+    glGenTextures(1, &texture);
+    glBindTexture(target, texture);
+
+    if (target == GL_TEXTURE_2D_ARRAY)
+    {
+        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(target, GL_TEXTURE_MAX_LEVEL,  levels - 1);
+        glTexParameteri(target, GL_TEXTURE_WRAP_S,     GL_CLAMP_TO_EDGE);
+        glTexParameteri(target, GL_TEXTURE_WRAP_T,     GL_CLAMP_TO_EDGE);
+
+        if (GLEW_EXT_texture_filter_anisotropic)
+        {
+            GLfloat a;
+            glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &a);
+            glTexParameterf(target, GL_TEXTURE_MAX_ANISOTROPY_EXT, a);
+        }
+
+        // Allocate each level and clear layer zero, the blank filler.
+
+        for (int k = 0; k < levels; ++k)
+        {
+            const int    m = std::max((n + 2) >> k, 1);
+            const size_t z = scm_page_size(m, c, h, e);
+
+            if (e)
+                glCompressedTexImage3D(target, k, i, m, m, r, 0,
+                                       GLsizei(z * r), 0);
+            else
+                glTexImage3D(target, k, i, m, m, r, 0, x, y, 0);
+
+            if (GLubyte *p = (GLubyte *) calloc(z, 1))
+            {
+                if (e)
+                    glCompressedTexSubImage3D(target, k, 0, 0, 0, m, m, 1,
+                                              i, GLsizei(z), p);
+                else
+                    glTexSubImage3D(target, k, 0, 0, 0, m, m, 1, x, y, p);
+                free(p);
+            }
+        }
+    }
+    else
+    {
+        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+        // Initialize it with a buffer of zeros.
+
+        const int    w = s * (n + 2);
+        const int    v = r * (n + 2);
+        const size_t z = scm_page_size(n + 2, c, h, e) * s * r;
+
+        if (GLubyte *p = (GLubyte *) calloc(z, 1))
+        {
+            if (e)
+                glCompressedTexImage2D(target, 0, i, w, v, 0, GLsizei(z), p);
+            else
+                glTexImage2D(target, 0, i, w, v, 0, x, y, p);
+            free(p);
+        }
+    }
+    glBindTexture(target, 0);
+}
+
+/// Set the page capacity of the atlas
+///
+/// A 2D atlas keeps its width and changes its height, so the capacity is
+/// rounded up to whole rows of pages, and a page keeps its position whatever
+/// the capacity. An array atlas changes its layer count. The capacity is
+/// clamped to that with which the cache was created. Pages beyond a reduced
+/// capacity are ejected. The texture is reallocated and the remaining pages
+/// copied across where ARB_copy_image is supported. Otherwise all pages are
+/// flushed and reloaded on demand. @see scm_budget
+///
+/// @param m Page capacity, including the blank line zero
+
+void scm_cache::set_lines(int m)
+{
+    int r;
+    int k;
+
+    if (target == GL_TEXTURE_2D)
+    {
+        r = std::max(std::min((m + s - 1) / s, max_lines / s), 1);
+        k = r * s;
+    }
+    else
+    {
+        r = std::max(std::min(m, max_lines), 2);
+        k = r;
+    }
+
+    if (k != lines)
+    {
+        scm_log("scm_cache set_lines %d %d %d %d : %d -> %d", n, c, b, e,
+                                                            lines, k);
+
+        // Eject all pages above the new capacity.
+
+        if (k < lines)
+        {
+            std::vector<scm_page> v;
+
+            pages.remove_lines(k, v);
+
+            for (size_t j = 0; j < v.size(); ++j)
+                table.remove(v[j].f, v[j].i);
+
+            ejects += v.size();
+            l       = std::min(l, k);
+
+            scm_stats::add(scm_stats::cache_ejects, int(v.size()));
+        }
+
+        // Reallocate the texture, copying the pages that remain.
+
+        GLuint o = texture;
+
+        init_texture(r);
+
+        if (GLEW_ARB_copy_image)
+        {
+            const int q = std::min(r, rows);
+
+            if (target == GL_TEXTURE_2D)
+                glCopyImageSubData(o,       target, 0, 0, 0, 0,
+                                   texture, target, 0, 0, 0, 0,
+                                   s * (n + 2), q * (n + 2), 1);
+            else
+                for (int j = 0; j < levels; ++j)
+                {
+                    const int d = std::max((n + 2) >> j, 1);
+
+                    glCopyImageSubData(o,       target, j, 0, 0, 0,
+                                       texture, target, j, 0, 0, 0, d, d, q);
+                }
+        }
+        else flush();
+
+        glDeleteTextures(1, &o);
+
+        rows  = r;
+        lines = k;
+    }
 }
 
 //------------------------------------------------------------------------------
 
+/// Return the size in bytes of each upload slot, holding a page and its mipmaps
+
+size_t scm_cache::get_span() const
+{
+    return span;
+}
+
+/// Return the size in bytes of the atlas storage of each cache line
+
+size_t scm_cache::get_line_bytes() const
+{
+    const uint16 h = scm_storage_bits(b, g);
+
+    return scm_page_size(n + 2, c, h, e) + scm_mipmap_size(n + 2, levels, c, h);
+}
+
+/// Return the value offset and scale of the page in cache line l. These are
+/// zero and one unless pages are normalized. @see float_storage
+
+void scm_cache::get_line_range(int l, GLfloat& o, GLfloat& k) const
+{
+    if (g == 2 && 0 <= l && l < max_lines)
+    {
+        o = ranges[2 * l + 0];
+        k = ranges[2 * l + 1];
+    }
+    else
+    {
+        o = 0.f;
+        k = 1.f;
+    }
+}
+
 /// Return the OpenGL texture object representing the cache
 
 GLuint scm_cache::get_texture() const
@@ -156,7 +504,8 @@ GLuint scm_cache::get_texture() const
 ///
 /// Cache lines are indexed from left to right and top to bottom. Request the
 /// page if necessary. Return 0 if the page is not available (line 0 is always
-/// transparent blank and will thus appear invisible).
+/// transparent blank and will thus appear invisible). A single table probe
+/// determines whether the page is resident, waiting, or unknown.
 ///
 /// @param f File index
 /// @param i Page index
@@ -174,49 +523,126 @@ int scm_cache::get_page(int f, long long i, int t, int& u)
         if (o == 0)
             return 0;
 
-        // If this page is waiting, return the filler.
-
-        scm_page wait = waits.search(scm_page(f, i), t);
+        // If this page is loaded, return the index. If waiting, the filler.
 
-        if (wait.is_valid())
+        if (scm_entry *entry = table.search(f, i))
         {
-            u    = wait.t;
-            return wait.l;
+            if (entry->is_waiting())
+            {
+                SDL_AtomicSet(&wants[entry->s], t);
+                scm_stats::add(scm_stats::cache_misses);
+                misses++;
+            }
+            else
+            {
+                scm_stats::add(scm_stats::cache_hits);
+                hits++;
+
+                if (pages.touch(entry->k, t) != t)
+                    touched++;
+            }
+            u    = entry->t;
+            return entry->l;
         }
 
-        // If this page is loaded, return the index.
+        scm_stats::add(scm_stats::cache_misses);
+        misses++;
 
-        scm_page page = pages.search(scm_page(f, i), t);
+        // Otherwise request the page and add it to the table as waiting.
+
+        add_need(file, f, i, o, t, false);
+    }
+
+    // If all else fails, punt and let the app request again.
+
+    u = t;
+    return 0;
+}
+
+/// Request a page expected to become visible soon
+///
+/// A resident page is marked used at time t so that it survives until it is
+/// needed. An unknown page is requested at prefetch priority, behind all pages
+/// currently visible, and only while at least half of the upload slots are free
+/// so that visible pages are never starved of slots. Hits and misses are not
+/// counted. Return true if the page is resident or does not exist, and false
+/// if it is yet to arrive. @see scm_sphere::set_prefetch
+///
+/// @param f File index
+/// @param i Page index
+/// @param t Current time
+
+bool scm_cache::ask_page(int f, long long i, int t)
+{
+    if (scm_file *file = sys->get_file(f))
+    {
+        uint64 o = file->get_page_offset(i);
 
-        if (page.is_valid())
+        if (o == 0)
+            return true;
+
+        if (scm_entry *entry = table.search(f, i))
         {
-            u    = page.t;
-            return page.l;
+            if (!entry->is_waiting())
+            {
+                if (pages.touch(entry->k, t) != t)
+                    touched++;
+
+                return true;
+            }
+            SDL_AtomicSet(&wants[entry->s], t);
         }
+        else if (pbos.size() > buffers.size() / 2)
+            add_need(file, f, i, o, t, true);
+
+        return false;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+// Claim an upload slot and queue a load task for page i of file f at offset o,
+// wanted at time t, adding the page to the table as waiting. Prefetch tasks are
+// served after all others.
+
+void scm_cache::add_need(scm_file *file, int f, long long i, uint64 o, int t,
+                                                                     bool a)
+{
+    int k = take_pbo();
+
+    if (k >= 0)
+    {
+        scm_task task = arena ?
+            scm_task(f, i, o, n, c, b, k, buffers[k], GLintptr(span * k),
+                                   arena + span * k, this) :
+            scm_task(f, i, o, n, c, b, k, buffers[k], this);
 
-        // Otherwise request the page and add it to the waiting set.
+        task.a = a;
 
-        if (!pbos.empty())
+        SDL_AtomicSet(&wants[k], t);
+
+        if (file->add_need(task))
         {
-            scm_task task(f, i, o, n, c, b, pbos.deq(), this);
-            scm_page page(f, i, 0);
+            scm_entry& entry = table.insert(f, i);
 
-            if (file->add_need(task))
-            {
-                waits.insert(page, t);
-            }
-            else
-            {
-                task.dump_page();
-                pbos.enq(task.u);
-            }
+            entry   = scm_entry();
+            entry.s = k;
+        }
+        else
+        {
+            task.dump_page();
+            pbos.enq(k);
         }
     }
+}
 
-    // If all else fails, punt and let the app request again.
+/// Return true if the request occupying upload slot k has gone unwanted for
+/// more than stale_frames. This may be called by any thread.
 
-    u = t;
-    return 0;
+bool scm_cache::is_stale(int k)
+{
+    return (SDL_AtomicGet(&now) - SDL_AtomicGet(&wants[k]) > stale_frames);
 }
 
 /// Find a slot for an incoming page
@@ -229,71 +655,219 @@ int scm_cache::get_page(int f, long long i, int t, int& u)
 
 int scm_cache::get_slot(int t, long long i)
 {
-    if (l < s * s)
+    if (l < lines)
         return l++;
     else
     {
         scm_page victim = pages.eject(t, i);
 
         if (victim.is_valid())
+        {
+            table.remove(victim.f, victim.i);
+            scm_stats::add(scm_stats::cache_ejects);
+            ejects++;
             return victim.l;
+        }
         else
             return 0;
     }
 }
 
+// Remove and return the least-recently queued upload slot that is free for
+// reuse, passing over slots whose last upload the GPU has yet to finish.
+// Return -1 if there is none.
+
+int scm_cache::take_pbo()
+{
+    for (scm_fifo<int>::iterator j = pbos.begin(); j != pbos.end(); ++j)
+        if (get_pbo(*j))
+        {
+            int k = *j;
+            pbos.erase(j);
+            return k;
+        }
+
+    return -1;
+}
+
+/// Return true if upload slot k is free for reuse. A slot of the persistent
+/// arena remains busy until the GPU has finished reading its last upload.
+
+bool scm_cache::get_pbo(int k)
+{
+    if (fences[k])
+    {
+        if (glClientWaitSync(fences[k], 0, 0) == GL_TIMEOUT_EXPIRED)
+            return false;
+
+        glDeleteSync(fences[k]);
+        fences[k] = 0;
+    }
+    return true;
+}
+
 //------------------------------------------------------------------------------
 
 /// Handle incoming textures on the loads queue, copying them to the atlas.
 ///
 /// This should be called by the render thread every frame. If invoked with
 /// the synchronous flag, loop until all page requests in the load queue are
-/// handled.
+/// handled. Otherwise, given a budget of m milliseconds, upload pages while
+/// their estimated cost fits the budget, always allowing at least one. Given
+/// a negative budget, upload at most loads_per_cycle pages. The estimate is
+/// the byte count of each upload times a per-byte cost measured using timer
+/// queries, where supported. Return the estimated time spent.
 ///
 /// @param t Current time
 /// @param b Synchronous?
+/// @param m Upload time budget in milliseconds
 
-void scm_cache::update(int t, bool b)
+double scm_cache::update(int t, bool b, double m)
 {
-    int c;
+    const Uint64 t0 = scm_stats::now();
+    const double x  = cost * span;
+
+    scm_trace::scope     trace("cache_update");
+    scm_trace::gpu_scope trace_gpu("upload");
+
+    double z = 0.0;
+    size_t y = 0;
+    int    c = 0;
 
     scm_task task;
 
-    glBindTexture(GL_TEXTURE_2D, texture);
+    SDL_AtomicSet(&now, t);
+
+    // Note the number of resident pages used since the last update.
+
+    working = touched;
+    touched = 0;
+
+    // Fold any finished timings into the cost estimate and begin a new one.
+
+    get_cost();
+
+    const bool timed = (queries[query] && timing[query] == 0);
+
+    if (timed)
+        glBeginQuery(GL_TIME_ELAPSED, queries[query]);
 
-    for (c = 0; (b || c < loads_per_cycle) && loads.try_remove(task); ++c)
+    glBindTexture(target, texture);
+
+    while ((b || (m < 0 ? c < loads_per_cycle : (c == 0 || z + x <= m)))
+              && loads.try_remove(task))
     {
-        if (task.d)
+        scm_stats::add(scm_stats::load_depth, -1);
+
+        if (task.d && is_stale(task.k))
+        {
+            scm_stats::add(scm_stats::cache_stale);
+            table.remove(task.f, task.i);
+            task.dump_page();
+        }
+        else if (task.d)
         {
             scm_page page(task.f, task.i);
 
-            waits.remove(page);
+            table.remove(page.f, page.i);
 
             if (int l = get_slot(t, page.i))
             {
                 page.l = l;
                 page.t = t;
-                pages.insert(page, t);
-                task.make_page((l % s) * (n + 2),
-                               (l / s) * (n + 2));
+
+                scm_entry& entry = table.insert(page.f, page.i);
+
+                entry.l = l;
+                entry.t = t;
+                entry.k = pages.insert(page, t);
+
+                if (g == 2)
+                {
+                    ranges[2 * l + 0] = task.v0;
+                    ranges[2 * l + 1] = task.v1;
+                }
+
+                if (target == GL_TEXTURE_2D_ARRAY)
+                    task.make_layer(l, std::min(levels, task.v));
+                else
+                    task.make_page((l % s) * (n + 2),
+                                   (l / s) * (n + 2));
+
+                if (arena)
+                    fences[task.k] =
+                        glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+                scm_stats::add(scm_stats::cache_uploads);
+                scm_stats::add(scm_stats::cache_bytes, int(span));
+
+                y += span;
+                z += x;
             }
             else task.dump_page();
+
+            c++;
+        }
+        else
+        {
+            table.remove(task.f, task.i);
+            task.dump_page();
         }
-        else task.dump_page();
 
-        pbos.enq(task.u);
+        pbos.enq(task.k);
     }
+
+    if (timed)
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+
+        if (y)
+        {
+            timing[query] = y;
+            query = (query + 1) % queries_count;
+        }
+    }
+    scm_stats::add(scm_stats::upload_time, t0);
+    return z;
+}
+
+// Poll the timer queries of previous updates. Fold the per-byte cost of each
+// finished upload into a running estimate.
+
+void scm_cache::get_cost()
+{
+    for (int j = 0; j < queries_count; ++j)
+        if (timing[j])
+        {
+            GLint a = 0;
+
+            glGetQueryObjectiv(queries[j], GL_QUERY_RESULT_AVAILABLE, &a);
+
+            if (a)
+            {
+                GLuint64 d = 0;
+
+                glGetQueryObjectui64v(queries[j], GL_QUERY_RESULT, &d);
+
+                cost      = 0.75 * cost + 0.25 * (double(d) * 1e-6 / timing[j]);
+                timing[j] = 0;
+            }
+        }
 }
 
 /// Render a 2D overlay of the contents of all caches.
 ///
 /// The parameters are used to format an optimal on-screen array of caches.
+/// Array texture caches have no single image to show and are not drawn.
 ///
 /// @param ii Cache index
 /// @param nn Cache count
 
 void scm_cache::render(int ii, int nn)
 {
+    if (target != GL_TEXTURE_2D)
+        return;
+
     glPushAttrib(GL_ENABLE_BIT);
     {
         GLint v[4];
@@ -348,8 +922,10 @@ void scm_cache::render(int ii, int nn)
 void scm_cache::flush()
 {
     while (!pages.empty())
-        pages.eject(0, -1);
-
+    {
+        scm_page victim = pages.eject(0, -1);
+        table.remove(victim.f, victim.i);
+    }
     l = 1;
 }
 
@@ -22,10 +22,30 @@
 #include "scm-fifo.hpp"
 #include "scm-task.hpp"
 #include "scm-set.hpp"
+#include "scm-table.hpp"
+#include "scm-host.hpp"
 
 //------------------------------------------------------------------------------
 
 class scm_system;
+class scm_file;
+
+//------------------------------------------------------------------------------
+
+/// An scm_entry records the state of a page known to a cache, either resident
+/// in the atlas or awaiting loading.
+
+struct scm_entry
+{
+    scm_entry() : l(0), t(0), k(-1), s(-1) { }
+
+    int l;  ///< Cache line index
+    int t;  ///< Cache add time
+    int k;  ///< Resident page set node, or -1 if waiting
+    int s;  ///< Upload slot index, while waiting
+
+    bool is_waiting() const { return (k < 0); }
+};
 
 //------------------------------------------------------------------------------
 
@@ -41,38 +61,100 @@ public:
     static int need_queue_size;
     static int load_queue_size;
     static int loads_per_cycle;
+    static int stale_frames;
+    static int host_cache_size;
+    static bool cache_array;
+    static int  float_storage;
 
-    scm_cache(scm_system *, int, int, int);
+    scm_cache(scm_system *, int, int, int, int);
    ~scm_cache();
 
     void   add_load(scm_task&);
 
     int    get_grid_size() const { return s; }
+    int    get_grid_rows() const { return rows; }
     int    get_page_size() const { return n; }
+    int    get_format()    const { return e; }
+    int    get_storage()   const { return g; }
+    GLenum get_target()    const { return target; }
+    int    get_levels()    const { return levels; }
+    size_t get_span()      const;
 
     GLuint get_texture() const;
     int    get_page(int, long long, int, int&);
+    bool   is_stale(int);
+    bool   ask_page(int, long long, int);
+
+    long long get_hits()   const { return hits;   }
+    long long get_misses() const { return misses; }
+    long long get_ejects() const { return ejects; }
+
+    int    get_lines()     const { return lines;     }
+    int    get_max_lines() const { return max_lines; }
+    int    get_used()      const { return l - 1;     }
+    int    get_working()   const { return working;   }
+    size_t get_line_bytes() const;
+    void   get_line_range(int, GLfloat&, GLfloat&) const;
+
+    void   set_lines(int);
 
-    void   update(int, bool);
+    scm_host *get_host()   const { return host;   }
+
+    double update(int, bool, double);
     void   render(int, int);
     void   flush ();
 
 private:
 
-    scm_system         *sys;
-    scm_set             pages;  // Page set currently active
-    scm_set             waits;  // Page set currently being loaded
-    scm_queue<scm_task> loads;  // Page loader queue
-    scm_fifo <GLuint>   pbos;   // Asynchronous upload ring
+    scm_system           *sys;
+    scm_set               pages;  // Page set currently active
+    scm_table<scm_entry>  table;  // Page look-up, active and loading
+    scm_queue<scm_task>   loads;  // Page loader queue
+    scm_fifo <int>        pbos;   // Idle upload slots, oldest first
+    scm_host             *host;   // Decoded page cache in system memory
+
+    std::vector<GLuint>   buffers;    // Pixel unpack buffer of each slot
+    std::vector<GLsync>   fences;     // Pending upload fence of each slot
+    std::vector<SDL_atomic_t> wants;  // Last time each slot's page was wanted
+    SDL_atomic_t          now;        // Time of the latest update
+    GLubyte              *arena;      // Persistent upload arena mapping
+    size_t                span;       // Upload slot size in bytes
 
     GLuint texture;             // Atlas texture object
-    int    s;                   // Atlas width and height in pages
+    GLenum target;              // Atlas texture target, 2D or 2D array
+    int    s;                   // Atlas width in pages
+    int    rows;                // Atlas height in pages, or layer count
     int    l;                   // Atlas current page
+    int    lines;               // Atlas page capacity
+    int    max_lines;           // Atlas page capacity limit
+    int    levels;              // Atlas mipmap level count
     int    n;                   // Page width and height in pixels
     int    c;                   // Channels per pixel
     int    b;                   // Bits per channel
-
-    int get_slot(int, long long);
+    int    e;                   // Block compression format
+    int    g;                   // Storage conversion of float data
+
+    std::vector<GLfloat> ranges;  // Value offset and scale of each line
+
+    long long hits;             // Look-ups finding a resident page
+    long long misses;           // Look-ups finding none
+    long long ejects;           // Resident pages ejected to make room
+    int       touched;          // Distinct resident pages used this frame
+    int       working;          // Distinct resident pages used last frame
+
+    static const int queries_count = 4;
+
+    GLuint queries[queries_count];  // Upload timer queries
+    size_t timing [queries_count];  // Bytes timed by each pending query
+    int    query;                   // Next timer query
+    double cost;                    // Upload time per byte in milliseconds
+
+    void init_texture(int);
+    void get_cost();
+    int  get_slot(int, long long);
+    bool get_pbo (int);
+    int  take_pbo();
+    void add_need(scm_file *, int, long long, uint64, int, bool);
 };
 
 typedef std::vector<scm_cache *>           scm_cache_v;
@@ -0,0 +1,478 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "util3d/glsl.h"
+
+#include "scm-cull.hpp"
+#include "scm-scene.hpp"
+#include "scm-index.hpp"
+#include "scm-log.hpp"
+
+//------------------------------------------------------------------------------
+
+/// The maximum number of pages in each level of the traversal and in the
+/// selection. A view needing more is selected on the CPU.
+
+int scm_cull::capacity = 65536;
+
+/// The number of levels of the page tree traversed. Pages at the last level
+/// are drawn without subdivision. The page key allows at most 16.
+
+int scm_cull::depth    = 16;
+
+//------------------------------------------------------------------------------
+
+// A catalog entry gives a page key, with the page status in the top bit of x,
+// and its radius bounds.
+
+struct entry
+{
+    GLuint x;
+    GLuint y;
+    GLfloat r0;
+    GLfloat r1;
+};
+
+static bool operator<(const entry& a, const entry& b)
+{
+    if ((a.x & 0x7FFFFFFF) < (b.x & 0x7FFFFFFF)) return true;
+    if ((a.x & 0x7FFFFFFF) > (b.x & 0x7FFFFFFF)) return false;
+    return (a.y < b.y);
+}
+
+static bool operator==(const entry& a, const entry& b)
+{
+    return ((a.x & 0x7FFFFFFF) == (b.x & 0x7FFFFFFF) && a.y == b.y);
+}
+
+// Compute the key of page i. @see scm_cull_comp.glsl
+
+static inline void key(long long i, GLuint& x, GLuint& y)
+{
+    const scm_coord p = scm_page_coord(i);
+
+    x = GLuint((p.l <<  3) | p.a);
+    y = GLuint((p.r << 16) | p.c);
+}
+
+// Compute the index of the page with key (x, y).
+
+static inline long long index_of(GLuint x, GLuint y)
+{
+    return scm_page_index((x & 7), (x & 0x7FFFFFFF) >> 3, y >> 16, y & 0xFFFF);
+}
+
+//------------------------------------------------------------------------------
+
+#include "scm_cull_comp.h"
+
+/// Create the compute program and the buffers of the traversal.
+
+scm_cull::scm_cull() : program(0)
+{
+    GLint  n = GLint(scm_cull_comp_len);
+    GLint  p = 0;
+    GLuint s;
+
+    const GLchar *t = (const GLchar *) scm_cull_comp;
+
+    s = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource (s, 1, &t, &n);
+    glCompileShader(s);
+
+    program = glCreateProgram();
+    glAttachShader(program, s);
+    glLinkProgram (program);
+    glDeleteShader(s);
+
+    glGetProgramiv(program, GL_LINK_STATUS, &p);
+
+    if (p == 0)
+    {
+        GLchar log[1024];
+
+        glGetProgramInfoLog(program, sizeof (log), 0, log);
+        scm_log("scm_cull program failed %s", log);
+    }
+
+    uM         = glsl_uniform(program, "M");
+    usize      = glsl_uniform(program, "size");
+    ulimit     = glsl_uniform(program, "limit");
+    ulevel     = glsl_uniform(program, "level");
+    udepth     = glsl_uniform(program, "depth");
+    ucapacity  = glsl_uniform(program, "capacity");
+    ucatalog_n = glsl_uniform(program, "catalog_n");
+    upresent   = glsl_uniform(program, "present");
+
+    // Each list has a header of four words, followed by two words per page.
+    // The selection has the same header followed by four words per page.
+
+    const GLsizeiptr l = (4 + 2 * GLsizeiptr(capacity)) * sizeof (GLuint);
+    const GLsizeiptr c = (4 + 4 * GLsizeiptr(capacity)) * sizeof (GLuint);
+    const GLsizeiptr a = (4 * GLsizeiptr(depth))        * sizeof (GLuint);
+
+    glGenBuffers(2, lists);
+    glGenBuffers(1, &chosen);
+    glGenBuffers(1, &args);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, lists[0]);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, l, 0, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, lists[1]);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, l, 0, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, chosen);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, c, 0, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, args);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, a, 0, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    scm_log("scm_cull constructor %d", program);
+}
+
+/// Delete all buffers, fences, and the program.
+
+scm_cull::~scm_cull()
+{
+    for (std::map<view_key, view *>::iterator it = views.begin();
+                                              it != views.end(); ++it)
+        del_view(it->second);
+
+    glDeleteBuffers(1, &args);
+    glDeleteBuffers(1, &chosen);
+    glDeleteBuffers(2, lists);
+    glDeleteProgram(program);
+}
+
+/// Return true if the OpenGL implementation supports GPU selection.
+
+bool scm_cull::is_supported()
+{
+    return (GLEW_ARB_compute_shader &&
+            GLEW_ARB_shader_storage_buffer_object &&
+            GLEW_ARB_draw_indirect && GLEW_ARB_sync);
+}
+
+/// Delete the selection state of all channels of the given scene, which is
+/// being deleted, so that no scene later allocated at the same address
+/// inherits its buffers or results.
+
+void scm_cull::del_scene(const scm_scene *scene)
+{
+    std::map<view_key, view *>::iterator a, b, it;
+
+    a = views.lower_bound(view_key(scene, std::numeric_limits<int>::min()));
+    b = views.upper_bound(view_key(scene, std::numeric_limits<int>::max()));
+
+    for (it = a; it != b; ++it)
+        del_view(it->second);
+
+    views.erase(a, b);
+}
+
+// Delete the buffers and fences of a view, and the view itself.
+
+void scm_cull::del_view(view *v)
+{
+    for (int k = 0; k < ring_size; ++k)
+        if (v->fence[k])
+            glDeleteSync(v->fence[k]);
+
+    glDeleteBuffers(ring_size, v->ring);
+    glDeleteBuffers(1, &v->catalog);
+
+    delete v;
+}
+
+scm_cull::view::view() : catalog(0), catalog_n(0), present(false),
+                         head(0), pending(0), valid(false)
+{
+    for (int k = 0; k < ring_size; ++k)
+        fence[k] = 0;
+
+    glGenBuffers(1, &catalog);
+    glGenBuffers(ring_size, ring);
+}
+
+//------------------------------------------------------------------------------
+
+/// Select the pages of a view of a scene for drawing, as scm_sphere::prep would
+/// before it applies the neighborhood rule. Read back the most recent complete
+/// selection, if any, and issue the selection of this view. Return false if no
+/// selection is yet available, in which case the CPU should select.
+///
+/// @param scene   Scene giving the data to be rendered
+/// @param M       Model-view-projection matrix in OpenGL column-major order
+/// @param width   Width of the render target (in pixels)
+/// @param height  Height of the render target (in pixels)
+/// @param channel Channel index
+/// @param limit   Subdivision limit (in pixels)
+/// @param pages   Output selection
+
+bool scm_cull::select(scm_scene *scene, const double *M,
+                      int width, int height, int channel, int limit,
+                      std::vector<page>& pages)
+{
+    view *&v = views[view_key(scene, channel)];
+
+    if (v == 0)
+        v = new view();
+
+    // Do nothing until all files are open, and reload when they change.
+
+    std::vector<int> files;
+
+    if (!scene->get_page_files(channel, files))
+        return false;
+
+    if (files != v->files)
+    {
+        load(v, scene, channel);
+        v->files.swap(files);
+    }
+
+    // Receive the oldest selection, if complete, and issue a new one.
+
+    read(v);
+
+    if (v->pending < ring_size)
+        run(v, M, width, height, limit);
+
+    if (v->valid)
+    {
+        pages = v->last;
+        return true;
+    }
+    return false;
+}
+
+//------------------------------------------------------------------------------
+
+// Build and upload the catalog of a scene channel, discarding any selections
+// of the previous catalog.
+
+void scm_cull::load(view *v, scm_scene *scene, int channel)
+{
+    std::vector<long long> c;
+    std::vector<entry>     e;
+
+    v->present = !scene->get_page_catalog(channel, c);
+
+    for (long long i = 0; i < 6; ++i)
+        c.push_back(i);
+
+    e.reserve(c.size());
+
+    for (size_t j = 0; j < c.size(); ++j)
+        if (scm_page_level(c[j]) < depth)
+        {
+            entry n;
+
+            key(c[j], n.x, n.y);
+
+            if (v->present || scene->get_page_status(channel, c[j]))
+                n.x |= 0x80000000;
+
+            scene->get_page_bounds(channel, c[j], n.r0, n.r1);
+            e.push_back(n);
+        }
+
+    std::sort(e.begin(), e.end());
+    e.erase(std::unique(e.begin(), e.end()), e.end());
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, v->catalog);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, e.size() * sizeof (entry),
+                                          &e.front(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    v->catalog_n = GLuint(e.size());
+    v->valid     = false;
+
+    for (int k = 0; k < ring_size; ++k)
+        if (v->fence[k])
+        {
+            glDeleteSync(v->fence[k]);
+            v->fence[k] = 0;
+        }
+
+    v->pending = 0;
+
+    scm_log("scm_cull load %d pages", int(e.size()));
+}
+
+// Traverse the page tree on the GPU and copy the selection into the next
+// readback buffer of the ring.
+
+void scm_cull::run(view *v, const double *M, int width, int height, int limit)
+{
+    // Reset the root list, the selection, and the dispatch arguments, giving
+    // the six root pages as the first level.
+
+    GLuint roots[16] = { 6, 0, 0, 0, 0, 0, 1, 0, 2, 0, 3, 0, 4, 0, 5, 0 };
+    GLuint empty[4]  = { 0, 0, 0, 0 };
+
+    std::vector<GLuint> a(4 * depth, 1);
+
+    for (int l = 0; l < depth; ++l)
+    {
+        a[4 * l + 0] = (l == 0) ? 1 : 0;
+        a[4 * l + 3] = 0;
+    }
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, lists[0]);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof (roots), roots);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, chosen);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof (empty), empty);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, args);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, a.size() * sizeof (GLuint),
+                                                &a.front());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    // Configure the program.
+
+    GLfloat N[16];
+
+    for (int k = 0; k < 16; ++k)
+        N[k] = GLfloat(M[k]);
+
+    glUseProgram(program);
+    glUniformMatrix4fv(uM, 1, GL_FALSE, N);
+    glUniform2f (usize, GLfloat(width), GLfloat(height));
+    glUniform1f (ulimit, GLfloat(limit));
+    glUniform1ui(udepth, GLuint(depth));
+    glUniform1ui(ucapacity, GLuint(capacity));
+    glUniform1ui(ucatalog_n, v->catalog_n);
+    glUniform1i (upresent, v->present ? 1 : 0);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, v->catalog);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, chosen);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, args);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, args);
+
+    // Evaluate each level, the target of one being the source of the next.
+
+    for (int l = 0; l < depth; ++l)
+    {
+        GLuint s = lists[(l    ) % 2];
+        GLuint t = lists[(l + 1) % 2];
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, t);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof (empty), empty);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, s);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, t);
+
+        glUniform1ui(ulevel, GLuint(l));
+        glDispatchComputeIndirect(GLintptr(l) * 4 * sizeof (GLuint));
+
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT |
+                        GL_BUFFER_UPDATE_BARRIER_BIT  |
+                        GL_COMMAND_BARRIER_BIT);
+    }
+
+    for (GLuint k = 0; k < 5; ++k)
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, k, 0);
+
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER,    0);
+    glUseProgram(0);
+
+    // Copy the selection for reading back once the fence has signaled.
+
+    const GLsizeiptr c = (4 + 4 * GLsizeiptr(capacity)) * sizeof (GLuint);
+    const int        k = v->head;
+
+    glBindBuffer(GL_COPY_READ_BUFFER,  chosen);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, v->ring[k]);
+    glBufferData(GL_COPY_WRITE_BUFFER, c, 0, GL_STREAM_READ);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, c);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glBindBuffer(GL_COPY_READ_BUFFER,  0);
+
+    v->fence[k] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    v->head     = (k + 1) % ring_size;
+    v->pending += 1;
+}
+
+// If the oldest selection issued is complete, read it back. A page that was
+// subdivided is drawn only if none of its children are drawn, as in prep_page.
+// Pages are listed level by level, so this is resolved in reverse.
+
+void scm_cull::read(view *v)
+{
+    if (v->pending == 0)
+        return;
+
+    const int k = (v->head - v->pending + ring_size) % ring_size;
+
+    if (glClientWaitSync(v->fence[k], 0, 0) == GL_TIMEOUT_EXPIRED)
+        return;
+
+    glDeleteSync(v->fence[k]);
+
+    v->fence[k]  = 0;
+    v->pending  -= 1;
+
+    GLuint h[4];
+
+    glBindBuffer(GL_COPY_READ_BUFFER, v->ring[k]);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof (h), h);
+
+    if (h[1])
+    {
+        scm_log("scm_cull selection overflow");
+        v->valid = false;
+    }
+    else
+    {
+        const GLuint n = std::min(h[0], GLuint(capacity));
+
+        data.resize(4 * n + 4);
+
+        if (n)
+            glGetBufferSubData(GL_COPY_READ_BUFFER, sizeof (h),
+                               4 * n * sizeof (GLuint), &data.front());
+        marks.clear();
+        v->last.clear();
+
+        for (GLuint j = n; j-- > 0; )
+        {
+            const GLuint *d = &data[4 * j];
+            const long long i = index_of(d[0], d[1]);
+
+            bool drawn = true;
+
+            if (d[0] & 0x80000000)
+                drawn = !(marks.search(scm_page_child(i, 0)) ||
+                          marks.search(scm_page_child(i, 1)) ||
+                          marks.search(scm_page_child(i, 2)) ||
+                          marks.search(scm_page_child(i, 3)));
+            if (drawn)
+            {
+                page p;
+
+                p.i = i;
+                memcpy(&p.r0, d + 2, sizeof (GLfloat));
+                memcpy(&p.r1, d + 3, sizeof (GLfloat));
+
+                v->last.push_back(p);
+            }
+            marks.insert(i);
+        }
+        v->valid = true;
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+}
+
+//------------------------------------------------------------------------------
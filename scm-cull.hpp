@@ -0,0 +1,125 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#ifndef SCM_CULL_HPP
+#define SCM_CULL_HPP
+
+#include <GL/glew.h>
+
+#include <vector>
+#include <map>
+
+#include "scm-pageset.hpp"
+
+//------------------------------------------------------------------------------
+
+class scm_scene;
+
+//------------------------------------------------------------------------------
+
+/// An scm_cull selects the pages of a view on the GPU
+///
+/// The page status and bounds known to a scene are uploaded once to a catalog
+/// buffer, sorted for binary search. Each selection then runs a compute shader
+/// over the page tree breadth-first, one dispatch per level, each level sizing
+/// the indirect dispatch of the next. Pages to be drawn are appended to a
+/// selection buffer, along with those that were subdivided, in case none of
+/// their children are drawn. The CPU issues only a fixed sequence of calls.
+///
+/// The selection is copied into a ring of readback buffers, and read back
+/// once its fence has signaled, so the CPU never waits upon the GPU. The
+/// selection returned is therefore that of a view ring_size frames or so in
+/// the past. A selection that overflows its capacity is discarded.
+///
+/// The traversal is limited to depth levels, and the catalog is rebuilt when
+/// the files of the scene change. @see scm_sphere::set_compute
+
+class scm_cull
+{
+public:
+
+    static int capacity;
+    static int depth;
+
+    static const int ring_size = 3;
+
+    /// A page selected for drawing, with its radius bounds.
+
+    struct page
+    {
+        long long i;
+        float     r0;
+        float     r1;
+    };
+
+    scm_cull();
+   ~scm_cull();
+
+    static bool is_supported();
+
+    bool select(scm_scene *, const double *, int, int, int, int,
+                std::vector<page>&);
+
+    void del_scene(const scm_scene *);
+
+private:
+
+    // Selection state per scene and channel.
+
+    struct view
+    {
+        view();
+
+        std::vector<int>  files;
+        GLuint            catalog;
+        GLuint            catalog_n;
+        bool              present;
+
+        GLuint            ring [ring_size];
+        GLsync            fence[ring_size];
+        int               head;
+        int               pending;
+
+        bool              valid;
+        std::vector<page> last;
+    };
+
+    typedef std::pair<const scm_scene *, int> view_key;
+
+    std::map<view_key, view *> views;
+
+    GLuint program;
+    GLuint lists[2];
+    GLuint chosen;
+    GLuint args;
+
+    GLint  uM;
+    GLint  usize;
+    GLint  ulimit;
+    GLint  ulevel;
+    GLint  udepth;
+    GLint  ucapacity;
+    GLint  ucatalog_n;
+    GLint  upresent;
+
+    scm_pageset          marks;
+    std::vector<GLuint>  data;
+
+    void del_view(view *);
+    void load(view *, scm_scene *, int);
+    void  run(view *, const double *, int, int, int);
+    void read(view *);
+};
+
+//------------------------------------------------------------------------------
+
+#endif
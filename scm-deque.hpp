@@ -40,6 +40,16 @@ public:
     const scm_state& front() const { return sequence.front(); }
     const scm_state&  back() const { return sequence.back();  }
           bool       empty() const { return sequence.empty(); }
+          size_t      size() const { return sequence.size();  }
+
+    /// @}
+    /// @name Iteration
+    /// @{
+
+    typedef std::list<scm_state>::const_iterator const_iterator;
+
+    const_iterator begin() const { return sequence.begin(); }
+    const_iterator   end() const { return sequence.end();   }
 
     /// @}
     /// @name Basic mutators
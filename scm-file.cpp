@@ -17,16 +17,25 @@
 
 #include "util3d/math3d.h"
 #include "scm-index.hpp"
+#include "scm-loader.hpp"
 #include "scm-cache.hpp"
 #include "scm-file.hpp"
 #include "scm-path.hpp"
+#include "scm-stats.hpp"
+#include "scm-trace.hpp"
 #include "scm-log.hpp"
 
 //------------------------------------------------------------------------------
 
-/// Construct a file table entry
-///
-/// Open the TIFF briefly to determine its format and cache its meta-data.
+/// Write a sidecar index upon opening a TIFF that lacks a current one, so that
+/// subsequent openings may map its meta-data rather than parse it.
+/// @see scm_sidecar
+
+bool scm_file::write_sidecars = true;
+
+//------------------------------------------------------------------------------
+
+/// Construct a file table entry. The file is not read until it is opened.
 ///
 /// @param name TIFF file name
 /// @param path Fully resolved path and name of TIFF file
@@ -35,20 +44,63 @@ scm_file::scm_file(const std::string& name,
                    const std::string& path) :
     name(name),
     path(path),
+    cache(0),
+    loader(0),
     needs(32),
     active(true),
+    ready(false),
     sampler(0),
-    w(256), h(256), c(1), b(8),
+    reader(0),
+    sidecar(0),
+    search(0),
+    source(0),
+    w(256), h(256), c(1), b(8), e(0),
     xv(0), xc(0),
     ov(0), oc(0),
     av(0), ac(0),
     zv(0), zc(0)
+{
+    scm_log("scm_file constructor %s", path.c_str());
+}
+
+/// Open the TIFF briefly to determine its format and cache its meta-data.
+///
+/// This may take some time for a large file, and it may be called by a thread
+/// other than the render thread. No other member may be used until is_ready
+/// returns true, at which point the results are published. A file that fails
+/// to open is published with default parameters and no pages.
+///
+/// If tag 0xFFB5 is present then its value gives the block compression format
+/// of all pages: 1 for BC1 (RGB), 4 for BC4 (one channel), or 5 for BC5 (two
+/// channels). Each page is then stored as an 8-bit image with one pixel per
+/// 4x4 block, its samples holding the 8 or 16 bytes of the block. The texel
+/// format is reported instead, and the page minima and maxima are 8-bit. The
+/// page width, including its border, must be a multiple of 4, as it is by
+/// construction of such a file. A file not meeting this, perhaps by way of a
+/// corrupt sidecar, is published with no pages.
+///
+/// If a current sidecar index exists then all of this is read from it, and the
+/// meta-data arrays are referenced in place within its mapping.
+///
+/// A remote file is first reached through a new scm_source, which gives its
+/// size for validation. Its meta-data, once read, are thus not read again.
+
+void scm_file::open()
 {
     // Attempt to find and load the located TIFF.
 
     if (!path.empty())
     {
-        if (TIFF *T = TIFFOpen(path.c_str(), "r"))
+        if (scm_source::is_remote(path))
+            source = scm_source::create(path);
+
+        if (get_sidecar())
+        {
+            // Open the file for direct page access.
+
+            reader = source ? new scm_reader(source) : new scm_reader(path);
+        }
+        else if (TIFF *T = open_tiff())
         {
             uint64 n = 0;
             void  *p = 0;
@@ -60,6 +112,21 @@ scm_file::scm_file(const std::string& name,
             TIFFGetField(T, TIFFTAG_BITSPERSAMPLE,   &b);
             TIFFGetField(T, TIFFTAG_SAMPLESPERPIXEL, &c);
 
+            // Convert a block image format to its texel format.
+
+            if (TIFFGetField(T, 0xFFB5, &n, &p) && n > 0)
+            {
+                uint16 x = ((uint16 *) p)[0];
+
+                if (scm_block_size(x) == c && b == 8)
+                {
+                    e = x;
+                    w = w * 4;
+                    h = h * 4;
+                    c = scm_block_channels(x);
+                }
+            }
+
             // Preload all metadata.
 
             if (TIFFGetField(T, 0xFFB1, &n, &p))
@@ -95,9 +162,42 @@ scm_file::scm_file(const std::string& name,
                 }
             }
             TIFFClose(T);
+
+            // Store the meta-data for the next opening.
+
+            if (write_sidecars && (xc || oc))
+                put_sidecar();
+
+            // Open the file for direct page access.
+
+            reader = source ? new scm_reader(source) : new scm_reader(path);
         }
     }
-    scm_log("scm_file constructor %s", path.c_str());
+    // A compressed page, with its border, must consist of whole blocks, as the
+    // atlas places and uploads it by blocks. Reject a file whose pages do not.
+
+    if (e && (w % 4 || h % 4))
+    {
+        scm_log("* scm_file open %s page size %d not a multiple of 4",
+                 path.c_str(), int(w));
+        xc = oc = ac = zc = 0;
+    }
+
+    // Index the page catalog for searching.
+
+    if (xc)
+        search = new scm_search(xv, xc);
+
+    scm_log("scm_file open %s", path.c_str());
+
+    ready.set(true);
+}
+
+/// Return true if the file has been opened and its meta-data may be used.
+
+bool scm_file::is_ready() const
+{
+    return ready.get();
 }
 
 scm_file::~scm_file()
@@ -108,56 +208,49 @@ scm_file::~scm_file()
 
     if (is_active()) deactivate();
 
-    // Await the exit of each loader.
-
-    int s = 0;
-
-    for (thread_i i = threads.begin(); i != threads.end(); ++i)
-        SDL_WaitThread(*i, &s);
-
     // Release all resources.
 
+    for (size_t i = 0; i < tiffs.size(); ++i)
+        if (tiffs[i]) TIFFClose(tiffs[i]);
+
     if (sampler) delete sampler;
+    if (reader)  delete reader;
+    if (search)  delete search;
+    if (source)  delete source;
 
-    free(zv);
-    free(av);
-    free(ov);
-    free(xv);
+    if (sidecar)
+        delete sidecar;
+    else
+    {
+        free(zv);
+        free(av);
+        free(ov);
+        free(xv);
+    }
 }
 
 //------------------------------------------------------------------------------
 
-/// Launch all loader threads for this file.
+/// Begin servicing this file's page requests using the given loader pool.
 
-void scm_file::activate(scm_cache *cache)
+void scm_file::activate(scm_cache *cache, scm_loader *loader)
 {
-    this->cache = cache;
-
-    // Launch the loader threads.
+    this->cache  = cache;
+    this->loader = loader;
 
-    int loader(void *);
+    if (xc && sampler == 0)
+        sampler = new scm_sample(this, loader);
 
-    for (int i = 0; i < 2; ++i)
-        threads.push_back(SDL_CreateThread(loader, "scm-loader", this));
+    tiffs.resize(loader->get_count(), 0);
+    loader->add_file(this);
 }
 
-/// Command all loader threads to exit.
+/// Notify the loaders that they may disregard this file's tasks. The loader
+/// pool returns any remaining tasks unloaded. @see scm_loader::del_file
 
 void scm_file::deactivate()
 {
-    // Notify the loaders that they may disregard their tasks.
-
     active.set(false);
-
-    // A non-empty queue ensures that each loader unblocks.
-
-    int t = 1;
-
-    for (thread_i i = threads.begin(); i != threads.end(); ++i, ++t)
-    {
-        scm_task junk(-t, -t);
-        needs.try_insert(junk);
-    }
 }
 
 /// Return true if loader threads are active on this file.
@@ -171,7 +264,133 @@ bool scm_file::is_active() const
 
 bool scm_file::add_need(scm_task& task)
 {
-    return needs.try_insert(task);
+    if (needs.try_insert(task))
+    {
+        scm_stats::add(scm_stats::need_inserts);
+        scm_stats::add(scm_stats::need_depth, 1);
+        loader->post();
+        return true;
+    }
+    scm_stats::add(scm_stats::need_rejects);
+    return false;
+}
+
+/// Load page i at offset o into buffer p on behalf of loader worker k. Read
+/// the page directly if possible, sharing the work of a large page with the
+/// loader pool, and otherwise load it through the worker's own TIFF handle.
+/// The latter also produces diagnostic pages upon failure.
+/// @see scm_load_page
+
+bool scm_file::read_page(int k, long long i, uint64 o,
+                         int w, int h, int c, int b, void *p)
+{
+    if (reader && reader->read_page(o, w, h, c, b, p, loader))
+        return true;
+    else
+        return scm_load_page(get_path(), i, get_tiff(k), o, w, h, c, b, p);
+}
+
+/// Return a pointer to the data of the page at offset o if the file is mapped
+/// and the page may be read in place, or null otherwise. @see scm_reader
+
+const void *scm_file::get_page_data(uint64 o, int w, int h, int c, int b) const
+{
+    return reader ? reader->get_data(o, w, h, c, b) : 0;
+}
+
+// Map a current sidecar index, if any, and reference its meta-data in place.
+
+bool scm_file::get_sidecar()
+{
+    if (source)
+    {
+        if (!source->is_open() || source->get_local().empty())
+            return false;
+
+        sidecar = new scm_sidecar(source->get_local(), source->get_size(),
+                                                       source->get_time());
+    }
+    else if (scm_source::is_remote(path))
+        return false;
+    else
+        sidecar = new scm_sidecar(path);
+
+    if (sidecar->is_valid())
+    {
+        const scm_sidecar::header *H = sidecar->get_header();
+
+        w  = H->w;
+        h  = H->h;
+        c  = H->c;
+        b  = H->b;
+        e  = H->e;
+
+        xv = (uint64 *) sidecar->get_array(H->xo);
+        ov = (uint64 *) sidecar->get_array(H->oo);
+        av = (void   *) sidecar->get_array(H->ao);
+        zv = (void   *) sidecar->get_array(H->zo);
+
+        xc = H->xc;
+        oc = H->oc;
+        ac = H->ac;
+        zc = H->zc;
+
+        return true;
+    }
+    delete sidecar;
+    sidecar = 0;
+    return false;
+}
+
+// Write the meta-data to a sidecar index.
+
+void scm_file::put_sidecar() const
+{
+    scm_sidecar::header H;
+
+    memset(&H, 0, sizeof (H));
+
+    H.w  = w;
+    H.h  = h;
+    H.c  = c;
+    H.b  = b;
+    H.e  = e;
+    H.xc = xc;
+    H.oc = oc;
+    H.ac = ac;
+    H.zc = zc;
+
+    if (source)
+    {
+        if (!source->get_local().empty())
+            scm_sidecar::write(source->get_local(), H, xv, ov, av, zv,
+                               source->get_size(), source->get_time());
+    }
+    else
+        scm_sidecar::write(path, H, xv, ov, av, zv);
+}
+
+// Return loader worker k's TIFF handle, opening it on first use. Only worker k
+// accesses handle k, so no locking is needed.
+
+TIFF *scm_file::get_tiff(int k)
+{
+    if (tiffs[k] == 0)
+        tiffs[k] = open_tiff();
+
+    return tiffs[k];
+}
+
+// Open the file with libtiff, through its source if it is remote.
+
+TIFF *scm_file::open_tiff() const
+{
+    if (source)
+        return source->open_tiff(path);
+    else if (scm_source::is_remote(path))
+        return 0;
+    else
+        return TIFFOpen(path.c_str(), "r");
 }
 
 //------------------------------------------------------------------------------
@@ -243,49 +462,40 @@ void scm_file::get_page_bounds(uint64 i, float& r0, float& r1) const
     }
 }
 
-// Sample this file along vector v using linear filtering.
+// Sample this file along vector v using linear filtering. The sampler is
+// created upon activation, so an inactive file returns a default.
 
 float scm_file::get_page_sample(const double *v)
 {
     if (xc)
-    {
-        if (sampler == 0)
-            sampler = new scm_sample(this);
-
         return sampler ? sampler->get(v) : 1.f;
-    }
-    return 0.5f;
+    else
+        return 0.5f;
 }
 
-//------------------------------------------------------------------------------
-
-// Compare two uint64s, for use by bsearch and qsort.
+// Sample this file along each of n vectors v, giving n results k. If b is
+// false, sample without data access. @see scm_sample::get
 
-static int xcmp(const void *p, const void *q)
+void scm_file::get_page_samples(const double *v, float *k, int n, bool b)
 {
-    const uint64 *a = (const uint64 *) p;
-    const uint64 *b = (const uint64 *) q;
-
-    if      (a[0] < b[0]) return -1;
-    else if (a[0] > b[0]) return +1;
-    else                  return  0;
+    if (xc && sampler)
+        sampler->get(v, k, n, b);
+    else
+        for (int j = 0; j < n; ++j)
+            k[j] = xc ? 1.f : 0.5f;
 }
 
+//------------------------------------------------------------------------------
+
 // Determine where SCM index i appears in the sorted index list xv. This will
 // indicate where the file offset and extrema appear in ov, av, and zv.
 
 uint64 scm_file::toindex(uint64 i) const
 {
-    void *p;
-
-    if (xc)
-    {
-        if ((p = bsearch(&i, xv, size_t(xc), sizeof (uint64), xcmp)))
-        {
-            return (uint64) ((uint64 *) p - xv);
-        }
-    }
-    return (uint64) (-1);
+    if (search)
+        return search->find(i);
+    else
+        return (uint64) (-1);
 }
 
 // Return sample i of the given buffer as a float.
@@ -558,6 +768,8 @@ bool scm_load_page(const char *name, long long i,
                 tsize_t N = TIFFNumberOfStrips(T);
                 tsize_t S = TIFFStripSize(T);
 
+                scm_trace::scope trace("read_tiff");
+
                 for (int l = 0; l < N; ++l)
                 {
                     if (TIFFReadEncodedStrip(T, l, (uint8 *) p + l * S, -1) == -1)
@@ -576,33 +788,4 @@ bool scm_load_page(const char *name, long long i,
     return true;
 }
 
-/// Service page load requests
-///
-/// This function is the entry point for loader threads. The void data pointer
-/// gives an scm_file structure with pointers to a needs queue and a cache with
-/// a loads queue. An invalid file request represents an order to shut down.
-
-int loader(void *data)
-{
-    scm_file *file = (scm_file *) data;
-    scm_task  task;
-
-    scm_log("loader thread begin %s", file->path.c_str());
-    {
-        const char *name = file->path.c_str();
-        TIFF       *tiff = TIFFOpen(name, "r");
-
-        while ((task = file->needs.remove()).f >= 0)
-
-            if (file->is_active())
-            {
-                task.load_page(name, tiff);
-                file->cache->add_load(task);
-            }
-            else break;
-
-        if (tiff) TIFFClose(tiff);
-    }
-    scm_log("loader thread end %s", file->path.c_str());
-    return 0;
-}
+//------------------------------------------------------------------------------
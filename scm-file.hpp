@@ -24,15 +24,21 @@
 #include "scm-guard.hpp"
 #include "scm-task.hpp"
 #include "scm-sample.hpp"
+#include "scm-reader.hpp"
+#include "scm-sidecar.hpp"
+#include "scm-search.hpp"
+#include "scm-source.hpp"
 
 //------------------------------------------------------------------------------
 
-typedef std::vector<SDL_Thread *>           thread_v;
-typedef std::vector<SDL_Thread *>::iterator thread_i;
+class scm_loader;
 
 //------------------------------------------------------------------------------
 
 /// An scm_file encapsulates an open SCM data file.
+///
+/// A file named by a URL is read through an scm_source, and its sidecar index
+/// is kept wherever the source designates. @see scm_source::is_remote
 
 class scm_file
 {
@@ -43,27 +49,41 @@ public:
 
     virtual ~scm_file();
 
-    void    activate(scm_cache *);
+    static bool write_sidecars;
+
+    void        open();
+    bool    is_ready() const;
+
+    void    activate(scm_cache *, scm_loader *);
     void  deactivate();
     bool is_active() const;
 
-    bool           add_need(scm_task&);
+    bool           add_need (scm_task&);
+    bool           read_page(int, long long, uint64,
+                             int, int, int, int, void *);
+
+    const void    *get_page_data  (uint64, int, int, int, int) const;
 
     virtual bool   get_page_status(uint64)                 const;
     virtual uint64 get_page_offset(uint64)                 const;
     virtual void   get_page_bounds(uint64, float&, float&) const;
     virtual float  get_page_sample(const double *);
+    virtual void   get_page_samples(const double *, float *, int, bool);
 
     virtual uint32 get_w()    const { return w; }
     virtual uint32 get_h()    const { return h; }
     virtual uint16 get_c()    const { return c; }
     virtual uint16 get_b()    const { return b; }
+    virtual uint16 get_e()    const { return e; }
 
     const char    *get_path() const { return path.c_str(); }
     const char    *get_name() const { return name.c_str(); }
 
     uint64        find_page(long long, double&, double&) const;
 
+    uint64         get_catalog_size() const { return xc; }
+    const uint64  *get_catalog()      const { return xv; }
+
 protected:
 
     std::string path;
@@ -74,10 +94,16 @@ private:
     // IO handling and threading data
 
     scm_cache          *cache;
+    scm_loader         *loader;
     scm_queue<scm_task> needs;
     scm_guard<bool>     active;
+    scm_guard<bool>     ready;
     scm_sample         *sampler;
-    thread_v            threads;
+    scm_reader         *reader;
+    scm_sidecar        *sidecar;
+    scm_search         *search;
+    scm_source         *source;
+    std::vector<TIFF *> tiffs;
 
     // Image parameters
 
@@ -85,6 +111,7 @@ private:
     uint32   h;         ///< Page height
     uint16   c;         ///< Sample count
     uint16   b;         ///< Sample depth
+    uint16   e;         ///< Block compression format
 
     uint64 *xv;         ///< Page indices
     uint64  xc;         ///< Page indices count
@@ -103,7 +130,14 @@ private:
 
     uint64 toindex(uint64) const;
 
-    friend int loader(void *);
+    TIFF  *get_tiff(int);
+    TIFF  *open_tiff() const;
+
+    bool   get_sidecar();
+    void   put_sidecar() const;
+
+    friend class scm_loader;
+    friend class scm_sample;
 };
 
 //------------------------------------------------------------------------------
@@ -49,6 +49,16 @@ void scm_frame::bind_frame() const
     glScissor (0, 0, width, height);
 }
 
+/// Bind the framebuffer as render target with the Viewport and Scissor set to
+/// its lower-left w by h pixels, for rendering at less than full size.
+
+void scm_frame::bind_frame(GLsizei w, GLsizei h) const
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, frame);
+    glViewport(0, 0, w, h);
+    glScissor (0, 0, w, h);
+}
+
 /// Bind the color texture
 
 void scm_frame::bind_color() const
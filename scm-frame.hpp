@@ -27,6 +27,7 @@ public:
    ~scm_frame();
 
     void bind_frame() const;
+    void bind_frame(GLsizei, GLsizei) const;
     void bind_color() const;
     void bind_depth() const;
 
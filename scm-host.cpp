@@ -0,0 +1,237 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#include <cstdlib>
+#include <cstring>
+
+#include "scm-host.hpp"
+#include "scm-log.hpp"
+
+//------------------------------------------------------------------------------
+
+/// Create a host page cache.
+///
+/// @param bytes Maximum total size of cached page data in bytes
+/// @param size  Size of one page in bytes
+
+scm_host::scm_host(size_t bytes, size_t size) :
+    size(size),
+    capacity(int(bytes / size)),
+    count(0),
+    head(-1),
+    tail(-1),
+    hits(0),
+    misses(0),
+    evictions(0)
+{
+    mutex = SDL_CreateMutex();
+    slots.reserve(capacity);
+
+    scm_log("scm_host constructor %d pages", capacity);
+}
+
+/// Release all cached page data.
+
+scm_host::~scm_host()
+{
+    scm_log("scm_host destructor %lld hits %lld misses %lld evictions",
+                                                     hits, misses, evictions);
+
+    for (size_t k = 0; k < slots.size(); ++k)
+        free(slots[k].data);
+
+    SDL_DestroyMutex(mutex);
+}
+
+//------------------------------------------------------------------------------
+
+/// Seek page i of file f and, if found, copy its data to p and return true.
+
+bool scm_host::get(int f, long long i, void *p)
+{
+    int k;
+
+    if ((k = find(f, i)) >= 0)
+    {
+        memcpy(p, slots[k].data, size);
+        release(k);
+        return true;
+    }
+    return false;
+}
+
+/// Seek page i of file f and, if found, pin its slot and return its index.
+/// The slot's data may then be read until it is released. Return -1 if the
+/// page is not found.
+
+int scm_host::find(int f, long long i)
+{
+    int k = -1;
+
+    SDL_LockMutex(mutex);
+    {
+        if (int *j = table.search(f, i))
+        {
+            k = *j;
+            slots[k].pins++;
+            unlink(k);
+            link  (k);
+            hits++;
+        }
+        else misses++;
+    }
+    SDL_UnlockMutex(mutex);
+
+    return k;
+}
+
+/// Release the pin on a slot returned by find.
+
+void scm_host::release(int k)
+{
+    SDL_LockMutex(mutex);
+    slots[k].pins--;
+    SDL_UnlockMutex(mutex);
+}
+
+/// Claim a slot to receive page i of file f. Allocate a new slot if the size
+/// bound allows, otherwise recycle the least-recently used unpinned slot. The
+/// slot is pinned and invisible until committed or canceled. Return -1 if no
+/// slot is available.
+
+int scm_host::claim(int f, long long i)
+{
+    int k = -1;
+
+    SDL_LockMutex(mutex);
+    {
+        if (count < capacity)
+        {
+            slot s;
+
+            if ((s.data = malloc(size)))
+            {
+                k = int(slots.size());
+                slots.push_back(s);
+                count++;
+            }
+        }
+        else
+        {
+            for (k = head; k >= 0 && slots[k].pins; k = slots[k].next)
+                ;
+
+            if (k >= 0)
+            {
+                if (slots[k].live)
+                {
+                    table.remove(slots[k].key.f, slots[k].key.i);
+                    evictions++;
+                }
+                unlink(k);
+            }
+        }
+
+        if (k >= 0)
+        {
+            slots[k].key  = scm_item(f, i);
+            slots[k].pins = 1;
+            slots[k].live = false;
+            slots[k].prev = -1;
+            slots[k].next = -1;
+        }
+    }
+    SDL_UnlockMutex(mutex);
+
+    return k;
+}
+
+/// Return the data buffer of claimed slot k.
+
+void *scm_host::data(int k) const
+{
+    return slots[k].data;
+}
+
+/// Make claimed slot k visible to look-up and release its pin. If another
+/// loader committed the same page first, abandon the slot instead.
+
+void scm_host::commit(int k)
+{
+    SDL_LockMutex(mutex);
+    {
+        if (table.search(slots[k].key.f, slots[k].key.i) == 0)
+        {
+            table.insert(slots[k].key.f, slots[k].key.i) = k;
+
+            slots[k].pins = 0;
+            slots[k].live = true;
+            link(k);
+        }
+        else
+        {
+            slots[k].pins = 0;
+            slots[k].live = false;
+            push(k);
+        }
+    }
+    SDL_UnlockMutex(mutex);
+}
+
+/// Abandon claimed slot k, leaving it least-recently used.
+
+void scm_host::cancel(int k)
+{
+    SDL_LockMutex(mutex);
+    {
+        slots[k].pins = 0;
+        slots[k].live = false;
+        push(k);
+    }
+    SDL_UnlockMutex(mutex);
+}
+
+//------------------------------------------------------------------------------
+
+// Append slot k to the most-recently used end of the use list.
+
+void scm_host::link(int k)
+{
+    slots[k].prev = tail;
+    slots[k].next = -1;
+
+    if (tail >= 0) slots[tail].next = k; else head = k;
+    tail = k;
+}
+
+// Prepend slot k to the least-recently used end of the use list.
+
+void scm_host::push(int k)
+{
+    slots[k].prev = -1;
+    slots[k].next = head;
+
+    if (head >= 0) slots[head].prev = k; else tail = k;
+    head = k;
+}
+
+// Unlink slot k from the use list.
+
+void scm_host::unlink(int k)
+{
+    if (slots[k].next >= 0) slots[slots[k].next].prev = slots[k].prev;
+    else                    tail                      = slots[k].prev;
+    if (slots[k].prev >= 0) slots[slots[k].prev].next = slots[k].next;
+    else                    head                      = slots[k].next;
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,91 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#ifndef SCM_HOST_HPP
+#define SCM_HOST_HPP
+
+#include <vector>
+
+#include <SDL.h>
+#include <SDL_thread.h>
+
+#include "scm-table.hpp"
+
+//------------------------------------------------------------------------------
+
+/// An scm_host is a size-bounded cache of decoded pages in system memory
+///
+/// It sits between the loader threads and the VRAM atlas of one scm_cache, and
+/// is thus shared by all files of that cache's format. A page found here is
+/// copied directly into its pixel buffer without file access or decoding. A
+/// page not found is decoded into a claimed slot, copied to its pixel buffer,
+/// and then committed for later reuse. Slots are allocated on demand up to the
+/// size bound and recycled in least-recently used order. All operations are
+/// thread-safe, and slots being read or written are pinned against eviction
+/// so that copies proceed outside of the lock.
+
+class scm_host
+{
+public:
+
+    scm_host(size_t, size_t);
+   ~scm_host();
+
+    bool  get    (int, long long, void *);
+    int   find   (int, long long);
+    void  release(int);
+
+    int   claim  (int, long long);
+    void *data   (int) const;
+    void  commit (int);
+    void  cancel (int);
+
+    long long get_hits()      const { return hits;      }
+    long long get_misses()    const { return misses;    }
+    long long get_evictions() const { return evictions; }
+    int       get_count()     const { return count;     }
+    int       get_capacity()  const { return capacity;  }
+
+private:
+
+    struct slot
+    {
+        scm_item key;   // Page held by this slot
+        void    *data;  // Page data
+        int      pins;  // Number of copies in progress
+        bool     live;  // Slot is visible to look-up
+        int      prev;  // Previous slot in the use list
+        int      next;  // Next slot in the use list
+    };
+
+    SDL_mutex        *mutex;
+    std::vector<slot> slots;
+    scm_table<int>    table;
+
+    size_t size;       // Page size in bytes
+    int    capacity;   // Maximum slot count
+    int    count;      // Current slot count
+    int    head;       // Least-recently used slot
+    int    tail;       // Most-recently used slot
+
+    long long hits;
+    long long misses;
+    long long evictions;
+
+    void link  (int);
+    void push  (int);
+    void unlink(int);
+};
+
+//------------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,698 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#ifdef SCM_HTTP
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+#include <curl/curl.h>
+
+#include "scm-http.hpp"
+#include "scm-trace.hpp"
+#include "scm-util.hpp"
+#include "scm-log.hpp"
+
+#ifdef WIN32
+#define PATH_SEPARATOR '\\'
+#define strncasecmp _strnicmp
+#else
+#define PATH_SEPARATOR '/'
+#endif
+
+//------------------------------------------------------------------------------
+
+/// The directory of the persistent block cache, initially given by the SCMCACHE
+/// environment variable. If empty, blocks are held only in memory.
+
+std::string scm_http::cache_path = scm_getenv("SCMCACHE");
+
+/// The limit upon the disk cache of each remote file, in bytes.
+
+uint64 scm_http::cache_size = 4ULL << 30;
+
+/// The size of the blocks by which remote files are read and cached.
+
+size_t scm_http::block_size = 1 << 20;
+
+/// The number of unused blocks held in memory for each remote file.
+
+int scm_http::memory_blocks = 64;
+
+//------------------------------------------------------------------------------
+
+// Initialize libcurl once, however many files are opened concurrently.
+
+static void init_curl()
+{
+    static SDL_SpinLock lock = 0;
+    static bool         done = false;
+
+    SDL_AtomicLock(&lock);
+
+    if (!done)
+    {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+        done = true;
+    }
+    SDL_AtomicUnlock(&lock);
+}
+
+static std::string hex(uint64 x)
+{
+    char s[32];
+    sprintf(s, "%016llx", (unsigned long long) x);
+    return std::string(s);
+}
+
+// A file of a cache directory.
+
+struct listing
+{
+    std::string name;
+    uint64      size;
+    uint64      time;
+};
+
+// List the cache block files in the given directory.
+
+static void list_directory(const std::string& dir, std::vector<listing>& v)
+{
+#ifdef WIN32
+    WIN32_FIND_DATAA d;
+    HANDLE           h;
+
+    if ((h = FindFirstFileA((dir + "\\*.blk").c_str(), &d))
+                                            != INVALID_HANDLE_VALUE)
+    {
+        do
+        {
+            listing l;
+
+            l.name = d.cFileName;
+            l.size = (uint64(d.nFileSizeHigh)       << 32) | d.nFileSizeLow;
+            l.time = (uint64(d.ftLastWriteTime.dwHighDateTime) << 32)
+                   |         d.ftLastWriteTime.dwLowDateTime;
+            v.push_back(l);
+        }
+        while (FindNextFileA(h, &d));
+
+        FindClose(h);
+    }
+#else
+    if (DIR *D = opendir(dir.c_str()))
+    {
+        while (struct dirent *d = readdir(D))
+        {
+            const std::string name(d->d_name);
+            struct stat       info;
+
+            if (name.size() > 4 && name.compare(name.size() - 4, 4, ".blk") == 0
+                && stat((dir + PATH_SEPARATOR + name).c_str(), &info) == 0)
+            {
+                listing l;
+
+                l.name = name;
+                l.size = uint64(info.st_size);
+                l.time = uint64(info.st_mtime);
+                v.push_back(l);
+            }
+        }
+        closedir(D);
+    }
+#endif
+}
+
+static bool older(const listing& a, const listing& b)
+{
+    return (a.time < b.time);
+}
+
+//------------------------------------------------------------------------------
+
+// A libcurl write target of fixed size. Overflow aborts the transfer.
+
+struct sink
+{
+    unsigned char *p;
+    size_t         n;
+    size_t         k;
+};
+
+static size_t write_sink(char *p, size_t s, size_t n, void *data)
+{
+    sink *d = (sink *) data;
+
+    if (d->k + s * n > d->n)
+        return 0;
+
+    memcpy(d->p + d->k, p, s * n);
+    d->k += s * n;
+    return s * n;
+}
+
+// Capture the ETag header of a response.
+
+static size_t write_header(char *p, size_t s, size_t n, void *data)
+{
+    std::string *etag = (std::string *) data;
+    std::string  line(p, s * n);
+
+    if (line.size() > 5 && strncasecmp(line.c_str(), "etag:", 5) == 0)
+    {
+        size_t a = line.find_first_not_of(" \t", 5);
+        size_t b = line.find_last_not_of(" \t\r\n");
+
+        if (a != std::string::npos && b >= a)
+            *etag = line.substr(a, b - a + 1);
+    }
+    return s * n;
+}
+
+//------------------------------------------------------------------------------
+
+/// Open the file at the given URL, requesting its size and validator. Check
+/// is_open to determine the outcome. If a disk cache is configured, index the
+/// blocks already stored there, discarding them if they are not current.
+
+scm_http::scm_http(const std::string& url) :
+    url(url),
+    size(0),
+    time(0),
+    mutex(SDL_CreateMutex()),
+    cond (SDL_CreateCond()),
+    clock(0),
+    total(0)
+{
+    init_curl();
+
+    if (query() && !cache_path.empty())
+    {
+        dir = cache_path + PATH_SEPARATOR + hex(scm_hash(url));
+
+        scm_mkdir(cache_path);
+        scm_mkdir(dir);
+        scan();
+    }
+    scm_log("scm_http %s %llu bytes%s%s", url.c_str(),
+            (unsigned long long) size, dir.empty() ? "" : " cached in ",
+                                       dir.c_str());
+}
+
+/// Release all blocks and connections.
+
+scm_http::~scm_http()
+{
+    for (block_i i = blocks.begin(); i != blocks.end(); ++i)
+        delete i->second;
+
+    for (size_t k = 0; k < handles.size(); ++k)
+        curl_easy_cleanup((CURL *) handles[k]);
+
+    SDL_DestroyCond(cond);
+    SDL_DestroyMutex(mutex);
+}
+
+/// Return the path under which local state of this file may be stored. This is
+/// a name within the cache directory, or empty if there is no cache.
+
+std::string scm_http::get_local() const
+{
+    return dir.empty() ? dir : dir + PATH_SEPARATOR + "index";
+}
+
+//------------------------------------------------------------------------------
+
+/// Read n bytes at offset o into buffer p, returning success. Absent blocks are
+/// loaded from the disk cache or fetched, while blocks already in flight are
+/// awaited. This may be called concurrently by any number of threads.
+
+bool scm_http::read(uint64 o, size_t n, void *p)
+{
+    if (n == 0)
+        return true;
+    if (o + n > size)
+        return false;
+
+    const uint64 b0 = o / block_size;
+    const uint64 b1 = (o + n - 1) / block_size;
+
+    std::vector<block *> v(size_t(b1 - b0 + 1), 0);
+    std::vector<char>    mine(v.size(), 0);
+
+    // Reference every block, claiming for loading those not yet present.
+
+    SDL_LockMutex(mutex);
+    {
+        for (size_t k = 0; k < v.size(); ++k)
+        {
+            block_i i = blocks.find(b0 + k);
+
+            if (i == blocks.end())
+            {
+                v[k] = blocks[b0 + k] = new block;
+                mine[k] = 1;
+            }
+            else
+                v[k] = i->second;
+
+            v[k]->refs++;
+            v[k]->t = ++clock;
+        }
+    }
+    SDL_UnlockMutex(mutex);
+
+    // Load each run of claimed blocks.
+
+    for (size_t k = 0, j; k < v.size(); k = j)
+    {
+        for (j = k; j < v.size() && mine[j]; ++j)
+            ;
+        if (j > k)
+            load(b0, v, k, j);
+        else
+            j++;
+    }
+
+    // Await the blocks claimed by other threads.
+
+    bool ok = true;
+
+    SDL_LockMutex(mutex);
+    {
+        for (size_t k = 0; k < v.size(); ++k)
+        {
+            while (!v[k]->done)
+                SDL_CondWait(cond, mutex);
+
+            ok = ok && v[k]->ok;
+        }
+    }
+    SDL_UnlockMutex(mutex);
+
+    // Copy the requested bytes from each block. Blocks are not modified once
+    // done, and are not released while referenced, so no lock is needed.
+
+    if (ok)
+    {
+        unsigned char *d = (unsigned char *) p;
+
+        for (size_t k = 0; k < v.size(); ++k)
+        {
+            const uint64 bo = (b0 + k) * block_size;
+            const uint64 a  = std::max(o,     bo);
+            const uint64 z  = std::min(o + n, bo + v[k]->data.size());
+
+            memcpy(d + (a - o), &v[k]->data[size_t(a - bo)], size_t(z - a));
+        }
+    }
+
+    // Release the blocks. A failed block is forgotten, to be tried again.
+
+    SDL_LockMutex(mutex);
+    {
+        for (size_t k = 0; k < v.size(); ++k)
+            if (--v[k]->refs == 0 && !v[k]->ok)
+            {
+                blocks.erase(b0 + k);
+                delete v[k];
+            }
+        trim();
+    }
+    SDL_UnlockMutex(mutex);
+
+    return ok;
+}
+
+// Load blocks k through j - 1 of vector v, the first of which has index b0 + k.
+// Read each from disk if possible, fetch the rest with one request per run,
+// and mark them all done.
+
+void scm_http::load(uint64 b0, std::vector<block *>& v, size_t k, size_t j)
+{
+    std::vector<char> ok(j - k, 0);
+
+    for (size_t m = k; m < j; ++m)
+        ok[m - k] = get_block(b0 + m, v[m]);
+
+    for (size_t m = k, e; m < j; m = e)
+    {
+        for (e = m; e < j && !ok[e - k]; ++e)
+            ;
+        if (e > m)
+        {
+            const uint64 o = (b0 + m) * block_size;
+            const uint64 z = std::min(size, (b0 + e) * block_size);
+
+            std::vector<unsigned char> data(size_t(z - o));
+
+            if (fetch(o, data.size(), &data.front()))
+                for (size_t q = m; q < e; ++q)
+                {
+                    const size_t a = (q - m) * block_size;
+                    const size_t b = std::min(data.size(), a + block_size);
+
+                    v[q]->data.assign(data.begin() + a, data.begin() + b);
+                    ok[q - k] = 1;
+
+                    put_block(b0 + q, v[q]);
+                }
+        }
+        else
+            e++;
+    }
+
+    SDL_LockMutex(mutex);
+    {
+        for (size_t m = k; m < j; ++m)
+        {
+            v[m]->ok   = ok[m - k];
+            v[m]->done = true;
+        }
+        SDL_CondBroadcast(cond);
+    }
+    SDL_UnlockMutex(mutex);
+}
+
+// Release unreferenced blocks in excess of the memory limit, least-recently
+// used first. The mutex must be held.
+
+void scm_http::trim()
+{
+    int n = 0;
+
+    for (block_i i = blocks.begin(); i != blocks.end(); ++i)
+        if (i->second->refs == 0)
+            n++;
+
+    while (n > memory_blocks)
+    {
+        block_i j = blocks.end();
+
+        for (block_i i = blocks.begin(); i != blocks.end(); ++i)
+            if (i->second->refs == 0)
+                if (j == blocks.end() || i->second->t < j->second->t)
+                    j = i;
+
+        delete j->second;
+        blocks.erase(j);
+        n--;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// Take a libcurl handle from the pool, or create one. A pooled handle keeps
+// its connection to the server alive for reuse by the next request.
+
+void *scm_http::take_handle()
+{
+    void *c = 0;
+
+    SDL_LockMutex(mutex);
+    {
+        if (!handles.empty())
+        {
+            c = handles.back();
+            handles.pop_back();
+        }
+    }
+    SDL_UnlockMutex(mutex);
+
+    return c ? c : curl_easy_init();
+}
+
+void scm_http::give_handle(void *c)
+{
+    SDL_LockMutex(mutex);
+    handles.push_back(c);
+    SDL_UnlockMutex(mutex);
+}
+
+// Request the size and validator of the file. The validator is the hash of
+// its ETag, or its modification time if the server gives no ETag.
+
+bool scm_http::query()
+{
+    CURL       *c = (CURL *) take_handle();
+    std::string etag;
+    long        code = 0;
+    long        when = -1;
+
+    curl_easy_setopt(c, CURLOPT_URL,            url.c_str());
+    curl_easy_setopt(c, CURLOPT_NOBODY,         1L);
+    curl_easy_setopt(c, CURLOPT_FILETIME,       1L);
+    curl_easy_setopt(c, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(c, CURLOPT_NOSIGNAL,       1L);
+    curl_easy_setopt(c, CURLOPT_FAILONERROR,    1L);
+    curl_easy_setopt(c, CURLOPT_HEADERFUNCTION, write_header);
+    curl_easy_setopt(c, CURLOPT_HEADERDATA,     &etag);
+
+    CURLcode r = curl_easy_perform(c);
+
+    if (r == CURLE_OK)
+    {
+#if LIBCURL_VERSION_NUM >= 0x073700
+        curl_off_t n = -1;
+        curl_easy_getinfo(c, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &n);
+#else
+        double     n = -1;
+        curl_easy_getinfo(c, CURLINFO_CONTENT_LENGTH_DOWNLOAD,   &n);
+#endif
+        curl_easy_getinfo(c, CURLINFO_RESPONSE_CODE, &code);
+        curl_easy_getinfo(c, CURLINFO_FILETIME,      &when);
+
+        if (code == 200 && n > 0)
+        {
+            size = uint64(n);
+            time = etag.empty() ? uint64(when) : uint64(scm_hash(etag));
+        }
+    }
+    else
+        scm_log("* scm_http %s: %s", url.c_str(), curl_easy_strerror(r));
+
+    curl_easy_reset(c);
+    give_handle(c);
+
+    return (size > 0);
+}
+
+// Fetch n bytes at offset o into buffer p with a range request, retrying a
+// failed request twice.
+
+bool scm_http::fetch(uint64 o, size_t n, unsigned char *p)
+{
+    scm_trace::scope trace("fetch");
+
+    char range[64];
+
+    sprintf(range, "%llu-%llu", (unsigned long long) o,
+                                (unsigned long long) (o + n - 1));
+
+    for (int attempt = 0; attempt < 3; ++attempt)
+    {
+        CURL *c    = (CURL *) take_handle();
+        sink  s    = { p, n, 0 };
+        long  code = 0;
+
+        curl_easy_setopt(c, CURLOPT_URL,             url.c_str());
+        curl_easy_setopt(c, CURLOPT_RANGE,           range);
+        curl_easy_setopt(c, CURLOPT_WRITEFUNCTION,   write_sink);
+        curl_easy_setopt(c, CURLOPT_WRITEDATA,       &s);
+        curl_easy_setopt(c, CURLOPT_FOLLOWLOCATION,  1L);
+        curl_easy_setopt(c, CURLOPT_NOSIGNAL,        1L);
+        curl_easy_setopt(c, CURLOPT_FAILONERROR,     1L);
+        curl_easy_setopt(c, CURLOPT_TCP_KEEPALIVE,   1L);
+        curl_easy_setopt(c, CURLOPT_CONNECTTIMEOUT,  10L);
+        curl_easy_setopt(c, CURLOPT_LOW_SPEED_LIMIT, 1L);
+        curl_easy_setopt(c, CURLOPT_LOW_SPEED_TIME,  30L);
+
+        CURLcode r = curl_easy_perform(c);
+
+        curl_easy_getinfo(c, CURLINFO_RESPONSE_CODE, &code);
+        curl_easy_reset(c);
+        give_handle(c);
+
+        // A server ignoring the range sends the whole file, which suffices
+        // only if the whole file was requested.
+
+        if (r == CURLE_OK && s.k == n && (code == 206 || (code == 200 &&
+                                                          o == 0 && n == size)))
+            return true;
+
+        scm_log("* scm_http %s %s: %s (%ld)", url.c_str(), range,
+                                              curl_easy_strerror(r), code);
+        SDL_Delay(100 << attempt);
+    }
+    return false;
+}
+
+//------------------------------------------------------------------------------
+
+std::string scm_http::block_name(uint64 b) const
+{
+    return dir + PATH_SEPARATOR + hex(b) + ".blk";
+}
+
+// Index the blocks of the disk cache, in order of their modification. If the
+// cache was stored for another version of the file, empty it first.
+
+void scm_http::scan()
+{
+    const std::string name = dir + PATH_SEPARATOR + "stamp";
+
+    unsigned long long s = 0;
+    unsigned long long t = 0;
+
+    std::vector<listing> v;
+
+    list_directory(dir, v);
+
+    if (FILE *f = fopen(name.c_str(), "r"))
+    {
+        if (fscanf(f, "%llu %llu", &s, &t) != 2)
+            s = t = 0;
+        fclose(f);
+    }
+
+    if (s != size || t != time)
+    {
+        for (size_t k = 0; k < v.size(); ++k)
+            remove((dir + PATH_SEPARATOR + v[k].name).c_str());
+
+        v.clear();
+
+        if (FILE *f = fopen(name.c_str(), "w"))
+        {
+            fprintf(f, "%llu %llu\n", (unsigned long long) size,
+                                      (unsigned long long) time);
+            fclose(f);
+        }
+    }
+
+    std::sort(v.begin(), v.end(), older);
+
+    for (size_t k = 0; k < v.size(); ++k)
+    {
+        entry e;
+
+        e.size = v[k].size;
+        e.t    = ++clock;
+
+        entries[strtoull(v[k].name.c_str(), 0, 16)] = e;
+        total += e.size;
+    }
+    prune();
+}
+
+// Read block b from the disk cache, returning success.
+
+bool scm_http::get_block(uint64 b, block *B)
+{
+    if (dir.empty())
+        return false;
+
+    const uint64 o = b * block_size;
+    const size_t n = size_t(std::min(uint64(block_size), size - o));
+
+    bool ok = false;
+
+    SDL_LockMutex(mutex);
+    {
+        entry_i i = entries.find(b);
+
+        if (i != entries.end() && i->second.size == n)
+        {
+            i->second.t = ++clock;
+            ok = true;
+        }
+    }
+    SDL_UnlockMutex(mutex);
+
+    if (ok)
+    {
+        ok = false;
+
+        if (FILE *f = fopen(block_name(b).c_str(), "rb"))
+        {
+            B->data.resize(n);
+            ok = (fread(&B->data.front(), 1, n, f) == n);
+            fclose(f);
+        }
+    }
+    return ok;
+}
+
+// Write block b to the disk cache. @see scm_atomic_write
+
+void scm_http::put_block(uint64 b, const block *B)
+{
+    if (dir.empty())
+        return;
+
+    const std::string name = block_name(b);
+
+    if (scm_atomic_write(name, &B->data.front(), B->data.size()))
+    {
+        SDL_LockMutex(mutex);
+        {
+            entry_i i = entries.find(b);
+
+            if (i != entries.end())
+                total -= i->second.size;
+
+            entry e;
+
+            e.size     = B->data.size();
+            e.t        = ++clock;
+            entries[b] = e;
+            total     += e.size;
+
+            prune();
+        }
+        SDL_UnlockMutex(mutex);
+    }
+}
+
+// Remove blocks from the disk cache, least-recently used first, until its
+// total size is within the limit. The mutex must be held.
+
+void scm_http::prune()
+{
+    while (total > cache_size && !entries.empty())
+    {
+        entry_i j = entries.begin();
+
+        for (entry_i i = entries.begin(); i != entries.end(); ++i)
+            if (i->second.t < j->second.t)
+                j = i;
+
+        remove(block_name(j->first).c_str());
+
+        total -= j->second.size;
+        entries.erase(j);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+#endif
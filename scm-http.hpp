@@ -0,0 +1,133 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#ifndef SCM_HTTP_HPP
+#define SCM_HTTP_HPP
+
+#ifdef SCM_HTTP
+
+#include <vector>
+#include <string>
+#include <map>
+
+#include <SDL.h>
+#include <SDL_thread.h>
+
+#include "scm-source.hpp"
+
+//------------------------------------------------------------------------------
+
+/// An scm_http reads an SCM TIFF from an HTTP server using range requests
+///
+/// The file is divided into blocks of block_size bytes, and every read is
+/// served from whole blocks. A read needing several absent blocks in sequence
+/// fetches them with a single request, and a read needing a block already in
+/// flight waits upon that request rather than issuing another. Neighboring
+/// pages stored together, as siblings usually are, thus share their requests.
+/// Recently used blocks are held in memory, up to memory_blocks of them.
+///
+/// Each loader thread issues its own requests, in parallel, so requests are
+/// made in the priority order of the loader queues: visible pages before those
+/// prefetched. Connections are reused through a pool of libcurl handles.
+///
+/// If cache_path names a directory then each fetched block is also stored in
+/// a subdirectory there, named for the URL, and later reads of the block are
+/// served from disk, across runs of the program. The blocks of one file are
+/// limited to cache_size bytes in total, the least-recently used removed
+/// first. The cache is discarded if the server reports a different size or
+/// validator (ETag or modification time) for the file. The file's sidecar
+/// index is kept in the same subdirectory.
+///
+/// This class is built only when SCM_HTTP is defined, and requires libcurl.
+
+class scm_http : public scm_source
+{
+public:
+
+    scm_http(const std::string&);
+   ~scm_http();
+
+    static std::string cache_path;
+    static uint64      cache_size;
+    static size_t      block_size;
+    static int         memory_blocks;
+
+    bool   is_open()  const { return (size > 0); }
+    uint64 get_size() const { return size;       }
+    uint64 get_time() const { return time;       }
+
+    std::string get_local() const;
+
+    bool read(uint64, size_t, void *);
+
+private:
+
+    // A block of the file, resident or in flight.
+
+    struct block
+    {
+        block() : done(false), ok(false), refs(0), t(0) { }
+
+        std::vector<unsigned char> data;
+        bool                       done;
+        bool                       ok;
+        int                        refs;
+        uint64                     t;
+    };
+
+    // A block stored on disk.
+
+    struct entry
+    {
+        uint64 size;
+        uint64 t;
+    };
+
+    typedef std::map<uint64, block *>           block_m;
+    typedef std::map<uint64, block *>::iterator block_i;
+    typedef std::map<uint64, entry>             entry_m;
+    typedef std::map<uint64, entry>::iterator   entry_i;
+
+    std::string url;
+    std::string dir;
+    uint64      size;
+    uint64      time;
+
+    SDL_mutex  *mutex;
+    SDL_cond   *cond;
+    block_m     blocks;
+    entry_m     entries;
+    uint64      clock;
+    uint64      total;
+
+    std::vector<void *> handles;
+
+    void *take_handle();
+    void  give_handle(void *);
+
+    bool  query();
+    bool  fetch(uint64, size_t, unsigned char *);
+    void  load (uint64, std::vector<block *>&, size_t, size_t);
+    void  trim ();
+
+    void  scan ();
+    bool  get_block(uint64, block *);
+    void  put_block(uint64, const block *);
+    void  prune();
+
+    std::string block_name(uint64) const;
+};
+
+//------------------------------------------------------------------------------
+
+#endif
+#endif
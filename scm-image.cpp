@@ -12,11 +12,11 @@
 
 #include <algorithm>
 
-#include "util3d/glsl.h"
-
+#include "scm-program.hpp"
 #include "scm-system.hpp"
 #include "scm-cache.hpp"
 #include "scm-image.hpp"
+#include "scm-file.hpp"
 #include "scm-index.hpp"
 #include "scm-log.hpp"
 
@@ -36,6 +36,13 @@ scm_image::scm_image(scm_system *sys) :
     uk1(-1),
     index(-1)
 {
+    for (int d = 0; d < 16; d++)
+    {
+        ua[d] = -1;
+        ub[d] = -1;
+        ul[d] = -1;
+        um[d] = -1;
+    }
 }
 
 /// Finalize this image's SCM file.
@@ -59,9 +66,10 @@ scm_image::~scm_image()
 /// to exit and waited upon. @see scm_system::release_scm
 ///
 /// 2. The nemed SCM is aquired. If it is not already open, this will trigger
-/// the construction of a new scm_file object, and possibly the construction of
-/// an scm_cache. In the event of an scm_cache construction, loader threads for
-/// that cache are launched. @see scm_system::acquire_scm
+/// the construction of a new scm_file object, opened in the background. Once
+/// open, the next scm_system::update_cache attaches it to an scm_cache, which
+/// it may construct. Until then the image is drawn as absent.
+/// @see scm_system::acquire_scm
 ///
 /// So, while the scm_system makes every effort to minimize the effort of SCM
 /// data access, significant setup may be necessary, and it all starts here.
@@ -113,26 +121,42 @@ void scm_image::set_normal_max(float k)
     k1 = k;
 }
 
+/// Return the cache of this image's SCM file. A file still opening has none,
+/// so look again until the file is published. @see scm_system::acquire_scm
+
+scm_cache *scm_image::get_cache() const
+{
+    if (cache == 0 && index >= 0)
+        cache = sys->get_cache(index);
+
+    return cache;
+}
+
 //------------------------------------------------------------------------------
 
-/// Request and store GLSL uniform locations for this image's parameters.
+/// Store the GLSL uniform locations of this image's parameters, taken from the
+/// uniform table of the given program.
 
-void scm_image::init_uniforms(GLuint program)
+void scm_image::init_uniforms(const scm_program& program)
 {
     scm_log("scm_image init_uniforms %s %s %d", scm.c_str(),
-                                               name.c_str(), program);
-
-    if (program && !name.empty())
+                                               name.c_str(),
+                                               program.get_program());
+    if (!name.empty())
     {
-        uS  = glsl_uniform(program, "%s_sampler", name.c_str());
-        ur  = glsl_uniform(program, "%s.r",       name.c_str());
-        uk0 = glsl_uniform(program, "%s.k0",      name.c_str());
-        uk1 = glsl_uniform(program, "%s.k1",      name.c_str());
+        const char *s = name.c_str();
+
+        uS  = program.get_uniform("%s_sampler", s);
+        ur  = program.get_uniform("%s.r",       s);
+        uk0 = program.get_uniform("%s.k0",      s);
+        uk1 = program.get_uniform("%s.k1",      s);
 
         for (int d = 0; d < 16; d++)
         {
-            ua[d] = glsl_uniform(program, "%s.a[%d]", name.c_str(), d);
-            ub[d] = glsl_uniform(program, "%s.b[%d]", name.c_str(), d);
+            ua[d] = program.get_uniform("%s.a[%d]", s, d);
+            ub[d] = program.get_uniform("%s.b[%d]", s, d);
+            ul[d] = program.get_uniform("%s.l[%d]", s, d);
+            um[d] = program.get_uniform("%s.m[%d]", s, d);
         }
     }
 }
@@ -145,15 +169,20 @@ void scm_image::bind(GLuint unit, GLuint program) const
     glUniform1f(uk0, k0);
     glUniform1f(uk1, k1);
 
-    if (cache)
+    if (get_cache())
     {
+        const GLenum  g = cache->get_target();
         const GLfloat r = GLfloat(cache->get_page_size())
-                        / GLfloat(cache->get_page_size() + 2)
-                        / GLfloat(cache->get_grid_size());
+                        / GLfloat(cache->get_page_size() + 2);
+
+        if (g == GL_TEXTURE_2D)
+            glUniform2f(ur, r / cache->get_grid_size(),
+                            r / cache->get_grid_rows());
+        else
+            glUniform2f(ur, r, r);
 
-        glUniform2f(ur,  r, r);
         glActiveTexture(GL_TEXTURE0 + unit);
-        glBindTexture(GL_TEXTURE_2D, cache->get_texture());
+        glBindTexture(g, cache->get_texture());
     }
 }
 
@@ -162,7 +191,7 @@ void scm_image::bind(GLuint unit, GLuint program) const
 void scm_image::unbind(GLuint unit) const
 {
     glActiveTexture(GL_TEXTURE0 + unit);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindTexture(cache ? cache->get_target() : GL_TEXTURE_2D, 0);
 }
 
 //------------------------------------------------------------------------------
@@ -176,6 +205,50 @@ void scm_image::unbind(GLuint unit) const
 
 void scm_image::bind_page(GLuint program, int d, int t, long long i) const
 {
+    if (cache)
+    {
+        GLfloat v[4];
+        GLfloat m[2];
+
+        get_page_record(t, i, v, m);
+
+        glUniform1f(ua[d], v[0]);
+        glUniform2f(ub[d], v[1], v[2]);
+
+        if (cache->get_target() != GL_TEXTURE_2D)
+            glUniform1f(ul[d], v[3]);
+
+        if (cache->get_storage() == 2)
+            glUniform2f(um[d], m[0], m[1]);
+    }
+}
+
+/// Compute the values that bind_page would give the uniforms of a page at one
+/// depth, for use in a batched draw: the age a, the offset b, and the layer l.
+/// These are zero if the image has no cache, as after unbind_page. If m is
+/// given, it receives the value offset and scale of the page.
+///
+/// @param t Current time
+/// @param i SCM page index
+/// @param v Output record of four values
+/// @param m Output value offset and scale, or null
+///
+/// @see scm_sphere::set_batched
+
+void scm_image::get_page_record(int t, long long i, GLfloat *v,
+                                                    GLfloat *m) const
+{
+    v[0] = 0.f;
+    v[1] = 0.f;
+    v[2] = 0.f;
+    v[3] = 0.f;
+
+    if (m)
+    {
+        m[0] = 0.f;
+        m[1] = 1.f;
+    }
+
     if (cache)
     {
         // Get the page index and the time of its loading.
@@ -193,14 +266,28 @@ void scm_image::bind_page(GLuint program, int d, int t, long long i) const
             a = std::max(a, 0.0);
         }
 
-        // Compute texture coordinate offsets and set the uniforms.
+        // Compute texture coordinate offsets.
 
         const int s = cache->get_grid_size();
+        const int h = cache->get_grid_rows();
         const int n = cache->get_page_size();
 
-        glUniform1f(ua[d], GLfloat(a));
-        glUniform2f(ub[d], GLfloat((l % s) * (n + 2) + 1) / (s * (n + 2)),
-                           GLfloat((l / s) * (n + 2) + 1) / (s * (n + 2)));
+        v[0] = GLfloat(a);
+
+        if (cache->get_target() == GL_TEXTURE_2D)
+        {
+            v[1] = GLfloat((l % s) * (n + 2) + 1) / (s * (n + 2));
+            v[2] = GLfloat((l / s) * (n + 2) + 1) / (h * (n + 2));
+        }
+        else
+        {
+            v[1] = 1.f / (n + 2);
+            v[2] = 1.f / (n + 2);
+            v[3] = GLfloat(l);
+        }
+
+        if (m)
+            cache->get_line_range(l, m[0], m[1]);
     }
 }
 
@@ -211,19 +298,75 @@ void scm_image::unbind_page(GLuint program, int d) const
 {
     glUniform1f(ua[d], 0.f);
     glUniform2f(ub[d], 0.f, 0.f);
+    glUniform1f(ul[d], 0.f);
+    glUniform2f(um[d], 0.f, 1.f);
 }
 
 /// Set the last-used time of a page.
 
 void scm_image::touch_page(int t, long long i) const
 {
-    if (cache)
+    if (get_cache())
     {
         int ignored;
         cache->get_page(index, i, t, ignored);
     }
 }
 
+/// Ask for a page expected to be needed soon. Return true if it is already
+/// resident. @see scm_cache::ask_page
+
+bool scm_image::ask_page(int t, long long i) const
+{
+    if (get_cache())
+        return cache->ask_page(index, i, t);
+    else
+        return true;
+}
+
+/// Return true if this image's SCM file is open, or if it has none.
+
+bool scm_image::is_ready() const
+{
+    if (index < 0)
+        return true;
+
+    if (scm_file *file = sys->get_file(index))
+        return file->is_ready();
+    else
+        return false;
+}
+
+/// Return true if this image's cache normalizes its pages, so that the shader
+/// must apply the per-page offset and scale. @see scm_cache::float_storage
+
+bool scm_image::is_normalized() const
+{
+    return (get_cache() && cache->get_storage() == 2);
+}
+
+/// Append the index of every page in this image's SCM file to the given
+/// vector. Return false if the file synthesizes every page rather than giving
+/// a catalog. @see scm_cull
+
+bool scm_image::get_page_catalog(std::vector<long long>& v) const
+{
+    if (index < 0)
+        return true;
+
+    if (scm_file *file = sys->get_file(index))
+    {
+        const uint64  n = file->get_catalog_size();
+        const uint64 *c = file->get_catalog();
+
+        for (uint64 j = 0; j < n; ++j)
+            v.push_back((long long) c[j]);
+
+        return (n > 0);
+    }
+    return true;
+}
+
 //------------------------------------------------------------------------------
 
 /// Sample this image at the given location, returning a normalized result.
@@ -237,6 +380,24 @@ float scm_image::get_page_sample(const double *v) const
         return sys->get_page_sample(index, v) * (k1 - k0) + k0;
 }
 
+/// Sample this image at each of n locations, returning normalized results.
+/// @see scm_scene::get_current_ground
+
+void scm_image::get_page_samples(const double *v, float *k, int n,
+                                 bool b) const
+{
+    if (index < 0)
+        for (int j = 0; j < n; ++j)
+            k[j] = k1;
+    else
+    {
+        sys->get_page_samples(index, v, k, n, b);
+
+        for (int j = 0; j < n; ++j)
+            k[j] = k[j] * (k1 - k0) + k0;
+    }
+}
+
 /// Determine the minimum and maximum values of one page, returning a
 /// normalized result. @see scm_scene::get_page_bounds
 
@@ -22,6 +22,7 @@
 
 class scm_system;
 class scm_cache;
+class scm_program;
 
 //------------------------------------------------------------------------------
 
@@ -30,6 +31,17 @@ class scm_cache;
 /// This object is largely responsible for mapping SCM data onto OpenGL state,
 /// including OpenGL textures and GLSL uniforms. Notably, this includes those
 /// parameters mapping texture coordinates onto a scm_cache texture atlas.
+///
+/// If the cache is an array texture (see scm_cache::cache_array) the sampler
+/// must be declared sampler2DArray, and each page's layer is given by the
+/// uniform l[d], while b[d] gives the offset of the page body within the layer.
+/// The page coordinate scale r applies to both layouts. A 2D atlas need not be
+/// square (see scm_cache::set_lines) so its two components may differ.
+///
+/// If the cache normalizes float pages (see scm_cache::float_storage) then a
+/// sampled value t of the page at depth d stands for m[d].x + m[d].y * t, the
+/// offset and scale of that page. Such an image is not drawn in batches, the
+/// page records having no room for them. @see scm_scene::is_batched
 
 class scm_image
 {
@@ -64,7 +76,7 @@ public:
     /// @name Internal Interface
     /// @{
 
-    void   init_uniforms(GLuint);
+    void   init_uniforms(const scm_program&);
 
     void   bind(GLuint, GLuint) const;
     void unbind(GLuint)         const;
@@ -72,10 +84,19 @@ public:
     void   bind_page(GLuint, int, int, long long) const;
     void unbind_page(GLuint, int)                 const;
     void  touch_page(             int, long long) const;
+    bool    ask_page(             int, long long) const;
+
+    void get_page_record(int, long long, GLfloat *, GLfloat * = 0) const;
 
     float   get_page_sample(const double *)              const;
+    void    get_page_samples(const double *, float *, int, bool) const;
     void    get_page_bounds(long long, float &, float &) const;
     bool    get_page_status(long long)                   const;
+    bool    get_page_catalog(std::vector<long long>&)    const;
+
+    int     get_index() const { return index; }
+    bool     is_ready() const;
+    bool     is_normalized() const;
 
     /// @}
 
@@ -96,9 +117,13 @@ private:
     GLint       uk1;
     GLint       ua[16];
     GLint       ub[16];
+    GLint       ul[16];
+    GLint       um[16];
+
+    mutable scm_cache *cache;
+    int                index;
 
-    scm_cache  *cache;
-    int         index;
+    scm_cache *get_cache() const;
 };
 
 //------------------------------------------------------------------------------
@@ -90,123 +90,131 @@ void scm_locate(long long *a, double *y, double *x, const double *v)
     *y = (t + M_PI_4) / M_PI_2;
 }
 
-// Determine the page to the north of page i. ----------------------------------
+// Cube face adjacency. For each direction and each root, give the root across
+// that edge, and the sources of the row and the column of the page there, in
+// terms of the row r, column c, and last row or column m of a page at the edge.
 
-long long scm_page_north(long long i)
-{
-    long long l = scm_page_level(i);
-    long long a = scm_page_root(i);
-    long long r = scm_page_row(i);
-    long long c = scm_page_col(i);
+enum { take_r, take_c, take_0, take_m, take_mr, take_mc };
 
-    long long n = 1LL << l, m = n - 1, t = m - c;
+struct scm_edge
+{
+    unsigned char a;
+    unsigned char r;
+    unsigned char c;
+};
+
+static const scm_edge edges[4][6] = {
+    {   // North
+        { 2, take_mc, take_m  }, { 2, take_c,  take_0  },
+        { 5, take_0,  take_mc }, { 4, take_m,  take_c  },
+        { 2, take_m,  take_c  }, { 2, take_0,  take_mc },
+    },
+    {   // South
+        { 3, take_c,  take_m  }, { 3, take_mc, take_0  },
+        { 4, take_0,  take_c  }, { 5, take_m,  take_mc },
+        { 3, take_0,  take_c  }, { 3, take_m,  take_mc },
+    },
+    {   // West
+        { 4, take_r,  take_m  }, { 5, take_r,  take_m  },
+        { 1, take_0,  take_r  }, { 1, take_m,  take_mr },
+        { 1, take_r,  take_m  }, { 0, take_r,  take_m  },
+    },
+    {   // East
+        { 5, take_r,  take_0  }, { 4, take_r,  take_0  },
+        { 0, take_0,  take_mr }, { 0, take_m,  take_r  },
+        { 0, take_r,  take_0  }, { 1, take_r,  take_0  },
+    },
+};
+
+// Step from page p in direction d, to row r and column c of the same root if
+// the step does not cross edge e, or across the edge by table otherwise.
+
+static inline scm_coord step(const scm_coord& p, int d, bool e,
+                             long long r, long long c)
+{
+    const long long m = (1LL << p.l) - 1;
+    const long long v[6] = { p.r, p.c, 0, m, m - p.r, m - p.c };
+    const scm_edge& E = edges[d][p.a];
+
+    scm_coord q = { e ? E.a    : p.a, p.l,
+                    e ? v[E.r] : r,
+                    e ? v[E.c] : c };
+    return q;
+}
 
-    if      (r >  0) {        r = r - 1;    }
-    else if (a == 0) { a = 2; r = t; c = m; }
-    else if (a == 1) { a = 2; r = c; c = 0; }
-    else if (a == 2) { a = 5; r = 0; c = t; }
-    else if (a == 3) { a = 4; r = m;        }
-    else if (a == 4) { a = 2; r = m;        }
-    else             { a = 2; r = 0; c = t; }
+// Determine the page to the north of page p. ----------------------------------
 
-    return scm_page_index(a, l, r, c);
+scm_coord scm_page_north(const scm_coord& p)
+{
+    return step(p, 0, p.r == 0, p.r - 1, p.c);
 }
 
-// Determine the page to the south of page i. ----------------------------------
+// Determine the page to the south of page p. ----------------------------------
 
-long long scm_page_south(long long i)
+scm_coord scm_page_south(const scm_coord& p)
 {
-    long long l = scm_page_level(i);
-    long long a = scm_page_root(i);
-    long long r = scm_page_row(i);
-    long long c = scm_page_col(i);
-
-    long long n = 1LL << l, m = n - 1, t = m - c;
+    return step(p, 1, p.r == (1LL << p.l) - 1, p.r + 1, p.c);
+}
 
-    if      (r <  m) {        r = r + 1;    }
-    else if (a == 0) { a = 3; r = c; c = m; }
-    else if (a == 1) { a = 3; r = t; c = 0; }
-    else if (a == 2) { a = 4; r = 0;        }
-    else if (a == 3) { a = 5; r = m; c = t; }
-    else if (a == 4) { a = 3; r = 0;        }
-    else             { a = 3; r = m; c = t; }
+// Determine the page to the west of page p. -----------------------------------
 
-    return scm_page_index(a, l, r, c);
+scm_coord scm_page_west(const scm_coord& p)
+{
+    return step(p, 2, p.c == 0, p.r, p.c - 1);
 }
 
-// Determine the page to the west of page i. -----------------------------------
+// Determine the page to the east of page p. -----------------------------------
 
-long long scm_page_west(long long i)
+scm_coord scm_page_east(const scm_coord& p)
 {
-    long long l = scm_page_level(i);
-    long long a = scm_page_root(i);
-    long long r = scm_page_row(i);
-    long long c = scm_page_col(i);
+    return step(p, 3, p.c == (1LL << p.l) - 1, p.r, p.c + 1);
+}
 
-    long long n = 1LL << l, m = n - 1, t = m - r;
+// Determine the neighbors of page i. ------------------------------------------
 
-    if      (c >  0) {        c = c - 1;    }
-    else if (a == 0) { a = 4; c = m;        }
-    else if (a == 1) { a = 5; c = m;        }
-    else if (a == 2) { a = 1; c = r; r = 0; }
-    else if (a == 3) { a = 1; c = t; r = m; }
-    else if (a == 4) { a = 1; c = m;        }
-    else             { a = 0; c = m;        }
+long long scm_page_north(long long i)
+{
+    return scm_page_index(scm_page_north(scm_page_coord(i)));
+}
 
-    return scm_page_index(a, l, r, c);
+long long scm_page_south(long long i)
+{
+    return scm_page_index(scm_page_south(scm_page_coord(i)));
 }
 
-// Determine the page to the east of page i. -----------------------------------
+long long scm_page_west(long long i)
+{
+    return scm_page_index(scm_page_west(scm_page_coord(i)));
+}
 
 long long scm_page_east(long long i)
 {
-    long long l = scm_page_level(i);
-    long long a = scm_page_root(i);
-    long long r = scm_page_row(i);
-    long long c = scm_page_col(i);
-
-    long long n = 1LL << l, m = n - 1, t = m - r;
-
-    if      (c <  m) {        c = c + 1;    }
-    else if (a == 0) { a = 5; c = 0;        }
-    else if (a == 1) { a = 4; c = 0;        }
-    else if (a == 2) { a = 0; c = t; r = 0; }
-    else if (a == 3) { a = 0; c = r; r = m; }
-    else if (a == 4) { a = 0; c = 0;        }
-    else             { a = 1; c = 0;        }
-
-    return scm_page_index(a, l, r, c);
+    return scm_page_index(scm_page_east(scm_page_coord(i)));
 }
 
 // Calculate the four corner vectors of page i. --------------------------------
 
 void scm_page_corners(long long i, double *v)
 {
-    long long l = scm_page_level(i);
-    long long a = scm_page_root(i);
-    long long r = scm_page_row(i);
-    long long c = scm_page_col(i);
+    scm_coord p = scm_page_coord(i);
 
-    long long n = 1LL << l;
+    long long n = 1LL << p.l;
 
-    scm_vector(a, (double) (r + 0) / n, (double) (c + 0) / n, v + 0);
-    scm_vector(a, (double) (r + 0) / n, (double) (c + 1) / n, v + 3);
-    scm_vector(a, (double) (r + 1) / n, (double) (c + 0) / n, v + 6);
-    scm_vector(a, (double) (r + 1) / n, (double) (c + 1) / n, v + 9);
+    scm_vector(p.a, (double) (p.r + 0) / n, (double) (p.c + 0) / n, v + 0);
+    scm_vector(p.a, (double) (p.r + 0) / n, (double) (p.c + 1) / n, v + 3);
+    scm_vector(p.a, (double) (p.r + 1) / n, (double) (p.c + 0) / n, v + 6);
+    scm_vector(p.a, (double) (p.r + 1) / n, (double) (p.c + 1) / n, v + 9);
 }
 
 // Calculate the center vector of page i. --------------------------------------
 
 void scm_page_center(long long i, double *v)
 {
-    long long l = scm_page_level(i);
-    long long a = scm_page_root(i);
-    long long r = scm_page_row(i);
-    long long c = scm_page_col(i);
+    scm_coord p = scm_page_coord(i);
 
-    long long n = 1LL << l;
+    long long n = 1LL << p.l;
 
-    scm_vector(a, (double) (r + 0.5) / n, (double) (c + 0.5) / n, v + 0);
+    scm_vector(p.a, (double) (p.r + 0.5) / n, (double) (p.c + 0.5) / n, v + 0);
 }
 
 //------------------------------------------------------------------------------
@@ -13,9 +13,16 @@
 #ifndef SCM_INDEX_HPP
 #define SCM_INDEX_HPP
 
-// The following functions compute SCM page index relationships. There is quite
-// a bit of redundant computation in their implementation, and it is expected
-// that the compiler will aggressively inline and reduce common sub-expressions.
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+// The following functions compute SCM page index relationships. The pages of
+// each level are numbered consecutively, root by root and row by row, so that
+// the level follows from the binary log of the index, and the root, row, and
+// column are bit fields of the index's offset within its level. Thus no divide
+// is needed, and the neighbors are resolved by table lookup. A caller visiting
+// many relatives of one page may decode it once as an scm_coord.
 
 // These calculations are performed using 64-bit signed indices. They're 64-bit
 // because 31-bit indices have already been found in the wild, and increasing
@@ -26,6 +33,13 @@
 static inline long long log2(long long n)
 {
     unsigned long long v = (unsigned long long) n;
+
+#if defined(__GNUC__)
+    return v ? 63 - __builtin_clzll(v) : 0;
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long r;
+    return _BitScanReverse64(&r, v) ? (long long) r : 0;
+#else
     unsigned long long r;
     unsigned long long s;
 
@@ -36,6 +50,7 @@ static inline long long log2(long long n)
     s = (v > 0x3ULL       ) << 1; v >>= s; r |= s;
 
     return (long long) (r | (v >> 1));
+#endif
 }
 
 // Calculate the number of pages in an SCM of depth d. -------------------------
@@ -52,34 +67,41 @@ static inline long long scm_page_level(long long i)
     return (log2(i + 2) - 1) / 2;
 }
 
+// Calculate the offset of page i within level l. ------------------------------
+
+static inline long long scm_page_offset(long long i, long long l)
+{
+    return i + 2 - (2LL << (2 * l));
+}
+
 // Calculate the root page in the ancestry of page i. --------------------------
 
 static inline long long scm_page_root(long long i)
 {
-    long long n = 1LL << (2 * scm_page_level(i));
-    return (i - 2 * (n - 1)) / n;
+    long long l = scm_page_level(i);
+    return scm_page_offset(i, l) >> (2 * l);
 }
 
 // Calculate the tile number (face index) of page i. ---------------------------
 
 static inline long long scm_page_tile(long long i)
 {
-    long long n = 1LL << (2 * scm_page_level(i));
-    return (i - 2 * (n - 1)) % n;
+    long long l = scm_page_level(i);
+    return scm_page_offset(i, l) & ((1LL << (2 * l)) - 1);
 }
 
 // Calculate the tile row of page i. -------------------------------------------
 
 static inline long long scm_page_row(long long i)
 {
-    return scm_page_tile(i) / (1LL << scm_page_level(i));
+    return scm_page_tile(i) >> scm_page_level(i);
 }
 
 // Calculate the tile column of page i. ----------------------------------------
 
 static inline long long scm_page_col(long long i)
 {
-    return scm_page_tile(i) % (1LL << scm_page_level(i));
+    return scm_page_tile(i) & ((1LL << scm_page_level(i)) - 1);
 }
 
 // Calculate the index of the page on root a at level l, row r, column c. -----
@@ -90,30 +112,73 @@ static inline long long scm_page_index(long long a, long long l,
     return scm_page_count(l - 1) + (a << (2 * l)) + (r << l) + c;
 }
 
+//------------------------------------------------------------------------------
+
+/// An scm_coord is a page decoded into its root a, level l, row r, and column
+/// c. The page index remains the external name of a page, but a traversal may
+/// carry its pages decoded, deriving relatives without re-encoding.
+
+struct scm_coord
+{
+    long long a;
+    long long l;
+    long long r;
+    long long c;
+};
+
+static inline scm_coord scm_page_coord(long long i)
+{
+    long long l = scm_page_level(i);
+    long long t = scm_page_offset(i, l);
+    long long m = (1LL << l) - 1;
+
+    scm_coord p = { t >> (2 * l), l, (t >> l) & m, t & m };
+    return p;
+}
+
+static inline long long scm_page_index(const scm_coord& p)
+{
+    return scm_page_index(p.a, p.l, p.r, p.c);
+}
+
+static inline scm_coord scm_page_parent(const scm_coord& p)
+{
+    scm_coord q = { p.a, p.l - 1, p.r >> 1, p.c >> 1 };
+    return q;
+}
+
+static inline scm_coord scm_page_child(const scm_coord& p, long long k)
+{
+    scm_coord q = { p.a, p.l + 1, p.r * 2 + (k >> 1), p.c * 2 + (k & 1) };
+    return q;
+}
+
+static inline long long scm_page_order(const scm_coord& p)
+{
+    return 2 * (p.r & 1) + (p.c & 1);
+}
+
+//------------------------------------------------------------------------------
+
 // Calculate the parent page of page i. ----------------------------------------
 
 static inline long long scm_page_parent(long long i)
 {
-    return scm_page_index(scm_page_root(i), scm_page_level(i) - 1,
-                                            scm_page_row  (i) / 2,
-                                            scm_page_col  (i) / 2);
+    return scm_page_index(scm_page_parent(scm_page_coord(i)));
 }
 
 // Calculate child page k of page i. -------------------------------------------
 
 static inline long long scm_page_child(long long i, long long k)
 {
-    return scm_page_index(scm_page_root(i), scm_page_level(i) + 1,
-                                            scm_page_row  (i) * 2 + k / 2,
-                                            scm_page_col  (i) * 2 + k % 2);
+    return scm_page_index(scm_page_child(scm_page_coord(i), k));
 }
 
 // Calculate the order (child index) of page i. --------------------------------
 
 static inline long long scm_page_order(long long i)
 {
-    return 2 * (scm_page_row(i) % 2)
-             + (scm_page_col(i) % 2);
+    return scm_page_order(scm_page_coord(i));
 }
 
 //------------------------------------------------------------------------------
@@ -126,6 +191,11 @@ long long scm_page_south(long long);
 long long scm_page_west (long long);
 long long scm_page_east (long long);
 
+scm_coord scm_page_north(const scm_coord&);
+scm_coord scm_page_south(const scm_coord&);
+scm_coord scm_page_west (const scm_coord&);
+scm_coord scm_page_east (const scm_coord&);
+
 void scm_page_corners(long long, double *);
 void scm_page_center (long long, double *);
 
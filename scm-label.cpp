@@ -10,6 +10,7 @@
 // FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
 // more details.
 
+#include <algorithm>
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
@@ -22,7 +23,12 @@
 #include "util3d/glsl.h"
 
 #include "scm-label.hpp"
+#include "scm-sphere.hpp"
+#include "scm-scene.hpp"
+#include "scm-index.hpp"
 #include "scm-path.hpp"
+#include "scm-sidecar.hpp"
+#include "scm-util.hpp"
 #include "scm-log.hpp"
 
 #include "scm-label-icons.h"
@@ -215,6 +221,92 @@ static double clamp(double k, double a, double b)
     else            return k;
 }
 
+// Return the page containing a label of diameter d at latitude and longitude
+// (a, o) on a sphere of radius r, at the deepest level whose pages span at
+// least sixteen diameters.
+
+static long long locate(double a, double o, double d, double r)
+{
+    double v[3], x, y;
+    long long f, l = 0;
+
+    v[0] = sin(radians(o)) * cos(radians(a));
+    v[1] =                   sin(radians(a));
+    v[2] = cos(radians(o)) * cos(radians(a));
+
+    scm_locate(&f, &y, &x, v);
+    x = 1 - x;
+
+    if (d > 0 && r > 0)
+        while (l < 15 && M_PI_2 * r / double(1LL << (l + 1)) >= 16 * d)
+            l++;
+
+    const long long n = 1LL << l;
+
+    return scm_page_index(f, l, std::min((long long) (y * n), n - 1),
+                                std::min((long long) (x * n), n - 1));
+}
+
+// Order labels by page, that each page's labels may be drawn as one range.
+
+struct before
+{
+    const std::vector<long long>& k;
+
+    before(const std::vector<long long>& k) : k(k) { }
+
+    bool operator()(int a, int b) const { return k[a] < k[b]; }
+};
+
+// Label cache file layout. A header gives the magic number, version, CSV size
+// and time, and label count, followed by each label as its fields in order.
+// Every integer and float is stored little endian, whatever the host, so the
+// cache does not depend upon the byte order or padding of the label struct.
+
+static const uint32 scml_magic   = 0x4C4D4353;  // "SCML"
+static const uint32 scml_version = 2;
+static const size_t scml_head    = 32;
+
+static void put32(std::vector<uint8>& v, uint32 x)
+{
+    v.push_back(uint8(x      ));
+    v.push_back(uint8(x >>  8));
+    v.push_back(uint8(x >> 16));
+    v.push_back(uint8(x >> 24));
+}
+
+static void put64(std::vector<uint8>& v, uint64 x)
+{
+    put32(v, uint32(x      ));
+    put32(v, uint32(x >> 32));
+}
+
+static void putf(std::vector<uint8>& v, float f)
+{
+    uint32 x;
+    memcpy(&x, &f, 4);
+    put32(v, x);
+}
+
+static uint32 get32(const uint8 *p)
+{
+    return (uint32(p[0])      ) | (uint32(p[1]) <<  8)
+         | (uint32(p[2]) << 16) | (uint32(p[3]) << 24);
+}
+
+static uint64 get64(const uint8 *p)
+{
+    return uint64(get32(p)) | (uint64(get32(p + 4)) << 32);
+}
+
+static float getf(const uint8 *p)
+{
+    uint32 x = get32(p);
+    float  f;
+    memcpy(&f, &x, 4);
+    return f;
+}
+
 /// @endcond
 //------------------------------------------------------------------------------
 
@@ -227,7 +319,6 @@ static double clamp(double k, double a, double b)
 /// @param size Icon size (in pixels)
 
 scm_label::scm_label(const std::string& path, int size) :
-    label_line(0),
     num_circles(0),
     num_sprites(0),
     num_latlons(0),
@@ -257,9 +348,13 @@ scm_label::scm_label(const std::string& path, int size) :
     glUseProgram(sprite_glsl.program);
     glUniform1i(glGetUniformLocation(sprite_glsl.program, "icons"), 0);
 
-    // Parse the data file into labels.
+    // Load the cached labels, or parse the data file into labels.
 
-    parse(path);
+    if (!load(path))
+    {
+        parse(path);
+        store(path);
+    }
 
     // Generate an annotation for each label.
 
@@ -268,9 +363,32 @@ scm_label::scm_label(const std::string& path, int size) :
     std::vector<circle> circle_v;
     std::vector<sprite> sprite_v;
     std::vector<latlon> latlon_v;
+    std::vector<int>    first_v;
 
     for (int i = 0; i < int(labels.size()); ++i)
     {
+        // Begin a new bucket at each new page.
+
+        long long p = locate(labels[i].lat, labels[i].lon,
+                             labels[i].dia, labels[i].rad);
+
+        if (buckets.empty() || buckets.back().i != p)
+        {
+            bucket B;
+
+            B.i    = p;
+            B.c0   = GLint(circle_v.size());
+            B.cn   = 0;
+            B.s0   = GLint(sprite_v.size());
+            B.sn   = 0;
+            B.l0   = int(latlon_v.size());
+            B.ln   = 0;
+            B.text = 0;
+
+            buckets.push_back(B);
+            first_v.push_back(i);
+        }
+
         int w = line_length(labels[i].str, label_font);
         int h = font_height(               label_font);
 
@@ -296,6 +414,7 @@ scm_label::scm_label(const std::string& path, int size) :
         {
             sprite S(M, labels[i].typ);
             sprite_v.push_back(S);
+            buckets.back().sn++;
             y = +h / 3.0;
         }
 
@@ -305,6 +424,7 @@ scm_label::scm_label(const std::string& path, int size) :
         {
             circle C(M, labels[i].typ);
             circle_v.push_back(C);
+            buckets.back().cn++;
         }
 
         // Create a line of latitude.
@@ -312,7 +432,10 @@ scm_label::scm_label(const std::string& path, int size) :
         if (labels[i].latlon())
         {
             latlon L(labels[i].lat, labels[i].lon, labels[i].rad);
+            latlon_first.push_back(GLint(latlon_v.size() * 360));
+            latlon_count.push_back(360);
             latlon_v.push_back(L);
+            buckets.back().ln++;
         }
 
         // Add the string and matrix to the list.
@@ -332,11 +455,18 @@ scm_label::scm_label(const std::string& path, int size) :
 
     size_t sz = sizeof (point);
 
-    // Typeset the labels.
+    // Typeset the labels of each bucket.
+
+    first_v.push_back(int(string_v.size()));
+
+    for (int j = 0; j < int(buckets.size()); ++j)
+    {
+        const int a = first_v[j];
+        const int n = first_v[j + 1] - a;
 
-    if (!string_v.empty())
-        label_line = line_layout(string_v.size(), &string_v.front(), NULL,
-                                                   matrix_v.front().M, label_font);
+        buckets[j].text = line_layout(n, &string_v[a], NULL,
+                                         matrix_v[a].M, label_font);
+    }
 
     // Create a VBO for the circles.
 
@@ -389,7 +519,9 @@ scm_label::~scm_label()
     if (sprite_vbo) glDeleteBuffers(1, &sprite_vbo);
     if (circle_vbo) glDeleteBuffers(1, &circle_vbo);
 
-    line_delete(label_line);
+    for (int j = 0; j < int(buckets.size()); ++j)
+        line_delete(buckets[j].text);
+
     font_delete(label_font);
 
     glsl_delete(&sprite_glsl);
@@ -398,17 +530,31 @@ scm_label::~scm_label()
 
 //------------------------------------------------------------------------------
 
-/// Draw all annotations using the given color and transparency
+/// Draw the annotations of the pages drawn by a sphere, using the given color
+/// and transparency. If no sphere is given, draw all annotations.
 ///
-/// @param r Red
-/// @param g Green
-/// @param b Blue
-/// @param a Alpha
-
-void scm_label::draw(GLubyte r, GLubyte g, GLubyte b, GLubyte a)
+/// @param r       Red
+/// @param g       Green
+/// @param b       Blue
+/// @param a       Alpha
+/// @param sphere  Sphere having drawn the scene, or null
+/// @param scene   Scene annotated by these labels
+/// @param channel Channel index
+
+void scm_label::draw(GLubyte r, GLubyte g, GLubyte b, GLubyte a,
+                     const scm_sphere *sphere, const scm_scene *scene,
+                     int channel)
 {
     size_t sz = sizeof (point);
 
+    // Find the visible buckets.
+
+    std::vector<int> shown;
+
+    for (int j = 0; j < int(buckets.size()); ++j)
+        if (visible(buckets[j], sphere))
+            shown.push_back(j);
+
     glPushAttrib(GL_ENABLE_BIT | GL_POLYGON_BIT);
     {
         // Ensure we're in clockwise mode regardless of sphere winding.
@@ -441,8 +587,25 @@ void scm_label::draw(GLubyte r, GLubyte g, GLubyte b, GLubyte a)
             glColorPointer   (4, GL_UNSIGNED_BYTE, sz, (GLvoid *) 20);
 
             glUseProgram(0);
-            for (int i = 0; i < num_latlons; i++)
-                glDrawArrays(GL_LINE_LOOP, i * 360, 360);
+
+            batch_first.clear();
+            batch_count.clear();
+
+            for (int k = 0; k < int(shown.size()); ++k)
+            {
+                const bucket& B = buckets[shown[k]];
+
+                for (int l = B.l0; l < B.l0 + B.ln; ++l)
+                {
+                    batch_first.push_back(latlon_first[l]);
+                    batch_count.push_back(latlon_count[l]);
+                }
+            }
+
+            if (!batch_first.empty())
+                glMultiDrawArrays(GL_LINE_LOOP, &batch_first.front(),
+                                                &batch_count.front(),
+                                          GLsizei(batch_first.size()));
 
             // Draw the circles.
 
@@ -452,7 +615,17 @@ void scm_label::draw(GLubyte r, GLubyte g, GLubyte b, GLubyte a)
             glColorPointer   (4, GL_UNSIGNED_BYTE, sz, (GLvoid *) 20);
 
             glUseProgram(circle_glsl.program);
-            glDrawArrays(GL_QUADS, 0, 4 * num_circles);
+
+            batch_first.clear();
+            batch_count.clear();
+
+            for (int k = 0; k < int(shown.size()); ++k)
+                add_range(4 * buckets[shown[k]].c0, 4 * buckets[shown[k]].cn);
+
+            if (!batch_first.empty())
+                glMultiDrawArrays(GL_QUADS, &batch_first.front(),
+                                            &batch_count.front(),
+                                      GLsizei(batch_first.size()));
 
             // Draw the sprites.
 
@@ -466,7 +639,17 @@ void scm_label::draw(GLubyte r, GLubyte g, GLubyte b, GLubyte a)
             glBindTexture(GL_TEXTURE_2D, sprite_tex);
 
             glUseProgram(sprite_glsl.program);
-            glDrawArrays(GL_POINTS, 0, 1 * num_sprites);
+
+            batch_first.clear();
+            batch_count.clear();
+
+            for (int k = 0; k < int(shown.size()); ++k)
+                add_range(buckets[shown[k]].s0, buckets[shown[k]].sn);
+
+            if (!batch_first.empty())
+                glMultiDrawArrays(GL_POINTS, &batch_first.front(),
+                                             &batch_count.front(),
+                                       GLsizei(batch_first.size()));
 
             glDisable(GL_POINT_SPRITE);
         }
@@ -478,11 +661,49 @@ void scm_label::draw(GLubyte r, GLubyte g, GLubyte b, GLubyte a)
         glDisable(GL_LIGHTING);
         glEnable(GL_TEXTURE_2D);
 
-        line_render(label_line);
+        for (int k = 0; k < int(shown.size()); ++k)
+            line_render(buckets[shown[k]].text);
     }
     glPopAttrib();
 }
 
+// Append the range of n elements beginning at i to the current batch, merging
+// it with the last range if the two abut.
+
+void scm_label::add_range(GLint i, GLsizei n)
+{
+    if (n > 0)
+    {
+        if (!batch_first.empty() && batch_first.back()
+                                  + batch_count.back() == i)
+            batch_count.back() += n;
+        else
+        {
+            batch_first.push_back(i);
+            batch_count.push_back(n);
+        }
+    }
+}
+
+// Return true if a bucket is to be drawn: if the sphere drew the bucket's page,
+// any page within it, or any page containing it.
+
+bool scm_label::visible(const bucket& B, const scm_sphere *sphere) const
+{
+    if (sphere)
+    {
+        if (sphere->is_covered(B.i))
+            return true;
+
+        for (long long i = B.i; i > 5; )
+            if (sphere->is_drawn(i = scm_page_parent(i)))
+                return true;
+
+        return false;
+    }
+    return true;
+}
+
 //------------------------------------------------------------------------------
 
 /// Scan one record of the label definition
@@ -519,6 +740,135 @@ void scm_label::parse(const std::string& path)
             fclose(fp);
         }
     }
+
+    // Sort the labels by page, preserving the file order within each page.
+
+    std::vector<long long> k(labels.size());
+    std::vector<int>       o(labels.size());
+
+    for (int i = 0; i < int(labels.size()); ++i)
+    {
+        k[i] = locate(labels[i].lat, labels[i].lon,
+                      labels[i].dia, labels[i].rad);
+        o[i] = i;
+    }
+
+    std::stable_sort(o.begin(), o.end(), before(k));
+
+    std::vector<label> sorted(labels.size());
+
+    for (int i = 0; i < int(labels.size()); ++i)
+        sorted[i] = labels[o[i]];
+
+    labels.swap(sorted);
+}
+
+/// Read the cached labels of the named CSV. Return false if there is no cache,
+/// or if it does not match the CSV.
+
+bool scm_label::load(const std::string& path)
+{
+    uint64 s;
+    uint64 t;
+
+    bool ok = false;
+
+    if (!path.empty() && scm_sidecar::stat_file(path, s, t))
+    {
+        const std::string name = path + ".scml";
+
+        if (FILE *f = fopen(name.c_str(), "rb"))
+        {
+            const size_t m = strmax + 18;
+
+            uint8 h[scml_head];
+            long  z = -1;
+
+            // Accept only a current cache whose length matches its count.
+
+            bool cur = (fread(h, scml_head, 1, f) == 1
+                        && get32(h +  0) == scml_magic
+                        && get32(h +  4) == scml_version
+                        && get64(h +  8) == s
+                        && get64(h + 16) == t);
+
+            if (cur && fseek(f, 0, SEEK_END) == 0)
+                z = ftell(f) - long(scml_head);
+
+            if (cur && z >= 0 && z % long(m) == 0
+                    && get64(h + 24) == uint64(z) / m
+                    && fseek(f, long(scml_head), SEEK_SET) == 0)
+            {
+                std::vector<uint8> v((size_t(z)));
+
+                if (v.empty() || fread(&v.front(), 1, v.size(), f) == v.size())
+                {
+                    labels.resize(v.size() / m);
+
+                    for (size_t i = 0; i < labels.size(); ++i)
+                    {
+                        const uint8 *p = &v[i * m];
+                        label&       L = labels[i];
+
+                        memcpy(L.str, p, strmax);
+
+                        L.str[strmax - 1] = 0;
+                        L.lat    = getf(p + strmax +  0);
+                        L.lon    = getf(p + strmax +  4);
+                        L.dia    = getf(p + strmax +  8);
+                        L.rad    = getf(p + strmax + 12);
+                        L.typ[0] = char(p[strmax + 16]);
+                        L.typ[1] = char(p[strmax + 17]);
+                    }
+                    ok = true;
+                }
+            }
+            fclose(f);
+        }
+    }
+    scm_log("scm_label load %s %s", path.c_str(), ok ? "cached" : "parsed");
+    return ok;
+}
+
+/// Write the parsed labels of the named CSV to its cache. Failure is not an
+/// error, as the CSV remains. @see scm_atomic_write
+
+void scm_label::store(const std::string& path)
+{
+    uint64 s;
+    uint64 t;
+
+    if (!path.empty() && scm_sidecar::stat_file(path, s, t))
+    {
+        const std::string name = path + ".scml";
+
+        std::vector<uint8> v;
+
+        v.reserve(scml_head + labels.size() * (strmax + 18));
+
+        put32(v, scml_magic);
+        put32(v, scml_version);
+        put64(v, s);
+        put64(v, t);
+        put64(v, labels.size());
+
+        for (size_t i = 0; i < labels.size(); ++i)
+        {
+            const label& L = labels[i];
+
+            v.insert(v.end(), L.str, L.str + strmax);
+
+            putf(v, L.lat);
+            putf(v, L.lon);
+            putf(v, L.dia);
+            putf(v, L.rad);
+
+            v.push_back(uint8(L.typ[0]));
+            v.push_back(uint8(L.typ[1]));
+        }
+
+        scm_atomic_write(name, &v.front(), v.size());
+    }
 }
 
 //------------------------------------------------------------------------------
@@ -48,6 +48,21 @@
 ///    LF    | Landing Site     | Flag icon
 ///    \@*   | Star             | Star icon
 ///    \@C   | Circle           | Circle icon
+///
+/// Labels are bucketed by the SCM page containing them, at the level whose
+/// pages span several label diameters. Given the sphere that drew the scene,
+/// a bucket is drawn only if the sphere drew its page, a page within it, or a
+/// page containing it, so labels appear as the view approaches them, and each
+/// kind of annotation is drawn in a single batch.
+///
+/// Parsed labels are cached in a binary file, named by appending ".scml" to
+/// the CSV's name, which records the CSV's size and modification time and is
+/// rejected if either differs. The file is little endian with each field
+/// stored explicitly, so it is portable among hosts. A later load is a single
+/// read.
+
+class scm_sphere;
+class scm_scene;
 
 class scm_label
 {
@@ -56,7 +71,8 @@ public:
     scm_label(const std::string&, int);
    ~scm_label();
 
-    void draw(GLubyte r, GLubyte g, GLubyte b, GLubyte a);
+    void draw(GLubyte r, GLubyte g, GLubyte b, GLubyte a,
+              const scm_sphere *, const scm_scene *, int);
 
 private:
 
@@ -86,12 +102,31 @@ private:
         }
     };
 
+    // A bucket gives the range of the circles, sprites, and strings of the
+    // labels of one page.
+
+    struct bucket
+    {
+        long long i;
+        GLint     c0;
+        GLsizei   cn;
+        GLint     s0;
+        GLsizei   sn;
+        int       l0;
+        int       ln;
+        line     *text;
+    };
+
     int  scan (FILE *, label&);
     void parse(const std::string&);
+    bool  load(const std::string&);
+    void store(const std::string&);
     void apply(label *);
 
+    bool visible(const bucket&, const scm_sphere *) const;
+    void add_range(GLint, GLsizei);
+
     font *label_font;
-    line *label_line;
 
     int    num_circles;
     int    num_sprites;
@@ -106,7 +141,13 @@ private:
     GLuint latlon_vbo;
     GLuint sprite_tex;
 
-    std::vector<label> labels;
+    std::vector<label>  labels;
+    std::vector<bucket> buckets;
+
+    std::vector<GLint>   latlon_first;
+    std::vector<GLsizei> latlon_count;
+    std::vector<GLint>   batch_first;
+    std::vector<GLsizei> batch_count;
 };
 
 //-----------------------------------------------------------------------------
@@ -0,0 +1,344 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#include <algorithm>
+
+#include "scm-loader.hpp"
+#include "scm-cache.hpp"
+#include "scm-file.hpp"
+#include "scm-stats.hpp"
+#include "scm-trace.hpp"
+#include "scm-log.hpp"
+
+//------------------------------------------------------------------------------
+
+/// Create a loader pool and launch its worker threads.
+///
+/// @param n Number of workers, or zero to use one per processor
+
+scm_loader::scm_loader(int n) : running(true)
+{
+    if (n <= 0) n = SDL_GetCPUCount();
+    if (n <= 0) n = 1;
+
+    mutex = SDL_CreateMutex();
+    cond  = SDL_CreateCond();
+    tasks = SDL_CreateSemaphore(0);
+
+    workers.resize(n);
+
+    for (int i = 0; i < n; ++i)
+    {
+        workers[i].loader = this;
+        workers[i].index  = i;
+    }
+    for (int i = 0; i < n; ++i)
+        threads.push_back(SDL_CreateThread(run, "scm-loader", &workers[i]));
+
+    scm_log("scm_loader constructor %d", n);
+}
+
+/// Command all workers to exit and await them.
+
+scm_loader::~scm_loader()
+{
+    scm_log("scm_loader destructor");
+
+    SDL_LockMutex(mutex);
+    running = false;
+    SDL_UnlockMutex(mutex);
+
+    int s = 0;
+
+    for (thread_i i = threads.begin(); i != threads.end(); ++i)
+        SDL_SemPost(tasks);
+    for (thread_i i = threads.begin(); i != threads.end(); ++i)
+        SDL_WaitThread(*i, &s);
+
+    SDL_DestroySemaphore(tasks);
+    SDL_DestroyCond(cond);
+    SDL_DestroyMutex(mutex);
+}
+
+//------------------------------------------------------------------------------
+
+/// Begin servicing the needs queue of the given file.
+
+void scm_loader::add_file(scm_file *file)
+{
+    SDL_LockMutex(mutex);
+    files[file] = 0;
+    SDL_UnlockMutex(mutex);
+}
+
+/// Cease servicing the given file. The file should already be deactivated so
+/// that its remaining tasks are returned unloaded. Block until its needs queue
+/// is empty and no worker holds it, cycling the given cache to ensure that any
+/// worker blocked on the cache's loads queue may proceed.
+
+void scm_loader::del_file(scm_file *file, scm_cache *cache)
+{
+    while (!wait(file))
+    {
+        post();
+        cache->update(0, true, -1.0);
+
+        SDL_LockMutex(mutex);
+        SDL_CondWaitTimeout(cond, mutex, 10);
+        SDL_UnlockMutex(mutex);
+    }
+}
+
+/// Notify the pool that a task has been added to some file's needs queue.
+
+void scm_loader::post()
+{
+    SDL_SemPost(tasks);
+}
+
+/// Run all n parts of the given job, using idle workers to run parts in
+/// parallel with the calling thread, and return when all parts are complete.
+/// The calling thread participates, so this completes even if no other
+/// worker is free.
+
+void scm_loader::parallel(scm_job *job, int n)
+{
+    batch b;
+
+    b.job   = job;
+    b.n     = n;
+    b.next  = 0;
+    b.users = 1;
+
+    SDL_LockMutex(mutex);
+    batches.push_back(&b);
+    SDL_UnlockMutex(mutex);
+
+    for (int i = 1; i < std::min(n, get_count()); ++i)
+        SDL_SemPost(tasks);
+
+    work(&b);
+
+    // Close the batch to further help and await the helpers.
+
+    SDL_LockMutex(mutex);
+    {
+        batches.erase(std::find(batches.begin(), batches.end(), &b));
+
+        while (b.users > 0)
+            SDL_CondWait(cond, mutex);
+    }
+    SDL_UnlockMutex(mutex);
+}
+
+//------------------------------------------------------------------------------
+
+// Run parts of the given batch until none remain unclaimed, then release it.
+// The caller must have counted itself among the batch's users.
+
+void scm_loader::work(batch *b)
+{
+    for (;;)
+    {
+        int k;
+
+        SDL_LockMutex(mutex);
+        k = (b->next < b->n) ? b->next++ : -1;
+        SDL_UnlockMutex(mutex);
+
+        if (k < 0)
+            break;
+
+        b->job->run(k);
+    }
+
+    SDL_LockMutex(mutex);
+    b->users--;
+    SDL_CondBroadcast(cond);
+    SDL_UnlockMutex(mutex);
+}
+
+// Help with any open batch. The mutex must be locked, and remains locked.
+
+void scm_loader::help()
+{
+    for (;;)
+    {
+        batch *b = 0;
+
+        for (size_t i = 0; i < batches.size() && b == 0; ++i)
+            if (batches[i]->next < batches[i]->n)
+                b = batches[i];
+
+        if (b == 0)
+            break;
+
+        b->users++;
+        SDL_UnlockMutex(mutex);
+        work(b);
+        SDL_LockMutex(mutex);
+    }
+}
+
+// If the given file is idle and drained, remove it and return true.
+
+bool scm_loader::wait(scm_file *file)
+{
+    bool done = false;
+
+    SDL_LockMutex(mutex);
+    {
+        std::map<scm_file *, int>::iterator i = files.find(file);
+
+        if (i == files.end())
+            done = true;
+        else if (i->second == 0 && file->needs.level() < 0)
+        {
+            files.erase(i);
+            done = true;
+        }
+    }
+    SDL_UnlockMutex(mutex);
+
+    return done;
+}
+
+// Select the file with the most urgent pending task and mark it busy. Return
+// null if no file has pending tasks. The mutex must be locked, but each file's
+// level is read from its queue's summary bits. @see scm_queue::level
+
+scm_file *scm_loader::pick()
+{
+    std::map<scm_file *, int>::iterator j = files.end();
+    int                                 m = 0;
+
+    for (std::map<scm_file *, int>::iterator i = files.begin();
+                                             i != files.end(); ++i)
+    {
+        int l = i->first->needs.level();
+
+        if (l >= 0 && (j == files.end() || l < m))
+        {
+            j = i;
+            m = l;
+        }
+    }
+
+    if (j != files.end())
+    {
+        j->second++;
+        return j->first;
+    }
+    return 0;
+}
+
+// Select an active file whose sampler has pending page requests and mark it
+// busy. Return null if there is none. The mutex must be locked.
+
+scm_file *scm_loader::pick_sample()
+{
+    for (std::map<scm_file *, int>::iterator i = files.begin();
+                                             i != files.end(); ++i)
+        if (i->first->sampler && i->first->is_active()
+                              && i->first->sampler->is_pending())
+        {
+            i->second++;
+            return i->first;
+        }
+
+    return 0;
+}
+
+/// Service page load requests
+///
+/// This function is the entry point for loader threads. Each wakeup corresponds
+/// to one task added to some file's needs queue, or to some part of a divided
+/// page. Help with any divided page first. Then take the most urgent task,
+/// load it, and return it to the file's cache. Tasks of deactivated files, and
+/// tasks gone stale while queued, are returned unloaded so that their buffers
+/// are recycled. Lacking any task, service a sample request, which carries a
+/// wakeup of its own. @see scm_cache::stale_frames @see scm_sample::service
+
+int scm_loader::run(void *data)
+{
+    worker     *w = (worker *) data;
+    scm_loader *L = w->loader;
+    scm_task    task;
+
+    scm_log("loader thread begin %d", w->index);
+    scm_trace::name("loader");
+
+    for (;;)
+    {
+        SDL_SemWait(L->tasks);
+        SDL_LockMutex(L->mutex);
+
+        if (!L->running)
+        {
+            SDL_UnlockMutex(L->mutex);
+            break;
+        }
+
+        L->help();
+
+        scm_file *file = L->pick();
+        scm_file *samp = file ? 0 : L->pick_sample();
+
+        SDL_UnlockMutex(L->mutex);
+
+        if (file)
+        {
+            // If another worker won the race, pass the wakeup along.
+
+            if (file->needs.try_remove(task))
+            {
+                scm_stats::add(scm_stats::need_depth, -1);
+
+                if (file->is_active() && !file->cache->is_stale(task.k))
+                {
+                    const Uint64 t0 = scm_stats::now();
+
+                    scm_trace::scope trace("load_page");
+
+                    if (!task.load_page(file, w->index))
+                        scm_stats::add(scm_stats::loader_fails);
+
+                    scm_stats::add(scm_stats::loader_pages);
+                    scm_stats::add(scm_stats::loader_time, t0);
+                }
+
+                file->cache->add_load(task);
+            }
+            else SDL_SemPost(L->tasks);
+
+            SDL_LockMutex(L->mutex);
+            L->files[file]--;
+            SDL_CondBroadcast(L->cond);
+            SDL_UnlockMutex(L->mutex);
+        }
+        else if (samp)
+        {
+            scm_trace::scope trace("sample_page");
+            samp->sampler->service(w->index);
+
+            SDL_LockMutex(L->mutex);
+            L->files[samp]--;
+            SDL_CondBroadcast(L->cond);
+            SDL_UnlockMutex(L->mutex);
+        }
+    }
+
+    scm_log("loader thread end %d", w->index);
+    return 0;
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,131 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#ifndef SCM_LOADER_HPP
+#define SCM_LOADER_HPP
+
+#include <vector>
+#include <map>
+
+#include <SDL.h>
+#include <SDL_thread.h>
+
+//------------------------------------------------------------------------------
+
+class scm_file;
+class scm_cache;
+
+typedef std::vector<SDL_Thread *>           thread_v;
+typedef std::vector<SDL_Thread *>::iterator thread_i;
+
+//------------------------------------------------------------------------------
+
+/// An scm_job is a unit of work divisible into independent parts, any number
+/// of which may be run concurrently by the workers of a loader pool.
+/// @see scm_loader::parallel
+
+class scm_job
+{
+public:
+    virtual ~scm_job() { }
+
+    /// Perform part k of this job.
+
+    virtual void run(int k) = 0;
+};
+
+//------------------------------------------------------------------------------
+
+/// An scm_loader is a pool of loader threads shared by all SCM files
+///
+/// Each scm_file feeds page load tasks into its own needs queue and notifies
+/// the pool. Any idle worker may take a task from any file, choosing the file
+/// whose most urgent page has the lowest level, so that the pool as a whole
+/// services the on-screen pages of all files in global priority order. Pages
+/// are normally read through the file's shared scm_reader. Where that fails,
+/// a worker opens its own TIFF handle on the file to load the page, and these
+/// handles are owned and closed by the file. The pool is owned by the
+/// scm_system and sized by scm_cache::cache_threads, or by the processor count
+/// by default.
+///
+/// Workers keep no deques of their own to steal from. The per-file needs
+/// queues serve that role: every worker draws from the same lock-free queues,
+/// so no work is ever stranded behind a busy worker, and a task is always the
+/// most urgent one available. Per-worker deques would instead order work by
+/// the worker that happened to receive it, defeating the global priority
+/// order. The pool's mutex guards only the choice of file and the busy
+/// counts, never the page tasks themselves. That choice is cheap, as each
+/// needs queue summarizes its non-empty levels in a bit mask, so the pool reads
+/// a word or two per file rather than scanning every level of every file.
+///
+/// A worker may also divide the work of a single page among the pool using
+/// parallel, as may the render thread for the sphere pre-pass. Idle workers
+/// help with such work before seeking new tasks. A worker finding no task
+/// services the page requests of a file's asynchronous sampler.
+///
+/// @see scm_file
+/// @see scm_sample
+/// @see scm_system
+
+class scm_loader
+{
+public:
+
+    scm_loader(int);
+   ~scm_loader();
+
+    void add_file(scm_file *);
+    void del_file(scm_file *, scm_cache *);
+
+    int  get_count() const { return int(threads.size()); }
+    void post();
+
+    void parallel(scm_job *, int);
+
+private:
+
+    struct worker
+    {
+        scm_loader *loader;
+        int         index;
+    };
+
+    struct batch
+    {
+        scm_job *job;
+        int      n;     // Part count
+        int      next;  // Next unclaimed part
+        int      users; // Workers helping
+    };
+
+    SDL_mutex  *mutex;
+    SDL_cond   *cond;
+    SDL_sem    *tasks;
+    bool        running;
+
+    thread_v                  threads;
+    std::vector<worker>       workers;
+    std::map<scm_file *, int> files;    // Files and their busy worker counts
+    std::vector<batch *>      batches;  // Divided jobs open for help
+
+    bool      wait(scm_file *);
+    scm_file *pick();
+    scm_file *pick_sample();
+    void      help();
+    void      work(batch *);
+
+    static int run(void *);
+};
+
+//------------------------------------------------------------------------------
+
+#endif
@@ -11,39 +11,56 @@
 // more details.
 
 #include <cstdarg>
+#include <cstdlib>
 #include <cstdio>
 
+#include "scm-queue.hpp"
+#include "scm-log.hpp"
+
+//------------------------------------------------------------------------------
+
+// Log lines are formatted by the caller and queued for writing by a sink
+// thread, so that threads logging in a hot path never contend for stderr.
+// The sink is started upon first use, and threads logging while it starts wait
+// for it. Lines logged while its queue is full are dropped and counted, rather
+// than written out of order, and the count is logged in their place. At exit,
+// the sink is stopped before the last lines are drained, and any lines logged
+// after that are written directly.
+
+struct scm_log_line
+{
+    char text[512];
+};
+
+static scm_ring<scm_log_line> *log_lines = 0;
+static SDL_sem                *log_sem   = 0;
+static SDL_Thread             *log_thread = 0;
+static SDL_atomic_t            log_state;   // 0 idle, 1 starting, 2 running,
+                                            // 3 stopped or failed
+static SDL_atomic_t            log_dropped; // Lines lost to a full queue
+
 //------------------------------------------------------------------------------
 
 #ifdef WIN32
 #include <Windows.h>
 
-void scm_log(const char *fmt, ...)
+static void log_write(const char *s)
 {
-    char err[1024];
-    char str[1024];
+    char str[600];
 
-    va_list  ap;
-    va_start(ap, fmt);
-    vsnprintf(err, 1024, fmt, ap);
-    va_end  (ap);
-
-    sprintf(str, "(SCM) %s\n", err);
+    _snprintf(str, 600, "(SCM) %s\n", s);
 
     OutputDebugStringA(str);
 }
 
 #else
 
-void scm_log(const char *fmt, ...)
+static void log_write(const char *s)
 {
     flockfile(stderr);
     {
-        va_list  ap;
-        va_start(ap, fmt);
-        vfprintf(stderr, fmt, ap);
-         fprintf(stderr, "\n");
-        va_end  (ap);
+        fputs(s, stderr);
+        fputs("\n", stderr);
     }
     funlockfile(stderr);
 }
@@ -52,6 +69,111 @@ void scm_log(const char *fmt, ...)
 
 //------------------------------------------------------------------------------
 
+// Write all queued lines, followed by the count of any lines dropped.
+
+static void log_drain()
+{
+    scm_log_line line;
+
+    while (log_lines->try_remove(line))
+        log_write(line.text);
+
+    if (int n = SDL_AtomicSet(&log_dropped, 0))
+    {
+        snprintf(line.text, sizeof (line.text), "scm_log dropped %d lines", n);
+        log_write(line.text);
+    }
+}
+
+// Write queued lines as they arrive, until stopped.
+
+static int log_sink(void *)
+{
+    do
+    {
+        SDL_SemWait(log_sem);
+        log_drain();
+    }
+    while (SDL_AtomicGet(&log_state) == 2);
+
+    return 0;
+}
+
+// Start the sink if it is idle, or await it if another thread is starting it.
+// Return true if it is running.
+
+static bool log_start()
+{
+    for (;;)
+    {
+        const int s = SDL_AtomicGet(&log_state);
+
+        if (s == 2)
+            return true;
+        if (s == 3)
+            return false;
+
+        if (s == 0 && SDL_AtomicCAS(&log_state, 0, 1))
+        {
+            log_lines = new scm_ring<scm_log_line>(256);
+            log_sem   = SDL_CreateSemaphore(0);
+
+            SDL_AtomicSet(&log_dropped, 0);
+
+            if ((log_thread = SDL_CreateThread(log_sink, "scm-log", 0)))
+            {
+                atexit(scm_log_flush);
+
+                SDL_MemoryBarrierRelease();
+                SDL_AtomicSet(&log_state, 2);
+                return true;
+            }
+            SDL_AtomicSet(&log_state, 3);
+            return false;
+        }
+        SDL_Delay(1);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+/// Format a message and queue it for the log.
+
+void scm_log(const char *fmt, ...)
+{
+    scm_log_line line;
+
+    va_list  ap;
+    va_start(ap, fmt);
+    vsnprintf(line.text, sizeof (line.text), fmt, ap);
+    va_end  (ap);
+
+    if (log_start())
+    {
+        if (log_lines->try_insert(line))
+            SDL_SemPost(log_sem);
+        else
+            SDL_AtomicIncRef(&log_dropped);
+    }
+    else log_write(line.text);
+}
+
+/// Stop the sink, then write all queued messages in the calling thread. Later
+/// messages are written directly. This is called at exit.
+
+void scm_log_flush()
+{
+    if (SDL_AtomicCAS(&log_state, 2, 3))
+    {
+        SDL_MemoryBarrierAcquire();
+        SDL_SemPost(log_sem);
+        SDL_WaitThread(log_thread, 0);
+        log_drain();
+    }
+}
+
+//------------------------------------------------------------------------------
+
 void tiff_error(const char *module, const char *fmt, va_list args)
 {
     char err[1024];
@@ -18,6 +18,7 @@
 //------------------------------------------------------------------------------
 
 void scm_log(const char *, ...);
+void scm_log_flush();
 
 void tiff_error  (const char *, const char *, va_list);
 void tiff_warning(const char *, const char *, va_list);
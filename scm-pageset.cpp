@@ -0,0 +1,108 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#include <algorithm>
+
+#include "scm-pageset.hpp"
+
+//------------------------------------------------------------------------------
+
+/// Create an empty set with room for at least n pages before growing.
+
+scm_pageset::scm_pageset(int n) : stamp(1)
+{
+    int m = 2;
+
+    while (m < 2 * n)
+        m <<= 1;
+
+    keys  .resize(m, 0);
+    stamps.resize(m, 0);
+    order .reserve(n);
+    mask = m - 1;
+}
+
+/// Add page i to the set. Return true if it was not already present.
+
+bool scm_pageset::insert(long long i)
+{
+    if (2 * (size() + 1) > int(keys.size()))
+        grow();
+
+    int k;
+
+    for (k = home(i); stamps[k] == stamp; k = (k + 1) & mask)
+        if (keys[k] == i)
+            return false;
+
+    keys  [k] = i;
+    stamps[k] = stamp;
+    order.push_back(i);
+
+    return true;
+}
+
+/// Remove all pages. Stamps are reset only when the stamp counter wraps.
+
+void scm_pageset::clear()
+{
+    order.clear();
+
+    if (++stamp == 0)
+    {
+        std::fill(stamps.begin(), stamps.end(), 0u);
+        stamp = 1;
+    }
+}
+
+/// Sort the iteration order by page index. As page indices increase with
+/// subdivision level, this gives breadth-first order.
+
+void scm_pageset::sort()
+{
+    std::sort(order.begin(), order.end());
+}
+
+/// Exchange the contents of this set with another.
+
+void scm_pageset::swap(scm_pageset& that)
+{
+    keys  .swap(that.keys);
+    stamps.swap(that.stamps);
+    order .swap(that.order);
+
+    std::swap(stamp, that.stamp);
+    std::swap(mask,  that.mask);
+}
+
+//------------------------------------------------------------------------------
+
+// Double the slot count and reinsert all pages in their existing order.
+
+void scm_pageset::grow()
+{
+    std::vector<long long> old;
+
+    old.swap(order);
+
+    keys  .assign(keys.size() * 2, 0);
+    stamps.assign(keys.size(),     0);
+    order .reserve(old.size() * 2);
+
+    stamp = 1;
+    mask  = int(keys.size()) - 1;
+
+    for (size_t j = 0; j < old.size(); ++j)
+        insert(old[j]);
+}
+
+//------------------------------------------------------------------------------
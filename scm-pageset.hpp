@@ -0,0 +1,78 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#ifndef SCM_PAGESET_HPP
+#define SCM_PAGESET_HPP
+
+#include <vector>
+
+//------------------------------------------------------------------------------
+
+/// An scm_pageset is a flat set of page indices, cleared in constant time
+///
+/// It holds the pages selected by one visibility pass of scm_sphere. Indices
+/// are stored in a power-of-two array searched by linear probing, alongside a
+/// list of the indices in order of insertion. A slot is occupied only if its
+/// stamp matches the current one, so clearing the set merely advances the
+/// stamp and empties the list, and storage persists from frame to frame.
+
+class scm_pageset
+{
+public:
+
+    scm_pageset(int n = 1024);
+
+    bool insert(long long);
+    void clear();
+    void sort();
+    void swap(scm_pageset&);
+
+    /// Return true if page i is in the set.
+
+    bool search(long long i) const {
+        for (int k = home(i); stamps[k] == stamp; k = (k + 1) & mask)
+            if (keys[k] == i)
+                return true;
+        return false;
+    }
+
+    int  size() const { return int(order.size()); }
+
+    /// @name Iteration, in order of insertion or as sorted
+    /// @{
+
+    typedef std::vector<long long>::const_iterator const_iterator;
+
+    const_iterator begin() const { return order.begin(); }
+    const_iterator   end() const { return order.end();   }
+
+    /// @}
+
+private:
+
+    std::vector<long long> keys;    // Slot keys
+    std::vector<unsigned>  stamps;  // Slot stamps
+    std::vector<long long> order;   // Keys in order of insertion
+    unsigned               stamp;   // Stamp of occupied slots
+    int                    mask;    // Slot count minus one
+
+    int  home(long long i) const {
+        unsigned long long h = (unsigned long long) i * 0x9E3779B97F4A7C15ULL;
+        return int((h ^ (h >> 29)) & (unsigned long long) mask);
+    }
+
+    void grow();
+};
+
+//------------------------------------------------------------------------------
+
+#endif
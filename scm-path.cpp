@@ -15,6 +15,7 @@
 #include <cassert>
 #include <sstream>
 
+#include "scm-source.hpp"
 #include "scm-log.hpp"
 #include "scm-path.hpp"
 
@@ -72,9 +73,9 @@ std::string scm_path::search(const std::string& file)
 {
     std::list<std::string>::iterator i;
 
-    // If the given file name is absolute, use it.
+    // If the given file name is absolute, use it. A URL is used as is.
 
-    if (exists(file))
+    if (exists(file) || scm_source::is_remote(file))
         return file;
 
     // Otherwise, search the SCM path for the file.
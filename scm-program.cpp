@@ -0,0 +1,437 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstdarg>
+#include <cstring>
+#include <cstdio>
+
+#include "scm-program.hpp"
+#include "scm-trace.hpp"
+#include "scm-util.hpp"
+#include "scm-log.hpp"
+
+#ifdef WIN32
+#define PATH_SEPARATOR '\\'
+#else
+#define PATH_SEPARATOR '/'
+#endif
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+//------------------------------------------------------------------------------
+
+/// The directory of the program binary cache, initially given by the SCMCACHE
+/// environment variable. If empty, every program is compiled from source.
+
+std::string scm_program::cache_path = scm_getenv("SCMCACHE");
+
+/// Compile programs on the driver's threads, where supported, and draw each
+/// scene only once its program is ready.
+
+bool scm_program::background = false;
+
+//------------------------------------------------------------------------------
+
+static std::string get_string(GLenum e)
+{
+    const GLubyte *s = glGetString(e);
+    return s ? std::string((const char *) s) : std::string();
+}
+
+// Create a shader of type t and begin compiling source s. Compilation may
+// continue in the background, so its status is not checked here.
+
+static GLuint compile(GLenum t, const std::string& s)
+{
+    const GLchar *p = s.c_str();
+    const GLint   n = GLint(s.size());
+
+    GLuint shader = glCreateShader(t);
+
+    glShaderSource (shader, 1, &p, &n);
+    glCompileShader(shader);
+
+    return shader;
+}
+
+// Log the info log of a shader, if it failed to compile.
+
+static void check_shader(GLuint shader, const char *type)
+{
+    GLint s = 0;
+    GLint n = 0;
+
+    glGetShaderiv(shader, GL_COMPILE_STATUS,  &s);
+    glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &n);
+
+    if (s == 0 && n > 1)
+    {
+        std::vector<GLchar> log(n);
+        glGetShaderInfoLog(shader, n, 0, &log.front());
+        scm_log("! scm_program %s shader: %s", type, &log.front());
+    }
+}
+
+//------------------------------------------------------------------------------
+
+/// Create a program with no sources.
+
+scm_program::scm_program() :
+    vert(0), frag(0), program(0), pending(0), ready(false)
+{
+}
+
+/// Delete the program and any compilation in progress.
+
+scm_program::~scm_program()
+{
+    clear();
+}
+
+/// Set the vertex and fragment shader sources. The previous program, and any
+/// compilation in progress, is deleted. The new program is built beginning at
+/// the next call to is_ready.
+
+void scm_program::set_source(const std::string& v, const std::string& f)
+{
+    clear();
+
+    vert_src = v;
+    frag_src = f;
+}
+
+/// Return true if the program is ready for use, building it first if it was
+/// not compiled in the background. A program lacking a source or failing to
+/// link is ready with a program object of zero.
+
+bool scm_program::is_ready()
+{
+    if (ready)
+        return true;
+
+    if (vert_src.empty() || frag_src.empty())
+        return (ready = true);
+
+    if (pending == 0)
+        start();
+
+    if (background && GLEW_KHR_parallel_shader_compile)
+    {
+        GLint d = 0;
+
+        glGetProgramiv(pending, GL_COMPLETION_STATUS_KHR, &d);
+
+        if (d == 0)
+            return false;
+    }
+
+    finish();
+    return true;
+}
+
+/// Return the location of the named uniform, or -1 if the program is not ready
+/// or the uniform is not active. The name is given in printf form.
+
+GLint scm_program::get_uniform(const char *fmt, ...) const
+{
+    char    s[256];
+    va_list a;
+
+    va_start(a, fmt);
+    vsnprintf(s, sizeof (s), fmt, a);
+    va_end(a);
+
+    uniform u;
+
+    u.name = s;
+
+    std::vector<uniform>::const_iterator i;
+
+    i = std::lower_bound(uniforms.begin(), uniforms.end(), u);
+
+    if (i != uniforms.end() && i->name == u.name)
+        return i->location;
+    else
+        return -1;
+}
+
+//------------------------------------------------------------------------------
+
+// Begin building the program, loading a cached binary if one exists and
+// otherwise compiling and linking the sources.
+
+void scm_program::start()
+{
+    static bool threads = false;
+
+    if (background && GLEW_KHR_parallel_shader_compile && !threads)
+    {
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+        threads = true;
+    }
+
+    if ((pending = load_binary()))
+        return;
+
+    scm_trace::scope trace("compile");
+
+    pending = glCreateProgram();
+    vert    = compile(GL_VERTEX_SHADER,   vert_src);
+    frag    = compile(GL_FRAGMENT_SHADER, frag_src);
+
+    glAttachShader(pending, vert);
+    glAttachShader(pending, frag);
+
+    if (GLEW_ARB_get_program_binary && !cache_path.empty())
+        glProgramParameteri(pending, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                                     GL_TRUE);
+    glLinkProgram(pending);
+}
+
+// Complete the build. Check the link status, store the binary of a program
+// compiled from source, and resolve the uniform table.
+
+void scm_program::finish()
+{
+    GLint s = 0;
+
+    glGetProgramiv(pending, GL_LINK_STATUS, &s);
+
+    if (s)
+    {
+        if (vert)
+            save_binary(pending);
+
+        init_table(pending);
+        program = pending;
+    }
+    else
+    {
+        GLint n = 0;
+
+        if (vert) check_shader(vert, "vertex");
+        if (frag) check_shader(frag, "fragment");
+
+        glGetProgramiv(pending, GL_INFO_LOG_LENGTH, &n);
+
+        if (n > 1)
+        {
+            std::vector<GLchar> log(n);
+            glGetProgramInfoLog(pending, n, 0, &log.front());
+            scm_log("! scm_program link: %s", &log.front());
+        }
+        glDeleteProgram(pending);
+    }
+
+    if (vert)
+    {
+        if (s) glDetachShader(pending, vert);
+        glDeleteShader(vert);
+    }
+    if (frag)
+    {
+        if (s) glDetachShader(pending, frag);
+        glDeleteShader(frag);
+    }
+
+    vert    = 0;
+    frag    = 0;
+    pending = 0;
+    ready   = true;
+}
+
+// Delete the program, any build in progress, and the uniform table.
+
+void scm_program::clear()
+{
+    if (vert)    glDeleteShader (vert);
+    if (frag)    glDeleteShader (frag);
+    if (pending) glDeleteProgram(pending);
+    if (program) glDeleteProgram(program);
+
+    vert    = 0;
+    frag    = 0;
+    pending = 0;
+    program = 0;
+    ready   = false;
+
+    uniforms.clear();
+}
+
+//------------------------------------------------------------------------------
+
+// Return the cache file name of the binary of this program, or the empty
+// string if binaries are not cached. The name hashes the sources along with
+// the vendor, renderer, and version strings of the driver, so that a driver
+// change invalidates every binary.
+
+std::string scm_program::binary_name() const
+{
+    if (!GLEW_ARB_get_program_binary || cache_path.empty())
+        return std::string();
+
+    std::string key = vert_src                 + '\n'
+                    + frag_src                 + '\n'
+                    + get_string(GL_VENDOR)    + '\n'
+                    + get_string(GL_RENDERER)  + '\n'
+                    + get_string(GL_VERSION);
+    char s[32];
+
+    sprintf(s, "%016llx.glsl", scm_hash(key));
+
+    return cache_path + PATH_SEPARATOR + s;
+}
+
+// Create a program from its cached binary. Return zero if there is none, or if
+// the driver rejects it.
+
+GLuint scm_program::load_binary()
+{
+    std::string name = binary_name();
+    GLuint      p    = 0;
+
+    if (name.empty())
+        return 0;
+
+    if (FILE *fp = fopen(name.c_str(), "rb"))
+    {
+        GLenum f = 0;
+        GLint  n = 0;
+
+        if (fread(&f, sizeof (GLenum), 1, fp) == 1 &&
+            fread(&n, sizeof (GLint),  1, fp) == 1 && n > 0)
+        {
+            std::vector<char> v(n);
+
+            if (fread(&v.front(), 1, size_t(n), fp) == size_t(n))
+            {
+                GLint s = 0;
+
+                p = glCreateProgram();
+
+                glProgramBinary(p, f, &v.front(), n);
+                glGetProgramiv (p, GL_LINK_STATUS, &s);
+
+                if (s == 0)
+                {
+                    scm_log("* scm_program binary rejected %s", name.c_str());
+                    glDeleteProgram(p);
+                    p = 0;
+                }
+            }
+        }
+        fclose(fp);
+    }
+    return p;
+}
+
+// Store the binary of a linked program in the cache, preceded by its format
+// and length. @see scm_atomic_write
+
+void scm_program::save_binary(GLuint p)
+{
+    const size_t h = sizeof (GLenum) + sizeof (GLint);
+
+    std::string name = binary_name();
+    GLint       n    = 0;
+
+    if (name.empty())
+        return;
+
+    glGetProgramiv(p, GL_PROGRAM_BINARY_LENGTH, &n);
+
+    if (n > 0)
+    {
+        std::vector<char> v(h + n);
+        GLenum            f = 0;
+        GLsizei           m = 0;
+
+        glGetProgramBinary(p, n, &m, &f, &v[h]);
+
+        if (m > 0)
+        {
+            GLint k = GLint(m);
+
+            memcpy(&v[0],                &f, sizeof (GLenum));
+            memcpy(&v[sizeof (GLenum)],  &k, sizeof (GLint));
+
+            scm_mkdir(cache_path);
+            scm_atomic_write(name, &v.front(), h + size_t(m));
+        }
+    }
+}
+
+// Resolve the location of every active uniform of program p. An array adds
+// an entry for each element, and one for its name alone. Uniforms of blocks
+// have no location and are omitted.
+
+void scm_program::init_table(GLuint p)
+{
+    GLint n = 0;
+    GLint m = 0;
+
+    glGetProgramiv(p, GL_ACTIVE_UNIFORMS,           &n);
+    glGetProgramiv(p, GL_ACTIVE_UNIFORM_MAX_LENGTH, &m);
+
+    std::vector<GLchar> s(m + 1);
+
+    uniforms.clear();
+
+    for (GLint i = 0; i < n; ++i)
+    {
+        GLsizei k = 0;
+        GLint   z = 0;
+        GLenum  t = 0;
+
+        glGetActiveUniform(p, GLuint(i), m + 1, &k, &z, &t, &s.front());
+
+        uniform u;
+
+        u.name     = std::string(&s.front(), k);
+        u.location = glGetUniformLocation(p, u.name.c_str());
+
+        if (u.location < 0)
+            continue;
+
+        const size_t l = u.name.size();
+
+        if (l > 3 && u.name.compare(l - 3, 3, "[0]") == 0)
+        {
+            const std::string base(u.name, 0, l - 3);
+
+            u.name = base;
+            uniforms.push_back(u);
+
+            for (GLint j = 0; j < z; ++j)
+            {
+                char e[16];
+
+                sprintf(e, "[%d]", j);
+
+                u.name     = base + e;
+                u.location = glGetUniformLocation(p, u.name.c_str());
+
+                if (u.location >= 0)
+                    uniforms.push_back(u);
+            }
+        }
+        else uniforms.push_back(u);
+    }
+
+    std::sort(uniforms.begin(), uniforms.end());
+}
+
+//------------------------------------------------------------------------------
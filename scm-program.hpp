@@ -0,0 +1,94 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#ifndef SCM_PROGRAM_HPP
+#define SCM_PROGRAM_HPP
+
+#include <vector>
+#include <string>
+
+#include <GL/glew.h>
+
+//------------------------------------------------------------------------------
+
+/// An scm_program is a GLSL program built from vertex and fragment sources
+///
+/// The program is built upon first use rather than as each source is given,
+/// so a scene given both sources compiles once. If cache_path names a
+/// directory and ARB_get_program_binary is supported, each linked program
+/// is stored there as a binary under a hash of its sources and the driver
+/// strings, and later builds load that binary instead of compiling. If
+/// background is set and KHR_parallel_shader_compile is supported, compilation
+/// begins at the first call to is_ready and proceeds on the driver's threads,
+/// and the program is not ready until it completes, so sources may be replaced
+/// one at a time without starting a build for each. Otherwise the program is
+/// built synchronously by the first call to is_ready.
+///
+/// Once linked, the location of every active uniform, including each element
+/// of each array, is resolved into a table sorted by name, so that uniform
+/// queries require no round trip to the driver.
+
+class scm_program
+{
+public:
+
+    static std::string cache_path;
+    static bool        background;
+
+    scm_program();
+   ~scm_program();
+
+    void   set_source(const std::string&, const std::string&);
+
+    bool   is_ready();
+    GLuint get_program() const { return program; }
+    GLint  get_uniform(const char *, ...) const;
+
+private:
+
+    // An active uniform location.
+
+    struct uniform
+    {
+        std::string name;
+        GLint       location;
+
+        bool operator<(const uniform& that) const {
+            return name < that.name;
+        }
+    };
+
+    std::string vert_src;
+    std::string frag_src;
+
+    GLuint vert;                    // Vertex shader, while compiling
+    GLuint frag;                    // Fragment shader, while compiling
+    GLuint program;                 // Program object, once ready
+    GLuint pending;                 // Program object, while compiling
+    bool   ready;
+
+    std::vector<uniform> uniforms;  // Uniform table, sorted by name
+
+    void   start();
+    void   finish();
+    void   clear();
+
+    GLuint load_binary();
+    void   save_binary(GLuint);
+    void   init_table (GLuint);
+
+    std::string binary_name() const;
+};
+
+//------------------------------------------------------------------------------
+
+#endif
@@ -16,13 +16,162 @@
 #include <SDL.h>
 #include <SDL_thread.h>
 
-#include <set>
+#include "scm-index.hpp"
+
+//------------------------------------------------------------------------------
+
+/// An scm_ring implements a templated, bounded, lock-free FIFO
+///
+/// Any number of threads may insert and remove concurrently. Each slot carries
+/// a sequence number that tells producers and consumers whether the slot is
+/// free, full, or still in flight, so that a single compare-and-swap on the
+/// head or tail claims it. All storage is allocated up front. The capacity is
+/// rounded up to a power of two.
+
+template <typename T> class scm_ring
+{
+public:
+
+    scm_ring(int n);
+   ~scm_ring();
+
+    bool try_insert(const T&);
+    bool try_remove(T&);
+
+    bool empty();
+
+private:
+
+    struct cell
+    {
+        SDL_atomic_t seq;
+        T            data;
+    };
+
+    cell        *cells;
+    int          mask;
+    SDL_atomic_t head;
+    SDL_atomic_t tail;
+};
+
+//------------------------------------------------------------------------------
+
+/// Create a new ring with at least n slots, each marked free for its position.
+
+template <typename T> scm_ring<T>::scm_ring(int n)
+{
+    int m = 1;
+
+    while (m < n)
+        m <<= 1;
+
+    cells = new cell[m];
+    mask  = m - 1;
+
+    for (int k = 0; k < m; k++)
+        SDL_AtomicSet(&cells[k].seq, k);
+
+    SDL_AtomicSet(&head, 0);
+    SDL_AtomicSet(&tail, 0);
+}
+
+/// Finalize a ring and release its storage.
+
+template <typename T> scm_ring<T>::~scm_ring()
+{
+    delete [] cells;
+}
+
+//------------------------------------------------------------------------------
+
+/// Non-blocking enqueue. Return false if the ring is full, or if its next cell
+/// is still being removed by a consumer a lap behind.
+
+template <typename T> bool scm_ring<T>::try_insert(const T& d)
+{
+    unsigned int pos = (unsigned int) SDL_AtomicGet(&tail);
+    cell        *c;
+
+    for (;;)
+    {
+        c = cells + (pos & mask);
+
+        int dif = (int) ((unsigned int) SDL_AtomicGet(&c->seq) - pos);
+
+        if (dif == 0)
+        {
+            if (SDL_AtomicCAS(&tail, (int) pos, (int) (pos + 1)))
+                break;
+        }
+        else if (dif < 0)
+            return false;
+
+        pos = (unsigned int) SDL_AtomicGet(&tail);
+    }
+
+    c->data = d;
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&c->seq, (int) (pos + 1));
+    return true;
+}
+
+/// Non-blocking dequeue. Return false if the ring is empty.
+
+template <typename T> bool scm_ring<T>::try_remove(T& d)
+{
+    unsigned int pos = (unsigned int) SDL_AtomicGet(&head);
+    cell        *c;
+
+    for (;;)
+    {
+        c = cells + (pos & mask);
+
+        int dif = (int) ((unsigned int) SDL_AtomicGet(&c->seq) - (pos + 1));
+
+        if (dif == 0)
+        {
+            if (SDL_AtomicCAS(&head, (int) pos, (int) (pos + 1)))
+                break;
+        }
+        else if (dif < 0)
+            return false;
+
+        pos = (unsigned int) SDL_AtomicGet(&head);
+    }
+
+    SDL_MemoryBarrierAcquire();
+    d = c->data;
+    SDL_AtomicSet(&c->seq, (int) (pos + mask + 1));
+    return true;
+}
+
+/// Return true if the ring appears empty. This is a snapshot only.
+
+template <typename T> bool scm_ring<T>::empty()
+{
+    return (SDL_AtomicGet(&head) == SDL_AtomicGet(&tail));
+}
 
 //------------------------------------------------------------------------------
 
 /// An scm_queue implements a templated producer-consumer priority queue.
 ///
-/// Priority is given by the partial ordering on the templated type.
+/// Priority is given by the page level of the templated scm_item, with lower
+/// levels served first. This matches the ordering of scm_item::operator<
+/// between levels, as page indices increase monotonically with level. Items
+/// flagged as prefetched are served after all others, again by level. Within
+/// a level the order is relaxed: items are served in the order inserted, not
+/// by page index, as all pages of one level are of equal urgency. This order
+/// is verified by etc/scm-micro. Each level is an allocation-free scm_ring
+/// sized for the full queue, so the only synchronization on the data itself
+/// is a single atomic compare-and-swap. Counting semaphores remain only to
+/// support the blocking operations and to bound the total size.
+///
+/// A consumer that has claimed an item may find none visible for a moment, as
+/// when the item's producer is preempted mid-insert. Likewise a producer may
+/// find its ring cell still held by a consumer preempted mid-remove. Either
+/// then sleeps on a wake semaphore, posted only while some thread waits,
+/// rather than spin.
 ///
 /// A "needs" queue is used by the render thread to delegate work to a set of
 /// loader threads. A "loads" queue is used by the loader threads to return
@@ -46,49 +195,213 @@ public:
     void insert(T);
     T    remove( );
 
+    int  level();
+
 private:
 
-    SDL_sem   *full_slots;
-    SDL_sem   *free_slots;
-    SDL_mutex *data_mutex;
+    static const int depth  = 32;
+    static const int levels = 2 * depth;
+
+    static int bucket(const T&);
+
+    void put(T&);
+    void get(T&);
 
-    std::set<T> S;
+    bool find(T&);
+    void notify();
+    void mark(int);
+    bool clear(int);
+
+    SDL_sem     *full_slots;
+    SDL_sem     *free_slots;
+    SDL_sem     *wake;
+    SDL_atomic_t waiting;
+    SDL_atomic_t used[levels / 32];     // Bits of levels last seen non-empty
+
+    scm_ring<T> *R[levels];
 };
 
 //------------------------------------------------------------------------------
 
 /// Create a new queue with n slots. Initialize counting semaphores for full
-/// slots and empty slots, plus a mutex to protect the data.
+/// slots and empty slots, plus a ring of n slots for each page level.
 
 template <typename T> scm_queue<T>::scm_queue(int n)
 {
     full_slots = SDL_CreateSemaphore(0);
     free_slots = SDL_CreateSemaphore(n);
-    data_mutex = SDL_CreateMutex();
+    wake       = SDL_CreateSemaphore(0);
+
+    SDL_AtomicSet(&waiting, 0);
+
+    for (int w = 0; w < levels / 32; w++)
+        SDL_AtomicSet(used + w, 0);
+
+    for (int l = 0; l < levels; l++)
+        R[l] = new scm_ring<T>(n);
 }
 
-/// Finalize a queue and release its mutex and semaphores.
+/// Finalize a queue and release its rings and semaphores.
 
 template <typename T> scm_queue<T>::~scm_queue()
 {
-    SDL_DestroyMutex    (data_mutex);
+    for (int l = 0; l < levels; l++)
+        delete R[l];
+
+    SDL_DestroySemaphore(wake);
     SDL_DestroySemaphore(free_slots);
     SDL_DestroySemaphore(full_slots);
 }
 
 //------------------------------------------------------------------------------
 
+/// Determine the priority level of an item. Invalid items are given the
+/// highest priority. Prefetched items fall in the lower half of the levels.
+
+template <typename T> int scm_queue<T>::bucket(const T& d)
+{
+    if (d.i < 0)
+        return 0;
+    else
+    {
+        long long l = scm_page_level(d.i);
+        int       k = (l < depth) ? int(l) : depth - 1;
+        return d.a ? depth + k : k;
+    }
+}
+
+/// Store an item in its level. A free slot has already been claimed, but the
+/// ring cell may still be held by a consumer a lap behind, preempted in the
+/// middle of its remove. Until the cell is released, sleep.
+
+template <typename T> void scm_queue<T>::put(T& d)
+{
+    const int    l = bucket(d);
+    scm_ring<T> *r = R[l];
+
+    if (!r->try_insert(d))
+    {
+        SDL_AtomicIncRef(&waiting);
+
+        while (!r->try_insert(d))
+            SDL_SemWait(wake);
+
+        SDL_AtomicAdd(&waiting, -1);
+    }
+    mark(l);
+    notify();
+}
+
+/// Take the highest-priority item. A full slot has already been claimed, so
+/// an item is or will shortly be visible in some level. Until it is, sleep.
+
+template <typename T> void scm_queue<T>::get(T& d)
+{
+    if (!find(d))
+    {
+        SDL_AtomicIncRef(&waiting);
+
+        while (!find(d))
+            SDL_SemWait(wake);
+
+        SDL_AtomicAdd(&waiting, -1);
+    }
+    notify();
+}
+
+/// Take the highest-priority visible item, returning false if none is visible.
+
+template <typename T> bool scm_queue<T>::find(T& d)
+{
+    for (int l = 0; l < levels; l++)
+        if (R[l]->try_remove(d))
+        {
+            if (R[l]->empty())
+                clear(l);
+            return true;
+        }
+
+    return false;
+}
+
+/// Wake a sleeping producer or consumer after a completed insert or remove. A
+/// waiter is counted before it tries again, so each completed operation either
+/// finishes in time to be seen or sees the waiter. The woken thread notifies in
+/// turn, passing the wakeup along when one operation unblocks several.
+
+template <typename T> void scm_queue<T>::notify()
+{
+    if (SDL_AtomicGet(&waiting))
+        SDL_SemPost(wake);
+}
+
+/// Set the bit of level l in the summary of non-empty levels.
+
+template <typename T> void scm_queue<T>::mark(int l)
+{
+    SDL_atomic_t *w = used + l / 32;
+    unsigned int  b = 1u << (l % 32);
+    int           o;
+
+    do
+        o = SDL_AtomicGet(w);
+    while (!(o & b) && !SDL_AtomicCAS(w, o, int(o | b)));
+}
+
+/// Clear the bit of level l, then set it again if the level is not empty after
+/// all. A producer marks only after its insert completes, so a bit is never
+/// left clear behind a concurrent insert. Return true if the level remains.
+
+template <typename T> bool scm_queue<T>::clear(int l)
+{
+    SDL_atomic_t *w = used + l / 32;
+    unsigned int  b = 1u << (l % 32);
+    int           o;
+
+    do
+        o = SDL_AtomicGet(w);
+    while ((o & b) && !SDL_AtomicCAS(w, o, int(o & ~b)));
+
+    if (R[l]->empty())
+        return false;
+
+    mark(l);
+    return true;
+}
+
+/// Return the level of the most urgent item in the queue, or -1 if the queue is
+/// empty. This is a snapshot only, for use in scheduling among queues. It is
+/// read from the summary bits, inspecting the rings only to refute a stale bit,
+/// so that a scheduler may poll many queues cheaply.
+
+template <typename T> int scm_queue<T>::level()
+{
+    for (int w = 0; w < levels / 32; w++)
+    {
+        unsigned int m = (unsigned int) SDL_AtomicGet(used + w);
+
+        while (m)
+        {
+            const int l = 32 * w + int(log2((long long) (m & (~m + 1))));
+
+            if (!R[l]->empty() || clear(l))
+                return l;
+
+            m &= m - 1;
+        }
+    }
+    return -1;
+}
+
+//------------------------------------------------------------------------------
+
 /// Non-blocking enqueue for use by the render thread.
 
 template <typename T> bool scm_queue<T>::try_insert(T& d)
 {
     if (SDL_SemTryWait(free_slots) == 0)
     {
-        SDL_LockMutex(data_mutex);
-        {
-            S.insert(d);
-        }
-        SDL_UnlockMutex(data_mutex);
+        put(d);
         SDL_SemPost(full_slots);
         return true;
     }
@@ -101,12 +414,7 @@ template <typename T> bool scm_queue<T>::try_remove(T& d)
 {
     if (SDL_SemTryWait(full_slots) == 0)
     {
-        SDL_LockMutex(data_mutex);
-        {
-            d   = *(S.begin());
-            S.erase(S.begin());
-        }
-        SDL_UnlockMutex(data_mutex);
+        get(d);
         SDL_SemPost(free_slots);
         return true;
     }
@@ -120,11 +428,7 @@ template <typename T> bool scm_queue<T>::try_remove(T& d)
 template <typename T> void scm_queue<T>::insert(T d)
 {
     SDL_SemWait(free_slots);
-    SDL_LockMutex(data_mutex);
-    {
-        S.insert(d);
-    }
-    SDL_UnlockMutex(data_mutex);
+    put(d);
     SDL_SemPost(full_slots);
 }
 
@@ -135,12 +439,7 @@ template <typename T> T scm_queue<T>::remove()
     T d;
 
     SDL_SemWait(full_slots);
-    SDL_LockMutex(data_mutex);
-    {
-        d   = *(S.begin());
-        S.erase(S.begin());
-    }
-    SDL_UnlockMutex(data_mutex);
+    get(d);
     SDL_SemPost(free_slots);
 
     return d;
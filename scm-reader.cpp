@@ -0,0 +1,826 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <zlib.h>
+
+#ifdef WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "scm-reader.hpp"
+#include "scm-trace.hpp"
+#include "scm-log.hpp"
+
+//------------------------------------------------------------------------------
+
+/// The smallest page in bytes whose strips are decoded in parallel.
+
+size_t scm_reader::parallel_size = 256 * 1024;
+
+//------------------------------------------------------------------------------
+
+/// Open the named TIFF file and determine its byte order and offset size. If
+/// its first page is uncompressed, assume that all pages are and map the
+/// whole file into memory.
+
+scm_reader::scm_reader(const std::string& path) :
+    source(0), fd(-1), big(false), swap(false), data(0), size(0), length(0),
+#ifdef WIN32
+    mapping(0),
+#endif
+    mutex(SDL_CreateMutex())
+{
+#ifdef WIN32
+    fd = _open(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+    fd = open(path.c_str(), O_RDONLY);
+#endif
+
+    init();
+
+    scm_log("scm_reader constructor %s %s%s", path.c_str(),
+            fd < 0 ? "failed" : (big ? "BigTIFF" : "TIFF"),
+            data   ? " mapped" : "");
+}
+
+/// Open a remote file for reading through the given source.
+
+scm_reader::scm_reader(scm_source *S) :
+    source(S), fd(-1), big(false), swap(false), data(0), size(0), length(0),
+#ifdef WIN32
+    mapping(0),
+#endif
+    mutex(SDL_CreateMutex())
+{
+    if (source && !source->is_open())
+        source = 0;
+
+    init();
+
+    scm_log("scm_reader constructor %s", source ? (big ? "BigTIFF" : "TIFF")
+                                                : "failed");
+}
+
+// Determine the byte order and format of the open file. Close it if it is not
+// a TIFF. Map a local file if its first page is uncompressed.
+
+void scm_reader::init()
+{
+    if (is_open())
+    {
+        length = get_length();
+
+        const uint16 one = 1;
+        const bool   le  = (*((const uint8 *) &one) == 1);
+
+        uint8 head[16];
+        bool  ok = false;
+
+        if (read(0, 8, head) && head[0] == head[1]
+                             && (head[0] == 'I' || head[0] == 'M'))
+        {
+            swap = ((head[0] == 'I') != le);
+
+            if      (get16(head + 2) == 42) { big = false; ok = true; }
+            else if (get16(head + 2) == 43) { big = true;  ok = true; }
+        }
+        if (!ok)
+        {
+            if (fd >= 0) close(fd);
+            fd     = -1;
+            source =  0;
+        }
+
+        // Map the file if its first page is uncompressed.
+
+        if (fd >= 0 && read(0, big ? 16 : 8, head))
+        {
+            const uint64 o = big ? get64(head + 8) : get32(head + 4);
+
+            if (page *P = get_page(o))
+                if (P->z == COMPRESSION_NONE)
+                    map_file();
+        }
+    }
+}
+
+/// Close the file and release all page records.
+
+scm_reader::~scm_reader()
+{
+    for (page_i i = pages.begin(); i != pages.end(); ++i)
+        delete i->second;
+
+#ifdef WIN32
+    if (data)    UnmapViewOfFile(data);
+    if (mapping) CloseHandle(mapping);
+#else
+    if (data)    munmap(data, size_t(size));
+#endif
+    if (fd >= 0) close(fd);
+
+    SDL_DestroyMutex(mutex);
+}
+
+//------------------------------------------------------------------------------
+
+/// Return a pointer to the data of the page with the IFD at offset o within
+/// the file mapping, confirming that its format matches the expected width w,
+/// height h, channel count c, and bit depth b. The data remains valid for the
+/// life of the reader. Return null if the file is not mapped, if the page is
+/// not stored uncompressed, contiguous, and in host byte order, or if the
+/// page extends beyond the end of the mapping, as in a truncated file. The
+/// caller should then read the page, which fails safely in the latter case.
+
+const void *scm_reader::get_data(uint64 o, int w, int h, int c, int b)
+{
+    if (data)
+        if (page *P = get_page(o))
+        {
+            const uint64 z = uint64(h) * uint64(w) * uint64(c) * uint64(b) / 8;
+
+            if (P->m && int(P->w) == w && int(P->h) == h
+                     && int(P->c) == c && int(P->b) == b
+                     && P->m <= size && z <= size - P->m)
+                return data + P->m;
+        }
+    return 0;
+}
+
+// An scm_reader::strips job decodes the strips of one page, each part of the
+// job decoding a contiguous range of strips.
+
+class scm_reader::strips : public scm_job
+{
+public:
+
+    strips(const scm_reader *R, const page *P, uint8 *p, int m)
+        : m(m), R(R), P(P), p(p), ok(m, 1) { }
+
+    void run(int k)
+    {
+        const size_t N = (P->h + P->r - 1) / P->r;
+
+        for (size_t l = N * k / m; l < N * (k + 1) / m; ++l)
+            if (!R->read_strip(P, l, p))
+                ok[k] = 0;
+    }
+
+    bool is_ok() const
+    {
+        return (std::find(ok.begin(), ok.end(), 0) == ok.end());
+    }
+
+    const int m;
+
+private:
+
+    const scm_reader *R;
+    const page       *P;
+    uint8            *p;
+    std::vector<char> ok;
+};
+
+/// Load the page with the IFD at file offset o into buffer p, confirming that
+/// its format matches the expected width w, height h, channel count c, and
+/// bit depth b. Return false if the page cannot be read or decoded here. If a
+/// loader pool is given, divide a large compressed page's strips among it.
+
+bool scm_reader::read_page(uint64 o, int w, int h, int c, int b, void *p,
+                                                           scm_loader *L)
+{
+    if (page *P = get_page(o))
+    {
+        if (int(P->w) == w && int(P->h) == h
+                           && int(P->c) == c && int(P->b) == b)
+        {
+            const size_t N = (P->h + P->r - 1) / P->r;
+            const size_t Z = size_t(h) * size_t(w) * size_t(c) * size_t(b) / 8;
+
+            if (L && L->get_count() > 1 && N > 1 && Z >= parallel_size
+                                        && P->z != COMPRESSION_NONE)
+            {
+                strips J(this, P, (uint8 *) p,
+                         int(std::min(N, size_t(4 * L->get_count()))));
+
+                L->parallel(&J, J.m);
+
+                return J.is_ok();
+            }
+            else
+            {
+                for (size_t l = 0; l < N; ++l)
+                    if (!read_strip(P, l, (uint8 *) p))
+                        return false;
+
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+//------------------------------------------------------------------------------
+
+// Read and decode strip l of page P into its place in page buffer p.
+
+bool scm_reader::read_strip(const page *P, size_t l, uint8 *p) const
+{
+    const size_t S = size_t(P->r) * P->w * P->c * P->b / 8;
+    const size_t Z = size_t(P->h) * P->w * P->c * P->b / 8;
+    const size_t s = std::min(S, Z - std::min(Z, l * S));
+    const size_t n = size_t(P->n[l]);
+
+    if (P->z == COMPRESSION_NONE)
+    {
+        scm_trace::scope trace("read");
+
+        if (n < s || !read(P->o[l], s, p + l * S))
+            return false;
+
+        finish(P, p + l * S, s);
+        return true;
+    }
+    else
+    {
+        std::vector<uint8> data(n);
+        bool               done;
+        {
+            scm_trace::scope trace("read");
+            done = (n > 0 && read(P->o[l], n, &data.front()));
+        }
+        if (!done)
+            return false;
+
+        scm_trace::scope trace("decode");
+
+        return decode(P, &data.front(), n, p + l * S, s);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// Read n bytes at file offset o into buffer p, returning success. Positioned
+// reads leave no file position state, so this is safe to call concurrently.
+
+bool scm_reader::read(uint64 o, size_t n, void *p) const
+{
+    if (source)
+        return source->read(o, n, p);
+
+    if (data)
+    {
+        if (o <= size && uint64(n) <= size - o)
+        {
+            memcpy(p, data + o, n);
+            return true;
+        }
+        return false;
+    }
+
+#ifdef WIN32
+    HANDLE     h = (HANDLE) _get_osfhandle(fd);
+    OVERLAPPED v;
+    DWORD      r = 0;
+
+    memset(&v, 0, sizeof (OVERLAPPED));
+
+    v.Offset     = DWORD(o);
+    v.OffsetHigh = DWORD(o >> 32);
+
+    return (ReadFile(h, p, DWORD(n), &r, &v) && size_t(r) == n);
+#else
+    uint8 *d = (uint8 *) p;
+
+    while (n > 0)
+    {
+        ssize_t r = pread(fd, d, n, off_t(o));
+
+        if (r <= 0)
+            return false;
+
+        d += r;
+        o += r;
+        n -= r;
+    }
+    return true;
+#endif
+}
+
+// Return true if n values of s bytes each, beginning at offset o, lie within
+// the file. Counts read from the file are checked thus before any allocation
+// is sized by them, so that a corrupt count fails cleanly.
+
+bool scm_reader::within(uint64 o, uint64 n, size_t s) const
+{
+    return (o <= length && n <= (length - o) / s);
+}
+
+// Return the length of the open file, or zero if it cannot be determined.
+
+uint64 scm_reader::get_length() const
+{
+    if (source)
+        return source->get_size();
+
+#ifdef WIN32
+    LARGE_INTEGER z;
+
+    if (GetFileSizeEx((HANDLE) _get_osfhandle(fd), &z) && z.QuadPart > 0)
+        return uint64(z.QuadPart);
+#else
+    struct stat st;
+
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        return uint64(st.st_size);
+#endif
+    return 0;
+}
+
+// Map the whole file into memory, leaving data null on failure.
+
+void scm_reader::map_file()
+{
+#ifdef WIN32
+    HANDLE        h = (HANDLE) _get_osfhandle(fd);
+    LARGE_INTEGER z;
+
+    if (GetFileSizeEx(h, &z) && z.QuadPart > 0)
+    {
+        if ((mapping = CreateFileMapping(h, 0, PAGE_READONLY, 0, 0, 0)))
+        {
+            if ((data = (uint8 *) MapViewOfFile(mapping, FILE_MAP_READ,
+                                                           0, 0, 0)))
+                size = uint64(z.QuadPart);
+            else
+            {
+                CloseHandle(mapping);
+                mapping = 0;
+            }
+        }
+    }
+#else
+    struct stat st;
+
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        void *p = mmap(0, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+
+        if (p != MAP_FAILED)
+        {
+            data = (uint8 *) p;
+            size = uint64(st.st_size);
+        }
+    }
+#endif
+}
+
+// Decode integers in the byte order of the file.
+
+uint16 scm_reader::get16(const uint8 *p) const
+{
+    uint16 v;
+    memcpy(&v, p, 2);
+    return swap ? uint16((v >> 8) | (v << 8)) : v;
+}
+
+uint32 scm_reader::get32(const uint8 *p) const
+{
+    uint32 v;
+    memcpy(&v, p, 4);
+    return swap ? ((v >> 24) | ((v >> 8) & 0xFF00) | ((v << 8) & 0xFF0000)
+                             | (v << 24)) : v;
+}
+
+uint64 scm_reader::get64(const uint8 *p) const
+{
+    uint64 v;
+    memcpy(&v, p, 8);
+    return swap ? ((uint64(get32(p)) << 32) | uint64(get32(p + 4))) : v;
+}
+
+// Read all values of IFD entry e as integers, whether they are stored in the
+// entry itself or elsewhere in the file.
+
+bool scm_reader::get_values(const uint8 *e, std::vector<uint64>& v) const
+{
+    const uint16 t = get16(e + 2);
+    const uint64 n = big ? get64(e + 4) : get32(e + 4);
+    const size_t f = big ? 8 : 4;
+
+    size_t s;
+
+    switch (t)
+    {
+    case  1: s = 1; break;
+    case  3: s = 2; break;
+    case  4: s = 4; break;
+    case 13: s = 4; break;
+    case 16: s = 8; break;
+    case 18: s = 8; break;
+    default: return false;
+    }
+
+    const uint64 o = big ? get64(e + 12) : get32(e + 8);
+
+    if (n == 0 || (n > f / s && !within(o, n, s)))
+        return false;
+
+    std::vector<uint8> data(size_t(n) * s);
+
+    if (data.size() <= f)
+        memcpy(&data.front(), e + (big ? 12 : 8), data.size());
+    else if (!read(o, data.size(), &data.front()))
+        return false;
+
+    v.resize(size_t(n));
+
+    for (size_t i = 0; i < v.size(); ++i)
+        switch (s)
+        {
+        case 1: v[i] =       data[i];          break;
+        case 2: v[i] = get16(&data[i * 2]);    break;
+        case 4: v[i] = get32(&data[i * 4]);    break;
+        case 8: v[i] = get64(&data[i * 8]);    break;
+        }
+
+    return true;
+}
+
+// Return the record of the page with the IFD at offset o, parsing the IFD on
+// first use. Return null if the page cannot be read by this reader.
+
+scm_reader::page *scm_reader::get_page(uint64 o)
+{
+    page *P = 0;
+
+    SDL_LockMutex(mutex);
+    {
+        page_i i = pages.find(o);
+
+        if (i != pages.end())
+        {
+            SDL_UnlockMutex(mutex);
+            return i->second;
+        }
+    }
+    SDL_UnlockMutex(mutex);
+
+    // Parse the IFD outside of the lock. Racing parsers yield equal records.
+
+    if (is_open())
+        P = new_page(o);
+
+    SDL_LockMutex(mutex);
+    {
+        page_i i = pages.find(o);
+
+        if (i == pages.end())
+            pages[o] = P;
+        else
+        {
+            delete P;
+            P = i->second;
+        }
+    }
+    SDL_UnlockMutex(mutex);
+
+    return P;
+}
+
+// Parse the IFD at offset o and return a new page record, or null if the IFD
+// describes a format not supported here.
+
+scm_reader::page *scm_reader::new_page(uint64 o) const
+{
+    const size_t k = big ? 20 : 12;
+
+    uint8  head[8];
+    uint64 n;
+
+    if (!read(o, big ? 8 : 2, head))
+        return 0;
+
+    n = big ? get64(head) : get16(head);
+
+    if (n == 0 || !within(o + (big ? 8 : 2), n, k))
+        return 0;
+
+    std::vector<uint8> data(size_t(n) * k);
+
+    if (!read(o + (big ? 8 : 2), data.size(), &data.front()))
+        return 0;
+
+    page *P = new page;
+
+    P->w = 0;
+    P->h = 0;
+    P->c = 1;
+    P->b = 1;
+    P->z = COMPRESSION_NONE;
+    P->d = PREDICTOR_NONE;
+    P->r = uint32(-1);
+    P->m = 0;
+
+    bool ok = true;
+
+    for (uint64 j = 0; ok && j < n; ++j)
+    {
+        const uint8 *e = &data[size_t(j) * k];
+
+        std::vector<uint64> v;
+
+        const uint16 t = get16(e);
+
+        switch (t)
+        {
+        case TIFFTAG_STRIPOFFSETS:    ok = get_values(e, P->o); break;
+        case TIFFTAG_STRIPBYTECOUNTS: ok = get_values(e, P->n); break;
+
+        case TIFFTAG_IMAGEWIDTH:
+        case TIFFTAG_IMAGELENGTH:
+        case TIFFTAG_BITSPERSAMPLE:
+        case TIFFTAG_SAMPLESPERPIXEL:
+        case TIFFTAG_COMPRESSION:
+        case TIFFTAG_PREDICTOR:
+        case TIFFTAG_ROWSPERSTRIP:
+        case TIFFTAG_PLANARCONFIG:
+
+            if ((ok = get_values(e, v)))
+                switch (t)
+                {
+                case TIFFTAG_IMAGEWIDTH:      P->w = uint32(v[0]); break;
+                case TIFFTAG_IMAGELENGTH:     P->h = uint32(v[0]); break;
+                case TIFFTAG_BITSPERSAMPLE:   P->b = uint16(v[0]); break;
+                case TIFFTAG_SAMPLESPERPIXEL: P->c = uint16(v[0]); break;
+                case TIFFTAG_COMPRESSION:     P->z = uint16(v[0]); break;
+                case TIFFTAG_PREDICTOR:       P->d = uint16(v[0]); break;
+                case TIFFTAG_ROWSPERSTRIP:    P->r = uint32(v[0]); break;
+                case TIFFTAG_PLANARCONFIG:
+                    ok = (v[0] == PLANARCONFIG_CONTIG);            break;
+                }
+            break;
+        }
+    }
+
+    // Accept only formats that decode() handles.
+
+    if (P->r > P->h)
+        P->r = P->h;
+
+    if (ok)
+        ok = (P->w > 0 && P->h > 0 && P->r > 0)
+          && (P->b == 8 || P->b == 16 || P->b == 32)
+          && (P->o.size() == P->n.size())
+          && (P->o.size() >= (P->h + P->r - 1) / P->r)
+          && (P->z == COMPRESSION_NONE     || P->z == COMPRESSION_LZW     ||
+              P->z == COMPRESSION_PACKBITS || P->z == COMPRESSION_DEFLATE ||
+              P->z == COMPRESSION_ADOBE_DEFLATE)
+          && (P->d == PREDICTOR_NONE || P->d == PREDICTOR_HORIZONTAL);
+
+    // Accept only strips that lie within the file, as their byte counts size
+    // the buffers into which they are read.
+
+    for (size_t l = 0; ok && l < P->o.size(); ++l)
+        ok = within(P->o[l], P->n[l], 1);
+
+    // Note the offset of data that may be read in place.
+
+    if (ok && P->z == COMPRESSION_NONE && P->d == PREDICTOR_NONE
+           && (P->b == 8 || !swap))
+    {
+        const uint64 S = uint64(P->r) * P->w * P->c * P->b / 8;
+
+        const size_t N = (P->h + P->r - 1) / P->r;
+
+        P->m = P->o[0];
+
+        for (size_t l = 1; l < N; ++l)
+            if (P->o[l] != P->o[0] + l * S)
+                P->m = 0;
+
+        for (size_t l = 0; l + 1 < N; ++l)
+            if (P->n[l] < S)
+                P->m = 0;
+    }
+
+    if (!ok)
+    {
+        delete P;
+        P = 0;
+    }
+    return P;
+}
+
+//------------------------------------------------------------------------------
+
+// Decode an LZW-compressed strip of n bytes from src into m bytes at dst.
+
+static bool lzw(const uint8 *src, size_t n, uint8 *dst, size_t m)
+{
+    static const int clear = 256;
+    static const int eoi   = 257;
+
+    std::vector<short> prefix(4096);
+    std::vector<uint8> suffix(4096);
+    std::vector<uint8> first (4096);
+    std::vector<short> length(4096);
+
+    for (int k = 0; k < 256; ++k)
+    {
+        prefix[k] = -1;
+        suffix[k] = uint8(k);
+        first [k] = uint8(k);
+        length[k] = 1;
+    }
+
+    size_t bit  = 0;
+    size_t pos  = 0;
+    int    next = 258;
+    int    size = 9;
+    int    prev = -1;
+
+    while (pos < m && bit + size <= n * 8)
+    {
+        // Read the next code, most significant bit first.
+
+        int code = 0;
+
+        for (int k = 0; k < size; ++k, ++bit)
+            code = (code << 1) | ((src[bit >> 3] >> (7 - (bit & 7))) & 1);
+
+        if (code == eoi)
+            break;
+
+        if (code == clear)
+        {
+            next =  258;
+            size =  9;
+            prev = -1;
+            continue;
+        }
+
+        // Determine the string for this code and add a new table entry.
+
+        if (prev >= 0)
+        {
+            if (code > next)
+                return false;
+
+            if (next < 4096)
+            {
+                prefix[next] = short(prev);
+                suffix[next] = (code == next) ? first[prev] : first[code];
+                first [next] = first[prev];
+                length[next] = short(length[prev] + 1);
+                next++;
+            }
+            if (next >= (1 << size) - 1 && size < 12)
+                size++;
+        }
+        else if (code > 255) return false;
+
+        // Write the string, which is stored last character first.
+
+        const int z = length[code];
+
+        if (pos + z > m)
+            return false;
+
+        for (int j = code, k = z - 1; j >= 0 && k >= 0; j = prefix[j], --k)
+            dst[pos + k] = suffix[j];
+
+        pos += z;
+        prev = code;
+    }
+    return (pos == m);
+}
+
+// Decode a PackBits-compressed strip of n bytes from src into m bytes at dst.
+
+static bool packbits(const uint8 *src, size_t n, uint8 *dst, size_t m)
+{
+    size_t i = 0;
+    size_t j = 0;
+
+    while (i < n && j < m)
+    {
+        const int k = int((signed char) src[i++]);
+
+        if (k >= 0)
+        {
+            if (i + k + 1 > n || j + k + 1 > m)
+                return false;
+
+            memcpy(dst + j, src + i, size_t(k + 1));
+            i += k + 1;
+            j += k + 1;
+        }
+        else if (k != -128)
+        {
+            if (i + 1 > n || j + 1 - k > m)
+                return false;
+
+            memset(dst + j, src[i], size_t(1 - k));
+            i += 1;
+            j += 1 - k;
+        }
+    }
+    return (j == m);
+}
+
+// Undo horizontal differencing on w pixels of c samples of type T per row.
+
+template <typename T> static void unpredict(T *p, size_t m, int w, int c)
+{
+    const size_t r = size_t(w) * size_t(c);
+
+    for (size_t y = 0; y + r <= m / sizeof (T); y += r)
+        for (size_t x = c; x < r; ++x)
+            p[y + x] = T(p[y + x] + p[y + x - c]);
+}
+
+// Decode a compressed strip of n bytes at src into m bytes at dst.
+
+bool scm_reader::decode(const page *P, const uint8 *src, size_t n,
+                                             uint8 *dst, size_t m) const
+{
+    switch (P->z)
+    {
+    case COMPRESSION_LZW:
+
+        if (!lzw(src, n, dst, m))
+            return false;
+        break;
+
+    case COMPRESSION_PACKBITS:
+
+        if (!packbits(src, n, dst, m))
+            return false;
+        break;
+
+    case COMPRESSION_ADOBE_DEFLATE:
+    case COMPRESSION_DEFLATE:
+    {
+        uLongf z = uLongf(m);
+
+        if (uncompress(dst, &z, src, uLong(n)) != Z_OK || size_t(z) != m)
+            return false;
+        break;
+    }
+    default:
+
+        memcpy(dst, src, std::min(n, m));
+        break;
+    }
+
+    finish(P, dst, m);
+    return true;
+}
+
+// Convert m bytes of decoded samples at p to host byte order and undo any
+// horizontal differencing.
+
+void scm_reader::finish(const page *P, uint8 *p, size_t m) const
+{
+    uint8 *dst = p;
+
+    if (swap && P->b == 16)
+        for (size_t i = 0; i + 1 < m; i += 2)
+            std::swap(dst[i], dst[i + 1]);
+
+    if (swap && P->b == 32)
+        for (size_t i = 0; i + 3 < m; i += 4)
+        {
+            std::swap(dst[i    ], dst[i + 3]);
+            std::swap(dst[i + 1], dst[i + 2]);
+        }
+
+    if (P->d == 2)
+        switch (P->b)
+        {
+        case  8: unpredict((uint8  *) dst, m, int(P->w), P->c); break;
+        case 16: unpredict((uint16 *) dst, m, int(P->w), P->c); break;
+        case 32: unpredict((uint32 *) dst, m, int(P->w), P->c); break;
+        }
+}
+
+//------------------------------------------------------------------------------
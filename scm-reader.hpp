@@ -0,0 +1,127 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#ifndef SCM_READER_HPP
+#define SCM_READER_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include <tiffio.h>
+#include <SDL.h>
+#include <SDL_thread.h>
+
+#include "scm-loader.hpp"
+#include "scm-source.hpp"
+
+//------------------------------------------------------------------------------
+
+/// An scm_reader reads SCM TIFF pages directly, bypassing libtiff
+///
+/// Setting a TIFF subdirectory with libtiff re-parses the whole IFD, and a
+/// libtiff handle carries enough state that each loader thread needs its own.
+/// Instead, an scm_reader parses each page's IFD once, retaining only a compact
+/// record of its format and its strip byte offsets and counts. Subsequent loads
+/// of the page read the compressed strips with positioned reads on a single
+/// shared file descriptor and decompress them without any libtiff state, so
+/// any number of loader threads may use one reader concurrently.
+///
+/// Uncompressed, Deflate, LZW, and PackBits data are supported, with or without
+/// horizontal differencing. Pages in any other format are rejected, and the
+/// caller should fall back upon libtiff. @see scm_file::read_page
+///
+/// The strips of a large compressed page may be decoded in parallel by the
+/// workers of a loader pool, so that page latency scales with core count.
+///
+/// An uncompressed file is mapped into memory in its entirety. Reads are then
+/// copies from the mapping, and pages stored contiguously may be accessed in
+/// place, leaving the OS page cache as the only host copy of the data.
+///
+/// A remote file is read through an scm_source instead, which the reader uses
+/// but does not own. @see scm_source
+
+class scm_reader
+{
+public:
+
+    scm_reader(const std::string&);
+    scm_reader(scm_source *);
+   ~scm_reader();
+
+    bool is_open()   const { return (fd >= 0 || source); }
+    bool is_mapped() const { return (data != 0); }
+
+    static size_t parallel_size;
+
+    bool        read_page(uint64, int, int, int, int, void *, scm_loader *);
+    const void *get_data (uint64, int, int, int, int);
+
+private:
+
+    struct page
+    {
+        uint32 w;   ///< Page width
+        uint32 h;   ///< Page height
+        uint16 c;   ///< Sample count
+        uint16 b;   ///< Sample depth
+        uint16 z;   ///< Compression
+        uint16 d;   ///< Predictor
+        uint32 r;   ///< Rows per strip
+        uint64 m;   ///< Offset of in-place data, or zero
+
+        std::vector<uint64> o;  ///< Strip byte offsets
+        std::vector<uint64> n;  ///< Strip byte counts
+    };
+
+    typedef std::map<uint64, page *>           page_m;
+    typedef std::map<uint64, page *>::iterator page_i;
+
+    scm_source *source;     // Remote file source, or null
+    int        fd;          // Shared file descriptor
+    bool       big;         // File is BigTIFF
+    bool       swap;        // File byte order differs from the host
+    uint8     *data;        // File mapping
+    uint64     size;        // File mapping size
+    uint64     length;      // File length, bounding all counts read from it
+#ifdef WIN32
+    void      *mapping;     // File mapping object handle
+#endif
+    SDL_mutex *mutex;       // Page record map mutex
+    page_m     pages;       // Page records by IFD offset
+
+    void   init();
+    bool   read(uint64, size_t, void *) const;
+    bool   within(uint64, uint64, size_t) const;
+    uint64 get_length() const;
+    void   map_file();
+
+    uint16 get16(const uint8 *) const;
+    uint32 get32(const uint8 *) const;
+    uint64 get64(const uint8 *) const;
+
+    bool   get_values(const uint8 *, std::vector<uint64>&) const;
+    page  *get_page  (uint64);
+    page  *new_page  (uint64) const;
+
+    bool   read_strip(const page *, size_t, uint8 *) const;
+
+    class strips;
+    friend class strips;
+
+    bool   decode(const page *, const uint8 *, size_t, uint8 *, size_t) const;
+    void   finish(const page *,                        uint8 *, size_t) const;
+};
+
+//------------------------------------------------------------------------------
+
+#endif
@@ -13,6 +13,8 @@
 #include <cstdlib>
 #include <cmath>
 #include <cstring>
+#include <algorithm>
+#include <vector>
 
 #include "util3d/math3d.h"
 
@@ -21,6 +23,7 @@
 #include "scm-scene.hpp"
 #include "scm-state.hpp"
 #include "scm-frame.hpp"
+#include "scm-trace.hpp"
 #include "scm-log.hpp"
 
 //------------------------------------------------------------------------------
@@ -35,19 +38,25 @@ static void wire_off();
 /// Create a new render manager. Initialize the necessary OpenGL state
 /// framebuffer object state.
 ///
-/// Motion blur is disabled (set to zero) by default.
+/// Motion blur is disabled (set to zero) by default, as is dynamic resolution.
 ///
 /// @param w Width of the off-screen render targets (in pixels).
 /// @param h Height of the off-screen render targets (in pixels).
 
 scm_render::scm_render(int w, int h) :
-    width(w), height(h), blur(0), wire(false), frame0(0), frame1(0)
+    width(w), height(h), blur(0), wire(false), divisor(1), dynamic(false),
+    budget(1000.0 / 60.0), scale(1.0), scale0(0.5), scale1(1.0), sharpen(0.0),
+    scaled_w(w), scaled_h(h), query(0), checked(-1),
+    frame0(0), frame1(0), frameT(0), frameH(0)
 {
     init_ogl();
     init_matrices();
 
     for (int i = 0; i < 16; i++)
+    {
         midentity(previous_T[i]);
+        shared[i] = -2;
+    }
 }
 
 /// Finalize all OpenGL state.
@@ -69,7 +78,7 @@ void scm_render::set_size(int w, int h)
     width  = w;
     height = h;
     init_ogl();
-    init_matrices();
+    set_scale(scale);
 }
 
 /// Set the motion blur degree. Higher degrees incur greater rendering loads.
@@ -87,6 +96,163 @@ void scm_render::set_wire(bool w)
     wire = w;
 }
 
+/// Set the atmosphere resolution divisor. At 1 the atmosphere is found for
+/// every pixel. Above 1 its transmittance is found at 1/d resolution in each
+/// dimension and upsampled with regard to depth, so that silhouettes remain
+/// sharp. This entails the recreation of a framebuffer object, so it should
+/// *not* be done every frame.
+
+void scm_render::set_divisor(int d)
+{
+    divisor = std::min(std::max(d, 1), 8);
+
+    delete frameH;
+    frameH = 0;
+
+    if (divisor > 1)
+        frameH = new scm_frame((width  + divisor - 1) / divisor,
+                               (height + divisor - 1) / divisor);
+}
+
+/// Enable or disable dynamic resolution. When enabled, and timer queries are
+/// supported, the GPU time of each render is measured, and the resolution at
+/// which the sphere is rendered is scaled within the range given by set_range
+/// to hold that time within the budget given by set_budget. When disabled, the
+/// sphere is rendered at full resolution.
+
+void scm_render::set_dynamic(bool b)
+{
+    dynamic = b;
+    set_scale(dynamic ? scale1 : 1.0);
+}
+
+/// Set the GPU time budget of each render in milliseconds. This is the time of
+/// one call to render, so a stereo display rendering two channels per frame
+/// would give half of its frame time.
+
+void scm_render::set_budget(double ms)
+{
+    budget = std::max(ms, 0.1);
+}
+
+/// Set the range of the dynamic resolution scale. The off-screen buffers are
+/// allocated at full size, so the scale does not exceed one.
+
+void scm_render::set_range(double k0, double k1)
+{
+    scale0 = std::min(std::max(k0, 1.0 / 16.0), 1.0);
+    scale1 = std::min(std::max(k1, scale0),     1.0);
+
+    if (dynamic)
+        set_scale(std::min(std::max(scale, scale0), scale1));
+}
+
+/// Set the strength of the sharpening applied while upscaling a frame rendered
+/// at reduced resolution. Zero gives plain bilinear filtering.
+
+void scm_render::set_sharpen(double k)
+{
+    sharpen = std::max(k, 0.0);
+}
+
+// Set the resolution scale, rounded to a multiple of 1/32 so that small
+// changes in timing do not disturb the level of detail from frame to frame.
+
+void scm_render::set_scale(double k)
+{
+    scale = std::floor(std::min(std::max(k, 1.0 / 16.0), 1.0) * 32.0 + 0.5)
+                                                                   / 32.0;
+
+    scaled_w = std::max(1, int(width  * scale + 0.5));
+    scaled_h = std::max(1, int(height * scale + 0.5));
+
+    init_matrices();
+}
+
+// Poll the timer queries once per frame, before the first selection or render
+// of the frame, so that every view of one frame shares one resolution scale.
+
+void scm_render::check_frame(int frame)
+{
+    if (dynamic && frame != checked)
+    {
+        checked = frame;
+        check_time();
+    }
+}
+
+// Poll the timer queries of previous renders. Scale the resolution toward the
+// size expected to take 90 percent of the budget, assuming that GPU time goes
+// as the pixel count, whenever the measured time falls outside of the budget
+// or well within it.
+
+void scm_render::check_time()
+{
+    for (int j = 0; j < queries_count; ++j)
+        if (timing[j])
+        {
+            GLint a = 0;
+
+            glGetQueryObjectiv(queries[j], GL_QUERY_RESULT_AVAILABLE, &a);
+
+            if (a)
+            {
+                GLuint64 d = 0;
+
+                glGetQueryObjectui64v(queries[j], GL_QUERY_RESULT, &d);
+
+                const double t = double(d) * 1e-6;
+
+                if (t > 0 && (t > budget || t < 0.8 * budget))
+                {
+                    double k = scale * sqrt(0.9 * budget / t);
+
+                    k = scale + (k - scale) * 0.5;
+                    k = std::min(std::max(k, scale0), scale1);
+
+                    set_scale(k);
+                }
+                timing[j] = false;
+            }
+        }
+}
+
+//------------------------------------------------------------------------------
+
+/// Compute the projection Q and model-view N with which the background sphere
+/// is drawn, given the projection P and model-view M of the view. The product
+/// Q N is the background transform given to scm_sphere.
+///
+/// @param Q Background projection matrix (output)
+/// @param N Background model-view matrix (output)
+/// @param P Projection matrix in OpenGL column-major order
+/// @param M Model-view matrix in OpenGL column-major order
+
+void scm_render::get_background(double *Q, double *N, const double *P,
+                                                      const double *M)
+{
+    double T[16], I[16];
+
+    // Extract only the rotation of the view matrix.
+
+    midentity(N);
+    vnormalize(N + 0, M + 0);
+    vnormalize(N + 4, M + 4);
+    vnormalize(N + 8, M + 8);
+
+    // Remove any offset in the projection matrix.
+
+    double w[4], v[4] = { 0.0, 0.0, -1.0, 0.0 };
+
+    minvert(I, P);
+    wtransform(w, I, v);
+    w[0] /= w[3];
+    w[1] /= w[3];
+    w[2] /= w[3];
+    mtranslate(T, w);
+    mmultiply(Q, P, T);
+}
+
 //------------------------------------------------------------------------------
 
 /// Render the foreground and background with optional blur and dissolve.
@@ -110,13 +276,32 @@ void scm_render::render(scm_sphere *sphere,
 
     const double t = state->get_fade();
 
+    scm_trace::scope trace("render");
+
+    // Adjust the resolution to suit the time of previous frames, and time
+    // this render.
+
+    check_frame(frame);
+
+    const bool timed = (dynamic && queries[query] && !timing[query]);
+
+    if (timed)
+        glBeginQuery(GL_TIME_ELAPSED, queries[query]);
+
     GLfloat blur_T[16];
 
     const bool do_blur = check_blur(P, M, blur_T, previous_T[channel]);
     const bool do_fade = check_fade(foreground0, foreground1,
                                     background0, background1, t);
+    const bool do_size = (scaled_w != width || scaled_h != height);
 
-    if (!do_fade && !do_blur)
+    // A fade draws each scene pair with one selection, unless the frame was
+    // already selected for all views.
+
+    if (do_fade && shared[channel] != frame)
+        select(sphere, state, 1, P, M, channel, frame);
+
+    if (!do_fade && !do_blur && !do_size)
         render(sphere, foreground0, background0, P, M, channel, frame);
 
     else
@@ -129,12 +314,12 @@ void scm_render::render(scm_sphere *sphere,
 
         glPushAttrib(GL_VIEWPORT_BIT | GL_SCISSOR_BIT);
         {
-            frame0->bind_frame();
+            frame0->bind_frame(scaled_w, scaled_h);
             render(sphere, foreground0, background0, P, M, channel, frame);
 
             if (do_fade)
             {
-                frame1->bind_frame();
+                frame1->bind_frame(scaled_w, scaled_h);
                 render(sphere, foreground1, background1, P, M, channel, frame);
             }
         }
@@ -150,6 +335,33 @@ void scm_render::render(scm_sphere *sphere,
         frame1->bind_color();
         glActiveTexture(GL_TEXTURE0);
         frame0->bind_color();
+
+        // Find the greatest motion of each tile, that the blur may skip the
+        // tiles that barely move.
+
+        if (do_blur)
+        {
+            const int w = (scaled_w + tile_size - 1) / tile_size;
+            const int h = (scaled_h + tile_size - 1) / tile_size;
+
+            scm_trace::gpu_scope trace_gpu("tile");
+
+            glPushAttrib(GL_VIEWPORT_BIT | GL_SCISSOR_BIT);
+            {
+                frameT->bind_frame(w, h);
+
+                glUseProgram(render_tile.program);
+                glUniform1f       (uniform_tile_f,       do_fade ? 1.f : 0.f);
+                glUniformMatrix4fv(uniform_tile_T, 1, 0, blur_T);
+
+                fillscreen(w, h);
+            }
+            glPopAttrib();
+
+            glActiveTexture(GL_TEXTURE4);
+            frameT->bind_color();
+            glActiveTexture(GL_TEXTURE0);
+        }
         glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
 
         // Bind the necessary shader and set its uniforms.
@@ -172,12 +384,94 @@ void scm_render::render(scm_sphere *sphere,
             glUniform1i       (uniform_blur_n,       blur);
             glUniformMatrix4fv(uniform_blur_T, 1, 0, blur_T);
         }
+        else
+        {
+            glUseProgram(render_scale.program);
+            glUniform1f       (uniform_scale_k,      GLfloat(sharpen));
+        }
+
+        // Render the blur / fade / upscale to the framebuffer.
 
-        // Render the blur / fade to the framebuffer.
+        scm_trace::begin_gpu("composite");
+        fillscreen(scaled_w, scaled_h);
+        scm_trace::end_gpu  ("composite");
 
-        fillscreen(width, height);
         glUseProgram(0);
     }
+
+    if (timed)
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+
+        timing[query] = true;
+        query = (query + 1) % queries_count;
+    }
+}
+
+/// Select the pages of each scene of a state once for n views of one frame, so
+/// that each subsequent render of the frame draws the shared selection rather
+/// than selecting its own. @see scm_sphere::share
+///
+/// @param sphere  Sphere geometry manager to perform the selection
+/// @param state   Viewer and environment state
+/// @param n       Number of views
+/// @param P       Projection matrices, 16 per view, column-major
+/// @param M       Model-view matrices, 16 per view, column-major
+/// @param channel Channel index
+/// @param frame   Frame number
+
+void scm_render::share(scm_sphere *sphere,
+                 const scm_state  *state, int n,
+                 const double     *P,
+                 const double     *M, int channel, int frame)
+{
+    check_frame(frame);
+    select(sphere, state, n, P, M, channel, frame);
+    shared[channel] = frame;
+}
+
+// Select the pages of each scene of a state for n views. While fading, each
+// scene shares its selection with the scene it fades to, so that one traversal
+// serves both passes.
+
+void scm_render::select(scm_sphere *sphere,
+                  const scm_state  *state, int n,
+                  const double     *P,
+                  const double     *M, int channel, int frame)
+{
+    scm_scene *foreground0 = state->get_foreground0();
+    scm_scene *foreground1 = state->get_foreground1();
+    scm_scene *background0 = state->get_background0();
+    scm_scene *background1 = state->get_background1();
+
+    if (!check_fade(foreground0, foreground1,
+                    background0, background1, state->get_fade()))
+    {
+        foreground1 = 0;
+        background1 = 0;
+    }
+    if (foreground0 == 0) std::swap(foreground0, foreground1);
+    if (background0 == 0) std::swap(background0, background1);
+
+    std::vector<double> F(16 * n);
+    std::vector<double> B(16 * n);
+
+    for (int j = 0; j < n; j++)
+    {
+        double N[16], Q[16];
+
+        get_background(Q, N, P + 16 * j, M + 16 * j);
+
+        mmultiply(&F[16 * j], P + 16 * j, M + 16 * j);
+        mmultiply(&B[16 * j], Q, N);
+    }
+
+    if (n > 0 && foreground0)
+        sphere->share(foreground0, foreground1, &F[0], n,
+                      scaled_w, scaled_h, channel, frame);
+    if (n > 0 && background0)
+        sphere->share(background0, background1, &B[0], n,
+                      scaled_w, scaled_h, channel, frame);
 }
 
 /// Render the background and foreground spheres, with atmosphere if configured,
@@ -218,7 +512,7 @@ void scm_render::render(scm_sphere *sphere,
     {
         glPushAttrib(GL_VIEWPORT_BIT | GL_SCISSOR_BIT);
         glGetIntegerv(GL_FRAMEBUFFER_BINDING, &framebuffer);
-        frameA->bind_frame();
+        frameA->bind_frame(scaled_w, scaled_h);
     }
 
     // If we're going to be doing rendering, clear the buffers.
@@ -240,26 +534,9 @@ void scm_render::render(scm_sphere *sphere,
 
     if (background)
     {
-        // Extract only the rotation of the view matrix.
-
-        double N[16], Q[16], T[16], I[16];
-
-        midentity(N);
-        vnormalize(N + 0, M + 0);
-        vnormalize(N + 4, M + 4);
-        vnormalize(N + 8, M + 8);
+        double N[16], Q[16];
 
-        // Remove any offset in the projection matrix.
-
-        double w[4], v[4] = { 0.0, 0.0, -1.0, 0.0 };
-
-        minvert(I, P);
-        wtransform(w, I, v);
-        w[0] /= w[3];
-        w[1] /= w[3];
-        w[2] /= w[3];
-        mtranslate(T, w);
-        mmultiply(Q, P, T);
+        get_background(Q, N, P, M);
 
         // Apply the transform.
 
@@ -279,10 +556,10 @@ void scm_render::render(scm_sphere *sphere,
             glFrontFace(GL_CCW);
 
             if (wire) wire_on();
-            sphere->draw(background, T, width, height, channel, frame);
+            sphere->draw(background, T, scaled_w, scaled_h, channel, frame);
             if (wire) wire_off();
 
-            background->draw_label();
+            background->draw_label(sphere, channel);
         }
         glPopAttrib();
 
@@ -313,11 +590,11 @@ void scm_render::render(scm_sphere *sphere,
             glFrontFace(GL_CW);
 
             if (wire) wire_on();
-            sphere->draw(foreground, T, width, height, channel, frame);
+            sphere->draw(foreground, T, scaled_w, scaled_h, channel, frame);
             if (wire) wire_off();
 
             glEnable(GL_CLIP_PLANE0);
-            foreground->draw_label();
+            foreground->draw_label(sphere, channel);
         }
         glPopAttrib();
     }
@@ -326,6 +603,8 @@ void scm_render::render(scm_sphere *sphere,
 
     if (atmo.H > 0)
     {
+        scm_trace::gpu_scope trace_gpu("atmo");
+
         glPopAttrib();
 
         // Bind the color and depth buffers of the temporary render target.
@@ -354,10 +633,35 @@ void scm_render::render(scm_sphere *sphere,
         glUniform2fv      (uniform_atmo_r, 1,    atmo_r);
         glUniform3fv      (uniform_atmo_p, 1,    atmo_p);
         glUniformMatrix4fv(uniform_atmo_T, 1, 0, atmo_T);
+        glUniform1i       (uniform_atmo_t,       divisor > 1);
+
+        if (divisor > 1)
+        {
+            // Find the transmittance at reduced resolution.
+
+            glPushAttrib(GL_VIEWPORT_BIT | GL_SCISSOR_BIT);
+            {
+                frameH->bind_frame((scaled_w + divisor - 1) / divisor,
+                                   (scaled_h + divisor - 1) / divisor);
+                fillscreen(scaled_w, scaled_h);
+            }
+            glPopAttrib();
+
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+            glActiveTexture(GL_TEXTURE1);
+            frameH->bind_color();
+            glActiveTexture(GL_TEXTURE0);
+
+            // Upsample it and apply it to the framebuffer.
+
+            glUseProgram(render_haze.program);
+            glUniform3fv      (uniform_haze_c, 1,    atmo.c);
+            glUniform1f       (uniform_haze_d,       GLfloat(divisor));
+        }
 
         // Render the atmosphere to the framebuffer.
 
-        fillscreen(width, height);
+        fillscreen(scaled_w, scaled_h);
         glUseProgram(0);
     }
 }
@@ -374,14 +678,15 @@ void scm_render::init_uniforms(GLuint program)
         glUniform1i(glGetUniformLocation(program, "color1"), 1);
         glUniform1i(glGetUniformLocation(program, "depth0"), 2);
         glUniform1i(glGetUniformLocation(program, "depth1"), 3);
+        glUniform1i(glGetUniformLocation(program, "tile"),   4);
     }
     glUseProgram(0);
 }
 
 void scm_render::init_matrices()
 {
-    double w = double(width);
-    double h = double(height);
+    double w = double(scaled_w);
+    double h = double(scaled_h);
 
     // A transforms a fragment coordinate to a texture coordinate.
 
@@ -422,6 +727,12 @@ void scm_render::init_matrices()
 #include "scm_render_both_frag.h"
 #include "scm_render_atmo_vert.h"
 #include "scm_render_atmo_frag.h"
+#include "scm_render_scale_vert.h"
+#include "scm_render_scale_frag.h"
+#include "scm_render_tile_vert.h"
+#include "scm_render_tile_frag.h"
+#include "scm_render_haze_vert.h"
+#include "scm_render_haze_frag.h"
 
 void scm_render::init_ogl()
 {
@@ -441,11 +752,26 @@ void scm_render::init_ogl()
                                              scm_render_atmo_vert_len,
                               (const char *) scm_render_atmo_frag,
                                              scm_render_atmo_frag_len);
+    glsl_source(&render_scale, (const char *) scm_render_scale_vert,
+                                              scm_render_scale_vert_len,
+                               (const char *) scm_render_scale_frag,
+                                              scm_render_scale_frag_len);
+    glsl_source(&render_tile, (const char *) scm_render_tile_vert,
+                                             scm_render_tile_vert_len,
+                              (const char *) scm_render_tile_frag,
+                                             scm_render_tile_frag_len);
+    glsl_source(&render_haze, (const char *) scm_render_haze_vert,
+                                             scm_render_haze_vert_len,
+                              (const char *) scm_render_haze_frag,
+                                             scm_render_haze_frag_len);
 
     init_uniforms(render_fade.program);
     init_uniforms(render_blur.program);
     init_uniforms(render_both.program);
     init_uniforms(render_atmo.program);
+    init_uniforms(render_scale.program);
+    init_uniforms(render_tile.program);
+    init_uniforms(render_haze.program);
 
     glUseProgram(render_fade.program);
     uniform_fade_t = glsl_uniform(render_fade.program, "t");
@@ -466,12 +792,41 @@ void scm_render::init_ogl()
     uniform_atmo_T = glsl_uniform(render_atmo.program, "atmo_T");
     uniform_atmo_P = glsl_uniform(render_atmo.program, "atmo_P");
     uniform_atmo_H = glsl_uniform(render_atmo.program, "atmo_H");
+    uniform_atmo_t = glsl_uniform(render_atmo.program, "atmo_t");
+
+    glUseProgram(render_scale.program);
+    uniform_scale_k = glsl_uniform(render_scale.program, "k");
+
+    glUseProgram(render_tile.program);
+    uniform_tile_T = glsl_uniform(render_tile.program, "T");
+    uniform_tile_f = glsl_uniform(render_tile.program, "f");
+
+    glUseProgram(render_haze.program);
+    uniform_haze_c = glsl_uniform(render_haze.program, "atmo_c");
+    uniform_haze_d = glsl_uniform(render_haze.program, "d");
 
     glUseProgram(0);
 
+    // Create the render timer queries, if supported.
+
+    for (int j = 0; j < queries_count; ++j)
+    {
+        queries[j] = 0;
+        timing [j] = false;
+    }
+    if (GLEW_ARB_timer_query)
+        glGenQueries(queries_count, queries);
+
     frameA = new scm_frame(width, height);
     frame0 = new scm_frame(width, height);
     frame1 = new scm_frame(width, height);
+    frameT = new scm_frame((width  + tile_size - 1) / tile_size,
+                           (height + tile_size - 1) / tile_size);
+    frameH = 0;
+
+    if (divisor > 1)
+        frameH = new scm_frame((width  + divisor - 1) / divisor,
+                               (height + divisor - 1) / divisor);
 
     scm_log("scm_render init_ogl %d %d", width, height);
 }
@@ -483,13 +838,21 @@ void scm_render::free_ogl()
     delete frameA;
     delete frame0;
     delete frame1;
+    delete frameT;
+    delete frameH;
+
+    frameA = frame0 = frame1 = frameT = frameH = 0;
 
-    frameA = frame0 = frame1 = 0;
+    if (queries[0])
+        glDeleteQueries(queries_count, queries);
 
     glsl_delete(&render_fade);
     glsl_delete(&render_blur);
     glsl_delete(&render_both);
     glsl_delete(&render_atmo);
+    glsl_delete(&render_scale);
+    glsl_delete(&render_tile);
+    glsl_delete(&render_haze);
 }
 
 //------------------------------------------------------------------------------
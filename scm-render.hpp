@@ -34,8 +34,20 @@ class scm_frame;
 /// sphere to be rendered first to an off-screen buffer which is then drawn to
 /// the screen as a single rectangle with the appropriate shader enabled.
 ///
+/// The atmosphere may be found at reduced resolution. @see set_divisor
+///
+/// Motion blur first finds the greatest motion within each tile of the screen,
+/// and skips the tiles that barely move, taking about one sample per pixel of
+/// motion, up to the blur degree, in those that do.
+///
 /// The render manager also maintains the wireframe debug option, which would
 /// otherwise conflict with more sophisticated capabilities.
+///
+/// With dynamic resolution enabled, the GPU time of each render is measured,
+/// and the scale of the off-screen buffers is adjusted to hold it within a
+/// given budget. The sphere is then rendered to a scaled viewport within the
+/// full-size buffers, with level of detail chosen to suit, and upscaled to the
+/// screen with an optional sharpening in the final pass. @see set_dynamic
 
 class scm_render
 {
@@ -47,9 +59,21 @@ public:
     void set_size(int, int);
     void set_blur(int);
     void set_wire(bool);
-
-    int  get_blur() const { return blur; }
-    bool get_wire() const { return wire; }
+    void set_divisor(int);
+    void set_dynamic(bool);
+    void set_budget (double);
+    void set_range  (double, double);
+    void set_sharpen(double);
+
+    int    get_blur()    const { return blur;    }
+    bool   get_wire()    const { return wire;    }
+    int    get_divisor() const { return divisor; }
+    int    get_width()   const { return width;   }
+    int    get_height()  const { return height;  }
+    bool   get_dynamic() const { return dynamic; }
+    double get_budget()  const { return budget;  }
+    double get_sharpen() const { return sharpen; }
+    double get_scale()   const { return scale;   }
 
     void render(scm_sphere *,
           const scm_state  *,
@@ -61,6 +85,14 @@ public:
               const double *,
               const double *, int, int);
 
+    void share(scm_sphere *,
+         const scm_state  *, int,
+         const     double *,
+         const     double *, int, int);
+
+    static void get_background(double *, double *, const double *,
+                                                   const double *);
+
 private:
 
     bool check_blur(const double *, const double *, GLfloat *, double  *);
@@ -68,6 +100,15 @@ private:
     bool check_fade(const scm_scene *, const scm_scene *,
                     const scm_scene *, const scm_scene *, double);
 
+    void select(scm_sphere *,
+          const scm_state  *, int,
+          const     double *,
+          const     double *, int, int);
+
+    void check_frame(int);
+    void check_time();
+    void set_scale(double);
+
     void init_uniforms(GLuint);
     void init_matrices();
     void init_ogl();
@@ -77,10 +118,33 @@ private:
     int  height;
     int  blur;
     bool wire;
+    int  divisor;
+
+    // Dynamic resolution state. The scene is rendered at scaled_w by scaled_h.
+
+    bool   dynamic;
+    double budget;
+    double scale;
+    double scale0;
+    double scale1;
+    double sharpen;
+    int    scaled_w;
+    int    scaled_h;
+
+    static const int queries_count = 4;
+
+    GLuint queries[queries_count];  // Render timer queries
+    bool   timing [queries_count];  // Is each query pending?
+    int    query;                   // Next timer query
+    int    checked;                 // Frame of the last timer poll
 
     scm_frame *frameA;
     scm_frame *frame0;
     scm_frame *frame1;
+    scm_frame *frameT;
+    scm_frame *frameH;
+
+    static const int tile_size = 16;
 
     double A[16];
     double B[16];
@@ -88,11 +152,15 @@ private:
     double D[16];
 
     double previous_T[16][16];
+    int    shared[16];
 
     glsl   render_fade;
     glsl   render_blur;
     glsl   render_both;
     glsl   render_atmo;
+    glsl   render_scale;
+    glsl   render_tile;
+    glsl   render_haze;
 
     GLint  uniform_fade_t;
     GLint  uniform_both_t;
@@ -107,6 +175,13 @@ private:
     GLint  uniform_atmo_p;
     GLint  uniform_atmo_P;
     GLint  uniform_atmo_H;
+    GLint  uniform_atmo_t;
+
+    GLint  uniform_scale_k;
+    GLint  uniform_tile_T;
+    GLint  uniform_tile_f;
+    GLint  uniform_haze_c;
+    GLint  uniform_haze_d;
 };
 
 
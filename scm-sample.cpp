@@ -16,166 +16,483 @@
 #include "util3d/math3d.h"
 
 #include "scm-sample.hpp"
+#include "scm-loader.hpp"
 #include "scm-index.hpp"
 #include "scm-file.hpp"
 #include "scm-log.hpp"
 
 //------------------------------------------------------------------------------
 
+/// Number of decoded pages retained by each sampler. Each page takes four
+/// bytes per pixel.
+
+int scm_sample::cache_pages = 32;
+
 /// Create a new SCM TIFF file sampler
 ///
 /// The given scm_file object includes the path and parameters of the TIFF
-/// file. Open that TIFF and prepare to make cached access to it.
-
-scm_sample::scm_sample(scm_file *file) : file(file)
+/// file. Prepare to make cached access to it, queueing asynchronous requests
+/// to the given loader pool. The TIFF is opened through the file upon the first
+/// synchronous load, and only once, whether or not it opens.
+
+scm_sample::scm_sample(scm_file *file, scm_loader *loader) :
+    time(0),
+    tiff(0),
+    tried(false),
+    file(file),
+    loader(loader),
+    buffer(0)
 {
     last_v[0] = 0;
     last_v[1] = 0;
     last_v[2] = 0;
     last_k    = 0;
-    last_p    = 0;
-    last_o    = 0;
-    last_i0   = (tsize_t) (-1);
-    last_i1   = (tsize_t) (-1);
 
-    if ((tiff = TIFFOpen(file->get_path(), "r")))
-    {
-        tsize_t N = TIFFNumberOfStrips(tiff);
-        tsize_t S = TIFFStripSize     (tiff);
-
-        last_p = (uint8 *) malloc(S * N);
+    mutex = SDL_CreateMutex();
 
-        scm_log("scm_sample constructor %s", file->get_path());
-    }
+    scm_log("scm_sample constructor %s", file->get_path());
 }
 
-// Release the TIFF
+// Release all decoded pages and the TIFF. The loader pool must no longer be
+// servicing this sampler. @see scm_loader::del_file
 
 scm_sample::~scm_sample()
 {
     scm_log("scm_sample destructor");
 
-    free(last_p);
+    for (page_i i = pages.begin(); i != pages.end(); ++i)
+        free(i->second.p);
+
+    for (size_t j = 0; j < loaded.size(); ++j)
+        free(loaded[j].p);
+
+    free(buffer);
 
     if (tiff) TIFFClose(tiff);
+
+    SDL_DestroyMutex(mutex);
 }
 
 //------------------------------------------------------------------------------
 
-/// Decode the raw data in the current page cache, returning a pixel value.
+// Decode texel t of a BC4 block, or of the first half of a BC5 block.
+
+static float bc4(const uint8 *p, int t)
+{
+    const int a = p[0];
+    const int b = p[1];
+
+    uint64 m = 0;
+
+    for (int k = 0; k < 6; ++k)
+        m |= uint64(p[2 + k]) << (8 * k);
+
+    const int j = int(m >> (3 * t)) & 7;
+
+    if      (j == 0) return a / 255.f;
+    else if (j == 1) return b / 255.f;
+    else if (a > b)  return ((8 - j) * a + (j - 1) * b) / 7.f / 255.f;
+    else if (j == 6) return 0.f;
+    else if (j == 7) return 1.f;
+    else             return ((6 - j) * a + (j - 1) * b) / 5.f / 255.f;
+}
+
+// Decode the red component of texel t of a BC1 block.
+
+static float bc1(const uint8 *p, int t)
+{
+    const int a = (p[0] | (p[1] << 8));
+    const int b = (p[2] | (p[3] << 8));
+    const int j = (p[4 + t / 4] >> (2 * (t % 4))) & 3;
+
+    const float r0 = ((a >> 11) & 31) / 31.f;
+    const float r1 = ((b >> 11) & 31) / 31.f;
+
+    if      (j == 0) return r0;
+    else if (j == 1) return r1;
+    else if (a > b)  return (j == 2) ? (2 * r0 + r1) / 3 : (r0 + 2 * r1) / 3;
+    else             return (j == 2) ? (r0 + r1) / 2 : 0.f;
+}
+
+/// Decode the raw data of a page, returning a pixel value. A block-compressed
+/// page is decoded one texel at a time.
 ///
+/// @param d page data
 /// @param y pixel row
 /// @param x pixel column
 
-float scm_sample::lookup(int y, int x) const
+float scm_sample::lookup(const uint8 *d, int y, int x) const
 {
     int w = file->get_w();
     int c = file->get_c();
 
+    if (uint16 e = file->get_e())
+    {
+        const uint8 *p = d + ((w / 4) * (y / 4) + (x / 4)) * scm_block_size(e);
+        const int    t = (y % 4) * 4 + (x % 4);
+
+        return (e == 1) ? bc1(p, t) : bc4(p, t);
+    }
+
     switch (file->get_b())
     {
-        case  8: return ((unsigned char  *) last_p)[(w * y + x) * c] /   255.f;
-        case 16: return ((unsigned short *) last_p)[(w * y + x) * c] / 65535.f;
-        case 32: return ((         float *) last_p)[(w * y + x) * c];
+        case  8: return ((const unsigned char  *) d)[(w * y + x) * c] /   255.f;
+        case 16: return ((const unsigned short *) d)[(w * y + x) * c] / 65535.f;
+        case 32: return ((const          float *) d)[(w * y + x) * c];
         default: return 1.f;
     }
 }
 
+/// Decode the raw data of a page to a new array of one float per pixel.
+
+float *scm_sample::decode(const uint8 *d) const
+{
+    const int w = file->get_w();
+    const int h = file->get_h();
+
+    float *p;
+
+    if ((p = (float *) malloc(size_t(w) * size_t(h) * sizeof (float))))
+        for (int y = 0; y < h; ++y)
+            for (int x = 0; x < w; ++x)
+                p[w * y + x] = lookup(d, y, x);
+
+    return p;
+}
+
+/// Return the size in bytes of the raw data of a page, along with the image
+/// parameters by which it is read. A block-compressed page is read as an
+/// image of blocks.
+
+size_t scm_sample::count(int& W, int& H, int& C, int& B) const
+{
+    const int e = file->get_e();
+
+    W = e ? file->get_w() / 4    : file->get_w();
+    H = e ? file->get_h() / 4    : file->get_h();
+    C = e ? scm_block_size(e)    : file->get_c();
+    B = e ? 8                    : file->get_b();
+
+    return size_t(W) * size_t(H) * size_t(C) * size_t(B) / 8;
+}
+
+/// Sample a decoded page with linear filtering.
+///
+/// @param p decoded page
+/// @param y page row coordinate in [0, 1)
+/// @param x page column coordinate in [0, 1)
+
+float scm_sample::filter(const float *p, double y, double x) const
+{
+    const int w = file->get_w();
+
+    // Convert the page coordinate to a pixel coordinate, skipping the border.
+
+    double r = y * (file->get_h() - 2.0) + 0.5;
+    double c = x * (file->get_w() - 2.0) + 0.5;
+
+    int r0 = int(floor(r)), r1 = r0 + 1;
+    int c0 = int(floor(c)), c1 = c0 + 1;
+
+    double rr = r - floor(r);
+    double cc = c - floor(c);
+
+    return float(lerp(lerp(p[w * r0 + c0], p[w * r0 + c1], cc),
+                      lerp(p[w * r1 + c0], p[w * r1 + c1], cc), rr));
+}
+
+//------------------------------------------------------------------------------
+
+/// Load and decode the page at offset o in the render thread. Read the page
+/// in place if the file is mapped, or through this sampler's own TIFF handle.
+/// That handle is opened as the loaders open theirs, so a remote file is read
+/// through its source. @see scm_file::open_tiff
+
+float *scm_sample::fetch(long long i, uint64 o)
+{
+    int W, H, C, B;
+
+    const size_t S = count(W, H, C, B);
+
+    if (const void *d = file->get_page_data(o, W, H, C, B))
+        return decode((const uint8 *) d);
+
+    if (!tried)
+    {
+        tiff  = file->open_tiff();
+        tried = true;
+    }
+    if (buffer == 0) buffer = (uint8 *) malloc(S);
+
+    if (tiff && buffer)
+        if (scm_load_page(file->get_path(), i, tiff, o, W, H, C, B, buffer))
+            return decode(buffer);
+
+    return 0;
+}
+
+/// Queue page i at offset o for loading by the loader pool, unless it is
+/// already queued. If the queue is full, the oldest request is dropped, as
+/// the newest are most likely to be sampled again.
+
+void scm_sample::ask(long long i, uint64 o)
+{
+    if (pending.find(o) == pending.end())
+    {
+        request r;
+
+        r.i = i;
+        r.o = o;
+        r.p = 0;
+
+        SDL_LockMutex(mutex);
+        {
+            if (int(queue.size()) >= cache_pages)
+            {
+                pending.erase(queue.front().o);
+                queue.erase(queue.begin());
+            }
+            queue.push_back(r);
+        }
+        SDL_UnlockMutex(mutex);
+
+        pending.insert(o);
+        loader->post();
+    }
+}
+
+/// Move all pages decoded by the loader pool into the cache. A page that
+/// failed to load is cached as empty so that it is not requested again.
+
+void scm_sample::update()
+{
+    std::vector<request> v;
+
+    SDL_LockMutex(mutex);
+    v.swap(loaded);
+    SDL_UnlockMutex(mutex);
+
+    for (size_t j = 0; j < v.size(); ++j)
+    {
+        pending.erase(v[j].o);
+
+        if (pages.find(v[j].o) == pages.end())
+        {
+            pages[v[j].o].p = v[j].p;
+            pages[v[j].o].t = time;
+        }
+        else free(v[j].p);
+    }
+}
+
+/// Release least-recently used pages until the cache is within its capacity.
+/// Pages used by the current batch are retained regardless.
+
+void scm_sample::evict()
+{
+    while (int(pages.size()) > cache_pages)
+    {
+        page_i j = pages.begin();
+
+        for (page_i i = pages.begin(); i != pages.end(); ++i)
+            if (i->second.t < j->second.t)
+                j = i;
+
+        if (j->second.t < time)
+        {
+            free(j->second.p);
+            pages.erase(j);
+        }
+        else break;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+/// Return true if any page requests await the loader pool.
+
+bool scm_sample::is_pending()
+{
+    bool b;
+
+    SDL_LockMutex(mutex);
+    b = !queue.empty();
+    SDL_UnlockMutex(mutex);
+
+    return b;
+}
+
+/// Load and decode the most recently requested page on behalf of loader
+/// worker k. This is called by the loader pool when it has no page tasks.
+/// @see scm_loader::run
+
+void scm_sample::service(int k)
+{
+    request r;
+    bool    b = false;
+
+    SDL_LockMutex(mutex);
+    if (!queue.empty())
+    {
+        r = queue.back();
+        queue.pop_back();
+        b = true;
+    }
+    SDL_UnlockMutex(mutex);
+
+    if (b)
+    {
+        int W, H, C, B;
+
+        if (uint8 *d = (uint8 *) malloc(count(W, H, C, B)))
+        {
+            if (file->read_page(k, r.i, r.o, W, H, C, B, d))
+                r.p = decode(d);
+
+            free(d);
+        }
+
+        SDL_LockMutex(mutex);
+        loaded.push_back(r);
+        SDL_UnlockMutex(mutex);
+    }
+}
+
+//------------------------------------------------------------------------------
+
 /// Perform a sample along a vector
 ///
-/// Seek the deepest page that contains the given vector and return a linearly-
-/// filtered sample of it. In the interest of performance, cache the page and
-/// cache the most recent result. In the interest of minimizing latency, read
-/// only a single scanline at a time.
+/// Walk down the pages that contain the given vector, noting the deepest page
+/// and the deepest resident page. If the deepest page is resident, or if the
+/// sample is synchronous, return a linearly-filtered sample of it. Otherwise
+/// request it and sample the deepest resident page instead, or return the
+/// middle of the deepest page's bounds if none is resident.
 ///
 /// @param v Vector from the center of the sphere to the sample point
+/// @param b Load the deepest page in this thread if it is not resident
 
-float scm_sample::get(const double *v)
+float scm_sample::sample(const double *v, bool b)
 {
-    if (file && tiff)
+    // Locate the face and coordinates of vector v.
+
+    long long a;
+    double    y;
+    double    x;
+
+    scm_locate(&a, &y, &x, v);
+    x = 1 - x;
+
+    // Find the deepest page and the deepest resident page.
+
+    long long i1 = -1, i0 = -1;
+    long long n1 =  0, n0 =  0;
+    uint64    o1 =  0;
+    page_i    j0 = pages.end();
+
+    for (long long n = 1, l = 0; l < 30; l++, n *= 2)
+    {
+        long long i = scm_page_index(a, l, int(n * y), int(n * x));
+        uint64    o = file->get_page_offset(i);
+
+        if (o == 0)
+            break;
+
+        page_i j = pages.find(o);
+
+        if (j != pages.end() && j->second.p)
+        {
+            j0 = j;
+            i0 = i;
+            n0 = n;
+        }
+        i1 = i;
+        n1 = n;
+        o1 = o;
+    }
+
+    if (i1 < 0)
+        return 1.f;
+
+    // Load the deepest page now, if required.
+
+    if (i1 != i0 && b && pages.find(o1) == pages.end())
     {
-        if (v[0] != last_v[0] || v[1] != last_v[1] || v[2] != last_v[2])
+        pages[o1].p = fetch(i1, o1);
+        pages[o1].t = time;
+
+        if (pages[o1].p)
         {
-            // Locate the face and coordinates of vector v.
+            j0 = pages.find(o1);
+            i0 = i1;
+            n0 = n1;
+        }
+    }
+    else if (i1 != i0 && pages.find(o1) == pages.end())
+        ask(i1, o1);
+
+    // Sample the best page available.
 
-            long long a;
-            double    y;
-            double    x;
+    if (i0 >= 0)
+    {
+        j0->second.t = time;
 
-            scm_locate(&a, &y, &x, v);
-            x = 1 - x;
+        return filter(j0->second.p, y * n0 - floor(y * n0),
+                                    x * n0 - floor(x * n0));
+    }
+    else
+    {
+        float r0;
+        float r1;
 
-            // Find the deepest page covering this location.
+        file->get_page_bounds(i1, r0, r1);
 
-            uint64 o = file->find_page(a, y, x);
+        return (r0 + r1) / 2;
+    }
+}
 
-            // Convert the root face coordinate to a local face coordinate.
+/// Perform a batch of samples
+///
+/// Take n vectors from the center of the sphere and return n sample values.
+/// If b is true, any page needed is loaded in the calling thread, and each
+/// result is exact. If b is false, no data is accessed in the calling thread.
+/// Each result is taken from the deepest page resident, and missing pages are
+/// queued for the loader threads. Samples repeated in later frames refine as
+/// those pages arrive.
+///
+/// @param v Array of n vectors
+/// @param k Array of n results
+/// @param n Vector count
+/// @param b Synchronous flag
 
-            double r = y * (file->get_h() - 2.0) + 0.5;
-            double c = x * (file->get_w() - 2.0) + 0.5;
+void scm_sample::get(const double *v, float *k, int n, bool b)
+{
+    update();
 
-            int r0 = int(floor(r)), r1 = r0 + 1;
-            int c0 = int(floor(c)), c1 = c0 + 1;
+    time++;
 
-            tsize_t i0 = TIFFComputeStrip(tiff, r0, 0);
-            tsize_t i1 = TIFFComputeStrip(tiff, r1, 0);
+    for (int j = 0; j < n; ++j)
+        k[j] = sample(v + 3 * j, b);
 
-            // If the required page is not current, set it.
+    evict();
+}
 
-            if (last_o != o)
-            {
-                if (TIFFSetSubDirectory(tiff, o))
-                {
-                    last_i0 = (tsize_t) -1;
-                    last_i1 = (tsize_t) -1;
-                    last_o  = o;
-                }
-            }
+/// Perform a synchronous sample along a vector, caching the most recent
+/// result. A page not resident is loaded in the calling thread, which blocks
+/// until it is read. @see get
+///
+/// @param v Vector from the center of the sphere to the sample point
 
-            // If the required data is not cached, load it.
+float scm_sample::get(const double *v)
+{
+    if (v[0] != last_v[0] || v[1] != last_v[1] || v[2] != last_v[2])
+    {
+        get(v, &last_k, 1, true);
 
-            if (last_o == o)
-            {
-                if (last_i0 != i0 || last_i1 != i1)
-                {
-                    tsize_t S = TIFFStripSize(tiff);
-
-                    if (i0 == i1)
-                        TIFFReadEncodedStrip(tiff, i0, last_p + i0 * S, S);
-                    else
-                    {
-                        TIFFReadEncodedStrip(tiff, i0, last_p + i0 * S, S);
-                        TIFFReadEncodedStrip(tiff, i1, last_p + i1 * S, S);
-                    }
-                    last_i0 = i0;
-                    last_i1 = i1;
-                }
-
-                if (last_i0 == i0 && last_i1 == i1)
-                {
-                    // Sample the cache with linear filtering.
-
-                    float s00 = lookup(r0, c0);
-                    float s01 = lookup(r0, c1);
-                    float s10 = lookup(r1, c0);
-                    float s11 = lookup(r1, c1);
-
-                    double rr = r - floor(r);
-                    double cc = c - floor(c);
-
-                    // Cache the request and its result.
-
-                    last_v[0] = v[0];
-                    last_v[1] = v[1];
-                    last_v[2] = v[2];
-                    last_k    = float(lerp(lerp(s00, s01, cc),
-                                           lerp(s10, s11, cc), rr));
-                }
-            }
-        }
+        last_v[0] = v[0];
+        last_v[1] = v[1];
+        last_v[2] = v[2];
     }
     return last_k;
 }
 
 //------------------------------------------------------------------------------
-
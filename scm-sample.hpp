@@ -14,12 +14,19 @@
 #define SCM_SAMPLE_HPP
 
 #include <string>
+#include <vector>
+#include <set>
+#include <map>
+
+#include <SDL.h>
+#include <SDL_thread.h>
 
 #include <tiffio.h>
 
 //------------------------------------------------------------------------------
 
 class scm_file;
+class scm_loader;
 
 //------------------------------------------------------------------------------
 
@@ -32,35 +39,83 @@ class scm_file;
 /// decompressors into the VRAM texture cache via asynchronous transfer.
 ///
 /// Unfortunately, collision detection requires that the main CPU thread have
-/// knowledge of SCM height data. This object provides that knowledge. Sadly,
-/// data access incurs latency, and the main thread is also the render thread,
-/// so collision detection has the potential to delay the generation of the
-/// frame, running contrary to the spirit of the entire library.
+/// knowledge of SCM height data. This object provides that knowledge. Sampled
+/// pages are decoded to floating point and retained in a cache of cache_pages
+/// pages, released least-recently used first.
 ///
-/// It's a necessary evil.
+/// A synchronous sample loads any page it lacks in the render thread, which
+/// has the potential to delay the generation of the frame. This remains so for
+/// the single-vector get, through which scm_state::get_current_ground serves
+/// collision detection and which must give the exact value. Only the batch get
+/// may be made asynchronous, and a render thread that must never block upon
+/// the disk should sample by that alone. An asynchronous sample never touches
+/// the disk. It returns the deepest resident page, or the page bounds if none
+/// is resident, and queues the page it lacks. The loader threads service that
+/// queue when they have no page tasks, so that later samples refine as pages
+/// arrive. @see scm_loader::run
 
 class scm_sample
 {
 public:
 
-    scm_sample(scm_file *);
+    static int cache_pages;
+
+    scm_sample(scm_file *, scm_loader *);
    ~scm_sample();
 
     float get(const double *);
+    void  get(const double *, float *, int, bool);
 
-private:
+    bool  is_pending();
+    void  service(int);
 
-    float lookup(int, int) const;
-
-    TIFF     *tiff;
-    scm_file *file;
+private:
 
-    double  last_v[3];  // Sample cache last vector
-    float   last_k;     // Sample cache last value
-    uint64  last_o;     // Sample cache last page offset
-    tsize_t last_i0;    // Sample cache last strip
-    tsize_t last_i1;    // Sample cache last strip
-    uint8  *last_p;     // Sample cache last page buffer
+    // A decoded page with its last-used time, and a page load request.
+
+    struct page
+    {
+        float *p;
+        int    t;
+    };
+
+    struct request
+    {
+        long long i;
+        uint64    o;
+        float    *p;
+    };
+
+    typedef std::map<uint64, page> page_m;
+    typedef page_m::iterator       page_i;
+
+    SDL_mutex            *mutex;
+    std::vector<request>  queue;    // Pages requested, guarded by mutex
+    std::vector<request>  loaded;   // Pages decoded, guarded by mutex
+
+    page_m                pages;    // Resident pages by offset
+    std::set<uint64>      pending;  // Pages requested but not yet resident
+    int                   time;
+
+    TIFF       *tiff;
+    bool        tried;      // TIFF open attempted
+    scm_file   *file;
+    scm_loader *loader;
+    uint8      *buffer;
+
+    double      last_v[3];  // Sample cache last vector
+    float       last_k;     // Sample cache last value
+
+    float  sample(const double *, bool);
+    float  filter(const float *, double, double) const;
+    float  lookup(const uint8 *, int, int)       const;
+    float *decode(const uint8 *)                 const;
+    size_t  count(int&, int&, int&, int&)        const;
+
+    float *fetch  (long long, uint64);
+    void   ask    (long long, uint64);
+    void   update();
+    void   evict ();
 };
 
 //------------------------------------------------------------------------------
@@ -16,6 +16,7 @@
 #include "scm-system.hpp"
 #include "scm-image.hpp"
 #include "scm-label.hpp"
+#include "scm-trace.hpp"
 #include "scm-log.hpp"
 
 //------------------------------------------------------------------------------
@@ -23,10 +24,9 @@
 /// Create a new SCM scene for use in the given SCM system.
 
 scm_scene::scm_scene(scm_system *sys) :
-    sys(sys), label(0), color(0xFFBF00FF), clear(0x00000000)
+    sys(sys), label(0), ready(false), color(0xFFBF00FF), clear(0x00000000),
+    ipages(GL_INVALID_INDEX)
 {
-    memset(&render, 0, sizeof (glsl));
-
     atmo.c[0] = 1;
     atmo.c[1] = 1;
     atmo.c[2] = 1;
@@ -137,35 +137,29 @@ void scm_scene::set_label(const std::string &s)
     label_file = s;
 }
 
-/// Set the vertex shader and reinitialize the uniforms
+/// Set the vertex shader. The program is rebuilt before the scene is next
+/// drawn. @see is_ready
 ///
 /// @param s GLSL vertex shader source (*not* file name)
 
 void scm_scene::set_vert(const std::string &s)
 {
     vert_file = s;
-
-    glsl_delete(&render);
-
-    if (!vert_file.empty() && !frag_file.empty())
-        glsl_source(&render, vert_file.c_str(), -1, frag_file.c_str(), -1);
-
+    program.set_source(vert_file, frag_file);
+    ready = false;
     init_uniforms();
 }
 
-/// Set the fragment shader and reinitialize the uniforms
+/// Set the fragment shader. The program is rebuilt before the scene is next
+/// drawn. @see is_ready
 ///
 /// @param s GLSL fragment shader source (*not* file name)
 
 void scm_scene::set_frag(const std::string &s)
 {
     frag_file = s;
-
-    glsl_delete(&render);
-
-    if (!vert_file.empty() && !frag_file.empty())
-        glsl_source(&render, vert_file.c_str(), -1, frag_file.c_str(), -1);
-
+    program.set_source(vert_file, frag_file);
+    ready = false;
     init_uniforms();
 }
 
@@ -180,30 +174,61 @@ void scm_scene::set_atmo(const scm_atmo& A)
 
 //------------------------------------------------------------------------------
 
-/// Request and store the uniform locations for the current program.
+/// Store the uniform locations of the current program, taken from its table.
+/// Until the program is ready, every location is -1.
 
 void scm_scene::init_uniforms()
 {
-    if (render.program)
+    const GLuint p = program.get_program();
+
+    ipages = GL_INVALID_INDEX;
+
+    for (int j = 0; j < get_image_count(); ++j)
+        images[j]->init_uniforms(program);
+
+    for (int d = 0; d < 16; d++)
     {
-        for (int j = 0; j < get_image_count(); ++j)
-            images[j]->init_uniforms(render.program);
+        uA[d] = program.get_uniform("A[%d]", d);
+        uB[d] = program.get_uniform("B[%d]", d);
+    }
+    uM           = program.get_uniform("M");
+    uzoomv       = program.get_uniform("zoomv");
+    uzoomk       = program.get_uniform("zoomk");
+    urange       = program.get_uniform("range");
+    upage_first  = program.get_uniform("page_first");
+    upage_stride = program.get_uniform("page_stride");
+
+    // A storage block of page records enables batched drawing, given the
+    // draw index by which the vertex shader selects each page's record.
+
+    if (p && GLEW_ARB_shader_storage_buffer_object &&
+             GLEW_ARB_multi_draw_indirect &&
+             GLEW_ARB_shader_draw_parameters)
+    {
+        ipages = glGetProgramResourceIndex(p, GL_SHADER_STORAGE_BLOCK, "pages");
 
-        for (int d = 0; d < 16; d++)
-        {
-            uA[d] = glsl_uniform(render.program, "A[%d]", d);
-            uB[d] = glsl_uniform(render.program, "B[%d]", d);
-        }
-        uM     = glsl_uniform(render.program, "M");
-        uzoomv = glsl_uniform(render.program, "zoomv");
-        uzoomk = glsl_uniform(render.program, "zoomk");
-        urange = glsl_uniform(render.program, "range");
+        if (ipages != GL_INVALID_INDEX)
+            glShaderStorageBlockBinding(p, ipages, 0);
     }
 }
 
-/// Render the labels for this scene, if any.
+/// Return true if the program is ready for drawing, building it now if it was
+/// not built in the background, and resolving the uniforms once it is.
 
-void scm_scene::draw_label()
+bool scm_scene::is_ready()
+{
+    if (!ready && program.is_ready())
+    {
+        ready = true;
+        init_uniforms();
+    }
+    return ready;
+}
+
+/// Render the labels for this scene, if any, in the pages drawn by the given
+/// sphere. @see scm_label::draw
+
+void scm_scene::draw_label(const scm_sphere *sphere, int channel)
 {
     if (label)
     {
@@ -212,7 +237,10 @@ void scm_scene::draw_label()
         GLubyte b = (color & 0x0000FF00) >>  8;
         GLubyte a = (color & 0x000000FF) >>  0;
 
-        label->draw(r, g, b, a);
+        scm_trace::scope     trace("label");
+        scm_trace::gpu_scope trace_gpu("label");
+
+        label->draw(r, g, b, a, sphere, this, channel);
     }
 }
 
@@ -223,11 +251,11 @@ void scm_scene::bind(int channel) const
 {
     GLenum unit = 0;
 
-    glUseProgram(render.program);
+    glUseProgram(program.get_program());
 
     for (int j = 0; j < get_image_count(); ++j)
         if (images[j]->is_channel(channel))
-            images[j]->bind(unit++, render.program);
+            images[j]->bind(unit++, program.get_program());
 
     glActiveTexture(GL_TEXTURE0);
 }
@@ -256,7 +284,7 @@ void scm_scene::bind_page(int channel, int depth, int frame, long long i) const
 {
     for (int j = 0; j < get_image_count(); ++j)
         if (images[j]->is_channel(channel))
-            images[j]->bind_page(render.program, depth, frame, i);
+            images[j]->bind_page(program.get_program(), depth, frame, i);
 }
 
 /// Unbind a page in each image matching a channel. @see scm_image::unbind_page
@@ -265,7 +293,7 @@ void scm_scene::unbind_page(int channel, int depth) const
 {
     for (int j = 0; j < get_image_count(); ++j)
         if (images[j]->is_channel(channel))
-            images[j]->unbind_page(render.program, depth);
+            images[j]->unbind_page(program.get_program(), depth);
 }
 
 /// Touch a page in each image matching a channel. @see scm_image::touch_page
@@ -282,6 +310,66 @@ void scm_scene::touch_page(int channel, int frame, long long i) const
 #endif
 }
 
+/// Ask for a page expected soon in each image matching a channel. Return the
+/// number of those images in which the page is not yet resident.
+/// @see scm_image::ask_page
+
+int scm_scene::ask_page(int channel, int frame, long long i) const
+{
+    int c = 0;
+
+    for (int j = 0; j < get_image_count(); ++j)
+        if (images[j]->is_channel(channel) && !images[j]->ask_page(frame, i))
+            c++;
+
+    return c;
+}
+
+/// Return the number of images matching a channel, being the number of texture
+/// units bound and the number of image records per page of a batched draw.
+
+int scm_scene::get_channel_count(int channel) const
+{
+    int c = 0;
+
+    for (int j = 0; j < get_image_count(); ++j)
+        if (images[j]->is_channel(channel))
+            c++;
+
+    return c;
+}
+
+/// Return true if the program reads its page records from a storage block, and
+/// no image needs the per-page uniforms that the records lack.
+/// @see scm_image::is_normalized
+
+bool scm_scene::is_batched() const
+{
+    if (ipages == GL_INVALID_INDEX)
+        return false;
+
+    for (int j = 0; j < get_image_count(); ++j)
+        if (images[j]->is_normalized())
+            return false;
+
+    return true;
+}
+
+/// Compute the page record of each image matching a channel, as bind_page
+/// would give its uniforms, storing four values per image in texture unit
+/// order. @see scm_image::get_page_record
+
+void scm_scene::get_page_record(int channel, int frame,
+                                long long i, GLfloat *v) const
+{
+    for (int j = 0; j < get_image_count(); ++j)
+        if (images[j]->is_channel(channel))
+        {
+            images[j]->get_page_record(frame, i, v);
+            v += 4;
+        }
+}
+
 //------------------------------------------------------------------------------
 
 /// Sample the height image at the given location.
@@ -298,6 +386,30 @@ float scm_scene::get_current_ground(const double *v) const
     return 1.f;
 }
 
+/// Sample the height image at each of n locations. If b is false, sample
+/// without blocking the render thread upon data access, giving the best data
+/// currently held and refining as data arrives. This suits many moving
+/// objects queried every frame. @see scm_sample::get
+///
+/// @param v Array of n vectors from the center of the planet.
+/// @param k Array of n results.
+/// @param n Vector count.
+/// @param b Synchronous flag.
+
+void scm_scene::get_current_ground(const double *v, float *k, int n,
+                                   bool b) const
+{
+    for (int j = 0; j < get_image_count(); ++j)
+        if (images[j]->is_height())
+        {
+            images[j]->get_page_samples(v, k, n, b);
+            return;
+        }
+
+    for (int j = 0; j < n; ++j)
+        k[j] = 1.f;
+}
+
 /// Return the smallest value in the height image.
 /// @see scm_system::get_minimum_ground
 
@@ -342,3 +454,47 @@ bool scm_scene::get_page_status(int channel, long long i) const
 }
 
 //------------------------------------------------------------------------------
+
+/// Append the file index of each image giving the status or bounds of pages of
+/// a channel, being the images of that channel and the height image. Return
+/// true if all of these files are open. @see scm_cull
+
+bool scm_scene::get_page_files(int channel, std::vector<int>& f) const
+{
+    bool b = true;
+
+    for (int j = 0; j < get_image_count(); ++j)
+        if (images[j]->is_channel(channel) || images[j]->is_height())
+        {
+            f.push_back(images[j]->get_index());
+
+            if (!images[j]->is_ready())
+                b = false;
+        }
+
+    return b;
+}
+
+/// Append the index of each page in the catalogs of the images giving the
+/// status or bounds of pages of a channel. Return false if any image of the
+/// channel gives every page, in which case all pages are present.
+/// @see scm_image::get_page_catalog
+
+bool scm_scene::get_page_catalog(int channel, std::vector<long long>& v) const
+{
+    bool b = true;
+
+    for (int j = 0; j < get_image_count(); ++j)
+    {
+        if (images[j]->is_channel(channel))
+        {
+            if (!images[j]->get_page_catalog(v))
+                b = false;
+        }
+        else if (images[j]->is_height())
+            images[j]->get_page_catalog(v);
+    }
+    return b;
+}
+
+//------------------------------------------------------------------------------
@@ -16,12 +16,13 @@
 #include <vector>
 #include <string>
 
-#include "util3d/glsl.h"
+#include "scm-program.hpp"
 
 //------------------------------------------------------------------------------
 
 class scm_system;
 class scm_label;
+class scm_sphere;
 class scm_image;
 
 typedef std::vector<scm_image *>                 scm_image_v;
@@ -56,6 +57,14 @@ struct scm_atmo
 /// vertex and fragment shaders that reference and render them. In addition,
 /// an scm_label gives annotations and a name string allows a scene to be
 /// requested by name.
+///
+/// A vertex shader may receive its per-page parameters from a storage block
+/// named "pages" rather than from uniforms, allowing the sphere to draw all
+/// pages in a few indirect draw calls. @see scm_sphere::set_batched
+///
+/// The program is built when the scene is first drawn, or in the background
+/// as soon as both shaders are given, and the scene is not drawn until it is
+/// ready. Its uniform locations are then resolved. @see scm_program
 
 class scm_scene
 {
@@ -101,7 +110,8 @@ public:
     /// @{
 
     void   init_uniforms();
-    void   draw_label();
+    bool   is_ready();
+    void   draw_label(const scm_sphere *, int);
 
     void   bind(int) const;
     void unbind(int) const;
@@ -109,13 +119,22 @@ public:
     void   bind_page(int, int, int, long long) const;
     void unbind_page(int, int)                 const;
     void  touch_page(int,      int, long long) const;
+    int     ask_page(int,      int, long long) const;
+
+    int     get_channel_count(int)                      const;
+    void    get_page_record  (int, int, long long, GLfloat *) const;
+    bool     is_batched() const;
 
     float   get_minimum_ground()               const;
     float   get_current_ground(const double *) const;
+    void    get_current_ground(const double *, float *, int, bool) const;
 
     void    get_page_bounds(int, long long, float&, float &) const;
     bool    get_page_status(int, long long)                  const;
 
+    bool    get_page_files  (int, std::vector<int>&)       const;
+    bool    get_page_catalog(int, std::vector<long long>&) const;
+
     /// @}
 
 private:
@@ -130,7 +149,8 @@ private:
     scm_atmo    atmo;
     scm_label  *label;
     scm_image_v images;
-    glsl        render;
+    scm_program program;
+    bool        ready;
     GLuint      color;
     GLuint      clear;
 
@@ -144,6 +164,10 @@ private:
     GLint uzoomv;
     GLint uzoomk;
     GLint urange;
+    GLint upage_first;
+    GLint upage_stride;
+
+    GLuint ipages;
 };
 
 //------------------------------------------------------------------------------
@@ -0,0 +1,120 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#include <algorithm>
+
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+#include "scm-search.hpp"
+
+//------------------------------------------------------------------------------
+
+/// Build the separator tree of the sorted array v of n unique keys.
+
+scm_search::scm_search(const uint64 *v, uint64 n) : v(v), n(n)
+{
+    const uint64 m = (n + block_size - 1) / block_size;
+
+    // Position 0 is unused, so that the children of k are 2k and 2k + 1.
+
+    e.resize(size_t(m + 1), 0);
+    r.resize(size_t(m + 1), 0);
+
+    build(0, 1);
+}
+
+// Fill the subtree at Eytzinger position k with separators in order, beginning
+// with block j. Return the next block.
+
+uint64 scm_search::build(uint64 j, uint64 k)
+{
+    if (k < e.size())
+    {
+        j = build(j, 2 * k);
+
+        e[size_t(k)] = v[j * block_size];
+        r[size_t(k)] = j++;
+
+        j = build(j, 2 * k + 1);
+    }
+    return j;
+}
+
+//------------------------------------------------------------------------------
+
+/// Return the position of key x in the array, or -1 if absent. This gives the
+/// same result as a binary search in all cases.
+
+uint64 scm_search::find(uint64 x) const
+{
+    const uint64 m = uint64(e.size()) - 1;
+
+    if (m == 0)
+        return (uint64) (-1);
+
+    // Descend to the first separator greater than x. Its position k is found
+    // by discarding the trailing right turns of the descent, and is 0 if x
+    // exceeds all separators.
+
+    uint64 k = 1;
+
+    while (k <= m)
+    {
+#ifdef __GNUC__
+        __builtin_prefetch(&e.front() + std::min(16 * k, m));
+#endif
+        k = 2 * k + (e[size_t(k)] <= x);
+    }
+    while (k & 1)
+        k >>= 1;
+
+    k >>= 1;
+
+    // x lies in the block preceding that separator, or in the last block.
+
+    uint64 b = k ? r[size_t(k)] : m;
+
+    if (b == 0)
+        return (uint64) (-1);
+
+    const uint64 j0 = (b - 1) * block_size;
+    const uint64 j1 = std::min(j0 + block_size, n);
+
+    // Count the keys of the block less than x.
+
+    uint64 c = 0;
+    uint64 j = j0;
+
+#ifdef __SSE4_2__
+    const __m128i s = _mm_set1_epi64x((long long) 0x8000000000000000ULL);
+    const __m128i y = _mm_xor_si128(_mm_set1_epi64x((long long) x), s);
+
+    for (; j + 2 <= j1; j += 2)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *) (v + j));
+        __m128i g = _mm_cmpgt_epi64(y, _mm_xor_si128(a, s));
+        int     t = _mm_movemask_pd(_mm_castsi128_pd(g));
+
+        c += uint64((t & 1) + (t >> 1));
+    }
+#endif
+    for (; j < j1; ++j)
+        c += (v[j] < x);
+
+    const uint64 p = j0 + c;
+
+    return (p < n && v[p] == x) ? p : (uint64) (-1);
+}
+
+//------------------------------------------------------------------------------
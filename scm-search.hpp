@@ -0,0 +1,56 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#ifndef SCM_SEARCH_HPP
+#define SCM_SEARCH_HPP
+
+#include <vector>
+
+#include <tiffio.h>
+
+//------------------------------------------------------------------------------
+
+/// An scm_search finds keys in a sorted array of unique 64-bit keys
+///
+/// A binary search of a large array misses the cache at nearly every step. To
+/// avoid this, every block_size-th key is sampled into a small tree of
+/// separators stored in Eytzinger (breadth-first) order. The top levels of the
+/// tree share a few cache lines, and the children of each node are adjacent,
+/// so they may be prefetched several levels ahead. The descent is branch-free
+/// and ends at one block of the original array, which is scanned with a
+/// branch-free count, vectorized where SSE4.2 is available. The array itself
+/// is neither copied nor modified, so it may reside in a read-only mapping.
+
+class scm_search
+{
+public:
+
+    scm_search(const uint64 *, uint64);
+
+    uint64 find(uint64) const;
+
+    static const int block_size = 16;
+
+private:
+
+    const uint64 *v;        ///< Sorted key array
+    uint64        n;        ///< Sorted key count
+
+    std::vector<uint64> e;  ///< Block separators in Eytzinger order
+    std::vector<uint64> r;  ///< Block of each separator
+
+    uint64 build(uint64, uint64);
+};
+
+//------------------------------------------------------------------------------
+
+#endif
@@ -11,6 +11,7 @@
 // more details.
 
 #include <GL/glew.h>
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 
@@ -19,36 +20,99 @@
 
 //------------------------------------------------------------------------------
 
+/// Create an empty page set.
+
+scm_set::scm_set() : head(-1), tail(-1), spare(-1)
+{
+}
+
 /// Search for the given page in this page set. If found, update the page entry
 /// with the current time t to indicate recent use.
 
 scm_page scm_set::search(scm_page page, int t)
 {
-    std::map<scm_page, int>::iterator i = m.find(page);
-
-    if (i != m.end())
+    if (int *k = m.search(page.f, page.i))
     {
-        scm_page p = i->first;
-
-        remove(p);
-        insert(p, t);
-        return(p);
+        touch(*k, t);
+        return nodes[*k].page;
     }
     return scm_page();
 }
 
-/// Add a page to this set, associated with the current time.
+/// Add a page to this set, associated with the current time. If the page is
+/// already present, update its time. Return the page's node index.
 
-void scm_set::insert(scm_page page, int t)
+int scm_set::insert(scm_page page, int t)
 {
-    m[page] = t;
+    int k;
+
+    if (int *j = m.search(page.f, page.i))
+    {
+        k = *j;
+        touch(k, t);
+    }
+    else
+    {
+        if (spare >= 0)
+        {
+            k     = spare;
+            spare = nodes[k].next;
+        }
+        else
+        {
+            k = int(nodes.size());
+            nodes.push_back(node());
+        }
+
+        nodes[k].page = page;
+        nodes[k].t    = t;
+        nodes[k].heap = int(heap.size());
+
+        heap.push_back(k);
+        up(nodes[k].heap);
+        link(k);
+
+        m.insert(page.f, page.i) = k;
+    }
+    return k;
 }
 
 /// Remove a page from this set.
 
 void scm_set::remove(scm_page page)
 {
-    m.erase(page);
+    if (int *k = m.search(page.f, page.i))
+        erase(*k);
+}
+
+/// Update node k with the current time t to indicate recent use. Return the
+/// time of its previous use.
+
+int scm_set::touch(int k, int t)
+{
+    int u = nodes[k].t;
+
+    unlink(k);
+    nodes[k].t = t;
+    link(k);
+
+    return u;
+}
+
+/// Remove all pages at cache line l or above, appending them to the given
+/// vector. This is a linear scan, for use when a cache shrinks.
+
+void scm_set::remove_lines(int l, std::vector<scm_page>& v)
+{
+    size_t n = v.size();
+
+    for (int k = 0; k < int(nodes.size()); ++k)
+        if (int *j = m.search(nodes[k].page.f, nodes[k].page.i))
+            if (*j == k && nodes[k].page.l >= l)
+                v.push_back(nodes[k].page);
+
+    for (size_t i = n; i < v.size(); ++i)
+        remove(v[i]);
 }
 
 /// Eject a page from this set to accommodate the addition of a new page.
@@ -61,56 +125,149 @@ void scm_set::remove(scm_page page)
 
 scm_page scm_set::eject(int t, long long i)
 {
-    assert(!m.empty());
-
-    // Determine the lowest priority and least-recently used pages.
-
-    std::map<scm_page, int>::iterator a = m.end();
-    std::map<scm_page, int>::iterator l = m.end();
-    std::map<scm_page, int>::iterator e;
-
-    for (e = m.begin(); e != m.end(); ++e)
-    {
-        if (a == m.end() || e->second < a->second) a = e;
-                                                   l = e;
-    }
+    assert(!empty());
 
     // If the LRU page was not used in this scene or the last, eject it.
     // Otherwise consider the lowest-priority loaded page and eject if it
     // has lower priority than the incoming page.
 
-    if (a != m.end() && a->second < t - 2)
+    if (head >= 0 && nodes[head].t < t - 2)
     {
-        scm_page page = a->first;
-        m.erase(a);
+        scm_page page = nodes[head].page;
+        erase(head);
         return page;
     }
-    if (l != m.end() && i < l->first.i)
+    if (!heap.empty() && i < nodes[heap[0]].page.i)
     {
-        scm_page page = l->first;
-        m.erase(l);
+        scm_page page = nodes[heap[0]].page;
+        erase(heap[0]);
         return page;
     }
     return scm_page();
 }
 
+//------------------------------------------------------------------------------
+
+// Link node k into the use list in order of time. Times are normally current,
+// so this is an append, but a time earlier than the newest is walked into
+// place so that the head is always the least-recently used.
+
+void scm_set::link(int k)
+{
+    int j = tail;
+
+    while (j >= 0 && nodes[j].t > nodes[k].t)
+        j = nodes[j].prev;
+
+    nodes[k].prev = j;
+    nodes[k].next = (j >= 0) ? nodes[j].next : head;
+
+    if (nodes[k].next >= 0) nodes[nodes[k].next].prev = k; else tail = k;
+    if (nodes[k].prev >= 0) nodes[nodes[k].prev].next = k; else head = k;
+}
+
+// Unlink node k from the use list.
+
+void scm_set::unlink(int k)
+{
+    if (nodes[k].next >= 0) nodes[nodes[k].next].prev = nodes[k].prev;
+    else                    tail                      = nodes[k].prev;
+    if (nodes[k].prev >= 0) nodes[nodes[k].prev].next = nodes[k].next;
+    else                    head                      = nodes[k].next;
+}
+
+// Return true if heap position a has lower priority than heap position b.
+
+bool scm_set::after(int a, int b) const
+{
+    return nodes[heap[b]].page < nodes[heap[a]].page;
+}
+
+// Exchange heap positions a and b.
+
+void scm_set::swap(int a, int b)
+{
+    std::swap(heap[a], heap[b]);
+
+    nodes[heap[a]].heap = a;
+    nodes[heap[b]].heap = b;
+}
+
+// Sift heap position k toward the root.
+
+void scm_set::up(int k)
+{
+    while (k > 0 && after(k, (k - 1) / 2))
+    {
+        swap(k, (k - 1) / 2);
+        k = (k - 1) / 2;
+    }
+}
+
+// Sift heap position k toward the leaves.
+
+void scm_set::down(int k)
+{
+    for (;;)
+    {
+        int n = int(heap.size());
+        int a = 2 * k + 1;
+        int b = 2 * k + 2;
+        int j = k;
+
+        if (a < n && after(a, j)) j = a;
+        if (b < n && after(b, j)) j = b;
+
+        if (j == k)
+            break;
+
+        swap(k, j);
+        k = j;
+    }
+}
+
+// Remove node k from the list, heap, and index, and recycle it.
+
+void scm_set::erase(int k)
+{
+    int h = nodes[k].heap;
+    int z = int(heap.size()) - 1;
+
+    unlink(k);
+
+    if (h < z)
+    {
+        swap(h, z);
+        heap.pop_back();
+        up  (h);
+        down(h);
+    }
+    else heap.pop_back();
+
+    m.remove(nodes[k].page.f, nodes[k].page.i);
+
+    nodes[k].next = spare;
+    spare         = k;
+}
+
+//------------------------------------------------------------------------------
+
 /// Return true if the set is empty.
 
 bool scm_set::empty() const
 {
-    return m.empty();
+    return (m.size() == 0);
 }
 
 /// Dump the contents of the set to stdout.
 
 void scm_set::dump() const
 {
-    std::map<scm_page, int>::const_iterator i;
-
-    printf("%lu : ", m.size());
+    printf("%d : ", m.size());
 
-    for (i = m.begin(); i != m.end(); ++i)
-        printf("%d/%lld ", i->first.f, i->first.i);
+    for (int k = 0; k < m.capacity(); ++k)
+        if (m.key(k).is_valid())
+            printf("%d/%lld ", m.key(k).f, m.key(k).i);
 
     printf("\n");
 }
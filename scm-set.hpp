@@ -13,9 +13,10 @@
 #ifndef SCM_SET_HPP
 #define SCM_SET_HPP
 
-#include <map>
+#include <vector>
 
 #include "scm-item.hpp"
+#include "scm-table.hpp"
 
 //------------------------------------------------------------------------------
 
@@ -37,14 +38,26 @@ struct scm_page : public scm_item
 
 /// An scm_set represents an a set of active pages, either currently in
 /// a cache or awaiting loading, with associated insertion time.
+///
+/// Entries are held in a recycled node pool. Each node is linked into a list
+/// ordered by time of last use, giving the least-recently used page in O(1),
+/// and into a binary heap ordered by page priority, giving the lowest-priority
+/// page in O(1) and its removal in O(log n). A flat hash table maps pages to
+/// nodes. Search and touch thus neither allocate nor rebalance, and a caller
+/// holding a node index may touch it directly.
 
 class scm_set
 {
 public:
 
+    scm_set();
+
     scm_page search(scm_page, int);
-    void     insert(scm_page, int);
+    int      insert(scm_page, int);
     void     remove(scm_page);
+    int      touch (int, int);
+
+    void     remove_lines(int, std::vector<scm_page>&);
 
     scm_page eject(int, long long);
 
@@ -53,7 +66,32 @@ public:
 
 private:
 
-    std::map<scm_page, int> m;
+    struct node
+    {
+        scm_page page;  // Page entry
+        int      t;     // Time of last use
+        int      prev;  // Previous node in the use list
+        int      next;  // Next node in the use list
+        int      heap;  // Position in the priority heap
+    };
+
+    std::vector<node> nodes;
+    std::vector<int>  heap;
+    scm_table<int>    m;
+
+    int head;  // Least-recently used node
+    int tail;  // Most-recently used node
+    int spare;  // First unused node
+
+    void link  (int);
+    void unlink(int);
+
+    bool after (int, int) const;
+    void swap  (int, int);
+    void up    (int);
+    void down  (int);
+
+    void erase (int);
 };
 
 //------------------------------------------------------------------------------
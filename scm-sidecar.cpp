@@ -0,0 +1,268 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "scm-sidecar.hpp"
+#include "scm-util.hpp"
+#include "scm-log.hpp"
+
+//------------------------------------------------------------------------------
+
+static const uint32 scmx_magic   = 0x584D4353;  // "SCMX" if little endian
+static const uint32 scmx_version = 1;
+
+// Round a byte offset up to the next multiple of 8.
+
+static uint64 align(uint64 o)
+{
+    return (o + 7) & ~uint64(7);
+}
+
+// Return true if n elements of s bytes each, at offset o, lie within z bytes.
+// This is computed so that no corrupt count or offset may overflow it.
+
+static bool within(uint64 o, uint64 n, uint64 s, uint64 z)
+{
+    return (o <= z && s > 0 && n <= (z - o) / s);
+}
+
+// Copy n bytes from p to offset o of buffer v.
+
+static void put(std::vector<uint8>& v, uint64 o, const void *p, uint64 n)
+{
+    if (n > 0)
+        memcpy(&v[size_t(o)], p, size_t(n));
+}
+
+//------------------------------------------------------------------------------
+
+/// Map the sidecar of the named TIFF, if one exists and is current. Check
+/// is_valid to determine the outcome.
+
+scm_sidecar::scm_sidecar(const std::string& path) : data(0), size(0)
+#ifdef WIN32
+    , mapping(0)
+#endif
+{
+    uint64 s;
+    uint64 t;
+
+    if (stat_file(path, s, t))
+        init(path, s, t);
+}
+
+/// Map the sidecar of the named TIFF, if one exists and records the given TIFF
+/// size s and time stamp t.
+
+scm_sidecar::scm_sidecar(const std::string& path, uint64 s, uint64 t) :
+    data(0), size(0)
+#ifdef WIN32
+    , mapping(0)
+#endif
+{
+    init(path, s, t);
+}
+
+// Map and validate the sidecar of the named TIFF of size s and time t.
+
+void scm_sidecar::init(const std::string& path, uint64 s, uint64 t)
+{
+    const std::string name = path + ".scmx";
+
+#ifdef WIN32
+    HANDLE f = CreateFileA(name.c_str(), GENERIC_READ, FILE_SHARE_READ, 0,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    LARGE_INTEGER z;
+
+    if (f != INVALID_HANDLE_VALUE)
+    {
+        if (GetFileSizeEx(f, &z) && z.QuadPart >= LONGLONG(sizeof (header)))
+        {
+            if ((mapping = CreateFileMapping(f, 0, PAGE_READONLY, 0, 0, 0)))
+            {
+                if ((data = (const uint8 *) MapViewOfFile(mapping, FILE_MAP_READ,
+                                                                    0, 0, 0)))
+                    size = uint64(z.QuadPart);
+                else
+                {
+                    CloseHandle(mapping);
+                    mapping = 0;
+                }
+            }
+        }
+        CloseHandle(f);
+    }
+#else
+    int fd = open(name.c_str(), O_RDONLY);
+
+    if (fd >= 0)
+    {
+        struct stat st;
+
+        if (fstat(fd, &st) == 0 && st.st_size >= off_t(sizeof (header)))
+        {
+            void *p = mmap(0, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+
+            if (p != MAP_FAILED)
+            {
+                data = (const uint8 *) p;
+                size = uint64(st.st_size);
+            }
+        }
+        close(fd);
+    }
+#endif
+
+    // Validate the header and array extents.
+
+    if (data)
+    {
+        const header *H = get_header();
+
+        const uint64 b = H->b / 8;
+        const uint64 u = sizeof (uint64);
+
+        if (H->magic   != scmx_magic   ||
+            H->version != scmx_version ||
+            H->size    != s            ||
+            H->time    != t            ||
+            H->xo % u  != 0            ||
+            H->oo % u  != 0            ||
+            !within(H->xo, H->xc, u, size) ||
+            !within(H->oo, H->oc, u, size) ||
+            !within(H->ao, H->ac, b, size) ||
+            !within(H->zo, H->zc, b, size))
+        {
+#ifdef WIN32
+            UnmapViewOfFile(data);
+            CloseHandle(mapping);
+            mapping = 0;
+#else
+            munmap((void *) data, size_t(size));
+#endif
+            data = 0;
+            size = 0;
+        }
+    }
+    scm_log("scm_sidecar %s %s", name.c_str(), data ? "mapped" : "absent");
+}
+
+/// Unmap the sidecar.
+
+scm_sidecar::~scm_sidecar()
+{
+#ifdef WIN32
+    if (data)    UnmapViewOfFile(data);
+    if (mapping) CloseHandle(mapping);
+#else
+    if (data)    munmap((void *) data, size_t(size));
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+/// Write the sidecar of the named TIFF. The format parameters and counts are
+/// taken from the given header, and the arrays from the given pointers. The
+/// magic, version, TIFF size and time, and array offsets are filled in. Return
+/// false on failure. @see scm_atomic_write
+
+bool scm_sidecar::write(const std::string& path, const header& H,
+                        const void *xv, const void *ov,
+                        const void *av, const void *zv)
+{
+    uint64 s;
+    uint64 t;
+
+    if (stat_file(path, s, t))
+        return write(path, H, xv, ov, av, zv, s, t);
+    else
+        return false;
+}
+
+/// Write the sidecar of the named TIFF, recording the given TIFF size s and
+/// time stamp t rather than those of a local file.
+
+bool scm_sidecar::write(const std::string& path, const header& H,
+                        const void *xv, const void *ov,
+                        const void *av, const void *zv, uint64 s, uint64 t)
+{
+    const std::string name = path + ".scmx";
+
+    header G = H;
+
+    G.magic   = scmx_magic;
+    G.version = scmx_version;
+    G.pad     = 0;
+    G.size    = s;
+    G.time    = t;
+
+    const uint64 xb = G.xc * sizeof (uint64);
+    const uint64 ob = G.oc * sizeof (uint64);
+    const uint64 ab = G.ac * G.b / 8;
+    const uint64 zb = G.zc * G.b / 8;
+
+    G.xo = align(sizeof (header));
+    G.oo = align(G.xo + xb);
+    G.ao = align(G.oo + ob);
+    G.zo = align(G.ao + ab);
+
+    std::vector<uint8> v(size_t(G.zo + zb), 0);
+
+    put(v, 0,    &G, sizeof (header));
+    put(v, G.xo, xv, xb);
+    put(v, G.oo, ov, ob);
+    put(v, G.ao, av, ab);
+    put(v, G.zo, zv, zb);
+
+    const bool ok = scm_atomic_write(name, &v.front(), v.size());
+
+    scm_log("scm_sidecar write %s %s", name.c_str(), ok ? "done" : "failed");
+    return ok;
+}
+
+/// Determine the size s and modification time t of the named file, as recorded
+/// by a sidecar or any other cache validated against its source file.
+
+bool scm_sidecar::stat_file(const std::string& path, uint64& s, uint64& t)
+{
+#ifdef WIN32
+    struct __stat64 info;
+
+    if (_stat64(path.c_str(), &info) == 0)
+#else
+    struct stat info;
+
+    if (stat(path.c_str(), &info) == 0)
+#endif
+    {
+        s = uint64(info.st_size);
+        t = uint64(info.st_mtime);
+        return true;
+    }
+    return false;
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,90 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#ifndef SCM_SIDECAR_HPP
+#define SCM_SIDECAR_HPP
+
+#include <string>
+
+#include <tiffio.h>
+
+//------------------------------------------------------------------------------
+
+/// An scm_sidecar maps the meta-data of an SCM TIFF from a binary index file
+///
+/// Parsing the page index, offset, minimum, and maximum tags of a deep SCM
+/// TIFF at startup is slow, and each process holds a private copy of arrays
+/// that may reach hundreds of megabytes. A sidecar file, named by appending
+/// ".scmx" to the TIFF's name, holds the same arrays in host byte order. It is
+/// mapped read-only, so opening is nearly instant and every process on a host
+/// shares one copy in the OS page cache.
+///
+/// The sidecar records the size and modification time of its TIFF and is
+/// rejected if either differs, or if it was written with another byte order.
+/// A TIFF not in the local file system has no modification time to stat, so
+/// the size and a time stamp may instead be given. @see scm_file::open
+
+class scm_sidecar
+{
+public:
+
+    /// The sidecar header. All arrays follow, at 8-byte aligned offsets.
+
+    struct header
+    {
+        uint32 magic;       ///< Magic number, in host byte order
+        uint32 version;     ///< Format version
+        uint64 size;        ///< TIFF file size
+        uint64 time;        ///< TIFF modification time
+        uint32 w;           ///< Page width
+        uint32 h;           ///< Page height
+        uint16 c;           ///< Sample count
+        uint16 b;           ///< Sample depth
+        uint16 e;           ///< Block compression format
+        uint16 pad;
+        uint64 xc, xo;      ///< Page index count and offset
+        uint64 oc, oo;      ///< Page offset count and offset
+        uint64 ac, ao;      ///< Page minima count and offset
+        uint64 zc, zo;      ///< Page maxima count and offset
+    };
+
+    scm_sidecar(const std::string&);
+    scm_sidecar(const std::string&, uint64, uint64);
+   ~scm_sidecar();
+
+    bool is_valid() const { return (data != 0); }
+
+    const header *get_header() const { return (const header *) data; }
+    const void   *get_array(uint64 o) const { return data + o; }
+
+    static bool write(const std::string&, const header&, const void *,
+                      const void *, const void *, const void *);
+    static bool write(const std::string&, const header&, const void *,
+                      const void *, const void *, const void *,
+                      uint64, uint64);
+
+    static bool stat_file(const std::string&, uint64&, uint64&);
+
+private:
+
+    void init(const std::string&, uint64, uint64);
+
+    const uint8 *data;
+    uint64       size;
+#ifdef WIN32
+    void        *mapping;
+#endif
+};
+
+//------------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,132 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#include <cstdio>
+
+#include "scm-source.hpp"
+#include "scm-http.hpp"
+#include "scm-log.hpp"
+
+//------------------------------------------------------------------------------
+
+/// Return true if the given path names a remote file, to be read through an
+/// scm_source rather than opened locally.
+
+bool scm_source::is_remote(const std::string& path)
+{
+    return (path.compare(0, 7, "http://")  == 0 ||
+            path.compare(0, 8, "https://") == 0);
+}
+
+/// Create a source for the remote file at the given path. Return null if the
+/// path names no supported protocol. Check is_open to determine whether the
+/// file was found.
+
+scm_source *scm_source::create(const std::string& path)
+{
+#ifdef SCM_HTTP
+    if (is_remote(path))
+        return new scm_http(path);
+#endif
+    scm_log("* scm_source no support for %s", path.c_str());
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+// A libtiff client stream reading through a source, with its own position.
+
+struct stream
+{
+    scm_source *S;
+    uint64      o;
+};
+
+static tmsize_t stream_read(thandle_t h, void *p, tmsize_t n)
+{
+    stream *s = (stream *) h;
+
+    if (s->o >= s->S->get_size())
+        return 0;
+
+    if (uint64(n) > s->S->get_size() - s->o)
+        n = tmsize_t(s->S->get_size() - s->o);
+
+    if (s->S->read(s->o, size_t(n), p))
+    {
+        s->o += uint64(n);
+        return n;
+    }
+    return -1;
+}
+
+static tmsize_t stream_write(thandle_t, void *, tmsize_t)
+{
+    return -1;
+}
+
+static toff_t stream_seek(thandle_t h, toff_t o, int w)
+{
+    stream *s = (stream *) h;
+
+    switch (w)
+    {
+        case SEEK_SET: s->o  = o;                    break;
+        case SEEK_CUR: s->o += o;                    break;
+        case SEEK_END: s->o  = s->S->get_size() + o; break;
+    }
+    return s->o;
+}
+
+static int stream_close(thandle_t h)
+{
+    delete (stream *) h;
+    return 0;
+}
+
+static toff_t stream_size(thandle_t h)
+{
+    return ((stream *) h)->S->get_size();
+}
+
+static int stream_map(thandle_t, void **, toff_t *)
+{
+    return 0;
+}
+
+static void stream_unmap(thandle_t, void *, toff_t)
+{
+}
+
+/// Open this source with libtiff for reading, under the given name. The source
+/// must outlive the returned handle, which is released by TIFFClose.
+
+TIFF *scm_source::open_tiff(const std::string& name)
+{
+    if (is_open())
+    {
+        stream *s = new stream;
+
+        s->S = this;
+        s->o = 0;
+
+        if (TIFF *T = TIFFClientOpen(name.c_str(), "rm", (thandle_t) s,
+                                     stream_read,  stream_write,
+                                     stream_seek,  stream_close,
+                                     stream_size,  stream_map,
+                                     stream_unmap))
+            return T;
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
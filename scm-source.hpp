@@ -0,0 +1,58 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#ifndef SCM_SOURCE_HPP
+#define SCM_SOURCE_HPP
+
+#include <string>
+
+#include <tiffio.h>
+
+//------------------------------------------------------------------------------
+
+/// An scm_source gives positioned reads of an SCM TIFF that is not local
+///
+/// A local SCM TIFF is read through a file descriptor or mapping by scm_reader
+/// and through libtiff by path. A file named by a URL is instead read through
+/// an scm_source, beneath both: the reader parses and loads pages with the
+/// source's positioned reads, and libtiff is given the source as a client
+/// stream, so the meta-data and any page the reader rejects are read the same
+/// way. Reads may be issued concurrently by any number of loader threads, and
+/// a read made on behalf of a loader task inherits that task's priority.
+///
+/// A source also names a local directory in which the file's sidecar index and
+/// any other persistent state are kept, along with a size and a time stamp by
+/// which that state is validated. @see scm_sidecar
+
+class scm_source
+{
+public:
+
+    virtual ~scm_source() { }
+
+    static bool        is_remote(const std::string&);
+    static scm_source *create   (const std::string&);
+
+    virtual bool   is_open()  const = 0;
+    virtual uint64 get_size() const = 0;
+    virtual uint64 get_time() const = 0;
+
+    virtual std::string get_local() const = 0;
+
+    virtual bool   read(uint64, size_t, void *) = 0;
+
+    TIFF *open_tiff(const std::string&);
+};
+
+//------------------------------------------------------------------------------
+
+#endif
@@ -11,6 +11,7 @@
 // more details.
 
 #include <GL/glew.h>
+#include <SDL.h>
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
@@ -18,11 +19,27 @@
 #include <algorithm>
 #include <limits>
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SCM_SPHERE_SSE2
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SCM_SPHERE_AVX __attribute__((target("avx")))
+#elif defined(_MSC_VER) && defined(_M_X64)
+#include <immintrin.h>
+#define SCM_SPHERE_AVX
+#endif
+
 #include "util3d/math3d.h"
 #include "util3d/glsl.h"
 
 #include "scm-sphere.hpp"
+#include "scm-loader.hpp"
 #include "scm-index.hpp"
+#include "scm-stats.hpp"
+#include "scm-trace.hpp"
 #include "scm-log.hpp"
 
 //------------------------------------------------------------------------------
@@ -37,14 +54,105 @@ typedef GLuint           GLindex;
 
 //------------------------------------------------------------------------------
 
+// A clipping kernel tests the corners of a page's bounding shell against the
+// view volume. One is chosen at run time according to the processor.
+
+typedef double (*scm_clip)(const double *, const double *,
+                           const double *, const double *, int, int);
+
+static scm_clip choose_clip();
+
+// The kernel is chosen by the first sphere constructed, rather than upon first
+// use, as the pre-pass may first run on several threads at once.
+
+static scm_clip clip = 0;
+
+//------------------------------------------------------------------------------
+
+// The row-major matrix of each root face, mapping page coordinates onto the
+// cube.
+
+static const GLfloat faces[6][9] = {
+    {  0.f,  0.f,  1.f,  0.f,  1.f,  0.f, -1.f,  0.f,  0.f },
+    {  0.f,  0.f, -1.f,  0.f,  1.f,  0.f,  1.f,  0.f,  0.f },
+    {  1.f,  0.f,  0.f,  0.f,  0.f,  1.f,  0.f, -1.f,  0.f },
+    {  1.f,  0.f,  0.f,  0.f,  0.f, -1.f,  0.f,  1.f,  0.f },
+    {  1.f,  0.f,  0.f,  0.f,  1.f,  0.f,  0.f,  0.f,  1.f },
+    { -1.f,  0.f,  0.f,  0.f,  1.f,  0.f,  0.f,  0.f, -1.f },
+};
+
+//------------------------------------------------------------------------------
+
+// The relative change in the view matrix beyond which incremental refinement
+// gives way to a full traversal.
+
+static const double jump = 0.1;
+
+// The number of parts per thread into which a parallel traversal is divided,
+// and the smallest run of a retained cut worth giving to a thread.
+
+static const int    parts_per_thread = 4;
+static const size_t smallest_run     = 64;
+
+//------------------------------------------------------------------------------
+
+// A prep job runs the parts of a parallel pre-pass on the loader pool. Each
+// part traverses one subtree, or refines one run of a retained cut, into its
+// own page set and cut. @see scm_loader::parallel
+
+class scm_sphere::job : public scm_job
+{
+public:
+
+    job(scm_sphere *o, scm_scene *s, const double *M,
+        int w, int h, int c, bool z, const std::vector<long long> *r) :
+        sphere(o), scene(s), M(M), width(w), height(h), channel(c), zoom(z),
+        retained(r) { }
+
+    void run(int k)
+    {
+        part& p = sphere->parts[k];
+
+        p.pages.clear();
+        p.cut  .clear();
+
+        if (retained)
+            sphere->refine(scene, M, width, height, channel, zoom,
+                           *retained, p.j0, p.j1, p.pages, p.cut);
+        else
+            p.b = sphere->prep_page(scene, M, width, height, channel,
+                                    p.i, zoom, p.pages, p.cut);
+    }
+
+private:
+
+    scm_sphere   *sphere;
+    scm_scene    *scene;
+    const double *M;
+    int           width;
+    int           height;
+    int           channel;
+    bool          zoom;
+
+    const std::vector<long long> *retained;
+};
+
+//------------------------------------------------------------------------------
+
 /// Create a new spherical geometry rendering object. Initialize the necessary
 /// OpenGL vertex buffer object state.
 ///
 /// @param d  Detail with which sphere pages are drawn (in vertices)
 /// @param l  Limit at which sphere pages are subdivided (in pixels)
 ///
-scm_sphere::scm_sphere(int d, int l) : detail(d), limit(l)
+scm_sphere::scm_sphere(int d, int l) :
+    detail(d), limit(l), prefetch(0.0), moved(-1), incremental(true),
+    parallel(true), batched(true), compute(false), views(1), paired(0),
+    loader(0), drawn(0), covered_ok(false), cull(0)
 {
+    if (clip == 0)
+        clip = choose_clip();
+
     init_arrays(d);
 
     zoomv[0] =  0;
@@ -57,6 +165,7 @@ scm_sphere::scm_sphere(int d, int l) : detail(d), limit(l)
 
 scm_sphere::~scm_sphere()
 {
+    delete cull;
     free_arrays();
 }
 
@@ -88,10 +197,129 @@ void scm_sphere::set_limit(int l)
         limit = l;
 }
 
+/// Set the prefetch look-ahead time in milliseconds. Each draw extrapolates the
+/// motion of the view over the previous frame t milliseconds into the future
+/// and requests the pages visible there, at lower priority than the pages
+/// visible now. Zero, the default, disables prefetch.
+
+void scm_sphere::set_prefetch(double t)
+{
+    if (0 <= t)
+        prefetch = t;
+}
+
+/// Enable or disable incremental refinement. When enabled, each draw begins
+/// with the selection of the previous frame for the same scene and channel,
+/// re-evaluating only the pages at which that traversal stopped. A page grown
+/// beyond the limit is subdivided, and four siblings whose parent has shrunk
+/// within the limit are merged, so that the cost of the pre-pass follows the
+/// change in the view rather than the depth of the scene. A full traversal is
+/// performed whenever the view jumps, the target size, limit, or zoom changes,
+/// or a scene is not drawn in consecutive frames.
+
+void scm_sphere::set_incremental(bool b)
+{
+    incremental = b;
+    reset();
+}
+
+/// Enable or disable the parallel pre-pass. It is used only if a loader pool
+/// with more than one thread has been given. The selection is the same either
+/// way, so this is a matter of performance alone.
+
+void scm_sphere::set_parallel(bool b)
+{
+    parallel = b;
+}
+
+/// Enable or disable batched drawing. When enabled, and the scene's vertex
+/// shader declares a storage block named "pages", each draw gathers a record
+/// for every page drawn into a shader storage buffer and issues one indirect
+/// multi-draw per mesh, rather than setting uniforms and drawing each page
+/// in turn. Otherwise pages are drawn individually as before.
+///
+/// The block is bound to storage binding 0 and is an array of vec4. Record p
+/// begins at element (page_first + gl_DrawIDARB) * page_stride, with the two
+/// uniforms set by the sphere. Where n is the number of images bound, each
+/// record holds page_stride = 20 + 16 n elements...
+///
+/// - 0 to 2: Rows of the face matrix M
+/// - 3: Page depth in x and mesh index in y
+/// - 4 to 19: A[l] in xy and B[l] in zw for each depth l
+/// - 20 + 16 j + l: Image j in texture unit order at depth l, giving the age
+///   a in x, offset b in yz, and array layer l in w
+///
+/// Depths beyond the page's own are zero, as after unbind_page. Age counts
+/// the same cache use as the unbatched draw. Batched drawing requires
+/// ARB_multi_draw_indirect, ARB_shader_storage_buffer_object, and, for
+/// gl_DrawIDARB, ARB_shader_draw_parameters. Lacking any of these, pages are
+/// drawn individually.
+
+void scm_sphere::set_batched(bool b)
+{
+    batched = b;
+}
+
+/// Enable or disable GPU selection. When enabled, and compute shaders are
+/// supported, pages are selected for drawing by a compute shader rather than
+/// by the CPU pre-pass, and only the neighborhood rule is applied on the CPU.
+/// The selection is read back without waiting, so it lags the view by a few
+/// frames. The CPU pre-pass is used until a selection is ready, while zooming,
+/// and whenever a selection overflows. @see scm_cull
+
+void scm_sphere::set_compute(bool b)
+{
+    compute = b;
+}
+
+/// Give the loader whose thread pool runs the parallel pre-pass. The loader
+/// must outlive any pre-pass, and zero gives a serial pre-pass.
+/// @see scm_loader::parallel
+
+void scm_sphere::set_loader(scm_loader *l)
+{
+    loader = l;
+}
+
+/// Discard all retained selections, ensuring a full traversal at the next draw.
+/// @see set_incremental
+
+void scm_sphere::reset()
+{
+    frontiers.clear();
+    forecasts.clear();
+    shares.clear();
+}
+
+// Erase the entries of all channels of the given scene from a map keyed by
+// scene and channel.
+
+template <typename M> static void prune(M& m, const scm_scene *scene)
+{
+    typedef typename M::key_type key;
+
+    m.erase(m.lower_bound(key(scene, std::numeric_limits<int>::min())),
+            m.upper_bound(key(scene, std::numeric_limits<int>::max())));
+}
+
+/// Discard all state retained for the given scene, which is being deleted, so
+/// that no scene later allocated at the same address inherits it.
+
+void scm_sphere::del_scene(const scm_scene *scene)
+{
+    prune(motions,   scene);
+    prune(frontiers, scene);
+    prune(forecasts, scene);
+    prune(shares,    scene);
+
+    if (cull) cull->del_scene(scene);
+}
+
 //------------------------------------------------------------------------------
 
 /// Prepare to render the sphere. Perform all visibility and subdivision
-/// calculations. Cache the results for use by a subsequent draw call.
+/// calculations. Cache the results for use by a subsequent draw call, sorted
+/// in breadth-first order.
 ///
 /// @param scene   Scene giving the data to be rendered
 /// @param M       Model-view-projection matrix in OpenGL column-major order
@@ -103,17 +331,59 @@ void scm_sphere::set_limit(int l)
 void scm_sphere::prep(scm_scene *scene, const double *M,
                       int width, int height, int channel, bool zoom)
 {
+    scm_trace::scope trace("prep");
+
     pages.clear();
+    next .clear();
+
+    if (is_parallel())
+        fork(scene, M, width, height, channel, zoom);
+    else
+    {
+        prep_page(scene, M, width, height, channel, 0, zoom, pages, next);
+        prep_page(scene, M, width, height, channel, 1, zoom, pages, next);
+        prep_page(scene, M, width, height, channel, 2, zoom, pages, next);
+        prep_page(scene, M, width, height, channel, 3, zoom, pages, next);
+        prep_page(scene, M, width, height, channel, 4, zoom, pages, next);
+        prep_page(scene, M, width, height, channel, 5, zoom, pages, next);
+    }
+
+    pages.sort();
+}
+
+/// Perform the visibility pre-pass without drawing and add the visible pages to
+/// the given set. This allows the page needs of a view to be known in advance.
+/// The pass gathers into local containers, leaving the selection and cut of
+/// the live view untouched, so that it may be called mid-frame.
+///
+/// @param scene   Scene giving the data to be rendered
+/// @param M       Model-view-projection matrix in OpenGL column-major order
+/// @param width   Width of the render target (in pixels)
+/// @param height  Height of the render target (in pixels)
+/// @param channel Channel index (e.g. 0 for left eye, 1 for right eye)
+/// @param s       Set receiving the visible page indices
+
+void scm_sphere::list(scm_scene *scene, const double *M,
+                      int width, int height, int channel,
+                      std::set<long long>& s)
+{
+    scm_pageset            live_pages;
+    std::vector<long long> live_next;
+
+    pages.swap(live_pages);
+    next .swap(live_next);
 
-    prep_page(scene, M, width, height, channel, 0, zoom);
-    prep_page(scene, M, width, height, channel, 1, zoom);
-    prep_page(scene, M, width, height, channel, 2, zoom);
-    prep_page(scene, M, width, height, channel, 3, zoom);
-    prep_page(scene, M, width, height, channel, 4, zoom);
-    prep_page(scene, M, width, height, channel, 5, zoom);
+    scene->is_ready();
+    prep(scene, M, width, height, channel, scene->uzoomk >= 0);
+    s.insert(pages.begin(), pages.end());
+
+    pages.swap(live_pages);
+    next .swap(live_next);
 }
 
-/// Render the sphere using cached visibility and subdivision state.
+/// Render the sphere using cached visibility and subdivision state. While the
+/// scene's program is compiling in the background, its pages are selected and
+/// requested but not drawn.
 ///
 /// @param scene   Scene giving the data to be rendered
 /// @param M       Model-view-projection matrix in OpenGL column-major order
@@ -125,6 +395,8 @@ void scm_sphere::prep(scm_scene *scene, const double *M,
 void scm_sphere::draw(scm_scene *scene, const double *M,
                      int width, int height, int channel, int frame)
 {
+    const bool ready = scene->is_ready();
+
     glEnable(GL_COLOR_MATERIAL);
 
     // Calculate the current view range.
@@ -134,16 +406,29 @@ void scm_sphere::draw(scm_scene *scene, const double *M,
 
     double range = fabs(vlen(I + 8) / I[11]);
 
-    // Perform the visibility pre-pass.
+    // Use the selection shared by all views of this frame, or select anew.
 
-    prep(scene, M, width, height, channel, scene->uzoomk >= 0);
+    std::map<motion_key, shared>::iterator s = shares.find(motion_key(scene,
+                                                                      channel));
+    const bool b = (s != shares.end() && s->second.frame == frame);
 
-    // Pre-cache all visible pages in breadth-first order.
+    if (b)
+        pages.swap(s->second.pages);
+    else
+    {
+        scm_trace::scope trace("select");
+        select(scene, M, width, height, channel, frame);
+    }
 
-    std::set<long long>::iterator i;
+    if (!ready)
+    {
+        if (b)
+            pages.swap(s->second.pages);
 
-    for (i = pages.begin(); i != pages.end(); ++i)
-        scene->touch_page(channel, frame, (*i));
+        drawn      = 0;
+        covered_ok = false;
+        return;
+    }
 
     // Bind the vertex buffer.
 
@@ -154,53 +439,55 @@ void scm_sphere::draw(scm_scene *scene, const double *M,
     // Configure the shaders and draw the six root pages.
 
     scene->bind(channel);
-    {
-        static const GLfloat M[6][9] = {
-            {  0.f,  0.f,  1.f,  0.f,  1.f,  0.f, -1.f,  0.f,  0.f },
-            {  0.f,  0.f, -1.f,  0.f,  1.f,  0.f,  1.f,  0.f,  0.f },
-            {  1.f,  0.f,  0.f,  0.f,  0.f,  1.f,  0.f, -1.f,  0.f },
-            {  1.f,  0.f,  0.f,  0.f,  0.f, -1.f,  0.f,  1.f,  0.f },
-            {  1.f,  0.f,  0.f,  0.f,  1.f,  0.f,  0.f,  0.f,  1.f },
-            { -1.f,  0.f,  0.f,  0.f,  1.f,  0.f,  0.f,  0.f, -1.f },
-        };
-
-        glUniform1f(scene->urange, GLfloat(range));
-        glUniform1f(scene->uzoomk, GLfloat(zoomk));
-        glUniform3f(scene->uzoomv, GLfloat(zoomv[0]),
-                                   GLfloat(zoomv[1]),
-                                   GLfloat(zoomv[2]));
 
+    glUniform1f(scene->urange, GLfloat(range));
+    glUniform1f(scene->uzoomk, GLfloat(zoomk));
+    glUniform3f(scene->uzoomv, GLfloat(zoomv[0]),
+                               GLfloat(zoomv[1]),
+                               GLfloat(zoomv[2]));
+
+    scm_trace::begin    ("draw_page");
+    scm_trace::begin_gpu("sphere");
+
+    if (batched && scene->is_batched())
+        draw_batch(scene, channel, frame);
+    else
+    {
         if (is_set(0))
         {
-            glUniformMatrix3fv(scene->uM, 1, GL_TRUE, M[0]);
+            glUniformMatrix3fv(scene->uM, 1, GL_TRUE, faces[0]);
             draw_page(scene, channel, 0, frame, 0);
         }
         if (is_set(1))
         {
-            glUniformMatrix3fv(scene->uM, 1, GL_TRUE, M[1]);
+            glUniformMatrix3fv(scene->uM, 1, GL_TRUE, faces[1]);
             draw_page(scene, channel, 0, frame, 1);
         }
         if (is_set(2))
         {
-            glUniformMatrix3fv(scene->uM, 1, GL_TRUE, M[2]);
+            glUniformMatrix3fv(scene->uM, 1, GL_TRUE, faces[2]);
             draw_page(scene, channel, 0, frame, 2);
         }
         if (is_set(3))
         {
-            glUniformMatrix3fv(scene->uM, 1, GL_TRUE, M[3]);
+            glUniformMatrix3fv(scene->uM, 1, GL_TRUE, faces[3]);
             draw_page(scene, channel, 0, frame, 3);
         }
         if (is_set(4))
         {
-            glUniformMatrix3fv(scene->uM, 1, GL_TRUE, M[4]);
+            glUniformMatrix3fv(scene->uM, 1, GL_TRUE, faces[4]);
             draw_page(scene, channel, 0, frame, 4);
         }
         if (is_set(5))
         {
-            glUniformMatrix3fv(scene->uM, 1, GL_TRUE, M[5]);
+            glUniformMatrix3fv(scene->uM, 1, GL_TRUE, faces[5]);
             draw_page(scene, channel, 0, frame, 5);
         }
     }
+
+    scm_trace::end_gpu("sphere");
+    scm_trace::end    ("draw_page");
+
     scene->unbind(channel);
 
     // Revert the local GL state.
@@ -208,8 +495,149 @@ void scm_sphere::draw(scm_scene *scene, const double *M,
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
     glBindBuffer(GL_ARRAY_BUFFER,         0);
     glDisableClientState(GL_VERTEX_ARRAY);
+
+    if (b)
+        pages.swap(s->second.pages);
+
+    drawn      = b ? &s->second.pages : &pages;
+    covered_ok = false;
 }
 
+/// Return true if page i or any of its descendants was drawn by the most recent
+/// draw. The pages covered by the drawn set are gathered on first request.
+
+bool scm_sphere::is_covered(long long i) const
+{
+    if (drawn == 0)
+        return false;
+
+    if (!covered_ok)
+    {
+        covered.clear();
+
+        for (scm_pageset::const_iterator j = drawn->begin();
+                                         j != drawn->end(); ++j)
+            for (long long k = *j; covered.insert(k) && k > 5; )
+                k = scm_page_parent(k);
+
+        covered_ok = true;
+    }
+    return covered.search(i);
+}
+
+// Perform the visibility pre-pass on the predicted view, then this one, each
+// refining its own selection of the previous frame where possible, and request
+// the pages selected.
+
+void scm_sphere::select(scm_scene *scene, const double *M,
+                        int width, int height, int channel, int frame)
+{
+    double N[16];
+
+    if (predict(N, scene, M, channel, frame))
+    {
+        track(scene, N, width, height, channel, frame,
+              forecasts[motion_key(scene, channel)]);
+        ahead.swap(pages);
+    }
+    else ahead.clear();
+
+    frontier& f = frontiers[motion_key(scene, channel)];
+
+    // A GPU selection leaves no cut, so the next draw may not refine it.
+
+    if (compute && !(scene->uzoomk >= 0 && zoomk != 1)
+                && choose(scene, M, width, height, channel))
+        keep(f, M, width, height, -2);
+    else
+        track(scene, M, width, height, channel, frame, f);
+
+    scm_stats::add(scm_stats::sphere_selects);
+    scm_stats::add(scm_stats::sphere_pages, int(pages.size()));
+
+    request(scene, channel, frame);
+}
+
+// Pre-cache all visible pages in breadth-first order, then prefetch all pages
+// of the predicted view not already visible.
+
+void scm_sphere::request(scm_scene *scene, int channel, int frame)
+{
+    scm_pageset::const_iterator i;
+
+    for (i = pages.begin(); i != pages.end(); ++i)
+        scene->touch_page(channel, frame, (*i));
+
+    for (i = ahead.begin(); i != ahead.end(); ++i)
+        if (!is_set(*i))
+            scene->ask_page(channel, frame, (*i));
+}
+
+/// Prepare one selection of a scene for all n views of a frame, for use by the
+/// draw of each view. A page is selected if any view sees it, and subdivided
+/// if any view needs it to be, so the selection suits every view at the finest
+/// detail any needs. Pages are requested once for all views. Views must share
+/// the channel and target size, as do the tiles of a wall driven by a single
+/// context. The first view is used for prefetch.
+///
+/// If a second scene is given, as during a fade, it shares the selection. A
+/// page is then considered present if either scene has it, within the union
+/// of the bounds of both, so one traversal serves the draws of both scenes.
+///
+/// @param scene   Scene giving the data to be rendered
+/// @param other   Scene to share the selection, or null
+/// @param M       Model-view-projection matrices, 16 per view, column-major
+/// @param n       Number of views
+/// @param width   Width of the render target (in pixels)
+/// @param height  Height of the render target (in pixels)
+/// @param channel Channel index
+/// @param frame   Frame number
+
+void scm_sphere::share(scm_scene *scene, scm_scene *other, const double *M,
+                       int n, int width, int height, int channel, int frame)
+{
+    double N[16];
+
+    if (other == scene)
+        other = 0;
+
+    scene->is_ready();
+
+    if (predict(N, scene, M, channel, frame))
+    {
+        track(scene, N, width, height, channel, frame,
+              forecasts[motion_key(scene, channel)]);
+        ahead.swap(pages);
+    }
+    else ahead.clear();
+
+    views  = std::max(n, 1);
+    paired = other;
+    prep(scene, M, width, height, channel, scene->uzoomk >= 0);
+    views  = 1;
+    paired = 0;
+
+    request(scene, channel, frame);
+
+    if (other)
+        request(other, channel, frame);
+
+    shared& s = shares[motion_key(scene, channel)];
+
+    s.frame = frame;
+    s.pages.swap(pages);
+
+    if (other)
+    {
+        shared& t = shares[motion_key(other, channel)];
+
+        t.frame = frame;
+        t.pages = s.pages;
+    }
+}
+
+//------------------------------------------------------------------------------
+
 /// Set the direction and magnitude of the zoom.
 
 void scm_sphere::set_zoom(double x, double y, double z, double k)
@@ -260,18 +688,217 @@ double determinant(const double *a, const double *b, const double *c)
     return vdot(a, t);
 }
 
-static inline double length(const double *a, const double *b, int w, int h)
+// Return the on-screen distance in pixels between clip-space corners j and k.
+
+static inline double length(const double *X, const double *Y, const double *W,
+                            int j, int k, int w, int h)
 {
-    if (a[3] <= 0 && b[3] <= 0) return 0;
-    if (a[3] <= 0)              return HUGE_VAL;
-    if (b[3] <= 0)              return HUGE_VAL;
+    if (W[j] <= 0 && W[k] <= 0) return 0;
+    if (W[j] <= 0)              return HUGE_VAL;
+    if (W[k] <= 0)              return HUGE_VAL;
 
-    double dx = (a[0] / a[3] - b[0] / b[3]) * w / 2;
-    double dy = (a[1] / a[3] - b[1] / b[3]) * h / 2;
+    double dx = (X[j] / W[j] - X[k] / W[k]) * w / 2;
+    double dy = (Y[j] / W[j] - Y[k] / W[k]) * h / 2;
 
     return sqrt(dx * dx + dy * dy);
 }
 
+// Return the length of the longest visible edge of the inner face of a shell,
+// in pixels, given its clip-space corners.
+
+static inline double longest(const double *X, const double *Y, const double *W,
+                             int w, int h)
+{
+    return std::max(std::max(length(X, Y, W, 0, 1, w, h),
+                             length(X, Y, W, 2, 3, w, h)),
+                    std::max(length(X, Y, W, 0, 2, w, h),
+                             length(X, Y, W, 1, 3, w, h)));
+}
+
+// Transform the eight corners x, y, z of a bounding shell, inner face first,
+// by M and test them against the view volume. Return zero if all corners lie
+// beyond any one clipping plane or behind the singularity, and otherwise the
+// length of the longest visible edge of the inner face.
+
+static double clip_scalar(const double *M, const double *x,
+                                           const double *y,
+                                           const double *z, int w, int h)
+{
+    double X[8], Y[8], Z[8], W[8];
+
+    int c[7] = { 0, 0, 0, 0, 0, 0, 0 };
+
+    for (int k = 0; k < 8; k++)
+    {
+        W[k] = M[ 3] * x[k] + M[ 7] * y[k] + M[11] * z[k] + M[15];
+        Z[k] = M[ 2] * x[k] + M[ 6] * y[k] + M[10] * z[k] + M[14];
+        Y[k] = M[ 1] * x[k] + M[ 5] * y[k] + M[ 9] * z[k] + M[13];
+        X[k] = M[ 0] * x[k] + M[ 4] * y[k] + M[ 8] * z[k] + M[12];
+
+        if (W[k] <=  0)    c[0]++;
+        if (Z[k] >  W[k])  c[1]++;
+        if (Z[k] < -W[k])  c[2]++;
+        if (Y[k] >  W[k])  c[3]++;
+        if (Y[k] < -W[k])  c[4]++;
+        if (X[k] >  W[k])  c[5]++;
+        if (X[k] < -W[k])  c[6]++;
+    }
+
+    for (int j = 0; j < 7; j++)
+        if (c[j] == 8)
+            return 0;
+
+    return longest(X, Y, W, w, h);
+}
+
+#ifdef SCM_SPHERE_SSE2
+
+// Transform and test the corners two at a time in SSE2 lanes. The products are
+// summed in the same order as the scalar code, so the results are identical.
+
+static double clip_sse2(const double *M, const double *x,
+                                         const double *y,
+                                         const double *z, int w, int h)
+{
+    double X[8], Y[8], W[8];
+
+    const __m128d s = _mm_set1_pd(-0.0);
+    const __m128d o = _mm_setzero_pd();
+
+    int c[7] = { 3, 3, 3, 3, 3, 3, 3 };
+
+    for (int k = 0; k < 8; k += 2)
+    {
+        const __m128d a = _mm_loadu_pd(x + k);
+        const __m128d b = _mm_loadu_pd(y + k);
+        const __m128d d = _mm_loadu_pd(z + k);
+
+        const __m128d ww = _mm_add_pd(_mm_add_pd(_mm_add_pd(
+                           _mm_mul_pd(_mm_set1_pd(M[ 3]), a),
+                           _mm_mul_pd(_mm_set1_pd(M[ 7]), b)),
+                           _mm_mul_pd(_mm_set1_pd(M[11]), d)),
+                                      _mm_set1_pd(M[15]));
+        const __m128d zz = _mm_add_pd(_mm_add_pd(_mm_add_pd(
+                           _mm_mul_pd(_mm_set1_pd(M[ 2]), a),
+                           _mm_mul_pd(_mm_set1_pd(M[ 6]), b)),
+                           _mm_mul_pd(_mm_set1_pd(M[10]), d)),
+                                      _mm_set1_pd(M[14]));
+        const __m128d yy = _mm_add_pd(_mm_add_pd(_mm_add_pd(
+                           _mm_mul_pd(_mm_set1_pd(M[ 1]), a),
+                           _mm_mul_pd(_mm_set1_pd(M[ 5]), b)),
+                           _mm_mul_pd(_mm_set1_pd(M[ 9]), d)),
+                                      _mm_set1_pd(M[13]));
+        const __m128d xx = _mm_add_pd(_mm_add_pd(_mm_add_pd(
+                           _mm_mul_pd(_mm_set1_pd(M[ 0]), a),
+                           _mm_mul_pd(_mm_set1_pd(M[ 4]), b)),
+                           _mm_mul_pd(_mm_set1_pd(M[ 8]), d)),
+                                      _mm_set1_pd(M[12]));
+
+        const __m128d nw = _mm_xor_pd(ww, s);
+
+        c[0] &= _mm_movemask_pd(_mm_cmple_pd(ww, o));
+        c[1] &= _mm_movemask_pd(_mm_cmpgt_pd(zz, ww));
+        c[2] &= _mm_movemask_pd(_mm_cmplt_pd(zz, nw));
+        c[3] &= _mm_movemask_pd(_mm_cmpgt_pd(yy, ww));
+        c[4] &= _mm_movemask_pd(_mm_cmplt_pd(yy, nw));
+        c[5] &= _mm_movemask_pd(_mm_cmpgt_pd(xx, ww));
+        c[6] &= _mm_movemask_pd(_mm_cmplt_pd(xx, nw));
+
+        _mm_storeu_pd(X + k, xx);
+        _mm_storeu_pd(Y + k, yy);
+        _mm_storeu_pd(W + k, ww);
+    }
+
+    for (int j = 0; j < 7; j++)
+        if (c[j] == 3)
+            return 0;
+
+    return longest(X, Y, W, w, h);
+}
+
+#endif
+#ifdef SCM_SPHERE_AVX
+
+// Transform and test the inner and outer faces in two sets of AVX lanes.
+
+SCM_SPHERE_AVX
+static double clip_avx(const double *M, const double *x,
+                                        const double *y,
+                                        const double *z, int w, int h)
+{
+    double X[8], Y[8], W[8];
+
+    const __m256d s = _mm256_set1_pd(-0.0);
+    const __m256d o = _mm256_setzero_pd();
+
+    int c[7] = { 15, 15, 15, 15, 15, 15, 15 };
+
+    for (int k = 0; k < 8; k += 4)
+    {
+        const __m256d a = _mm256_loadu_pd(x + k);
+        const __m256d b = _mm256_loadu_pd(y + k);
+        const __m256d d = _mm256_loadu_pd(z + k);
+
+        const __m256d ww = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(
+                           _mm256_mul_pd(_mm256_set1_pd(M[ 3]), a),
+                           _mm256_mul_pd(_mm256_set1_pd(M[ 7]), b)),
+                           _mm256_mul_pd(_mm256_set1_pd(M[11]), d)),
+                                         _mm256_set1_pd(M[15]));
+        const __m256d zz = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(
+                           _mm256_mul_pd(_mm256_set1_pd(M[ 2]), a),
+                           _mm256_mul_pd(_mm256_set1_pd(M[ 6]), b)),
+                           _mm256_mul_pd(_mm256_set1_pd(M[10]), d)),
+                                         _mm256_set1_pd(M[14]));
+        const __m256d yy = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(
+                           _mm256_mul_pd(_mm256_set1_pd(M[ 1]), a),
+                           _mm256_mul_pd(_mm256_set1_pd(M[ 5]), b)),
+                           _mm256_mul_pd(_mm256_set1_pd(M[ 9]), d)),
+                                         _mm256_set1_pd(M[13]));
+        const __m256d xx = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(
+                           _mm256_mul_pd(_mm256_set1_pd(M[ 0]), a),
+                           _mm256_mul_pd(_mm256_set1_pd(M[ 4]), b)),
+                           _mm256_mul_pd(_mm256_set1_pd(M[ 8]), d)),
+                                         _mm256_set1_pd(M[12]));
+
+        const __m256d nw = _mm256_xor_pd(ww, s);
+
+        c[0] &= _mm256_movemask_pd(_mm256_cmp_pd(ww, o,  _CMP_LE_OQ));
+        c[1] &= _mm256_movemask_pd(_mm256_cmp_pd(zz, ww, _CMP_GT_OQ));
+        c[2] &= _mm256_movemask_pd(_mm256_cmp_pd(zz, nw, _CMP_LT_OQ));
+        c[3] &= _mm256_movemask_pd(_mm256_cmp_pd(yy, ww, _CMP_GT_OQ));
+        c[4] &= _mm256_movemask_pd(_mm256_cmp_pd(yy, nw, _CMP_LT_OQ));
+        c[5] &= _mm256_movemask_pd(_mm256_cmp_pd(xx, ww, _CMP_GT_OQ));
+        c[6] &= _mm256_movemask_pd(_mm256_cmp_pd(xx, nw, _CMP_LT_OQ));
+
+        _mm256_storeu_pd(X + k, xx);
+        _mm256_storeu_pd(Y + k, yy);
+        _mm256_storeu_pd(W + k, ww);
+    }
+
+    for (int j = 0; j < 7; j++)
+        if (c[j] == 15)
+            return 0;
+
+    return longest(X, Y, W, w, h);
+}
+
+#endif
+
+// Select the fastest clipping kernel supported by the running processor.
+
+static scm_clip choose_clip()
+{
+#ifdef SCM_SPHERE_AVX
+    if (SDL_HasAVX())
+        return clip_avx;
+#endif
+#ifdef SCM_SPHERE_SSE2
+    if (SDL_HasSSE2())
+        return clip_sse2;
+#endif
+    return clip_scalar;
+}
+
 double scm_sphere::view_page(const double *M, int vw, int vh,
                              double r0, double r1, long long i, bool zoomb)
 {
@@ -322,171 +949,509 @@ double scm_sphere::view_page(const double *M, int vw, int vh,
 
     // Apply the inner and outer radii to the bounding volume.
 
-    double a[3], e[3], A[4], E[4];
-    double b[3], f[3], B[4], F[4];
-    double c[3], g[3], C[4], G[4];
-    double d[3], h[3], D[4], H[4];
-
-    vmul(a, v + 0, r0);
-    vmul(b, v + 3, r0);
-    vmul(c, v + 6, r0);
-    vmul(d, v + 9, r0);
-
-    vmul(e, v + 0, r2);
-    vmul(f, v + 3, r2);
-    vmul(g, v + 6, r2);
-    vmul(h, v + 9, r2);
-
-    // Compute W and reject any volume on the far side of the singularity.
-
-    A[3] = M[ 3] * a[0] + M[ 7] * a[1] + M[11] * a[2] + M[15];
-    B[3] = M[ 3] * b[0] + M[ 7] * b[1] + M[11] * b[2] + M[15];
-    C[3] = M[ 3] * c[0] + M[ 7] * c[1] + M[11] * c[2] + M[15];
-    D[3] = M[ 3] * d[0] + M[ 7] * d[1] + M[11] * d[2] + M[15];
-    E[3] = M[ 3] * e[0] + M[ 7] * e[1] + M[11] * e[2] + M[15];
-    F[3] = M[ 3] * f[0] + M[ 7] * f[1] + M[11] * f[2] + M[15];
-    G[3] = M[ 3] * g[0] + M[ 7] * g[1] + M[11] * g[2] + M[15];
-    H[3] = M[ 3] * h[0] + M[ 7] * h[1] + M[11] * h[2] + M[15];
-
-    if (A[3] <= 0 && B[3] <= 0 && C[3] <= 0 && D[3] <= 0 &&
-        E[3] <= 0 && F[3] <= 0 && G[3] <= 0 && H[3] <= 0)
-        return 0;
-
-    // Compute Z and reject using the near and far clipping planes.
-
-    A[2] = M[ 2] * a[0] + M[ 6] * a[1] + M[10] * a[2] + M[14];
-    B[2] = M[ 2] * b[0] + M[ 6] * b[1] + M[10] * b[2] + M[14];
-    C[2] = M[ 2] * c[0] + M[ 6] * c[1] + M[10] * c[2] + M[14];
-    D[2] = M[ 2] * d[0] + M[ 6] * d[1] + M[10] * d[2] + M[14];
-    E[2] = M[ 2] * e[0] + M[ 6] * e[1] + M[10] * e[2] + M[14];
-    F[2] = M[ 2] * f[0] + M[ 6] * f[1] + M[10] * f[2] + M[14];
-    G[2] = M[ 2] * g[0] + M[ 6] * g[1] + M[10] * g[2] + M[14];
-    H[2] = M[ 2] * h[0] + M[ 6] * h[1] + M[10] * h[2] + M[14];
-
-    if (A[2] >  A[3] && B[2] >  B[3] && C[2] >  C[3] && D[2] >  D[3] &&
-        E[2] >  E[3] && F[2] >  F[3] && G[2] >  G[3] && H[2] >  H[3])
-        return 0;
-    if (A[2] < -A[3] && B[2] < -B[3] && C[2] < -C[3] && D[2] < -D[3] &&
-        E[2] < -E[3] && F[2] < -F[3] && G[2] < -G[3] && H[2] < -H[3])
-        return 0;
-
-    // Compute Y and reject using the bottom and top clipping planes.
-
-    A[1] = M[ 1] * a[0] + M[ 5] * a[1] + M[ 9] * a[2] + M[13];
-    B[1] = M[ 1] * b[0] + M[ 5] * b[1] + M[ 9] * b[2] + M[13];
-    C[1] = M[ 1] * c[0] + M[ 5] * c[1] + M[ 9] * c[2] + M[13];
-    D[1] = M[ 1] * d[0] + M[ 5] * d[1] + M[ 9] * d[2] + M[13];
-    E[1] = M[ 1] * e[0] + M[ 5] * e[1] + M[ 9] * e[2] + M[13];
-    F[1] = M[ 1] * f[0] + M[ 5] * f[1] + M[ 9] * f[2] + M[13];
-    G[1] = M[ 1] * g[0] + M[ 5] * g[1] + M[ 9] * g[2] + M[13];
-    H[1] = M[ 1] * h[0] + M[ 5] * h[1] + M[ 9] * h[2] + M[13];
-
-    if (A[1] >  A[3] && B[1] >  B[3] && C[1] >  C[3] && D[1] >  D[3] &&
-        E[1] >  E[3] && F[1] >  F[3] && G[1] >  G[3] && H[1] >  H[3])
-        return 0;
-    if (A[1] < -A[3] && B[1] < -B[3] && C[1] < -C[3] && D[1] < -D[3] &&
-        E[1] < -E[3] && F[1] < -F[3] && G[1] < -G[3] && H[1] < -H[3])
-        return 0;
-
-    // Compute X and reject using the left and right clipping planes.
-
-    A[0] = M[ 0] * a[0] + M[ 4] * a[1] + M[ 8] * a[2] + M[12];
-    B[0] = M[ 0] * b[0] + M[ 4] * b[1] + M[ 8] * b[2] + M[12];
-    C[0] = M[ 0] * c[0] + M[ 4] * c[1] + M[ 8] * c[2] + M[12];
-    D[0] = M[ 0] * d[0] + M[ 4] * d[1] + M[ 8] * d[2] + M[12];
-    E[0] = M[ 0] * e[0] + M[ 4] * e[1] + M[ 8] * e[2] + M[12];
-    F[0] = M[ 0] * f[0] + M[ 4] * f[1] + M[ 8] * f[2] + M[12];
-    G[0] = M[ 0] * g[0] + M[ 4] * g[1] + M[ 8] * g[2] + M[12];
-    H[0] = M[ 0] * h[0] + M[ 4] * h[1] + M[ 8] * h[2] + M[12];
-
-    if (A[0] >  A[3] && B[0] >  B[3] && C[0] >  C[3] && D[0] >  D[3] &&
-        E[0] >  E[3] && F[0] >  F[3] && G[0] >  G[3] && H[0] >  H[3])
-        return 0;
-    if (A[0] < -A[3] && B[0] < -B[3] && C[0] < -C[3] && D[0] < -D[3] &&
-        E[0] < -E[3] && F[0] < -F[3] && G[0] < -G[3] && H[0] < -H[3])
-        return 0;
-
-    // Compute the length of the longest visible edge, in pixels.
-
-    return std::max(std::max(length(A, B, vw, vh),
-                             length(C, D, vw, vh)),
-                    std::max(length(A, C, vw, vh),
-                             length(B, D, vw, vh)));
+    double x[8], y[8], z[8];
+
+    for (int k = 0; k < 4; k++)
+    {
+        x[k    ] = v[3 * k + 0] * r0;
+        y[k    ] = v[3 * k + 1] * r0;
+        z[k    ] = v[3 * k + 2] * r0;
+        x[k + 4] = v[3 * k + 0] * r2;
+        y[k + 4] = v[3 * k + 1] * r2;
+        z[k + 4] = v[3 * k + 2] * r2;
+    }
+
+    // Test it against the view volume and measure it on screen.
+
+    double k = 0;
+
+    for (int j = 0; j < views; j++)
+        k = std::max(k, clip(M + 16 * j, x, y, z, vw, vh));
+
+    return k;
 }
 
 //------------------------------------------------------------------------------
 
-// Add page i to the set of pages needed for this scene. Recursively traverse
-// the neighborhood of this branch, adding pages to ensure that no two visibly
-// adjacent pages differ by more than one level of detail.
+// Extrapolate the view matrix M of the given scene and channel forward by the
+// prefetch time, giving N. The velocity of each matrix element is measured
+// between the first draws of consecutive frames, so repeated draws within a
+// frame share one estimate. Return false if there is no motion to predict. Note
+// the latest frame in which any view moved appreciably within one second.
 
-void scm_sphere::add_page(const double *M,
-                                   int width,
-                                   int height,
-                                double r0,
-                                double r1, long long i, bool zoom)
+bool scm_sphere::predict(double *N, const scm_scene *scene,
+                   const double *M, int channel, int frame)
 {
-    if (!is_set(i))
+    motion& m = motions[motion_key(scene, channel)];
+
+    if (m.frame != frame)
     {
-        double k = view_page(M, width, height, r0, r1, i, zoom);
+        unsigned t = SDL_GetTicks();
 
-        if (k > 0)
+        if (m.frame == frame - 1 && m.time < t)
+            for (int k = 0; k < 16; k++)
+                m.V[k] = (M[k] - m.M[k]) / double(t - m.time);
+        else
+            for (int k = 0; k < 16; k++)
+                m.V[k] = 0.0;
+
+        for (int k = 0; k < 16; k++)
+            m.M[k] = M[k];
+
+        m.frame = frame;
+        m.time  = t;
+    }
+
+    bool moving = false;
+
+    for (int k = 0; k < 16; k++)
+    {
+        N[k] = M[k] + m.V[k] * prefetch;
+
+        if (fabs(m.V[k]) * 1000.0 > 1e-6 * std::max(fabs(M[k]), 1.0))
+            moving = true;
+    }
+    if (moving)
+        moved = frame;
+
+    return moving && prefetch > 0;
+}
+
+//------------------------------------------------------------------------------
+
+// Select the pages of view M, refining the retained selection f if it follows,
+// and retain the new selection in f.
+
+void scm_sphere::track(scm_scene *scene, const double *M,
+                       int width, int height, int channel, int frame,
+                       frontier& f)
+{
+    if (incremental && follows(f, M, width, height, frame))
+        refine(scene, M, width, height, channel, scene->uzoomk >= 0, f);
+    else
+        prep  (scene, M, width, height, channel, scene->uzoomk >= 0);
+
+    keep(f, M, width, height, frame);
+}
+
+// Retain the cut of the last traversal in f, as made of view M at the given
+// target size and frame.
+
+void scm_sphere::keep(frontier& f, const double *M,
+                      int width, int height, int frame)
+{
+    f.cut.swap(next);
+    f.frame  = frame;
+    f.width  = width;
+    f.height = height;
+    f.limit  = limit;
+    f.zoomk  = zoomk;
+
+    for (int k = 0; k < 16; k++)
+        f.M[k] = M[k];
+}
+
+// Return true if the retained selection f may be refined to suit view matrix M
+// at the given target size and frame.
+
+bool scm_sphere::follows(const frontier& f, const double *M,
+                         int width, int height, int frame) const
+{
+    if (f.frame  != frame && f.frame != frame - 1) return false;
+    if (f.width  != width)  return false;
+    if (f.height != height) return false;
+    if (f.limit  != limit)  return false;
+    if (f.zoomk  != zoomk)  return false;
+
+    double d = 0;
+    double n = 0;
+
+    for (int k = 0; k < 16; k++)
+    {
+        d += (M[k] - f.M[k]) * (M[k] - f.M[k]);
+        n += (M[k]         ) * (M[k]         );
+    }
+    return (d <= jump * jump * n);
+}
+
+// Update the selection incrementally, beginning with the cut of frontier f.
+// The cut is recorded in traversal order, so four siblings that all stopped
+// the last traversal are adjacent. Such a group is re-evaluated from their
+// parent, which merges them if the parent no longer exceeds the limit, and
+// otherwise treats them exactly as a full traversal would. Any other page of
+// the cut is re-evaluated alone, which subdivides it where necessary. The new
+// cut is recorded in the same order as the traversal proceeds.
+
+void scm_sphere::refine(scm_scene *scene, const double *M,
+                        int width, int height, int channel, bool zoom,
+                        frontier& f)
+{
+    const size_t n = f.cut.size();
+
+    pages.clear();
+    next .clear();
+
+    if (is_parallel() && n >= 2 * smallest_run)
+    {
+        // Divide the cut into runs, moving each boundary forward to a root or
+        // first child so that no group of siblings is split between runs.
+
+        size_t m = std::min(size_t(parts_per_thread * (loader->get_count() + 1)),
+                            n / smallest_run);
+        size_t j = 0;
+
+        parts.resize(m);
+
+        for (size_t k = 0; k < m; k++)
         {
-            pages.insert(i);
+            size_t e = (k + 1 == m) ? n : n * (k + 1) / m;
 
-            if (i > 5)
+            while (e < n && f.cut[e] > 5 && scm_page_order(f.cut[e]) != 0)
+                e++;
+
+            parts[k].j0 = j;
+            parts[k].j1 = j = std::max(e, j);
+        }
+
+        job J(this, scene, M, width, height, channel, zoom, &f.cut);
+
+        loader->parallel(&J, int(m));
+
+        merge(true);
+    }
+    else
+        refine(scene, M, width, height, channel, zoom, f.cut, 0, n, pages, next);
+
+    pages.sort();
+}
+
+// Refine the run [j0, j1) of the retained cut, adding pages to the page set P
+// and appending the new cut to C.
+
+void scm_sphere::refine(scm_scene *scene, const double *M,
+                        int width, int height, int channel, bool zoom,
+                        const std::vector<long long>& cut, size_t j0, size_t j1,
+                        scm_pageset& P, std::vector<long long>& C)
+{
+    for (size_t j = j0; j < j1; )
+    {
+        long long i = cut[j];
+
+        if (i > 5 && j + 3 < j1 && scm_page_order(i) == 0)
+        {
+            long long p = scm_page_parent(i);
+
+            if (cut[j + 1] == scm_page_child(p, 1) &&
+                cut[j + 2] == scm_page_child(p, 2) &&
+                cut[j + 3] == scm_page_child(p, 3))
             {
-                long long p = scm_page_parent(i);
-
-                add_page(M, width, height, r0, r1, p, zoom);
-
-                switch (scm_page_order(i))
-                {
-                    case 0:
-                        add_page(M, width, height, r0, r1, scm_page_north(p), zoom);
-                        add_page(M, width, height, r0, r1, scm_page_south(i), zoom);
-                        add_page(M, width, height, r0, r1, scm_page_east (i), zoom);
-                        add_page(M, width, height, r0, r1, scm_page_west (p), zoom);
-                        break;
-                    case 1:
-                        add_page(M, width, height, r0, r1, scm_page_north(p), zoom);
-                        add_page(M, width, height, r0, r1, scm_page_south(i), zoom);
-                        add_page(M, width, height, r0, r1, scm_page_east (p), zoom);
-                        add_page(M, width, height, r0, r1, scm_page_west (i), zoom);
-                        break;
-                    case 2:
-                        add_page(M, width, height, r0, r1, scm_page_north(i), zoom);
-                        add_page(M, width, height, r0, r1, scm_page_south(p), zoom);
-                        add_page(M, width, height, r0, r1, scm_page_east (i), zoom);
-                        add_page(M, width, height, r0, r1, scm_page_west (p), zoom);
-                        break;
-                    case 3:
-                        add_page(M, width, height, r0, r1, scm_page_north(i), zoom);
-                        add_page(M, width, height, r0, r1, scm_page_south(p), zoom);
-                        add_page(M, width, height, r0, r1, scm_page_east (p), zoom);
-                        add_page(M, width, height, r0, r1, scm_page_west (i), zoom);
-                        break;
-                }
+                prep_page(scene, M, width, height, channel, p, zoom, P, C);
+                j += 4;
+                continue;
             }
         }
+        prep_page(scene, M, width, height, channel, i, zoom, P, C);
+        j += 1;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// Return true if the pre-pass should run on the loader pool.
+
+bool scm_sphere::is_parallel() const
+{
+    return (parallel && loader && loader->get_count() > 1);
+}
+
+// Perform a full pre-pass in parallel. Evaluate the top of the page tree on
+// the calling thread, breadth-first, until there are enough subtrees needing
+// subdivision to occupy the pool. Traverse these concurrently and merge their
+// page sets. Then resolve the top of the tree in depth-first order, giving the
+// same cut as a serial traversal.
+
+void scm_sphere::fork(scm_scene *scene, const double *M,
+                      int width, int height, int channel, bool zoom)
+{
+    const size_t m = size_t(parts_per_thread * (loader->get_count() + 1));
+
+    std::vector<int> c;
+    std::vector<int> d;
+
+    nodes.clear();
+
+    for (long long i = 0; i < 6; i++)
+        plan(scene, M, width, height, channel, i, zoom, c);
+
+    while (!c.empty() && c.size() < m)
+    {
+        d.swap(c);
+        c.clear();
+
+        for (size_t j = 0; j < d.size(); j++)
+        {
+            const long long i = nodes[d[j]].i;
+
+            nodes[d[j]].kind = node::split;
+            nodes[d[j]].next = int(nodes.size());
+
+            for (int q = 0; q < 4; q++)
+                plan(scene, M, width, height, channel,
+                     scm_page_child(i, q), zoom, c);
+        }
+    }
+
+    if (!c.empty())
+    {
+        parts.resize(c.size());
+
+        for (size_t k = 0; k < c.size(); k++)
+        {
+            nodes[c[k]].next = int(k);
+            parts[k].i       = nodes[c[k]].i;
+        }
+
+        job J(this, scene, M, width, height, channel, zoom, 0);
+
+        loader->parallel(&J, int(c.size()));
+
+        merge(false);
+    }
+
+    for (int r = 0; r < 6; r++)
+        resolve(scene, channel, r, M, width, height, zoom);
+}
+
+// Return true if page i is present in the scene, or in the scene paired with
+// it for a shared selection, and give the union of their bounds.
+
+bool scm_sphere::get_page(scm_scene *scene, int channel, long long i,
+                          float& r0, float& r1) const
+{
+    bool b = scene->get_page_status(channel, i);
+
+    if (b)
+        scene->get_page_bounds(channel, i, r0, r1);
+
+    if (paired && paired->get_page_status(channel, i))
+    {
+        float t0;
+        float t1;
+
+        paired->get_page_bounds(channel, i, t0, t1);
+
+        r0 = b ? std::min(r0, t0) : t0;
+        r1 = b ? std::max(r1, t1) : t1;
+        b  = true;
+    }
+    return b;
+}
+
+// Evaluate page i on the calling thread and append its node. A page needing
+// subdivision is noted in c.
+
+void scm_sphere::plan(scm_scene *scene, const double *M,
+                      int width, int height, int channel, long long i,
+                      bool zoom, std::vector<int>& c)
+{
+    node n;
+
+    n.i    = i;
+    n.kind = node::stop;
+    n.next = 0;
+
+    float t0;
+    float t1;
+
+    if (get_page(scene, channel, i, t0, t1))
+    {
+        double k = view_page(M, width, height, t0, t1, i, zoom);
+
+        if (k > limit)
+        {
+            n.kind = node::task;
+            c.push_back(int(nodes.size()));
+        }
+        else if (k > 0)
+            n.kind = node::leaf;
+    }
+    nodes.push_back(n);
+}
+
+// Complete the traversal of node n as prep_page would, appending to the cut and
+// drawing the pages the serial traversal would have drawn. Return true if any
+// page was added.
+
+bool scm_sphere::resolve(scm_scene *scene, int channel, int n,
+                         const double *M, int width, int height, bool zoom)
+{
+    const node& d = nodes[n];
+
+    if (d.kind == node::stop)
+    {
+        next.push_back(d.i);
+        return false;
+    }
+    if (d.kind == node::task)
+    {
+        const part& p = parts[d.next];
+
+        next.insert(next.end(), p.cut.begin(), p.cut.end());
+        return p.b;
+    }
+    if (d.kind == node::split)
+    {
+        const size_t m = next.size();
+
+        bool b0 = resolve(scene, channel, d.next + 0, M, width, height,
+                                                           zoom);
+        bool b1 = resolve(scene, channel, d.next + 1, M, width, height,
+                                                           zoom);
+        bool b2 = resolve(scene, channel, d.next + 2, M, width, height,
+                                                           zoom);
+        bool b3 = resolve(scene, channel, d.next + 3, M, width, height,
+                                                           zoom);
+
+        if (b0 || b1 || b2 || b3)
+            return true;
+
+        next.resize(m);
+    }
+    if (!pages.search(d.i))
+        set_page(scene, channel, M, width, height, d.i, zoom, pages);
+
+    next.push_back(d.i);
+    return true;
+}
+
+// Merge the page sets of all parts. Each page set is the closure of the pages
+// its part drew under the neighborhood rule of set_page, which does not depend
+// upon the order of insertion, so their union is the closure of all pages
+// drawn, exactly as a serial traversal gives. If requested, also
+// concatenate the cuts of all parts, in order.
+
+void scm_sphere::merge(bool cut)
+{
+    for (size_t k = 0; k < parts.size(); k++)
+    {
+        const part& p = parts[k];
+
+        for (scm_pageset::const_iterator it = p.pages.begin();
+                                         it != p.pages.end(); ++it)
+            pages.insert(*it);
+
+        if (cut)
+            next.insert(next.end(), p.cut.begin(), p.cut.end());
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// Select pages on the GPU, applying the neighborhood rule to the pages chosen.
+// Return false if there is no GPU selection, and the CPU must select instead.
+
+bool scm_sphere::choose(scm_scene *scene, const double *M,
+                        int width, int height, int channel)
+{
+    if (cull == 0 && scm_cull::is_supported())
+        cull = new scm_cull();
+
+    if (cull && cull->select(scene, M, width, height, channel, limit, culled))
+    {
+        pages.clear();
+        next .clear();
+
+        for (size_t j = 0; j < culled.size(); ++j)
+            if (!pages.search(culled[j].i))
+                set_page(scene, channel, M, width, height,
+                                           culled[j].i, false, pages);
+        pages.sort();
+        return true;
+    }
+    return false;
+}
+
+//------------------------------------------------------------------------------
+
+// Add page i to the page set P if it is visible. Its visibility is judged by
+// its own bounds, or by the unit sphere if it is absent from the scene, so
+// that the outcome never depends upon the page through which it was reached.
+
+void scm_sphere::add_page(scm_scene *scene,
+                                  int channel,
+                         const double *M,
+                                  int width,
+                                  int height, long long i, bool zoom,
+                          scm_pageset& P)
+{
+    if (!P.search(i))
+    {
+        float r0 = 1.0f;
+        float r1 = 1.0f;
+
+        get_page(scene, channel, i, r0, r1);
+
+        if (view_page(M, width, height, r0, r1, i, zoom) > 0)
+            set_page(scene, channel, M, width, height, i, zoom, P);
+    }
+}
+
+// Add visible page i to the page set P. Recursively traverse the neighborhood
+// of this branch, adding pages to ensure that no two visibly adjacent pages
+// differ by more than one level of detail. The resulting set is the closure
+// of its drawn pages under this rule, regardless of the order of insertion.
+
+void scm_sphere::set_page(scm_scene *scene,
+                                  int channel,
+                         const double *M,
+                                  int width,
+                                  int height, long long i, bool zoom,
+                          scm_pageset& P)
+{
+    P.insert(i);
+
+    if (i > 5)
+    {
+        const scm_coord q = scm_page_coord (i);
+        const scm_coord p = scm_page_parent(q);
+
+        add_page(scene, channel, M, width, height, scm_page_index(p), zoom, P);
+
+        // Visit the neighbors of the parent that border this page's quadrant,
+        // and the neighbors of this page across the quadrant's interior edges.
+
+        const long long o = scm_page_order(q);
+
+        scm_coord n = (o < 2) ? scm_page_north(p) : scm_page_north(q);
+        scm_coord s = (o < 2) ? scm_page_south(q) : scm_page_south(p);
+        scm_coord e = (o & 1) ? scm_page_east (p) : scm_page_east (q);
+        scm_coord w = (o & 1) ? scm_page_west (q) : scm_page_west (p);
+
+        add_page(scene, channel, M, width, height, scm_page_index(n), zoom, P);
+        add_page(scene, channel, M, width, height, scm_page_index(s), zoom, P);
+        add_page(scene, channel, M, width, height, scm_page_index(e), zoom, P);
+        add_page(scene, channel, M, width, height, scm_page_index(w), zoom, P);
     }
 }
 
+// Traverse page i, adding it or its descendants to the page set P. Append each
+// page at which the traversal stops to the cut C. Return true if any page was
+// added.
+
 bool scm_sphere::prep_page(scm_scene *scene,
                         const double *M,
                                   int width,
                                   int height,
-                                  int channel, long long i, bool zoom)
+                                  int channel, long long i, bool zoom,
+                         scm_pageset& P, std::vector<long long>& C)
 {
     float t0;
     float t1;
 
     // If this page is missing from all data sets, skip it.
 
-    if (scene->get_page_status(channel, i))
+    if (get_page(scene, channel, i, t0, t1))
     {
-        scene->get_page_bounds(channel, i, t0, t1);
-
         double r0 = double(t0);
         double r1 = double(t1);
 
@@ -500,24 +1465,34 @@ bool scm_sphere::prep_page(scm_scene *scene,
         {
             if (k > limit)
             {
-                long long i0 = scm_page_child(i, 0);
-                long long i1 = scm_page_child(i, 1);
-                long long i2 = scm_page_child(i, 2);
-                long long i3 = scm_page_child(i, 3);
+                const scm_coord q = scm_page_coord(i);
+
+                long long i0 = scm_page_index(scm_page_child(q, 0));
+                long long i1 = scm_page_index(scm_page_child(q, 1));
+                long long i2 = scm_page_index(scm_page_child(q, 2));
+                long long i3 = scm_page_index(scm_page_child(q, 3));
 
-                bool b0 = prep_page(scene, M, width, height, channel, i0, zoom);
-                bool b1 = prep_page(scene, M, width, height, channel, i1, zoom);
-                bool b2 = prep_page(scene, M, width, height, channel, i2, zoom);
-                bool b3 = prep_page(scene, M, width, height, channel, i3, zoom);
+                bool b0 = prep_page(scene, M, width, height, channel, i0, zoom, P, C);
+                bool b1 = prep_page(scene, M, width, height, channel, i1, zoom, P, C);
+                bool b2 = prep_page(scene, M, width, height, channel, i2, zoom, P, C);
+                bool b3 = prep_page(scene, M, width, height, channel, i3, zoom, P, C);
 
                 if (b0 || b1 || b2 || b3)
                     return true;
+
+                // No child is drawn, so this page stops the traversal instead.
+
+                C.resize(C.size() - 4);
             }
-            add_page(M, width, height, r0, r1, i, zoom);
+            if (!P.search(i))
+                set_page(scene, channel, M, width, height, i, zoom, P);
+
+            C.push_back(i);
 
             return true;
         }
     }
+    C.push_back(i);
     return false;
 }
 
@@ -526,10 +1501,12 @@ void scm_sphere::draw_page(scm_scene *scene,
 {
     scene->bind_page(channel, depth, frame, i);
     {
-        long long i0 = scm_page_child(i, 0);
-        long long i1 = scm_page_child(i, 1);
-        long long i2 = scm_page_child(i, 2);
-        long long i3 = scm_page_child(i, 3);
+        const scm_coord q = scm_page_coord(i);
+
+        long long i0 = scm_page_index(scm_page_child(q, 0));
+        long long i1 = scm_page_index(scm_page_child(q, 1));
+        long long i2 = scm_page_index(scm_page_child(q, 2));
+        long long i3 = scm_page_index(scm_page_child(q, 3));
 
         bool b0 = is_set(i0);
         bool b1 = is_set(i1);
@@ -549,8 +1526,8 @@ void scm_sphere::draw_page(scm_scene *scene,
         {
             // Compute the texture coordate transform for this page.
 
-            long long r = scm_page_row(i);
-            long long c = scm_page_col(i);
+            long long r = q.r;
+            long long c = q.c;
             long long R = r;
             long long C = c;
 
@@ -569,10 +1546,15 @@ void scm_sphere::draw_page(scm_scene *scene,
 
             // Select a mesh that matches up with the neighbors. Draw it.
 
-            int j = (i < 6) ? 0 : (is_set(scm_page_north(i)) ? 0 : 1)
-                                | (is_set(scm_page_south(i)) ? 0 : 2)
-                                | (is_set(scm_page_west (i)) ? 0 : 4)
-                                | (is_set(scm_page_east (i)) ? 0 : 8);
+            int j = 0;
+
+            if (i > 5)
+            {
+                if (!is_set(scm_page_index(scm_page_north(q)))) j |= 1;
+                if (!is_set(scm_page_index(scm_page_south(q)))) j |= 2;
+                if (!is_set(scm_page_index(scm_page_west (q)))) j |= 4;
+                if (!is_set(scm_page_index(scm_page_east (q)))) j |= 8;
+            }
 
             glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elements[j]);
             glDrawElements(GL_QUADS, count, GL_ELEMENT_INDEX, 0);
@@ -581,6 +1563,178 @@ void scm_sphere::draw_page(scm_scene *scene,
     scene->unbind_page(channel, depth);
 }
 
+// Gather a record for every page drawn, as draw_page would, and draw them all
+// with one indirect multi-draw per mesh. @see set_batched
+
+void scm_sphere::draw_batch(scm_scene *scene, int channel, int frame)
+{
+    const int n = scene->get_channel_count(channel);
+    const int s = 20 + 16 * n;
+
+    levels.resize(16 * 4 * n);
+
+    for (int j = 0; j < 16; ++j)
+        batch[j].clear();
+
+    for (int r = 0; r < 6; ++r)
+        if (is_set(r))
+            flat_page(scene, channel, 0, frame, s, r, r);
+
+    // Upload the records grouped by mesh.
+
+    size_t  size = 0;
+    GLsizei most = 0;
+
+    for (int j = 0; j < 16; ++j)
+    {
+        size += batch[j].size();
+        most  = std::max(most, GLsizei(batch[j].size() / (4 * s)));
+    }
+
+    if (size == 0)
+        return;
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, records);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, size * sizeof (GLfloat),
+                                           0, GL_STREAM_DRAW);
+    size = 0;
+
+    for (int j = 0; j < 16; ++j)
+        if (!batch[j].empty())
+        {
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, size * sizeof (GLfloat),
+                                  batch[j].size() * sizeof (GLfloat),
+                                 &batch[j].front());
+            size += batch[j].size();
+        }
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, records);
+
+    // Every page draws the whole mesh, so all commands are the same and the
+    // gl_DrawIDARB of each, offset by page_first, selects its record.
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands);
+
+    if (commands_n < most)
+    {
+        std::vector<GLuint> c(5 * most, 0);
+
+        for (GLsizei k = 0; k < most; ++k)
+        {
+            c[5 * k + 0] = GLuint(count);
+            c[5 * k + 1] = 1;
+        }
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, c.size() * sizeof (GLuint),
+                                             &c.front(), GL_STATIC_DRAW);
+        commands_n = most;
+    }
+
+    glUniform1i(scene->upage_stride, s);
+
+    GLint first = 0;
+
+    for (int j = 0; j < 16; ++j)
+        if (GLsizei m = GLsizei(batch[j].size() / (4 * s)))
+        {
+            glUniform1i(scene->upage_first, first);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elements[j]);
+            glMultiDrawElementsIndirect(GL_QUADS, GL_ELEMENT_INDEX, 0, m, 0);
+            first += m;
+        }
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+// Traverse page i at the given depth as draw_page does, noting the records of
+// each image at this depth and appending the record of stride s of each page
+// drawn to the batch of its mesh. r gives the root face.
+
+void scm_sphere::flat_page(scm_scene *scene, int channel, int depth, int frame,
+                           int s, int r, long long i)
+{
+    const int n = (s - 20) / 16;
+
+    if (n)
+        scene->get_page_record(channel, frame, i, &levels[4 * n * depth]);
+
+    const scm_coord q = scm_page_coord(i);
+
+    long long i0 = scm_page_index(scm_page_child(q, 0));
+    long long i1 = scm_page_index(scm_page_child(q, 1));
+    long long i2 = scm_page_index(scm_page_child(q, 2));
+    long long i3 = scm_page_index(scm_page_child(q, 3));
+
+    bool b0 = is_set(i0);
+    bool b1 = is_set(i1);
+    bool b2 = is_set(i2);
+    bool b3 = is_set(i3);
+
+    if (b0 || b1 || b2 || b3)
+    {
+        if (b0) flat_page(scene, channel, depth + 1, frame, s, r, i0);
+        if (b1) flat_page(scene, channel, depth + 1, frame, s, r, i1);
+        if (b2) flat_page(scene, channel, depth + 1, frame, s, r, i2);
+        if (b3) flat_page(scene, channel, depth + 1, frame, s, r, i3);
+    }
+    else
+    {
+        int j = 0;
+
+        if (i > 5)
+        {
+            if (!is_set(scm_page_index(scm_page_north(q)))) j |= 1;
+            if (!is_set(scm_page_index(scm_page_south(q)))) j |= 2;
+            if (!is_set(scm_page_index(scm_page_west (q)))) j |= 4;
+            if (!is_set(scm_page_index(scm_page_east (q)))) j |= 8;
+        }
+
+        std::vector<GLfloat>& b = batch[j];
+
+        const size_t o = b.size();
+
+        b.resize(o + 4 * s, 0.f);
+
+        GLfloat *p = &b[o];
+
+        // Face matrix, depth, and mesh.
+
+        for (int k = 0; k < 3; ++k)
+        {
+            p[4 * k + 0] = faces[r][3 * k + 0];
+            p[4 * k + 1] = faces[r][3 * k + 1];
+            p[4 * k + 2] = faces[r][3 * k + 2];
+        }
+        p[12] = GLfloat(depth);
+        p[13] = GLfloat(j);
+
+        // Texture coordinate transforms, exactly as draw_page computes them.
+
+        long long R = q.r;
+        long long C = q.c;
+
+        for (int l = depth; l >= 0; --l)
+        {
+            GLfloat m = 1.0f / (1 << (depth - l));
+
+            p[16 + 4 * l + 0] = m;
+            p[16 + 4 * l + 1] = m;
+            p[16 + 4 * l + 2] = m * q.c - C;
+            p[16 + 4 * l + 3] = m * q.r - R;
+
+            C /= 2;
+            R /= 2;
+        }
+
+        // Image records of this branch.
+
+        for (int k = 0; k < n; ++k)
+            for (int l = 0; l <= depth; ++l)
+                std::copy(&levels[4 * (n * l + k)],
+                          &levels[4 * (n * l + k)] + 4, p + 4 * (20 + 16 * k + l));
+    }
+}
+
 //------------------------------------------------------------------------------
 
 static void init_vertices(int n)
@@ -667,6 +1821,10 @@ void scm_sphere::init_arrays(int n)
 {
     glGenBuffers(1, &vertices);
     glGenBuffers(16, elements);
+    glGenBuffers(1, &records);
+    glGenBuffers(1, &commands);
+
+    commands_n = 0;
 
     glBindBuffer(GL_ARRAY_BUFFER, vertices);
     init_vertices(n);
@@ -682,6 +1840,8 @@ void scm_sphere::init_arrays(int n)
 
 void scm_sphere::free_arrays()
 {
+    glDeleteBuffers(1, &commands);
+    glDeleteBuffers(1, &records);
     glDeleteBuffers(16, elements);
     glDeleteBuffers(1, &vertices);
 }
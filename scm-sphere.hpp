@@ -16,8 +16,15 @@
 #include <GL/glew.h>
 #include <vector>
 #include <set>
+#include <map>
 
 #include "scm-scene.hpp"
+#include "scm-pageset.hpp"
+#include "scm-cull.hpp"
+
+//------------------------------------------------------------------------------
+
+class scm_loader;
 
 //------------------------------------------------------------------------------
 
@@ -26,6 +33,16 @@
 /// The sphere performs all visibility testing and subdivision necessary to
 /// optimally render a given scene. Detail and limit parameters tune this
 /// facility. Optional zoom direction and degree are maintained if needed.
+///
+/// Given a loader pool, the visibility pre-pass runs in parallel. The top of
+/// the page tree is expanded on the calling thread until there are enough
+/// subtrees to occupy the pool, and these are traversed concurrently, each
+/// into its own page set. The sets are then merged and the top of the tree
+/// resolved. An incremental pre-pass divides the retained cut among the pool
+/// in the same way. Each page added by the neighborhood rule is judged by its
+/// own bounds, not by those of the page from which it was reached, so every
+/// page set is a function only of the pages drawn. The selection is thus
+/// that of a serial traversal, whatever the pool size or order of completion.
 
 class scm_sphere
 {
@@ -34,21 +51,49 @@ public:
     scm_sphere(int d, int l);
    ~scm_sphere();
 
-    void set_detail(int d);
-    void set_limit (int l);
+    void   set_detail  (int d);
+    void   set_limit   (int l);
+    void   set_prefetch(double t);
+    void   set_incremental(bool b);
+    void   set_parallel   (bool b);
+    void   set_batched    (bool b);
+    void   set_compute    (bool b);
+
+    int    get_detail  () const { return detail;   }
+    int    get_limit   () const { return limit;    }
+    double get_prefetch() const { return prefetch; }
+    int    get_moved   () const { return moved;    }
+    bool   get_incremental() const { return incremental; }
+    bool   get_parallel   () const { return parallel;    }
+    bool   get_batched    () const { return batched;     }
+    bool   get_compute    () const { return compute;     }
 
-    int  get_detail() const { return detail; }
-    int  get_limit () const { return limit;  }
+    void   set_loader(scm_loader *);
 
     void prep(scm_scene *, const double *, int, int, int, bool);
     void draw(scm_scene *, const double *, int, int, int, int);
+    void share(scm_scene *, scm_scene *, const double *, int, int, int,
+                                                        int, int);
+    void list(scm_scene *, const double *, int, int, int,
+                                    std::set<long long>&);
+
+    bool is_drawn  (long long i) const { return drawn && drawn->search(i); }
+    bool is_covered(long long i) const;
 
     void set_zoom(double x, double y, double z, double k);
+    void reset();
+    void del_scene(const scm_scene *);
 
 private:
 
-    int detail;
-    int limit;
+    int    detail;
+    int    limit;
+    double prefetch;
+    int    moved;
+    bool   incremental;
+    bool   parallel;
+    bool   batched;
+    bool   compute;
 
     // Zooming state.
 
@@ -57,20 +102,155 @@ private:
 
     void zoom(double *, const double *);
 
+    // Camera motion state, per scene and channel, for predictive prefetch.
+
+    struct motion
+    {
+        motion() : frame(-2), time(0) { }
+
+        int      frame;
+        unsigned time;
+        double   M[16];
+        double   V[16];
+    };
+
+    typedef std::pair<const scm_scene *, int> motion_key;
+
+    std::map<motion_key, motion> motions;
+
+    bool predict(double *, const scm_scene *, const double *, int, int);
+
+    // Retained selection state, per scene and channel, for incremental prep,
+    // of the view and of its predicted view. The cut is the set of pages at
+    // which the last traversal stopped, being drawn, culled, or absent, and
+    // thus covers the sphere exactly once.
+
+    struct frontier
+    {
+        frontier() : frame(-2), width(0), height(0), limit(0), zoomk(1) { }
+
+        int      frame;
+        int      width;
+        int      height;
+        int      limit;
+        double   zoomk;
+        double   M[16];
+
+        std::vector<long long> cut;
+    };
+
+    std::map<motion_key, frontier> frontiers;
+    std::map<motion_key, frontier> forecasts;
+
+    std::vector<long long> next;
+
+    // Selections shared by all views of a frame, per scene and channel. While
+    // one is made, views gives the view count, and paired any second scene.
+
+    struct shared
+    {
+        shared() : frame(-2) { }
+
+        int         frame;
+        scm_pageset pages;
+    };
+
+    std::map<motion_key, shared> shares;
+
+    int        views;
+    scm_scene *paired;
+
+    void  select(scm_scene *, const double *, int, int, int, int);
+    void request(scm_scene *, int, int);
+
+    bool get_page(scm_scene *, int, long long, float&, float&) const;
+
+    void   track(scm_scene *, const double *, int, int, int, int, frontier&);
+    void    keep(frontier&, const double *, int, int, int);
+    bool follows(const frontier&, const double *, int, int, int) const;
+    void  refine(scm_scene *, const double *, int, int, int, bool, frontier&);
+    void  refine(scm_scene *, const double *, int, int, int, bool,
+                 const std::vector<long long>&, size_t, size_t,
+                 scm_pageset&, std::vector<long long>&);
+
+    // Parallel traversal state. A node is one page of the top of the tree,
+    // expanded on the calling thread. A part is one subtree, or one run of a
+    // retained cut, traversed by the loader pool.
+
+    struct node
+    {
+        enum { stop, leaf, task, split };
+
+        long long i;     // Page index
+        int       kind;  // Outcome of the page's evaluation
+        int       next;  // First child node if split, part index if task
+    };
+
+    struct part
+    {
+        part() : i(0), j0(0), j1(0), b(false) { }
+
+        long long              i;      // Subtree root
+        size_t                 j0;     // Cut run begin
+        size_t                 j1;     // Cut run end
+        bool                   b;      // Was any page added?
+        scm_pageset            pages;  // Pages added
+        std::vector<long long> cut;    // Pages at which traversal stopped
+    };
+
+    class job;
+    friend class job;
+
+    scm_loader       *loader;
+    std::vector<node> nodes;
+    std::vector<part> parts;
+
+    bool is_parallel() const;
+    void   fork(scm_scene *, const double *, int, int, int, bool);
+    void   plan(scm_scene *, const double *, int, int, int, long long, bool,
+                std::vector<int>&);
+    bool resolve(scm_scene *, int, int, const double *, int, int, bool);
+    void   merge(bool);
+
     // Data structures and algorithms for handling face adaptive subdivision.
 
-    std::set<long long> pages;
+    scm_pageset pages;
+    scm_pageset ahead;
+
+    const scm_pageset *drawn;
 
-    bool     is_set (long long i) const { return (pages.find(i) != pages.end()); }
-    void    set_page(long long i);
+    mutable scm_pageset covered;    // Drawn pages and all their ancestors
+    mutable bool        covered_ok; // Covered set matches the drawn set
 
-    void    add_page(const double *, int, int, double, double, long long, bool);
+    bool     is_set (long long i) const { return pages.search(i); }
+
+    void    add_page(scm_scene *, int, const double *, int, int, long long,
+                     bool, scm_pageset&);
+    void    set_page(scm_scene *, int, const double *, int, int, long long,
+                     bool, scm_pageset&);
     double view_page(const double *, int, int, double, double, long long, bool);
     void  debug_page(const double *,           double, double, long long);
 
-    bool   prep_page(scm_scene *, const double *, int, int, int, long long, bool);
+    bool   prep_page(scm_scene *, const double *, int, int, int, long long, bool,
+                     scm_pageset&, std::vector<long long>&);
     void   draw_page(scm_scene *,                 int, int, int, long long);
 
+    // GPU selection state.
+
+    scm_cull                    *cull;
+    std::vector<scm_cull::page>  culled;
+
+    bool choose(scm_scene *, const double *, int, int, int);
+
+    // Batched drawing state. Page records are gathered by mesh, with the
+    // records of each image at each depth of the current branch in levels.
+
+    void  draw_batch(scm_scene *, int, int);
+    void  flat_page (scm_scene *, int, int, int, int, int, long long);
+
+    std::vector<GLfloat> batch[16];
+    std::vector<GLfloat> levels;
+
     // OpenGL geometry state.
 
     void init_arrays(int);
@@ -79,6 +259,9 @@ private:
     GLsizei count;
     GLuint  vertices;
     GLuint  elements[16];
+    GLuint  records;
+    GLuint  commands;
+    GLsizei commands_n;
 };
 
 //------------------------------------------------------------------------------
@@ -0,0 +1,77 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#include "scm-stats.hpp"
+
+//------------------------------------------------------------------------------
+
+SDL_atomic_t scm_stats::counts [counter_count];
+SDL_atomic_t scm_stats::levels [gauge_count];
+SDL_atomic_t scm_stats::buckets[histogram_count][bucket_count];
+
+//------------------------------------------------------------------------------
+
+/// Initialize an empty snapshot. The first take counts activity from now.
+
+scm_stats::snapshot::snapshot() : frame(0)
+{
+    for (int c = 0; c < counter_count; ++c)
+    {
+        count[c] = 0;
+        total[c] = 0;
+        last [c] = SDL_AtomicGet(&counts[c]);
+    }
+    for (int g = 0; g < gauge_count; ++g)
+        level[g] = 0;
+
+    for (int h = 0; h < histogram_count; ++h)
+        for (int k = 0; k < bucket_count; ++k)
+        {
+            bucket[h][k] = 0;
+            marks [h][k] = SDL_AtomicGet(&buckets[h][k]);
+        }
+}
+
+//------------------------------------------------------------------------------
+
+/// Fold all activity since the previous take of snapshot s into it, labeled
+/// with frame t. Counts that wrap between calls are handled correctly, so long
+/// as fewer than 2^32 events occur in one frame. Each snapshot should be taken
+/// by only one thread. @see scm_system::update_cache
+
+void scm_stats::take(int t, snapshot& s)
+{
+    s.frame = t;
+
+    for (int c = 0; c < counter_count; ++c)
+    {
+        const int n = SDL_AtomicGet(&counts[c]);
+
+        s.count[c]  = (long long) (unsigned int) (n - s.last[c]);
+        s.total[c] += s.count[c];
+        s.last [c]  = n;
+    }
+
+    for (int g = 0; g < gauge_count; ++g)
+        s.level[g] = SDL_AtomicGet(&levels[g]);
+
+    for (int h = 0; h < histogram_count; ++h)
+        for (int k = 0; k < bucket_count; ++k)
+        {
+            const int n = SDL_AtomicGet(&buckets[h][k]);
+
+            s.bucket[h][k] = (long long) (unsigned int) (n - s.marks[h][k]);
+            s.marks [h][k] = n;
+        }
+}
+
+//------------------------------------------------------------------------------
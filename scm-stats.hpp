@@ -0,0 +1,156 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#ifndef SCM_STATS_HPP
+#define SCM_STATS_HPP
+
+#include <SDL.h>
+#include <SDL_atomic.h>
+
+//------------------------------------------------------------------------------
+
+/// scm_stats gathers performance counters across the SCM pipeline
+///
+/// Counters, gauges, and histograms may be updated by any thread without a
+/// lock, each update being a single atomic add. Counters accumulate events,
+/// gauges track levels such as queue depths, and histograms accumulate
+/// durations in power-of-two buckets of microseconds. Once per frame,
+/// scm_system::update_cache folds the activity since the previous frame into
+/// a snapshot, which may be read using scm_system::get_stats.
+///
+/// Counts are global to the process rather than to any one scm_system. Each
+/// snapshot remembers the counts at which it was last taken, so any number of
+/// systems may take snapshots independently, each seeing all activity since
+/// its own previous frame. If SCM_NO_STATS is defined then every update
+/// compiles to nothing and all snapshots read zero.
+
+class scm_stats
+{
+public:
+
+    enum counter
+    {
+        cache_hits,         ///< Look-ups finding a resident page
+        cache_misses,       ///< Look-ups finding none
+        cache_ejects,       ///< Resident pages ejected to make room
+        cache_uploads,      ///< Pages uploaded to a cache texture
+        cache_bytes,        ///< Bytes uploaded to a cache texture
+        cache_stale,        ///< Loaded pages discarded as no longer wanted
+        need_inserts,       ///< Page requests queued for the loaders
+        need_rejects,       ///< Page requests refused by a full needs queue
+        loader_pages,       ///< Pages read by loader threads
+        loader_fails,       ///< Page reads that failed
+        sphere_selects,     ///< Page selections made by scm_sphere
+        sphere_pages,       ///< Pages selected by scm_sphere
+        counter_count
+    };
+
+    enum gauge
+    {
+        need_depth,         ///< Tasks in all needs queues
+        load_depth,         ///< Tasks in all loads queues
+        gauge_count
+    };
+
+    enum histogram
+    {
+        loader_time,        ///< Duration of each page read
+        upload_time,        ///< Duration of each update_cache
+        histogram_count
+    };
+
+    static const int bucket_count = 16;
+
+    /// A snapshot of the counters, taken at the end of one frame. Bucket k of
+    /// a histogram counts durations from 2^(k-1) to 2^k microseconds, with the
+    /// last bucket counting all longer durations.
+
+    struct snapshot
+    {
+        snapshot();
+
+        int       frame;
+        long long count[counter_count];                 ///< This frame
+        long long total[counter_count];                 ///< All frames
+        int       level[gauge_count];                   ///< At frame end
+        long long bucket[histogram_count][bucket_count]; ///< This frame
+
+        int       last [counter_count];                 ///< Counts at take
+        int       marks[histogram_count][bucket_count]; ///< Buckets at take
+    };
+
+    static void   add(counter,   int n = 1);
+    static void   add(gauge,     int n);
+    static void   add(histogram, Uint64 t0);
+
+    static Uint64 now();
+
+    static void   take(int, snapshot&);
+
+private:
+
+    static SDL_atomic_t counts [counter_count];
+    static SDL_atomic_t levels [gauge_count];
+    static SDL_atomic_t buckets[histogram_count][bucket_count];
+};
+
+//------------------------------------------------------------------------------
+
+/// Count n events.
+
+inline void scm_stats::add(counter c, int n)
+{
+#ifndef SCM_NO_STATS
+    SDL_AtomicAdd(&counts[c], n);
+#endif
+}
+
+/// Raise (or with negative n, lower) a gauge by n.
+
+inline void scm_stats::add(gauge g, int n)
+{
+#ifndef SCM_NO_STATS
+    SDL_AtomicAdd(&levels[g], n);
+#endif
+}
+
+/// Add the duration since time stamp t0 to a histogram. @see now
+
+inline void scm_stats::add(histogram h, Uint64 t0)
+{
+#ifndef SCM_NO_STATS
+    const Uint64 f = SDL_GetPerformanceFrequency();
+    const Uint64 u = (SDL_GetPerformanceCounter() - t0) * 1000000 / f;
+
+    int k = 0;
+
+    while (k < bucket_count - 1 && (Uint64(1) << k) <= u)
+        k++;
+
+    SDL_AtomicAdd(&buckets[h][k], 1);
+#endif
+}
+
+/// Return a time stamp for use in timing a histogram entry.
+
+inline Uint64 scm_stats::now()
+{
+#ifndef SCM_NO_STATS
+    return SDL_GetPerformanceCounter();
+#else
+    return 0;
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+#endif
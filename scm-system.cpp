@@ -31,13 +31,17 @@
 #include "scm-cache.hpp"
 #include "scm-sphere.hpp"
 #include "scm-render.hpp"
+#include "scm-loader.hpp"
+#include "scm-budget.hpp"
 #include "scm-system.hpp"
+#include "scm-trace.hpp"
 #include "scm-log.hpp"
 
 //------------------------------------------------------------------------------
 
-/// Create a new empty SCM system. Instantiate a render handler and a sphere
-/// handler.
+/// Create a new empty SCM system. Instantiate the loader thread pool, the
+/// video memory budget, and the render handler and sphere handler of the
+/// current OpenGL context, which becomes context zero. @see add_context
 ///
 /// @see scm_render::scm_render
 /// @see scm_sphere::scm_sphere
@@ -48,29 +52,46 @@
 /// @param l  Limit at which sphere pages are subdivided (in pixels)
 
 scm_system::scm_system(int w, int h, int d, int l) :
-    serial(1), frame(0), sync(false)
+    current(0), upload(0), fence(0), serial(1), frame(0), sync(false),
+    budget_moving(2.0), budget_still(8.0), progress(0), progress_data(0)
 {
     TIFFSetWarningHandler(0);
     TIFFSetErrorHandler  (0);
 
     scm_log("scm_system working directory is %s", getcwd(0, 0));
 
+    scm_trace::init();
+    scm_trace::name("render");
+
     mutex  = SDL_CreateMutex();
-    render = new scm_render(w, h);
-    sphere = new scm_sphere(d, l);
     path   = new scm_path();
+    loader = new scm_loader(scm_cache::cache_threads);
+    budget = new scm_budget();
+
+    add_context(w, h, d, l);
 }
 
-/// Finalize all SCM system state.
+/// Finalize all SCM system state. Any contexts beyond the first should have
+/// been deleted beforehand, each with its own context current, as the handlers
+/// of all that remain are deleted in the current context. @see del_context
 
 scm_system::~scm_system()
 {
     while (get_scene_count())
         del_scene(0);
 
+    if (fence)
+        glDeleteSync(fence);
+
+    delete budget;
+    delete loader;
     delete path;
-    delete sphere;
-    delete render;
+
+    for (size_t i = 0; i < contexts.size(); ++i)
+    {
+        delete contexts[i].sphere;
+        delete contexts[i].render;
+    }
 
     SDL_DestroyMutex(mutex);
 }
@@ -95,8 +116,12 @@ void scm_system::render_sphere(const scm_state *state, const double *P,
                                                        const double *M,
                                                        int channel) const
 {
+    const active_context& c = contexts[current];
+
+    wait_upload();
+
     if (state->renderable())
-        render->render(sphere, state, P, M, channel, frame);
+        c.render->render(c.sphere, state, P, M, channel, frame);
     else
     {
         glClearColor(0.2f, 0.2f, 0.2f, 0.0f);
@@ -104,20 +129,166 @@ void scm_system::render_sphere(const scm_state *state, const double *P,
     }
 }
 
+/// Select the pages of a frame once for all of its views. A display with more
+/// than one view of the same channel per frame, such as a tiled wall driven by
+/// one context, may call this once per frame before the render_sphere call of
+/// each view, so that each view draws one shared selection rather than
+/// traversing the sphere anew. Pages are requested once for all views.
+///
+/// @see scm_render::share
+///
+/// @param state    Viewer and environment state
+/// @param n        Number of views
+/// @param P        Projection matrices, 16 per view, in column-major OpenGL form
+/// @param M        Model-view matrices, 16 per view, in column-major OpenGL form
+/// @param channel  Channel index
+
+void scm_system::prep_sphere(const scm_state *state, int n, const double *P,
+                                                             const double *M,
+                                                             int channel) const
+{
+    const active_context& c = contexts[current];
+
+    if (state->renderable())
+        c.render->share(c.sphere, state, n, P, M, channel, frame);
+}
+
 //------------------------------------------------------------------------------
 
-/// Return a pointer to the sphere geometry handler.
+/// Return a pointer to the sphere geometry handler of the current context.
 
 scm_sphere *scm_system::get_sphere() const
 {
-    return sphere;
+    return contexts[current].sphere;
 }
 
-/// Return a pointer to the render manager.
+/// Return a pointer to the render manager of the current context.
 
 scm_render *scm_system::get_render() const
 {
-    return render;
+    return contexts[current].render;
+}
+
+/// Return a pointer to the video memory budget of all caches.
+
+scm_budget *scm_system::get_budget() const
+{
+    return budget;
+}
+
+//------------------------------------------------------------------------------
+
+/// Add an OpenGL context to the system and return its index. The new context
+/// must share objects with the first, and must be current. It receives a render
+/// handler and a sphere handler of its own, using the loader shared by all.
+///
+/// @param w  Width of the off-screen render target (in pixels)
+/// @param h  Height of the off-screen render target (in pixels)
+/// @param d  Detail with which sphere pages are drawn (in vertices)
+/// @param l  Limit at which sphere pages are subdivided (in pixels)
+
+int scm_system::add_context(int w, int h, int d, int l)
+{
+    active_context c;
+
+    c.render  = new scm_render(w, h);
+    c.sphere  = new scm_sphere(d, l);
+    c.context = SDL_GL_GetCurrentContext();
+
+    c.sphere->set_loader(loader);
+
+    contexts.push_back(c);
+
+    scm_log("scm_system add_context %d", int(contexts.size()) - 1);
+
+    return int(contexts.size()) - 1;
+}
+
+/// Delete the context at index i, which must be current. The indices of all
+/// later contexts decrease by one. The last remaining context is not deleted.
+
+void scm_system::del_context(int i)
+{
+    scm_log("scm_system del_context %d", i);
+
+    if (0 <= i && i < int(contexts.size()) && contexts.size() > 1)
+    {
+        delete contexts[i].sphere;
+        delete contexts[i].render;
+
+        contexts.erase(contexts.begin() + i);
+
+        if (current > i || current == int(contexts.size()))
+            current--;
+    }
+}
+
+/// Select the context at index i, to which render_sphere, prep_sphere, and
+/// the sphere and render queries apply. Call this each time the context is
+/// made current. Any GPU trace marks of the context are collected.
+/// @see scm_trace::update
+
+void scm_system::set_context(int i)
+{
+    if (0 <= i && i < int(contexts.size()))
+        current = i;
+
+    scm_trace::update();
+}
+
+/// Return the number of contexts.
+
+int scm_system::get_context_count() const
+{
+    return int(contexts.size());
+}
+
+// Fence the uploads of the cache update just made in the current context, if
+// any view draws in another context. Lacking sync objects, finish them.
+
+void scm_system::fence_upload()
+{
+    bool shared = false;
+
+    upload = SDL_GL_GetCurrentContext();
+
+    for (size_t i = 0; i < contexts.size(); ++i)
+    {
+        if (contexts[i].context != upload)
+            shared = true;
+
+        contexts[i].synced = false;
+    }
+
+    if (fence)
+    {
+        glDeleteSync(fence);
+        fence = 0;
+    }
+
+    if (shared)
+    {
+        if (GLEW_ARB_sync)
+            fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        if (fence)
+            glFlush();
+        else
+            glFinish();
+    }
+}
+
+// Have the current context await the uploads of the latest cache update before
+// drawing from the atlases, unless it made them itself.
+
+void scm_system::wait_upload() const
+{
+    const active_context& c = contexts[current];
+
+    if (fence && !c.synced && c.context != upload)
+        glWaitSync(fence, 0, GL_TIMEOUT_IGNORED);
+
+    c.synced = true;
 }
 
 //------------------------------------------------------------------------------
@@ -138,12 +309,16 @@ int scm_system::add_scene(int i)
     return j;
 }
 
-/// Delete the scene at index i.
+/// Delete the scene at index i, and the state retained for it by the sphere of
+/// each context.
 
 void scm_system::del_scene(int i)
 {
     scm_log("scm_system del_scene %d", i);
 
+    for (size_t k = 0; k < contexts.size(); ++k)
+        contexts[k].sphere->del_scene(scenes[i]);
+
     delete scenes[i];
     scenes.erase(scenes.begin() + i);
 }
@@ -170,12 +345,48 @@ int scm_system::get_scene_count() const
 /// Update all image caches. This is among the most significant entry points of
 /// the SCM API as it handles image input. It ensures that any page requests
 /// being serviced in the background are properly transmitted to the OpenGL
-/// context. It should be called once per frame. @see scm_cache::update
+/// context. It should be called once per frame. The upload time budget is
+/// shared among all caches, each taking what the previous ones left. The
+/// larger budget applies if no view moved this frame. Finally, the video memory
+/// budget may resize the caches, and the performance counters of the frame are
+/// gathered, along with any finished GPU trace marks. The current context is
+/// taken to be the upload context, and the uploads are fenced for the others.
+/// The view is still if no view of any context moved this frame.
+/// @see scm_cache::update @see scm_budget @see get_stats @see scm_trace::update
 
 void scm_system::update_cache()
 {
+    scm_trace::scope trace("update_cache");
+    scm_trace::update();
+
+    update_scm(sync);
+
+    int moved = 0;
+
+    for (size_t i = 0; i < contexts.size(); ++i)
+        moved = std::max(moved, contexts[i].sphere->get_moved());
+
+    const bool still = (moved < frame);
+
+    double m = still ? budget_still : budget_moving;
+
+    for (active_cache_i i = caches.begin(); i != caches.end(); ++i)
+        if (m < 0)
+            i->second.cache->update(frame, sync, -1.0);
+        else
+            m = std::max(m - i->second.cache->update(frame, sync, m), 0.0);
+
+    scm_cache_v v;
+
     for (active_cache_i i = caches.begin(); i != caches.end(); ++i)
-        i->second.cache->update(frame, sync);
+        v.push_back(i->second.cache);
+
+    budget->update(v, frame);
+
+    fence_upload();
+
+    scm_stats::take(frame, stats);
+
     frame++;
 }
 
@@ -187,6 +398,8 @@ void scm_system::render_cache()
 {
     int ii = 0, nn = caches.size();
 
+    wait_upload();
+
     if (nn < 2)
         nn = 2;
 
@@ -219,6 +432,156 @@ bool scm_system::get_synchronous() const
     return sync;
 }
 
+/// Set a function to be called by update_cache whenever the background opening
+/// of one or more files completes. It receives the number of open files, the
+/// number of files acquired, and the given data pointer. Loading is complete
+/// when the two counts are equal.
+
+void scm_system::set_progress(scm_progress f, void *data)
+{
+    progress      = f;
+    progress_data = data;
+}
+
+/// Return the number of files still opening in the background.
+
+int scm_system::get_pending_count() const
+{
+    int n = 0;
+
+    for (active_file_m::const_iterator i = files.begin(); i != files.end(); ++i)
+        if (i->second.thread)
+            n++;
+
+    return n;
+}
+
+/// Set the time per frame, in milliseconds, that update_cache may spend on
+/// texture uploads. The budget m applies while the view is in motion, and the
+/// budget s while it is still, allowing the caches to drain faster when frame
+/// time is not at a premium. Negative values revert to the fixed count of
+/// scm_cache::loads_per_cycle.
+
+void scm_system::set_upload_budget(double m, double s)
+{
+    budget_moving = m;
+    budget_still  = s;
+}
+
+//------------------------------------------------------------------------------
+
+/// Compute the warm list of a tour. The tour is given as a deque of key states,
+/// and n steps are taken between each pair, interpolated as by scm_state(a, b,
+/// t). Each step is viewed from its state using the projection P, as though the
+/// model-view were the inverse of scm_state::get_matrix, at the size of the
+/// render handler and in channel 0. The visibility pre-pass is performed for
+/// each scene of each step, without drawing, and the pages not needed by the
+/// previous step are added to the warm list.
+///
+/// @param tour  Warm list (output)
+/// @param deque Key states of the tour
+/// @param P     Projection matrix in OpenGL column-major order
+/// @param n     Number of steps between key states
+
+void scm_system::prep_tour(scm_tour& tour, const scm_deque& deque,
+                           const double *P, int n)
+{
+    typedef std::map<scm_scene *, std::set<long long> > page_m;
+
+    std::vector<scm_state> states;
+    scm_deque::const_iterator a;
+    scm_deque::const_iterator b;
+
+    // Sample the tour.
+
+    n = std::max(n, 1);
+
+    for (a = b = deque.begin(); a != deque.end(); a = b)
+        if (++b != deque.end())
+            for (int k = 0; k < n; k++)
+                states.push_back(scm_state(*a, *b, double(k) / n));
+        else
+            states.push_back(*a);
+
+    // Find each step's page needs, and keep those not carried over.
+
+    const int w = contexts[current].render->get_width();
+    const int h = contexts[current].render->get_height();
+
+    page_m last;
+
+    tour.clear();
+
+    for (size_t k = 0; k < states.size(); k++)
+    {
+        scm_scene *s[4] = { states[k].get_foreground0(),
+                            states[k].get_foreground1(),
+                            states[k].get_background0(),
+                            states[k].get_background1() };
+        double V[16];
+        double M[16];
+        double Q[16];
+        double N[16];
+        double T[16];
+        page_m curr;
+
+        states[k].get_matrix(V);
+        minvert(M, V);
+
+        for (int j = 0; j < 4; j++)
+            if (s[j] && curr.find(s[j]) == curr.end())
+            {
+                if (j < 2)
+                    mmultiply(T, P, M);
+                else
+                {
+                    scm_render::get_background(Q, N, P, M);
+                    mmultiply(T, Q, N);
+                }
+                contexts[current].sphere->list(s[j], T, w, h, 0, curr[s[j]]);
+            }
+
+        tour.add_step();
+
+        for (page_m::iterator i = curr.begin(); i != curr.end(); ++i)
+        {
+            std::set<long long>& prev = last[i->first];
+            std::set<long long>::iterator p;
+
+            for (p = i->second.begin(); p != i->second.end(); ++p)
+                if (prev.find(*p) == prev.end())
+                    tour.add_page(i->first->get_name(), *p);
+        }
+        last.swap(curr);
+    }
+}
+
+/// Ask for the pages first needed in steps s through s + n - 1 of a tour, at
+/// prefetch priority. During playback of step s, this requests each page just
+/// in time for the step that needs it. Called repeatedly along with
+/// update_cache before playback begins, it fills the caches ahead of time.
+/// The pages of n steps should fit the caches. Only the images of the given
+/// channel are asked, so a stereo application warms each eye in turn. Return
+/// the number of pages not yet resident. @see scm_cache::ask_page
+///
+/// @param tour    Warm list
+/// @param s       First step
+/// @param n       Number of steps
+/// @param channel Channel index (e.g. 0 for left eye, 1 for right eye)
+
+int scm_system::warm_tour(const scm_tour& tour, int s, int n, int channel)
+{
+    int c = 0;
+
+    for (int k = std::max(s, 0); k < s + n && k < tour.get_step_count(); k++)
+        for (int j = 0; j < tour.get_page_count(k); j++)
+            if (scm_scene *scene = find_scene(tour.get_page_scene(k, j)))
+                c += scene->ask_page(channel, frame,
+                                     tour.get_page_index(k, j));
+
+    return c;
+}
+
 //------------------------------------------------------------------------------
 
 /// Determine a fully-resolved path for the given file name
@@ -248,12 +611,23 @@ void scm_system::pop_path()
 
 //------------------------------------------------------------------------------
 
+// Open a file on a thread of its own.
+
+static int open_scm(void *data)
+{
+    scm_file *file = (scm_file *) data;
+    file->open();
+    return 0;
+}
+
 /// Internal: Load the named SCM file, if not already loaded.
 ///
-/// Add a new scm_file object to the collection and return its index. If needed,
-/// create a new scm_cache object to manage this file's data. This will always
-/// succeed as an scm_file object produces fallback data under error conditions,
-/// such as an unfound SCM TIFF.
+/// Add a new scm_file object to the collection and return its index. The file
+/// is opened in the background and is absent, having no cache and no pages,
+/// until update_cache finds it open and publishes it. @see publish_scm
+///
+/// This will succeed for any file found on the path, as an scm_file object
+/// produces fallback data under error conditions.
 
 int scm_system::acquire_scm(const std::string& name)
 {
@@ -265,7 +639,7 @@ int scm_system::acquire_scm(const std::string& name)
         files[name].uses++;
     else
     {
-        // Otherwise load the file.
+        // Otherwise begin loading the file.
 
         std::string pathname = path->search(name);
 
@@ -273,35 +647,74 @@ int scm_system::acquire_scm(const std::string& name)
         {
             if (scm_file *file = new scm_file(name, pathname))
             {
-                int index = serial++;
+                files[name].file   = file;
+                files[name].index  = serial++;
+                files[name].uses   = 1;
+                files[name].thread = SDL_CreateThread(open_scm, "scm-open",
+                                                                  file);
+                if (files[name].thread == 0)
+                {
+                    file->open();
+                    publish_scm(files[name]);
+                }
+            }
+        }
+    }
+    return files[name].index;
+}
 
-                files[name].file  = file;
-                files[name].index = index;
-                files[name].uses  = 1;
+/// Internal: Attach a newly opened file to a compatible cache, creating one if
+/// needed, and begin servicing its page requests.
 
-                // Make sure we have a compatible cache.
+void scm_system::publish_scm(active_file& f)
+{
+    // Make sure we have a compatible cache.
 
-                cache_param cp(file);
+    cache_param cp(f.file);
 
-                if (caches[cp].cache)
-                    caches[cp].uses++;
-                else
-                {
-                    caches[cp].cache = new scm_cache(this, cp.n, cp.c, cp.b);
-                    caches[cp].uses  = 1;
-                }
+    if (caches[cp].cache)
+        caches[cp].uses++;
+    else
+    {
+        caches[cp].cache = new scm_cache(this, cp.n, cp.c, cp.b, cp.e);
+        caches[cp].uses  = 1;
+    }
+
+    // Associate the index, file, and cache in the reverse look-up.
+
+    SDL_mutexP(mutex);
+    pairs[f.index] = active_pair(f.file, caches[cp].cache);
+    SDL_mutexV(mutex);
 
-                // Associate the index, file, and cache in the reverse look-up.
+    f.file->activate(caches[cp].cache, loader);
+}
+
+/// Internal: Publish all files whose background opening is complete. If b is
+/// true then await those still opening. Report progress if any file finished.
 
-                SDL_mutexP(mutex);
-                pairs[index] = active_pair(files[name].file, caches[cp].cache);
-                SDL_mutexV(mutex);
+void scm_system::update_scm(bool b)
+{
+    int done = 0;
+    int open = 0;
+    int all  = 0;
 
-                file->activate(caches[cp].cache);
+    for (active_file_i i = files.begin(); i != files.end(); ++i)
+        if (i->second.file)
+        {
+            if (i->second.thread && (b || i->second.file->is_ready()))
+            {
+                SDL_WaitThread(i->second.thread, 0);
+                i->second.thread = 0;
+                publish_scm(i->second);
+                done++;
             }
+            if (i->second.thread == 0)
+                open++;
+            all++;
         }
-    }
-    return files[name].index;
+
+    if (done && progress)
+        progress(open, all, progress_data);
 }
 
 /// Release the named SCM file.
@@ -314,9 +727,17 @@ int scm_system::release_scm(const std::string& name)
 {
     scm_log("release_scm %s", name.c_str());
 
-    // Release the named file and delete it if no uses remain.
+    // Release the named file and delete it if no uses remain. If the file is
+    // still opening, await it and delete it without further ado.
 
-    if (--files[name].uses == 0)
+    if (--files[name].uses == 0 && files[name].thread)
+    {
+        SDL_WaitThread(files[name].thread, 0);
+
+        delete files[name].file;
+        files.erase(name);
+    }
+    else if (files[name].uses == 0)
     {
         // Remove the index from the reverse look-up.
 
@@ -324,14 +745,14 @@ int scm_system::release_scm(const std::string& name)
         pairs.erase(files[name].index);
         SDL_mutexV(mutex);
 
-        // Signal the loaders to prepare to exit.
+        // Signal the loaders to disregard this file's tasks.
 
         files[name].file->deactivate();
 
-        // Cycle the cache to ensure the loaders unblock.
+        // Await the loaders, cycling the cache to ensure that they unblock.
 
         cache_param cp(files[name].file);
-        caches[cp].cache->update(0, true);
+        loader->del_file(files[name].file, caches[cp].cache);
 
         // Delete the file.
 
@@ -372,14 +793,18 @@ scm_cache *scm_system::get_cache(int i)
         return pairs[i].cache;
 }
 
-/// Return the file associated with the given file index.
+/// Return the file associated with the given file index. This does not modify
+/// the file map, so it is safe for concurrent readers, such as the parallel
+/// sphere pre-pass, while no file is acquired or released.
 
 scm_file *scm_system::get_file(int i)
 {
-    if (pairs.find(i) == pairs.end())
+    active_pair_m::const_iterator it = pairs.find(i);
+
+    if (it == pairs.end())
         return 0;
     else
-        return pairs[i].file;
+        return it->second.file;
 }
 
 //------------------------------------------------------------------------------
@@ -398,6 +823,27 @@ float scm_system::get_page_sample(int f, const double *v)
         return 1.f;
 }
 
+/// Sample an SCM file at each of n locations. If b is false, no data is
+/// accessed in the render thread, and each result is taken from the data
+/// at hand while the missing data loads in the background.
+/// @see scm_file::get_page_samples
+///
+/// @param f File index
+/// @param v Array of n vectors from the center of the planet
+/// @param k Array of n results
+/// @param n Vector count
+/// @param b Synchronous flag
+
+void scm_system::get_page_samples(int f, const double *v, float *k, int n,
+                                  bool b)
+{
+    if (scm_file *file = get_file(f))
+        file->get_page_samples(v, k, n, b);
+    else
+        for (int j = 0; j < n; ++j)
+            k[j] = 1.f;
+}
+
 /// Determine the minimum and maximum values of an SCM file page. O(log n).
 /// @see scm_file::get_page_bounds
 ///
@@ -16,12 +16,17 @@
 #include <map>
 #include <set>
 
+#include <GL/glew.h>
+
 #include <SDL.h>
 #include <SDL_thread.h>
 
 #include "scm-file.hpp"
 #include "scm-state.hpp"
+#include "scm-deque.hpp"
+#include "scm-tour.hpp"
 #include "scm-path.hpp"
+#include "scm-stats.hpp"
 
 /** @mainpage Spherical Cube Map Library
 
@@ -70,12 +75,21 @@ dotted arrow is a weak (non-owning) reference.
   giving an interesting view upon these scenes. This sequence of steps allows an
   application to provide a tour of the scm_scene definitions.
 
+- All scm_file objects share a single scm_loader, a pool of loader threads that
+  services page requests from every file in global priority order.
+
 - Finally, the scm_system contains two functional objects. First, the scm_render
   object manages the production of SCM renderings with dissolve transitions
   and motion blur, with the help of one or more scm_frame off-screen render
   targents. Second, the scm_sphere object which manages the adaptive generation
   of the spherical geometry to which SCM image data is applied.
 
+- An application rendering to several OpenGL contexts of one share group, such
+  as a control monitor and a projector, adds a context to the scm_system for
+  each beyond the first. Each context receives an scm_render and scm_sphere of
+  its own, while the files, caches, and loader remain single instances. Every
+  page is thus read and uploaded once, to atlas textures shared by all.
+
 The scm_cache, scm_image, and scm_scene objects each maintain a weak reference
 to the scm_system that created them. By this reference they access system state,
 most notably scm_file data.
@@ -88,6 +102,8 @@ class scm_scene;
 class scm_cache;
 class scm_sphere;
 class scm_render;
+class scm_loader;
+class scm_budget;
 
 typedef std::vector<scm_scene *>           scm_scene_v;
 typedef std::vector<scm_scene *>::iterator scm_scene_i;
@@ -113,14 +129,16 @@ typedef std::map<int, active_pair> active_pair_m;
 
 struct active_file
 {
-    active_file() : file(0), uses(0), index(-1) { }
+    active_file() : file(0), uses(0), index(-1), thread(0) { }
 
-    scm_file  *file;
-    int        uses;
-    int        index;
+    scm_file   *file;
+    int         uses;
+    int         index;
+    SDL_Thread *thread;  // Background open thread, until published
 };
 
-typedef std::map<std::string, active_file> active_file_m;
+typedef std::map<std::string, active_file>           active_file_m;
+typedef std::map<std::string, active_file>::iterator active_file_i;
 
 /// An active_cache structure represents a reference-counted scm_cache object.
 
@@ -139,11 +157,13 @@ struct cache_param
 {
     cache_param(scm_file *file) : n(int(file->get_w()) - 2),
                                   c(int(file->get_c())),
-                                  b(int(file->get_b())) { }
+                                  b(int(file->get_b())),
+                                  e(int(file->get_e())) { }
 
     int n;  // Page size
     int c;  // Channels per pixel
     int b;  // Bits per channel
+    int e;  // Block compression format
 
     bool operator<(const cache_param& that) const {
         if      (n < that.n) return true;
@@ -151,6 +171,8 @@ struct cache_param
         else if (c < that.c) return true;
         else if (c > that.c) return false;
         else if (b < that.b) return true;
+        else if (b > that.b) return false;
+        else if (e < that.e) return true;
         else                 return false;
     }
 };
@@ -158,9 +180,31 @@ struct cache_param
 typedef std::map<cache_param, active_cache>           active_cache_m;
 typedef std::map<cache_param, active_cache>::iterator active_cache_i;
 
+/// An active_context structure represents the view state of one OpenGL context
+/// of the share group: the render and sphere handlers that draw into it.
+
+struct active_context
+{
+    active_context() : render(0), sphere(0), context(0), synced(false) { }
+
+    scm_render    *render;
+    scm_sphere    *sphere;
+    SDL_GLContext  context;
+    mutable bool   synced;  // Latest upload fence awaited
+};
+
+typedef std::vector<active_context> active_context_v;
+
 /// @endcond
 //------------------------------------------------------------------------------
 
+/// A progress function receives a count of files opened, a count of files
+/// acquired, and an application data pointer. @see scm_system::set_progress
+
+typedef void (*scm_progress)(int, int, void *);
+
+//------------------------------------------------------------------------------
+
 /// An scm_system encapsulates all of the state of an SCM renderer. Its
 /// interface is the primary API of the SCM rendering library.
 ///
@@ -168,6 +212,17 @@ typedef std::map<cache_param, active_cache>::iterator active_cache_i;
 /// application, all of the image that these scenes refer to, all of the caches
 /// that store the data of these images, the sphere manager used to render it,
 /// and the render handler that manages this rendering.
+///
+/// The system may render into any number of OpenGL contexts sharing objects
+/// with the one current at its construction. Each context has a sphere and
+/// render handler of its own, added with the context current, and selected by
+/// set_context whenever that context is made current, all in one thread. The
+/// caches are updated in one context, the upload context, which may be any of
+/// these or a dedicated context of the share group with no view of its own.
+/// Files should be acquired and released with the upload context current, as
+/// this is where caches are created and destroyed. When the upload context
+/// differs from that of any view, update_cache places a fence behind its
+/// uploads, and each view awaits it before next drawing from the atlases.
 
 class scm_system
 {
@@ -178,12 +233,26 @@ public:
 
     void     render_sphere(const scm_state *, const double *,
                                               const double *, int) const;
+    void       prep_sphere(const scm_state *, int, const double *,
+                                              const double *, int) const;
 
     /// @name System queries
     /// @{
 
     scm_sphere *get_sphere() const;
     scm_render *get_render() const;
+    scm_budget *get_budget() const;
+
+    /// @}
+    /// @name Context handlers
+    /// @{
+
+    int         add_context(int w, int h, int d, int l);
+    void        del_context(int i);
+    void        set_context(int i);
+    int         get_context() const { return current; }
+
+    int         get_context_count() const;
 
     /// @}
     /// @name Scene collection handlers
@@ -206,6 +275,22 @@ public:
     void        set_synchronous(bool);
     bool        get_synchronous() const;
 
+    void        set_progress(scm_progress, void *);
+    int         get_pending_count() const;
+
+    void        set_upload_budget(double, double);
+    double      get_upload_budget_moving() const { return budget_moving; }
+    double      get_upload_budget_still()  const { return budget_still;  }
+
+    const scm_stats::snapshot& get_stats() const { return stats; }
+
+    /// @}
+    /// @name Tour handlers
+    /// @{
+
+    void        prep_tour(scm_tour&, const scm_deque&, const double *, int);
+    int         warm_tour(const scm_tour&, int, int, int);
+
     /// @}
     /// @name Data path handlers
     /// @{
@@ -226,6 +311,8 @@ public:
     scm_file   *get_file (int);
 
     float       get_page_sample(int f, const double *v);
+    void        get_page_samples(int f, const double *v, float *k, int n,
+                                 bool b);
     bool        get_page_status(int f, long long i);
     void        get_page_bounds(int f, long long i, float& r0, float& r1);
 
@@ -236,17 +323,35 @@ private:
     SDL_mutex     *mutex;
 
     scm_scene_v    scenes;
-    scm_render    *render;
-    scm_sphere    *sphere;
     scm_path      *path;
+    scm_loader    *loader;
+    scm_budget    *budget;
 
     active_file_m  files;
     active_cache_m caches;
     active_pair_m  pairs;
 
+    active_context_v contexts;
+    int              current;
+    SDL_GLContext    upload;  // Context of the latest cache update
+    GLsync           fence;   // Fence behind the latest cache update
+
     int            serial;
     int            frame;
     bool           sync;
+    double         budget_moving;
+    double         budget_still;
+
+    scm_progress   progress;
+    void          *progress_data;
+
+    scm_stats::snapshot stats;
+
+    void publish_scm(active_file&);
+    void  update_scm(bool);
+
+    void   fence_upload();
+    void    wait_upload() const;
 };
 
 //------------------------------------------------------------------------------
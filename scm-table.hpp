@@ -0,0 +1,202 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#ifndef SCM_TABLE_HPP
+#define SCM_TABLE_HPP
+
+#include <vector>
+
+#include "scm-item.hpp"
+
+//------------------------------------------------------------------------------
+
+/// An scm_table is a flat hash table mapping (file, page) pairs to values
+///
+/// Entries are stored inline in a single power-of-two array and found by linear
+/// probing, so a lookup usually touches one cache line. Removal shifts later
+/// entries of a probe run back into the vacated slot, so no tombstones build
+/// up. Storage is allocated only when the table grows past half full.
+
+template <typename V> class scm_table
+{
+public:
+
+    scm_table(int n = 64);
+
+    V   *search(int, long long);
+    V&   insert(int, long long);
+    void remove(int, long long);
+    void clear();
+
+    int  size() const { return count; }
+
+    /// Return the key at slot k, or an invalid item if slot k is empty.
+
+    scm_item key(int k) const {
+        return slots[k].used ? slots[k].key : scm_item();
+    }
+
+    /// Return the number of slots, for iteration via key().
+
+    int  capacity() const { return int(slots.size()); }
+
+private:
+
+    struct slot
+    {
+        slot() : used(false) { }
+
+        scm_item key;
+        V        val;
+        bool     used;
+    };
+
+    std::vector<slot> slots;
+    int               mask;
+    int               count;
+
+    int  home(int, long long) const;
+    void grow();
+};
+
+//------------------------------------------------------------------------------
+
+/// Create a table with room for at least n entries before growing.
+
+template <typename V> scm_table<V>::scm_table(int n) : count(0)
+{
+    int m = 2;
+
+    while (m < 2 * n)
+        m <<= 1;
+
+    slots.resize(m);
+    mask = m - 1;
+}
+
+/// Return a pointer to the value of page i of file f, or null if absent.
+
+template <typename V> V *scm_table<V>::search(int f, long long i)
+{
+    for (int k = home(f, i); slots[k].used; k = (k + 1) & mask)
+        if (slots[k].key.i == i && slots[k].key.f == f)
+            return &slots[k].val;
+
+    return 0;
+}
+
+/// Return a reference to the value of page i of file f, adding a default
+/// value if absent.
+
+template <typename V> V& scm_table<V>::insert(int f, long long i)
+{
+    if (2 * (count + 1) > int(slots.size()))
+        grow();
+
+    int k;
+
+    for (k = home(f, i); slots[k].used; k = (k + 1) & mask)
+        if (slots[k].key.i == i && slots[k].key.f == f)
+            return slots[k].val;
+
+    slots[k].key  = scm_item(f, i);
+    slots[k].val  = V();
+    slots[k].used = true;
+    count++;
+
+    return slots[k].val;
+}
+
+/// Remove page i of file f, if present. Shift any displaced entries of the
+/// following probe run back toward their home slots.
+
+template <typename V> void scm_table<V>::remove(int f, long long i)
+{
+    int k;
+
+    for (k = home(f, i); slots[k].used; k = (k + 1) & mask)
+        if (slots[k].key.i == i && slots[k].key.f == f)
+            break;
+
+    if (slots[k].used)
+    {
+        int j = k;
+
+        for (;;)
+        {
+            slots[k].used = false;
+
+            for (;;)
+            {
+                j = (j + 1) & mask;
+
+                if (!slots[j].used)
+                {
+                    count--;
+                    return;
+                }
+
+                // Entry j may fill the hole at k only if its home slot does
+                // not lie cyclically within (k, j].
+
+                int h = home(slots[j].key.f, slots[j].key.i);
+
+                if (k <= j ? (h <= k || j < h) : (h <= k && j < h))
+                    break;
+            }
+
+            slots[k] = slots[j];
+            k        = j;
+        }
+    }
+}
+
+/// Remove all entries.
+
+template <typename V> void scm_table<V>::clear()
+{
+    for (int k = 0; k < int(slots.size()); ++k)
+        slots[k].used = false;
+
+    count = 0;
+}
+
+//------------------------------------------------------------------------------
+
+// Compute the home slot of page i of file f.
+
+template <typename V> int scm_table<V>::home(int f, long long i) const
+{
+    unsigned long long h = (unsigned long long) i * 0x9E3779B97F4A7C15ULL
+                         + (unsigned long long) f * 0xC2B2AE3D27D4EB4FULL;
+
+    return int((h ^ (h >> 29)) & (unsigned long long) mask);
+}
+
+// Double the slot count and reinsert all entries.
+
+template <typename V> void scm_table<V>::grow()
+{
+    std::vector<slot> old(slots.size() * 2);
+
+    old.swap(slots);
+    mask  = int(slots.size()) - 1;
+    count = 0;
+
+    for (int k = 0; k < int(old.size()); ++k)
+        if (old[k].used)
+            insert(old[k].key.f, old[k].key.i) = old[k].val;
+}
+
+//------------------------------------------------------------------------------
+
+#endif
@@ -10,12 +10,30 @@
 // FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
 // more details.
 
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
+#include <limits>
 #include <GL/glew.h>
 #include <tiffio.h>
+#include <SDL.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SCM_TASK_SSE2
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SCM_TASK_F16C __attribute__((target("f16c")))
+#elif defined(_MSC_VER) && defined(_M_X64)
+#include <immintrin.h>
+#define SCM_TASK_F16C
+#endif
 
 #include "scm-task.hpp"
 #include "scm-file.hpp"
+#include "scm-cache.hpp"
 
 //------------------------------------------------------------------------------
 
@@ -30,11 +48,13 @@ scm_task::scm_task()
 /// @param i Page index
 
 scm_task::scm_task(int f, long long i)
-    : scm_item(f, i), o(0), n(0), c(0), b(0), u(0), d(false)
+    : scm_item(f, i), o(0), n(0), c(0), b(0), e(0), k(0), u(0), q(0),
+      m(false), d(false), a(false), v(1), p(0), C(0), v0(0), v1(1)
 {
 }
 
 /// Construct a load task. Map the PBO to provide a destination for the loader.
+/// The block compression format and buffer size are those of the cache.
 ///
 /// @param f File index
 /// @param i Page index
@@ -42,21 +62,46 @@ scm_task::scm_task(int f, long long i)
 /// @param n Page size in pixels
 /// @param c Page channels per pixel
 /// @param b Page bits per channel
+/// @param k Upload slot index
 /// @param u Pixel buffer object
 /// @param C Destination cache
 
-scm_task::scm_task(int f, long long i, uint64 o, int n, int c, int b, GLuint u, scm_cache *C)
-    : scm_item(f, i), o(o), n(n), c(c), b(b), u(u), d(false), C(C)
+scm_task::scm_task(int f, long long i, uint64 o, int n, int c, int b,
+                   int k, GLuint u, scm_cache *C)
+    : scm_item(f, i), o(o), n(n), c(c), b(b), e(C->get_format()), k(k), u(u),
+      q(0), m(false), d(false), a(false), v(1), C(C), v0(0), v1(1)
 {
     glBindBuffer(GL_PIXEL_UNPACK_BUFFER, u);
     {
-        const size_t s = size_t(n + 2) * size_t(n + 2) * scm_pixel_size(c, b);
-        glBufferData(GL_PIXEL_UNPACK_BUFFER, s, 0, GL_STREAM_DRAW);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, C->get_span(), 0, GL_STREAM_DRAW);
         p = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
     }
     glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 }
 
+/// Construct a load task using a slot of a persistently-mapped upload arena.
+/// No buffer mapping is necessary.
+///
+/// @param f File index
+/// @param i Page index
+/// @param o TIFF offset
+/// @param n Page size in pixels
+/// @param c Page channels per pixel
+/// @param b Page bits per channel
+/// @param k Upload slot index
+/// @param u Pixel buffer object of the arena
+/// @param q Offset of the slot within the arena
+/// @param p Mapped address of the slot
+/// @param C Destination cache
+
+scm_task::scm_task(int f, long long i, uint64 o, int n, int c, int b,
+                   int k, GLuint u, GLintptr q, void *p, scm_cache *C)
+    : scm_item(f, i), o(o), n(n), c(c), b(b), e(C->get_format()), k(k), u(u),
+      q(q), m(true), d(false), a(false), v(1), p(p), C(C), v0(0),
+      v1(1)
+{
+}
+
 /// Upload the pixel buffer to the OpenGL texture object.
 ///
 /// @param x Location of upper-left pixel
@@ -66,12 +111,62 @@ void scm_task::make_page(int x, int y)
 {
     glBindBuffer(GL_PIXEL_UNPACK_BUFFER, u);
     {
-        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
-        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, n + 2, n + 2,
+        if (!m) glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+        if (e)
+            glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, x, y, n + 2, n + 2,
+                                     scm_compressed_form(e),
+                             GLsizei(scm_page_size(n + 2, c, b, e)),
+                                                          (GLvoid *) q);
+        else
+            glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, n + 2, n + 2,
                                      scm_external_form(c, b),
-                                     scm_external_type(c, b), 0);
+                                     scm_storage_type(c, b, C->get_storage()),
+                                                          (GLvoid *) q);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+/// Upload the pixel buffer to a layer of an OpenGL array texture object. The
+/// buffer holds the page followed by the given number of mipmap levels.
+///
+/// @param z Layer index
+/// @param v Mipmap level count
+
+void scm_task::make_layer(int z, int v)
+{
+    GLint a;
+
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &a);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, u);
+    {
+        if (!m) glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+        const int    g = C->get_storage();
+        const uint16 h = scm_storage_bits(b, g);
+
+        GLintptr r = q;
+
+        for (int l = 0; l < v; ++l)
+        {
+            const int    w = std::max((n + 2) >> l, 1);
+            const size_t s = scm_page_size(w, c, h, e);
+
+            if (e)
+                glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, l, 0, 0, z,
+                                          w, w, 1, scm_compressed_form(e),
+                                                 GLsizei(s), (GLvoid *) r);
+            else
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, l, 0, 0, z, w, w, 1,
+                                                 scm_external_form(c, b),
+                                                 scm_storage_type(c, b, g),
+                                                             (GLvoid *) r);
+            r += GLintptr(s);
+        }
     }
     glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, a);
 }
 
 /// Discard the pixel buffer
@@ -83,6 +178,8 @@ void scm_task::make_page(int x, int y)
 
 void scm_task::dump_page()
 {
+    if (m) return;
+
     glBindBuffer(GL_PIXEL_UNPACK_BUFFER, u);
     {
         glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
@@ -92,15 +189,157 @@ void scm_task::dump_page()
 
 /// Load a page. On success, mark the buffer as dirty.
 ///
-/// This method is called by a loader thread and exists solely to marshal
-/// the entensive argument list of the global function scm_load_page.
+/// This method is called by a loader thread and exists mostly to marshal
+/// the entensive argument list of scm_file::read_page. If the
+/// destination cache has a host page cache, seek the page there first, and
+/// otherwise decode into a host slot before copying to the pixel buffer, as
+/// the mapped buffer should not be read back. If the destination cache is
+/// mipmapped, also append the mipmap levels computed from a readable copy of
+/// the page, or if none could be had, mark the page as lacking them. A block-
+/// compressed page is passed through to the pixel buffer undecoded. A page
+/// that is directly addressable in a memory-mapped file is copied straight
+/// from the mapping, the OS page cache then being the only host copy. If the
+/// cache converts float data, the page is always decoded into a readable
+/// buffer, and the page and its mipmaps are converted as they are copied to
+/// the pixel buffer. @see scm_cache::float_storage
+///
+/// If the page cannot be read, whether decoded or block-compressed, nothing is
+/// written to the pixel buffer and false is returned, so that the cache drops
+/// the page rather than upload it.
 ///
-/// @param name TIFF name (used for generating error pages)
-/// @param T    TIFF pointer
+/// @param F File
+/// @param K Loader worker index
 
-bool scm_task::load_page(const char *name, TIFF *T)
+bool scm_task::load_page(scm_file *F, int K)
 {
-    return (d = scm_load_page(name, i, T, o, n + 2, n + 2, c, b, p));
+    const int    V = C->get_levels();
+    const int    G = C->get_storage();
+    const size_t z = scm_page_size(n + 2, c, b, e);
+    const size_t Z = scm_page_size(n + 2, c, scm_storage_bits(b, G), e);
+
+    // A compressed page is stored as an image of blocks, each block a pixel.
+
+    const int w = e ? (n + 2) / 4        : n + 2;
+    const int y = e ? scm_block_size(e)  : c;
+    const int x = e ? 8                  : b;
+
+    const void *r = F->get_page_data(o, w, w, y, x);
+
+    scm_host   *H = r ? 0 : C->get_host();
+    void       *s = p;
+    void       *t = 0;
+    int         k = -1;
+    bool        j = false;
+
+    // Find the page in the mapping, in the host cache, or decode it into a
+    // readable buffer.
+
+    if (r)
+        d = true;
+
+    else if (H)
+    {
+        if ((k = H->find(f, i)) >= 0)
+        {
+            s = H->data(k);
+            d = true;
+        }
+        else if ((k = H->claim(f, i)) >= 0)
+        {
+            s = H->data(k);
+            d = F->read_page(K, i, o, w, w, y, x, s);
+            j = true;
+        }
+    }
+    if (r == 0 && k < 0)
+    {
+        if ((V > 1 || G) && (t = malloc(z)))
+            s = t;
+
+        // A converted page is larger as read than as stored.
+
+        if (s != p || G == 0)
+            d = F->read_page(K, i, o, w, w, y, x, s);
+    }
+    // If the page could not be read, leave the pixel buffer untouched and the
+    // page marked as not loaded, rather than upload an unfilled buffer.
+
+    if (!d)
+    {
+        if (k >= 0)
+            H->cancel(k);
+
+        free(t);
+        return false;
+    }
+    if (r == 0)
+        r = s;
+
+    // Copy the page and its mipmaps to the pixel buffer.
+
+    if (G == 2 && r != p)
+    {
+        GLfloat r0;
+        GLfloat r1;
+
+        scm_range(r, z / sizeof (GLfloat), r0, r1);
+
+        v0 = r0;
+        v1 = r1 - r0;
+    }
+
+    if (G && r != p)
+        scm_convert(r, p, z / sizeof (GLfloat), G, v0, v1);
+    else if (r != p)
+        memcpy(p, r, z);
+
+    // Compute the mipmaps only from a readable copy of the page, never from
+    // the pixel buffer, which may be mapped write-only. Lacking a copy, upload
+    // the page alone.
+
+    v = 1;
+
+    if (V > 1 && r != p)
+    {
+        if (void *h = malloc(scm_mipmap_size(n + 2, V, c, b)))
+        {
+            const void *a = r;
+            GLubyte    *g = (GLubyte *) h;
+
+            for (int l = 1; l < V; ++l)
+            {
+                const int w0 = std::max((n + 2) >> (l - 1), 1);
+                const int w1 = std::max((n + 2) >>  l,      1);
+
+                scm_mipmap(a, g, w0, w0, c, b);
+
+                a  = g;
+                g += size_t(w1) * size_t(w1) * scm_pixel_size(c, b);
+            }
+
+            const size_t m = scm_mipmap_size(n + 2, V, c, b);
+
+            if (G)
+                scm_convert(h, (GLubyte *) p + Z, m / sizeof (GLfloat),
+                                                  G, v0, v1);
+            else
+                memcpy((GLubyte *) p + z, h, m);
+
+            free(h);
+            v = V;
+        }
+    }
+
+    // Release the host slot and scratch buffer.
+
+    if (k >= 0)
+    {
+        if (!j) H->release(k);
+        else    H->commit (k);
+    }
+    free(t);
+
+    return d;
 }
 
 //------------------------------------------------------------------------------
@@ -187,3 +426,442 @@ GLsizei scm_pixel_size(uint16 c, uint16 b)
 }
 
 //------------------------------------------------------------------------------
+
+/// Select an OpenGL internal texture format for data stored as converted by a
+/// cache. @see scm_cache::float_storage
+///
+/// @param c Channels per pixel
+/// @param b Bits per channel, as read
+/// @param s Storage conversion: 0 none, 1 half float, 2 normalized 16-bit
+
+GLenum scm_storage_form(uint16 c, uint16 b, int s)
+{
+    if (s == 1)
+        switch (c)
+        {
+        case  1: return GL_LUMINANCE16F_ARB;
+        case  2: return GL_LUMINANCE_ALPHA16F_ARB;
+        case  3: return GL_RGB16F_ARB;
+        default: return GL_RGBA16F_ARB;
+        }
+    else
+        return scm_internal_form(c, scm_storage_bits(b, s));
+}
+
+/// Select an OpenGL data type for data stored as converted by a cache.
+///
+/// @param c Channels per pixel
+/// @param b Bits per channel, as read
+/// @param s Storage conversion
+
+GLenum scm_storage_type(uint16 c, uint16 b, int s)
+{
+    if (s == 1)
+        return GL_HALF_FLOAT_ARB;
+    else
+        return scm_external_type(c, scm_storage_bits(b, s));
+}
+
+/// Return the bits per channel of data stored as converted by a cache.
+///
+/// @param b Bits per channel, as read
+/// @param s Storage conversion
+
+uint16 scm_storage_bits(uint16 b, int s)
+{
+    return s ? 16 : b;
+}
+
+//------------------------------------------------------------------------------
+
+// Convert a float to half float, rounding to nearest even. Overflow gives
+// infinity, and NaN gives a quiet NaN.
+
+static GLushort to_half(GLfloat f)
+{
+    unsigned int u;
+    unsigned int o;
+
+    memcpy(&u, &f, sizeof (u));
+
+    const unsigned int s = (u >> 16) & 0x8000u;
+
+    u &= 0x7FFFFFFFu;
+
+    if (u >= 0x47800000u)
+        o = (u > 0x7F800000u) ? 0x7E00u : 0x7C00u;
+
+    else if (u < 0x38800000u)
+    {
+        // Let the FPU round the subnormal by aligning it to the bias.
+
+        GLfloat x;
+
+        memcpy(&x, &u, sizeof (x));
+        x += 0.5f;
+        memcpy(&o, &x, sizeof (o));
+        o -= 0x3F000000u;
+    }
+    else
+    {
+        const unsigned int m = (u >> 13) & 1u;
+
+        u += 0xC8000FFFu + m;
+        o  = u >> 13;
+    }
+    return GLushort(s | o);
+}
+
+static void half_scalar(const GLfloat *a, GLushort *b, size_t n)
+{
+    for (size_t k = 0; k < n; ++k)
+        b[k] = to_half(a[k]);
+}
+
+static GLushort to_norm(GLfloat f, GLfloat o, GLfloat s)
+{
+    GLfloat t = (f - o) * s;
+
+    if (!(t > 0.f))   t = 0.f;
+    if (t > 65535.f)  t = 65535.f;
+
+    return GLushort(t + 0.5f);
+}
+
+static void norm_scalar(const GLfloat *a, GLushort *b, size_t n,
+                        GLfloat o, GLfloat s)
+{
+    for (size_t k = 0; k < n; ++k)
+        b[k] = to_norm(a[k], o, s);
+}
+
+static void range_scalar(const GLfloat *a, size_t n, GLfloat& r0, GLfloat& r1)
+{
+    for (size_t k = 0; k < n; ++k)
+    {
+        if (a[k] < r0) r0 = a[k];
+        if (a[k] > r1) r1 = a[k];
+    }
+}
+
+#ifdef SCM_TASK_SSE2
+
+// Normalize eight values at a time. Each lane is clamped as by to_norm, NaN
+// giving zero, and rounded by truncation of the value plus one half, so the
+// results are identical to the scalar code. SSE2 lacks an unsigned 32-to-16
+// pack, so the values are biased into the signed range and back.
+
+static void norm_sse2(const GLfloat *a, GLushort *b, size_t n,
+                      GLfloat o, GLfloat s)
+{
+    const __m128  O = _mm_set1_ps(o);
+    const __m128  S = _mm_set1_ps(s);
+    const __m128  Z = _mm_setzero_ps();
+    const __m128  M = _mm_set1_ps(65535.f);
+    const __m128  H = _mm_set1_ps(0.5f);
+    const __m128i B = _mm_set1_epi32(32768);
+    const __m128i X = _mm_set1_epi16(short(0x8000));
+
+    size_t k = 0;
+
+    for (; k + 8 <= n; k += 8)
+    {
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(a + k),     O), S);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(a + k + 4), O), S);
+
+        t0 = _mm_add_ps(_mm_min_ps(_mm_max_ps(t0, Z), M), H);
+        t1 = _mm_add_ps(_mm_min_ps(_mm_max_ps(t1, Z), M), H);
+
+        const __m128i i0 = _mm_sub_epi32(_mm_cvttps_epi32(t0), B);
+        const __m128i i1 = _mm_sub_epi32(_mm_cvttps_epi32(t1), B);
+
+        _mm_storeu_si128((__m128i *) (b + k),
+                         _mm_xor_si128(_mm_packs_epi32(i0, i1), X));
+    }
+    norm_scalar(a + k, b + k, n - k, o, s);
+}
+
+// Find the extrema four lanes at a time. The new value is given first to each
+// comparison so that a NaN lane keeps the running value, as in the scalar code.
+
+static void range_sse2(const GLfloat *a, size_t n, GLfloat& r0, GLfloat& r1)
+{
+    __m128 l = _mm_set1_ps(r0);
+    __m128 h = _mm_set1_ps(r1);
+
+    size_t k = 0;
+
+    for (; k + 4 <= n; k += 4)
+    {
+        const __m128 x = _mm_loadu_ps(a + k);
+
+        l = _mm_min_ps(x, l);
+        h = _mm_max_ps(x, h);
+    }
+
+    GLfloat L[4];
+    GLfloat H[4];
+
+    _mm_storeu_ps(L, l);
+    _mm_storeu_ps(H, h);
+
+    for (int i = 0; i < 4; ++i)
+    {
+        if (L[i] < r0) r0 = L[i];
+        if (H[i] > r1) r1 = H[i];
+    }
+    range_scalar(a + k, n - k, r0, r1);
+}
+
+#endif
+#ifdef SCM_TASK_F16C
+
+// Convert four values at a time, rounding to nearest even as does to_half.
+
+SCM_TASK_F16C
+static void half_f16c(const GLfloat *a, GLushort *b, size_t n)
+{
+    size_t k = 0;
+
+    for (; k + 4 <= n; k += 4)
+        _mm_storel_epi64((__m128i *) (b + k),
+                         _mm_cvtps_ph(_mm_loadu_ps(a + k), 0));
+
+    half_scalar(a + k, b + k, n - k);
+}
+
+#endif
+
+// Select the fastest conversion kernels supported by the running processor.
+// Every processor with AVX2 also has F16C.
+
+typedef void (*scm_half)(const GLfloat *, GLushort *, size_t);
+typedef void (*scm_norm)(const GLfloat *, GLushort *, size_t, GLfloat, GLfloat);
+typedef void (*scm_span)(const GLfloat *, size_t, GLfloat&, GLfloat&);
+
+static scm_half choose_half()
+{
+#ifdef SCM_TASK_F16C
+    if (SDL_HasAVX2())
+        return half_f16c;
+#endif
+    return half_scalar;
+}
+
+static scm_norm choose_norm()
+{
+#ifdef SCM_TASK_SSE2
+    if (SDL_HasSSE2())
+        return norm_sse2;
+#endif
+    return norm_scalar;
+}
+
+static scm_span choose_range()
+{
+#ifdef SCM_TASK_SSE2
+    if (SDL_HasSSE2())
+        return range_sse2;
+#endif
+    return range_scalar;
+}
+
+static const scm_half half_kernel  = choose_half();
+static const scm_norm norm_kernel  = choose_norm();
+static const scm_span range_kernel = choose_range();
+
+/// Find the minimum and maximum of n float values, disregarding NaN. If all
+/// are NaN, give zero and zero.
+///
+/// @param src Float values
+/// @param n   Value count
+/// @param r0  Minimum output
+/// @param r1  Maximum output
+
+void scm_range(const void *src, size_t n, GLfloat& r0, GLfloat& r1)
+{
+    r0 = +std::numeric_limits<GLfloat>::max();
+    r1 = -std::numeric_limits<GLfloat>::max();
+
+    range_kernel((const GLfloat *) src, n, r0, r1);
+
+    if (r0 > r1)
+    {
+        r0 = 0.f;
+        r1 = 0.f;
+    }
+}
+
+/// Convert n float values to 16-bit storage. Storage 1 gives half floats.
+/// Storage 2 maps the range from o to o + s onto unsigned integers, clamping
+/// values outside it and giving zero for NaN.
+///
+/// @param src Float values
+/// @param dst 16-bit values output
+/// @param n   Value count
+/// @param g   Storage conversion
+/// @param o   Value offset of storage 2
+/// @param s   Value scale of storage 2
+
+void scm_convert(const void *src, void *dst, size_t n, int g,
+                                  GLfloat o, GLfloat s)
+{
+    if (g == 1)
+        half_kernel((const GLfloat *) src, (GLushort *) dst, n);
+    else
+        norm_kernel((const GLfloat *) src, (GLushort *) dst, n,
+                                    o, (s > 0.f) ? 65535.f / s : 0.f);
+}
+
+//------------------------------------------------------------------------------
+
+/// Select an OpenGL compressed texture format for an SCM block compression
+/// format, as given by TIFF tag 0xFFB5. Return zero for uncompressed data.
+///
+/// @param x Block compression format: 1 for BC1, 4 for BC4, or 5 for BC5
+
+GLenum scm_compressed_form(uint16 x)
+{
+    switch (x)
+    {
+    case  1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case  4: return GL_COMPRESSED_RED_RGTC1;
+    case  5: return GL_COMPRESSED_RG_RGTC2;
+    default: return 0;
+    }
+}
+
+/// Return the size in bytes of one 4x4 block of a block compression format.
+///
+/// @param x Block compression format
+
+GLsizei scm_block_size(uint16 x)
+{
+    switch (x)
+    {
+    case  1: return  8;
+    case  4: return  8;
+    case  5: return 16;
+    default: return  0;
+    }
+}
+
+/// Return the number of channels decoded from a block compression format.
+///
+/// @param x Block compression format
+
+uint16 scm_block_channels(uint16 x)
+{
+    switch (x)
+    {
+    case  1: return 3;
+    case  4: return 1;
+    case  5: return 2;
+    default: return 0;
+    }
+}
+
+/// Return the storage size in bytes of a square page. A compressed page must
+/// have a width divisible by four.
+///
+/// @param w Page width and height
+/// @param c Channels per pixel
+/// @param b Bits per channel
+/// @param x Block compression format, or zero
+
+size_t scm_page_size(int w, uint16 c, uint16 b, uint16 x)
+{
+    if (x)
+        return size_t(std::max(w / 4, 1)) * size_t(std::max(w / 4, 1))
+                                          * size_t(scm_block_size(x));
+    else
+        return size_t(w) * size_t(w) * size_t(scm_pixel_size(c, b));
+}
+
+//------------------------------------------------------------------------------
+
+/// Return the number of mipmap levels of a square image, including the base.
+///
+/// @param w Image width and height
+
+int scm_mipmap_count(int w)
+{
+    int l = 1;
+
+    while (w > 1)
+    {
+        w >>= 1;
+        l  += 1;
+    }
+    return l;
+}
+
+/// Return the storage size of the mipmap levels of a square image, excluding
+/// the base.
+///
+/// @param w Image width and height
+/// @param l Mipmap level count, including the base
+/// @param c Channels per pixel
+/// @param b Bits per channel
+
+size_t scm_mipmap_size(int w, int l, uint16 c, uint16 b)
+{
+    size_t s = 0;
+
+    for (int k = 1; k < l; ++k)
+    {
+        const size_t x = size_t(std::max(w >> k, 1));
+        s += x * x * scm_pixel_size(c, b);
+    }
+    return s;
+}
+
+// Box filter a 2x2 neighborhood of image a into pixel (x, y) of image b.
+
+template <typename T> static void box(const T *a, T *b, int x, int y,
+                                      int w, int h, int W, int c)
+{
+    const int x0 = std::min(2 * x,     w - 1);
+    const int x1 = std::min(2 * x + 1, w - 1);
+    const int y0 = std::min(2 * y,     h - 1);
+    const int y1 = std::min(2 * y + 1, h - 1);
+
+    for (int k = 0; k < c; ++k)
+    {
+        double s = double(a[(y0 * w + x0) * c + k])
+                 + double(a[(y0 * w + x1) * c + k])
+                 + double(a[(y1 * w + x0) * c + k])
+                 + double(a[(y1 * w + x1) * c + k]);
+
+        if (std::numeric_limits<T>::is_integer)
+            b[(y * W + x) * c + k] = T(s / 4.0 + 0.5);
+        else
+            b[(y * W + x) * c + k] = T(s / 4.0);
+    }
+}
+
+/// Compute the next mipmap level of an image by box filtering.
+///
+/// @param src Source image
+/// @param dst Destination image of size max(w/2, 1) by max(h/2, 1)
+/// @param w   Source width
+/// @param h   Source height
+/// @param c   Channels per pixel
+/// @param b   Bits per channel
+
+void scm_mipmap(const void *src, void *dst, int w, int h, uint16 c, uint16 b)
+{
+    const int W = std::max(w / 2, 1);
+    const int H = std::max(h / 2, 1);
+
+    for     (int y = 0; y < H; ++y)
+        for (int x = 0; x < W; ++x)
+            switch (b)
+            {
+            case  8: box((const GLubyte  *) src, (GLubyte  *) dst, x, y, w, h, W, c); break;
+            case 16: box((const GLushort *) src, (GLushort *) dst, x, y, w, h, W, c); break;
+            case 32: box((const GLfloat  *) src, (GLfloat  *) dst, x, y, w, h, W, c); break;
+            }
+}
+
+//------------------------------------------------------------------------------
@@ -29,35 +29,66 @@ class scm_cache;
 ///
 /// It encapsulates all of the parameters of the page to be loaded and includes
 /// the OpenGL state necessary to perform an asynchronous upload of the loaded
-/// data.
+/// data. A page of 32-bit float data may be converted to 16 bits as it is
+/// loaded, according to the storage of the destination cache, in which case
+/// the range of a normalized page is returned along with it.
+/// @see scm_cache::float_storage
 
 struct scm_task : public scm_item
 {
     scm_task();
     scm_task(int, long long);
-    scm_task(int, long long, uint64, int, int, int, GLuint, scm_cache *);
+    scm_task(int, long long, uint64, int, int, int, int, GLuint, scm_cache *);
+    scm_task(int, long long, uint64, int, int, int, int, GLuint, GLintptr,
+                                                     void *, scm_cache *);
 
     void make_page(int, int);
-    bool load_page(const char *, TIFF *);
+    void make_layer(int, int);
+    bool load_page(scm_file *, int);
     void dump_page();
 
     uint64     o;          ///< SCM TIFF file offset of this page
     int        n;          ///< Page size
     int        c;          ///< Page channel per pixel
     int        b;          ///< Page bits per channel
+    int        e;          ///< Page block compression format
+    int        k;          ///< Upload slot index
     GLuint     u;          ///< Pixel unpack buffer object
+    GLintptr   q;          ///< Pixel unpack buffer offset
+    bool       m;          ///< Pixel unpack buffer persistent mapping flag
     bool       d;          ///< Pixel unpack buffer dirty flag
+    bool       a;          ///< Prefetch flag, for low-priority pages
+    int        v;          ///< Mipmap levels written to the pixel buffer
     void      *p;          ///< Pixel unpack buffer map address
     scm_cache *C;          ///< Destination cache
+    GLfloat    v0;         ///< Value offset of a normalized page
+    GLfloat    v1;         ///< Value scale of a normalized page
 };
 
 //------------------------------------------------------------------------------
 /// @file
 
-GLuint  scm_internal_form(uint16 c, uint16 b);
-GLuint  scm_external_form(uint16 c, uint16 b);
-GLuint  scm_external_type(uint16 c, uint16 b);
-GLsizei scm_pixel_size   (uint16 c, uint16 b);
+GLuint  scm_internal_form  (uint16 c, uint16 b);
+GLuint  scm_external_form  (uint16 c, uint16 b);
+GLuint  scm_external_type  (uint16 c, uint16 b);
+GLsizei scm_pixel_size     (uint16 c, uint16 b);
+
+GLuint  scm_storage_form   (uint16 c, uint16 b, int s);
+GLuint  scm_storage_type   (uint16 c, uint16 b, int s);
+uint16  scm_storage_bits   (uint16 b, int s);
+
+void    scm_range  (const void *, size_t, GLfloat&, GLfloat&);
+void    scm_convert(const void *, void *, size_t, int, GLfloat, GLfloat);
+
+GLenum  scm_compressed_form(uint16 x);
+GLsizei scm_block_size     (uint16 x);
+uint16  scm_block_channels (uint16 x);
+size_t  scm_page_size      (int w, uint16 c, uint16 b, uint16 x);
+
+int     scm_mipmap_count (int w);
+size_t  scm_mipmap_size  (int w, int l, uint16 c, uint16 b);
+void    scm_mipmap       (const void *, void *, int w, int h, uint16 c,
+                                                               uint16 b);
 
 //------------------------------------------------------------------------------
 
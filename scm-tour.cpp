@@ -0,0 +1,173 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#include <fstream>
+#include <sstream>
+#include <cassert>
+
+#include "scm-tour.hpp"
+#include "scm-log.hpp"
+
+//------------------------------------------------------------------------------
+
+/// Create an empty warm list.
+
+scm_tour::scm_tour()
+{
+}
+
+/// Remove all steps and pages.
+
+void scm_tour::clear()
+{
+    names.clear();
+    steps.clear();
+}
+
+/// Begin a new step. Subsequently added pages belong to it.
+
+void scm_tour::add_step()
+{
+    steps.push_back(std::vector<page>());
+}
+
+/// Add page i of the named scene to the current step.
+
+void scm_tour::add_page(const std::string& name, long long i)
+{
+    assert(!steps.empty());
+
+    page p;
+
+    for (p.s = 0; p.s < int(names.size()); p.s++)
+        if (names[p.s] == name)
+            break;
+
+    if (p.s == int(names.size()))
+        names.push_back(name);
+
+    p.i = i;
+
+    steps.back().push_back(p);
+}
+
+//------------------------------------------------------------------------------
+
+/// Return the number of steps.
+
+int scm_tour::get_step_count() const
+{
+    return int(steps.size());
+}
+
+/// Return the number of pages first needed at step k.
+
+int scm_tour::get_page_count(int k) const
+{
+    return int(steps[k].size());
+}
+
+/// Return the scene name of the jth page of step k.
+
+const std::string& scm_tour::get_page_scene(int k, int j) const
+{
+    return names[steps[k][j].s];
+}
+
+/// Return the page index of the jth page of step k.
+
+long long scm_tour::get_page_index(int k, int j) const
+{
+    return steps[k][j].i;
+}
+
+//------------------------------------------------------------------------------
+
+// A warm list file begins with a header line giving the scene count and step
+// count, followed by one scene name per line. Each step is then one line,
+// giving its page count and a scene index and page index for each page.
+
+/// Read a warm list from the named file. Return false on failure.
+
+bool scm_tour::read(const std::string& filename)
+{
+    std::ifstream file(filename.c_str());
+    std::string   line;
+    std::string   magic;
+    int           n = 0;
+    int           m = 0;
+
+    clear();
+
+    if (std::getline(file, line))
+    {
+        std::istringstream head(line);
+
+        if (head >> magic >> n >> m && magic == "scm-tour")
+        {
+            for (int s = 0; s < n && std::getline(file, line); s++)
+                names.push_back(line);
+
+            for (int k = 0; k < m && std::getline(file, line); k++)
+            {
+                std::istringstream step(line);
+                int c = 0;
+
+                add_step();
+
+                if (step >> c)
+                    for (int j = 0; j < c; j++)
+                    {
+                        page p;
+
+                        if (step >> p.s >> p.i && 0 <= p.s && p.s < n)
+                            steps.back().push_back(p);
+                    }
+            }
+            if (int(names.size()) == n && int(steps.size()) == m)
+                return true;
+        }
+    }
+    scm_log("* scm_tour read failure %s", filename.c_str());
+    clear();
+    return false;
+}
+
+/// Write this warm list to the named file. Return false on failure.
+
+bool scm_tour::write(const std::string& filename) const
+{
+    std::ofstream file(filename.c_str());
+
+    file << "scm-tour " << names.size() << " " << steps.size() << std::endl;
+
+    for (size_t s = 0; s < names.size(); s++)
+        file << names[s] << std::endl;
+
+    for (size_t k = 0; k < steps.size(); k++)
+    {
+        file << steps[k].size();
+
+        for (size_t j = 0; j < steps[k].size(); j++)
+            file << " " << steps[k][j].s << " " << steps[k][j].i;
+
+        file << std::endl;
+    }
+
+    if (file.good())
+        return true;
+
+    scm_log("* scm_tour write failure %s", filename.c_str());
+    return false;
+}
+
+//------------------------------------------------------------------------------
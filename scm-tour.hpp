@@ -0,0 +1,62 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#ifndef SCM_TOUR_HPP
+#define SCM_TOUR_HPP
+
+#include <string>
+#include <vector>
+
+//------------------------------------------------------------------------------
+
+/// An scm_tour is a warm list, giving the pages needed by each step of a fixed
+/// sequence of views.
+///
+/// Each step records only the pages that become visible at that step, so the
+/// list is compact and gives the exact step at which each page is first
+/// needed. Pages are keyed on scene name, allowing a warm list computed once to
+/// be stored and reloaded. @see scm_system::prep_tour
+/// @see scm_system::warm_tour
+
+class scm_tour
+{
+public:
+
+    scm_tour();
+
+    void clear();
+    void add_step();
+    void add_page(const std::string&, long long);
+
+    int                get_step_count()             const;
+    int                get_page_count(int)          const;
+    const std::string& get_page_scene(int, int)     const;
+    long long          get_page_index(int, int)     const;
+
+    bool read (const std::string&);
+    bool write(const std::string&) const;
+
+private:
+
+    struct page
+    {
+        int       s;    ///< Scene name index
+        long long i;    ///< Page index
+    };
+
+    std::vector<std::string>        names;
+    std::vector<std::vector<page> > steps;
+};
+
+//------------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,340 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#include <cstdio>
+
+#include "scm-trace.hpp"
+#include "scm-log.hpp"
+
+//------------------------------------------------------------------------------
+
+/// The number of marks retained by each thread's ring.
+
+int scm_trace::ring_size = 65536;
+
+/// The number of GPU marks that may await their timer queries.
+
+int scm_trace::query_size = 256;
+
+SDL_atomic_t                   scm_trace::enabled;
+SDL_mutex                     *scm_trace::mutex  = 0;
+SDL_TLSID                      scm_trace::slot   = 0;
+std::vector<scm_trace::ring *> scm_trace::rings;
+Uint64                         scm_trace::base   = 0;
+
+std::vector<scm_trace::query>  scm_trace::queries;
+unsigned int                   scm_trace::qhead  = 0;
+unsigned int                   scm_trace::qtail  = 0;
+unsigned int                   scm_trace::qopen  = 0;
+unsigned int                   scm_trace::qdrop  = 0;
+scm_trace::ring               *scm_trace::gpu    = 0;
+long long                      scm_trace::offset = 0;
+bool                           scm_trace::synced = false;
+SDL_GLContext                  scm_trace::owner  = 0;
+
+//------------------------------------------------------------------------------
+
+// Create an empty ring for the timeline of the given name and thread ID.
+
+scm_trace::ring::ring(const char *name, int tid) :
+    name(name), tid(tid), v(ring_size)
+{
+    SDL_AtomicSet(&head, 0);
+
+    for (size_t k = 0; k < v.size(); ++k)
+        v[k].s = 0;
+}
+
+//------------------------------------------------------------------------------
+
+/// Prepare to trace. This is called by the scm_system constructor, in the
+/// render thread, before any other thread may trace. It may be called again.
+
+void scm_trace::init()
+{
+    if (mutex == 0)
+    {
+        mutex = SDL_CreateMutex();
+        slot  = SDL_TLSCreate();
+        base  = SDL_GetPerformanceCounter();
+
+        SDL_AtomicSet(&enabled, 0);
+    }
+}
+
+/// Enable or disable the recording of marks. Disabling releases the timer
+/// queries, and must be done in the render thread with their context current.
+/// All recorded marks are retained for dumping.
+
+void scm_trace::set_enabled(bool b)
+{
+    init();
+
+    SDL_AtomicSet(&enabled, b ? 1 : 0);
+
+    if (!b && !queries.empty())
+    {
+        for (size_t k = 0; k < queries.size(); ++k)
+            glDeleteQueries(1, &queries[k].q);
+
+        queries.clear();
+        qhead  = 0;
+        qtail  = 0;
+        qopen  = 0;
+        qdrop  = 0;
+        synced = false;
+    }
+}
+
+/// Return true if marks are being recorded.
+
+bool scm_trace::get_enabled()
+{
+    return (SDL_AtomicGet(&enabled) != 0);
+}
+
+/// Name the timeline of the calling thread. The name must be a string literal.
+
+void scm_trace::name(const char *s)
+{
+    if (ring *r = get_ring())
+    {
+        SDL_LockMutex(mutex);
+        r->name = s;
+        SDL_UnlockMutex(mutex);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// Return the current time in microseconds since initialization.
+
+Uint64 scm_trace::now()
+{
+    const Uint64 f = SDL_GetPerformanceFrequency();
+    const Uint64 d = SDL_GetPerformanceCounter() - base;
+
+    return (d / f) * 1000000 + (d % f) * 1000000 / f;
+}
+
+// Return the ring of the calling thread, creating it as needed.
+
+scm_trace::ring *scm_trace::get_ring()
+{
+    if (mutex == 0)
+        return 0;
+
+    ring *r = (ring *) SDL_TLSGet(slot);
+
+    if (r == 0)
+    {
+        SDL_LockMutex(mutex);
+        r = new ring("thread", int(rings.size()));
+        rings.push_back(r);
+        SDL_UnlockMutex(mutex);
+
+        SDL_TLSSet(slot, r, 0);
+    }
+    return r;
+}
+
+// Append a mark to ring r, publishing it after it is written.
+
+void scm_trace::put(ring *r, const char *s, Uint64 t, char p)
+{
+    const unsigned int h = (unsigned int) SDL_AtomicGet(&r->head);
+
+    event& e = r->v[h % r->v.size()];
+
+    e.s = s;
+    e.t = t;
+    e.p = p;
+
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&r->head, int(h + 1));
+}
+
+// Mark a CPU scope in the calling thread's ring.
+
+void scm_trace::mark(const char *s, char p)
+{
+    if (ring *r = get_ring())
+        put(r, s, now(), p);
+}
+
+// Issue a timestamp query marking a GPU scope. If all queries are still
+// awaiting the GPU, or if the queries belong to a context other than the
+// current one, the mark is dropped. Scopes are dropped whole: a beginning is
+// accepted only if a query remains for the end of every open scope, and the
+// ends of dropped scopes, and of all scopes nested within them, are dropped
+// with them, so the trace never holds an unmatched slice.
+
+void scm_trace::mark_gpu(const char *s, char p)
+{
+    if (queries.empty())
+    {
+        owner = SDL_GL_GetCurrentContext();
+        queries.resize(query_size);
+
+        for (size_t k = 0; k < queries.size(); ++k)
+            glGenQueries(1, &queries[k].q);
+
+        if (gpu == 0)
+        {
+            SDL_LockMutex(mutex);
+            gpu = new ring("GPU", int(rings.size()));
+            rings.push_back(gpu);
+            SDL_UnlockMutex(mutex);
+        }
+    }
+    else if (SDL_GL_GetCurrentContext() != owner)
+        return;
+
+    if (p == 'B')
+    {
+        if (qdrop || qhead - qtail + qopen + 2 > queries.size())
+        {
+            qdrop++;
+            return;
+        }
+        qopen++;
+    }
+    if (p == 'E')
+    {
+        if (qdrop)
+        {
+            qdrop--;
+            return;
+        }
+        if (qopen == 0)
+            return;
+
+        qopen--;
+    }
+
+    query& q = queries[qhead % queries.size()];
+
+    glQueryCounter(q.q, GL_TIMESTAMP);
+
+    q.s = s;
+    q.p = p;
+
+    qhead++;
+}
+
+/// Collect the GPU marks whose timer queries have completed, without waiting
+/// for any that have not. GPU time is mapped onto the CPU timeline upon the
+/// first collection. This is called once per frame by scm_system::update_cache
+/// and upon each scm_system::set_context, and does nothing unless the context
+/// of the queries is current.
+
+void scm_trace::update()
+{
+    if (SDL_GL_GetCurrentContext() != owner)
+        return;
+
+    while (qtail != qhead)
+    {
+        query& q = queries[qtail % queries.size()];
+
+        GLint    a = 0;
+        GLuint64 t = 0;
+
+        glGetQueryObjectiv(q.q, GL_QUERY_RESULT_AVAILABLE, &a);
+
+        if (a == 0)
+            break;
+
+        glGetQueryObjectui64v(q.q, GL_QUERY_RESULT, &t);
+
+        if (!synced)
+        {
+            GLint64 g = 0;
+
+            glGetInteger64v(GL_TIMESTAMP, &g);
+
+            offset = (long long) now() - (long long) (g / 1000);
+            synced = true;
+        }
+
+        const long long u = (long long) (t / 1000) + offset;
+
+        put(gpu, q.s, Uint64(u > 0 ? u : 0), q.p);
+        qtail++;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+/// Write the contents of all rings to the named file as Chrome trace JSON.
+/// Return false on failure.
+
+bool scm_trace::dump(const char *path)
+{
+    FILE *fp;
+
+    if (mutex == 0 || (fp = fopen(path, "w")) == 0)
+        return false;
+
+    SDL_LockMutex(mutex);
+    {
+        const char *c = "";
+
+        fprintf(fp, "{\"traceEvents\":[\n");
+
+        for (size_t j = 0; j < rings.size(); ++j)
+        {
+            ring *r = rings[j];
+
+            fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                        "\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                        c, r->tid, r->name);
+            c = ",\n";
+
+            const unsigned int h = (unsigned int) SDL_AtomicGet(&r->head);
+            const unsigned int m = (unsigned int) r->v.size();
+            const unsigned int n = (h < m) ? h : m;
+
+            SDL_MemoryBarrierAcquire();
+
+            // Skip the ends of scopes whose beginnings the ring overwrote.
+
+            int d = 0;
+
+            for (unsigned int k = h - n; k != h; ++k)
+            {
+                const event& e = r->v[k % m];
+
+                if (e.p == 'B') d++;
+                if (e.p == 'E' && d-- == 0)
+                {
+                    d = 0;
+                    continue;
+                }
+                if (e.s)
+                    fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":1,"
+                                "\"tid\":%d,\"ts\":%llu}", c, e.s, e.p,
+                                r->tid, (unsigned long long) e.t);
+            }
+        }
+
+        fprintf(fp, "\n]}\n");
+    }
+    SDL_UnlockMutex(mutex);
+
+    scm_log("scm_trace dump %s", path);
+
+    fclose(fp);
+    return true;
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,182 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#ifndef SCM_TRACE_HPP
+#define SCM_TRACE_HPP
+
+#include <GL/glew.h>
+
+#include <vector>
+
+#include <SDL.h>
+#include <SDL_atomic.h>
+#include <SDL_thread.h>
+
+//------------------------------------------------------------------------------
+
+/// scm_trace records the timeline of each thread for export as a Chrome trace
+///
+/// Instrumented code marks the beginning and end of each scope of interest.
+/// Each thread appends these marks to a ring of its own, without locking, and
+/// only while tracing is enabled. The render thread may also mark the GPU
+/// work of a scope using timer queries, which are collected once per frame
+/// without waiting upon the GPU and placed on a timeline of their own. A dump
+/// writes the contents of all rings as Chrome trace JSON, to be viewed using
+/// chrome://tracing or similar. Timer queries belong to the OpenGL context in
+/// which the first GPU mark is made, and GPU marks made while any other context
+/// is current are dropped.
+///
+/// Scope names must be string literals, as only their pointers are recorded.
+/// A dump taken while threads are tracing may include a torn mark where a
+/// ring wraps. If SCM_NO_TRACE is defined then every mark compiles to nothing.
+
+class scm_trace
+{
+public:
+
+    static int ring_size;
+    static int query_size;
+
+    static void init();
+
+    static void set_enabled(bool);
+    static bool get_enabled();
+
+    static void name(const char *);
+
+    static void begin(const char *);
+    static void end  (const char *);
+
+    static void begin_gpu(const char *);
+    static void   end_gpu(const char *);
+
+    static void update();
+    static bool dump(const char *);
+
+    /// A CPU scope, marked for the lifetime of the object.
+
+    class scope
+    {
+    public:
+        scope(const char *s) : s(s) { begin(s); }
+       ~scope()                     {   end(s); }
+    private:
+        const char *s;
+    };
+
+    /// A GPU scope, marked for the lifetime of the object. The render thread
+    /// must make this within a current OpenGL context.
+
+    class gpu_scope
+    {
+    public:
+        gpu_scope(const char *s) : s(s) { begin_gpu(s); }
+       ~gpu_scope()                     {   end_gpu(s); }
+    private:
+        const char *s;
+    };
+
+private:
+
+    struct event
+    {
+        const char *s;
+        Uint64      t;
+        char        p;
+    };
+
+    // A ring of marks made by one thread, written by that thread alone.
+
+    struct ring
+    {
+        ring(const char *, int);
+
+        const char        *name;
+        int                tid;
+        std::vector<event> v;
+        SDL_atomic_t       head;
+    };
+
+    // A timer query marking one end of a GPU scope.
+
+    struct query
+    {
+        GLuint      q;
+        const char *s;
+        char        p;
+    };
+
+    static SDL_atomic_t        enabled;
+    static SDL_mutex          *mutex;
+    static SDL_TLSID           slot;
+    static std::vector<ring *> rings;
+    static Uint64              base;
+
+    static std::vector<query>  queries;
+    static unsigned int        qhead;
+    static unsigned int        qtail;
+    static unsigned int        qopen;
+    static unsigned int        qdrop;
+    static ring               *gpu;
+    static long long           offset;
+    static bool                synced;
+    static SDL_GLContext       owner;
+
+    static Uint64 now();
+    static ring  *get_ring();
+
+    static void   put     (ring *, const char *, Uint64, char);
+    static void   mark    (const char *, char);
+    static void   mark_gpu(const char *, char);
+};
+
+//------------------------------------------------------------------------------
+
+/// Mark the beginning of a CPU scope in the calling thread.
+
+inline void scm_trace::begin(const char *s)
+{
+#ifndef SCM_NO_TRACE
+    if (SDL_AtomicGet(&enabled)) mark(s, 'B');
+#endif
+}
+
+/// Mark the end of a CPU scope in the calling thread.
+
+inline void scm_trace::end(const char *s)
+{
+#ifndef SCM_NO_TRACE
+    if (SDL_AtomicGet(&enabled)) mark(s, 'E');
+#endif
+}
+
+/// Mark the beginning of a GPU scope. Call only from the render thread.
+
+inline void scm_trace::begin_gpu(const char *s)
+{
+#ifndef SCM_NO_TRACE
+    if (SDL_AtomicGet(&enabled)) mark_gpu(s, 'B');
+#endif
+}
+
+/// Mark the end of a GPU scope. Call only from the render thread.
+
+inline void scm_trace::end_gpu(const char *s)
+{
+#ifndef SCM_NO_TRACE
+    if (SDL_AtomicGet(&enabled)) mark_gpu(s, 'E');
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,94 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#include <cstdlib>
+#include <cstdio>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef WIN32
+#include <windows.h>
+#include <direct.h>
+#endif
+
+#include "scm-util.hpp"
+
+//------------------------------------------------------------------------------
+
+/// Return the value of the named environment variable, or the empty string if
+/// it is not set.
+
+std::string scm_getenv(const char *name)
+{
+    const char *s = getenv(name);
+    return s ? std::string(s) : std::string();
+}
+
+/// Return the 64-bit FNV-1a hash of a string, for naming and validating the
+/// contents of caches. The value is the same on every platform.
+
+unsigned long long scm_hash(const std::string& s)
+{
+    unsigned long long h = 14695981039346656037ULL;
+
+    for (size_t k = 0; k < s.size(); ++k)
+    {
+        h ^= (unsigned long long) (unsigned char) s[k];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/// Create the named directory, if it does not already exist.
+
+void scm_mkdir(const std::string& path)
+{
+#ifdef WIN32
+    _mkdir(path.c_str());
+#else
+    mkdir(path.c_str(), 0777);
+#endif
+}
+
+/// Write n bytes from p to the named file. The file is written under a
+/// temporary name and renamed into place, so that a concurrent reader, in this
+/// process or another, never sees a partial file. Return false on failure,
+/// leaving any previous file in place.
+
+bool scm_atomic_write(const std::string& path, const void *p, size_t n)
+{
+    const std::string temp = path + ".tmp";
+
+    bool ok = false;
+
+    if (FILE *f = fopen(temp.c_str(), "wb"))
+    {
+        ok = (n == 0 || fwrite(p, 1, n, f) == n);
+        ok = (fclose(f) == 0) && ok;
+    }
+
+#ifdef WIN32
+    if (ok)
+        ok = (MoveFileExA(temp.c_str(), path.c_str(),
+                          MOVEFILE_REPLACE_EXISTING) != 0);
+#else
+    if (ok)
+        ok = (rename(temp.c_str(), path.c_str()) == 0);
+#endif
+
+    if (!ok)
+        remove(temp.c_str());
+
+    return ok;
+}
+
+//------------------------------------------------------------------------------
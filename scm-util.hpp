@@ -0,0 +1,27 @@
+// Copyright (C) 2011-2012 Robert Kooima
+//
+// LIBSCM is free software; you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#ifndef SCM_UTIL_HPP
+#define SCM_UTIL_HPP
+
+#include <string>
+
+//------------------------------------------------------------------------------
+
+std::string        scm_getenv(const char *);
+unsigned long long scm_hash  (const std::string&);
+void               scm_mkdir (const std::string&);
+bool               scm_atomic_write(const std::string&, const void *, size_t);
+
+//------------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,252 @@
+#version 430
+
+// Evaluate one level of the page tree. Each invocation takes one page of the
+// source list, tests it against the view volume, and either appends its four
+// children to the target list for evaluation at the next level, or appends
+// the page itself to the selection.
+//
+// A page on face a at level l, row r, and column c has the key
+// (l << 3 | a, r << 16 | c). The catalog lists, in key order, each page known
+// to the scene, with the status of the page in the top bit of x and its radius
+// bounds in z and w. Every root is listed.
+
+layout(local_size_x = 64) in;
+
+layout(std430, binding = 0) readonly buffer catalog_block
+{
+    uvec4 catalog[];
+};
+
+layout(std430, binding = 1) readonly buffer source_block
+{
+    uvec4 source_n;
+    uvec2 source[];
+};
+
+layout(std430, binding = 2) buffer target_block
+{
+    uvec4 target_n;
+    uvec2 target[];
+};
+
+layout(std430, binding = 3) buffer chosen_block
+{
+    uvec4 chosen_n;     // Count in x, overflow in y
+    uvec4 chosen[];     // Key, with subdivision in the top bit of x, and bounds
+};
+
+layout(std430, binding = 4) buffer args_block
+{
+    uvec4 args[];       // Indirect dispatch arguments for each level
+};
+
+uniform mat4  M;
+uniform vec2  size;
+uniform float limit;
+uniform uint  level;
+uniform uint  depth;
+uniform uint  capacity;
+uniform uint  catalog_n;
+uniform bool  present;
+
+const float PI_2 = 1.57079632679;
+const float PI_4 = 0.78539816339;
+
+//------------------------------------------------------------------------------
+
+// Return the catalog position of key k, or -1 if it is not listed.
+
+int find(uvec2 k)
+{
+    int a = 0;
+    int b = int(catalog_n);
+
+    while (a < b)
+    {
+        int   m = (a + b) / 2;
+        uvec2 c = uvec2(catalog[m].x & 0x7FFFFFFFu, catalog[m].y);
+
+        if (c.x < k.x || (c.x == k.x && c.y < k.y))
+            a = m + 1;
+        else
+            b = m;
+    }
+
+    if (a < int(catalog_n) && (catalog[a].x & 0x7FFFFFFFu) == k.x
+                           &&  catalog[a].y                == k.y)
+        return a;
+    else
+        return -1;
+}
+
+// Return the key of the parent of the page with key k.
+
+uvec2 parent(uvec2 k)
+{
+    uint a = k.x & 7u;
+    uint l = k.x >> 3;
+    uint r = k.y >> 16;
+    uint c = k.y & 0xFFFFu;
+
+    return uvec2(((l - 1u) << 3) | a, ((r / 2u) << 16) | (c / 2u));
+}
+
+// Return true if the page with key k is present in the scene.
+
+bool status(uvec2 k)
+{
+    if (present)
+        return true;
+
+    int j = find(k);
+
+    return (j >= 0 && (catalog[j].x & 0x80000000u) != 0u);
+}
+
+// Return the bounds of the page with key k, or of its nearest listed ancestor.
+
+vec2 bounds(uvec2 k)
+{
+    int j;
+
+    while ((j = find(k)) < 0 && (k.x >> 3) > 0u)
+        k = parent(k);
+
+    if (j < 0)
+        return vec2(1.0);
+    else
+        return vec2(uintBitsToFloat(catalog[j].z),
+                    uintBitsToFloat(catalog[j].w));
+}
+
+//------------------------------------------------------------------------------
+
+// Calculate the vector toward (x, y) on root face a. @see scm_vector
+
+vec3 vector(uint a, float y, float x)
+{
+    float s = x * PI_2 - PI_4;
+    float t = y * PI_2 - PI_4;
+
+    vec3 u = normalize(vec3(sin(s) * cos(t), -cos(s) * sin(t), cos(s) * cos(t)));
+
+    if (a == 0u) return vec3( u.z,  u.y, -u.x);
+    if (a == 1u) return vec3(-u.z,  u.y,  u.x);
+    if (a == 2u) return vec3( u.x,  u.z, -u.y);
+    if (a == 3u) return vec3( u.x, -u.z,  u.y);
+    if (a == 4u) return vec3( u.x,  u.y,  u.z);
+    else         return vec3(-u.x,  u.y, -u.z);
+}
+
+// Return the screen length between two projected corners.
+
+float span(vec4 j, vec4 k)
+{
+    if (j.w <= 0.0 && k.w <= 0.0) return 0.0;
+    if (j.w <= 0.0)               return 1e30;
+    if (k.w <= 0.0)               return 1e30;
+
+    return length((j.xy / j.w - k.xy / k.w) * size / 2.0);
+}
+
+// Measure the on-screen size of a page with the given radius bounds, or return
+// zero if its bounding shell lies outside the view volume. @see view_page
+
+float view(uint a, uint l, uint r, uint c, float r0, float r1)
+{
+    float n = float(1u << l);
+
+    vec3 v[4];
+
+    v[0] = vector(a, float(r     ) / n, float(c     ) / n);
+    v[1] = vector(a, float(r     ) / n, float(c + 1u) / n);
+    v[2] = vector(a, float(r + 1u) / n, float(c     ) / n);
+    v[3] = vector(a, float(r + 1u) / n, float(c + 1u) / n);
+
+    vec3  u  = v[0] + v[1] + v[2] + v[3];
+    float r2 = r1 * length(u) / dot(v[0], u);
+
+    vec4 P[8];
+    int  o[7] = int[7](0, 0, 0, 0, 0, 0, 0);
+
+    for (int k = 0; k < 8; k++)
+    {
+        P[k] = M * vec4(v[k % 4] * (k < 4 ? r0 : r2), 1.0);
+
+        if (P[k].w <=  0.0)    o[0]++;
+        if (P[k].z >  P[k].w)  o[1]++;
+        if (P[k].z < -P[k].w)  o[2]++;
+        if (P[k].y >  P[k].w)  o[3]++;
+        if (P[k].y < -P[k].w)  o[4]++;
+        if (P[k].x >  P[k].w)  o[5]++;
+        if (P[k].x < -P[k].w)  o[6]++;
+    }
+
+    for (int j = 0; j < 7; j++)
+        if (o[j] == 8)
+            return 0.0;
+
+    return max(max(span(P[0], P[1]), span(P[2], P[3])),
+               max(span(P[0], P[2]), span(P[1], P[3])));
+}
+
+//------------------------------------------------------------------------------
+
+// Append a page to the selection.
+
+void choose(uvec2 k, vec2 b, uint split)
+{
+    uint j = atomicAdd(chosen_n.x, 1u);
+
+    if (j < capacity)
+        chosen[j] = uvec4(k.x | split, k.y, floatBitsToUint(b.x),
+                                            floatBitsToUint(b.y));
+    else
+        atomicOr(chosen_n.y, 1u);
+}
+
+void main()
+{
+    uint n = gl_GlobalInvocationID.x;
+
+    if (n >= source_n.x)
+        return;
+
+    uvec2 k = source[n];
+
+    if (!status(k))
+        return;
+
+    uint a = k.x & 7u;
+    uint l = k.x >> 3;
+    uint r = k.y >> 16;
+    uint c = k.y & 0xFFFFu;
+
+    vec2  b = bounds(k);
+    float s = view(a, l, r, c, b.x, b.y);
+
+    if (s > limit && l + 1u < depth)
+    {
+        // Subdivide. Note the page in case none of its children are drawn.
+
+        uint j = atomicAdd(target_n.x, 4u);
+
+        if (j + 4u <= capacity)
+        {
+            uint x = ((l + 1u) << 3) | a;
+
+            target[j + 0u] = uvec2(x, ((2u * r     ) << 16) | (2u * c     ));
+            target[j + 1u] = uvec2(x, ((2u * r     ) << 16) | (2u * c + 1u));
+            target[j + 2u] = uvec2(x, ((2u * r + 1u) << 16) | (2u * c     ));
+            target[j + 3u] = uvec2(x, ((2u * r + 1u) << 16) | (2u * c + 1u));
+
+            atomicMax(args[level + 1u].x, (j + 4u + 63u) / 64u);
+        }
+        else
+            atomicOr(chosen_n.y, 1u);
+
+        choose(k, b, 0x80000000u);
+    }
+    else if (s > 0.0)
+        choose(k, b, 0u);
+}
@@ -10,6 +10,7 @@ uniform vec2  atmo_r;
 uniform mat4  atmo_T;
 uniform float atmo_H;
 uniform float atmo_P;
+uniform bool  atmo_t;
 
 float density(vec3 p, float d)
 {
@@ -35,6 +36,10 @@ void main()
     vec4 w = atmo_T * vec4(gl_TexCoord[0].xy, d.r, 1.0);
     vec3 q = w.xyz / w.w;
 
+    // Transmittance of the air between p and q.
+
+    float T = 1.0;
+
     // Ray to cast from p toward q.
 
     vec3 v = normalize(q - p);
@@ -77,10 +82,15 @@ void main()
             {
                 vec3 u = mix(a, b, float(i) / float(n));
 
-                c.rgb = mix(c.rgb, atmo_c, density(u, d));
+                T *= 1.0 - density(u, d);
             }
         }
     }
 
-    gl_FragColor = vec4(c.rgb, 1.0);
+    // Give the transmittance alone for upsampling, or apply it.
+
+    if (atmo_t)
+        gl_FragColor = vec4(T);
+    else
+        gl_FragColor = vec4(mix(atmo_c, c.rgb, T), 1.0);
 }
@@ -2,26 +2,54 @@
 
 uniform sampler2DRect color0;
 uniform sampler2DRect depth0;
+uniform sampler2DRect tile;
 
 uniform mat4 T;
 uniform int  n;
 
+// Return the greatest motion in pixels of the tile of p and its neighbors.
+
+float motion(vec2 p)
+{
+    vec2  t = floor(p / 16.0) + 0.5;
+    float L = 0.0;
+
+    for (int j = -1; j <= 1; j++)
+        for (int i = -1; i <= 1; i++)
+            L = max(L, texture2DRect(tile, t + vec2(float(i), float(j))).r);
+
+    return L * 255.0;
+}
+
 void main()
 {
-    vec4 c0 = texture2DRect(color0, gl_FragCoord.xy);
-    vec4 d0 = texture2DRect(depth0, gl_FragCoord.xy);
+    vec4 c0 = texture2DRect(color0, gl_TexCoord[0].xy);
+    vec4 d0 = texture2DRect(depth0, gl_TexCoord[0].xy);
+
+    // Skip tiles that barely move, and take about one sample per pixel of
+    // motion in those that do.
+
+    float L = motion(gl_TexCoord[0].xy);
+
+    if (L < 0.5)
+    {
+        gl_FragColor = vec4(c0.rgb, 1.0);
+        return;
+    }
+
+    int k = int(min(float(n), max(ceil(L), 2.0)));
 
-    vec4 pn =          gl_FragCoord;
-    vec4 pp = T * vec4(gl_FragCoord.xy, d0.r, 1.0);
+    vec4 pn =          gl_TexCoord[0];
+    vec4 pp = T * vec4(gl_TexCoord[0].xy, d0.r, 1.0);
 
     pp = pp / pp.w;
 
     vec4 B = vec4(0.0);
     vec4 b;
 
-    for (int i = 0; i < n; i++)
+    for (int i = 0; i < k; i++)
     {
-        b  = texture2DRect(color0, mix(pn.xy, pp.xy, float(i) / float(n)));
+        b  = texture2DRect(color0, mix(pn.xy, pp.xy, float(i) / float(k)));
         B += vec4(b.rgb, 1.0);
     }
 
@@ -2,5 +2,6 @@
 
 void main()
 {
-    gl_Position = ftransform();
+    gl_TexCoord[0] = gl_MultiTexCoord0;
+    gl_Position    = ftransform();
 }
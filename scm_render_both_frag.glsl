@@ -4,21 +4,49 @@ uniform sampler2DRect color0;
 uniform sampler2DRect depth0;
 uniform sampler2DRect color1;
 uniform sampler2DRect depth1;
+uniform sampler2DRect tile;
 
 uniform mat4  T;
 uniform int   n;
 uniform float t;
 
+// Return the greatest motion in pixels of the tile of p and its neighbors.
+
+float motion(vec2 p)
+{
+    vec2  q = floor(p / 16.0) + 0.5;
+    float L = 0.0;
+
+    for (int j = -1; j <= 1; j++)
+        for (int i = -1; i <= 1; i++)
+            L = max(L, texture2DRect(tile, q + vec2(float(i), float(j))).r);
+
+    return L * 255.0;
+}
+
 void main()
 {
-    vec4 c0 = texture2DRect(color0, gl_FragCoord.xy);
-    vec4 d0 = texture2DRect(depth0, gl_FragCoord.xy);
-    vec4 c1 = texture2DRect(color1, gl_FragCoord.xy);
-    vec4 d1 = texture2DRect(depth1, gl_FragCoord.xy);
+    vec4 c0 = texture2DRect(color0, gl_TexCoord[0].xy);
+    vec4 d0 = texture2DRect(depth0, gl_TexCoord[0].xy);
+    vec4 c1 = texture2DRect(color1, gl_TexCoord[0].xy);
+    vec4 d1 = texture2DRect(depth1, gl_TexCoord[0].xy);
+
+    // Skip tiles that barely move, and take about one sample per pixel of
+    // motion in those that do.
+
+    float L = motion(gl_TexCoord[0].xy);
+
+    if (L < 0.5)
+    {
+        gl_FragColor = vec4(mix(c0.rgb, c1.rgb, t), 1.0);
+        return;
+    }
+
+    int k = int(min(float(n), max(ceil(L), 2.0)));
 
-    vec4 pn =          gl_FragCoord;
-    vec4 p0 = T * vec4(gl_FragCoord.xy, d0.r, 1.0);
-    vec4 p1 = T * vec4(gl_FragCoord.xy, d1.r, 1.0);
+    vec4 pn =          gl_TexCoord[0];
+    vec4 p0 = T * vec4(gl_TexCoord[0].xy, d0.r, 1.0);
+    vec4 p1 = T * vec4(gl_TexCoord[0].xy, d1.r, 1.0);
 
     p0 = p0 / p0.w;
     p1 = p1 / p1.w;
@@ -26,11 +54,11 @@ void main()
     vec4 B0 = vec4(0.0);
     vec4 B1 = vec4(0.0);
 
-    for (int i = 0; i < n; i++)
+    for (int i = 0; i < k; i++)
     {
-        float k = float(i) / float(n);
-        vec4 b0 = texture2DRect(color0, mix(pn.xy, p0.xy, k));
-        vec4 b1 = texture2DRect(color1, mix(pn.xy, p1.xy, k));
+        float s = float(i) / float(k);
+        vec4 b0 = texture2DRect(color0, mix(pn.xy, p0.xy, s));
+        vec4 b1 = texture2DRect(color1, mix(pn.xy, p1.xy, s));
         B0 += vec4(b0.rgb, 1.0);
         B1 += vec4(b1.rgb, 1.0);
     }
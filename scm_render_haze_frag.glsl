@@ -0,0 +1,44 @@
+#extension GL_ARB_texture_rectangle : enable
+
+uniform sampler2DRect color0;
+uniform sampler2DRect depth0;
+uniform sampler2DRect color1;
+
+uniform vec3  atmo_c;
+uniform float d;
+
+// Apply the atmosphere transmittance found at 1/d resolution. Each of the
+// four nearest low-resolution samples is weighted bilinearly and by how near
+// the depth at its location lies to the depth of the current fragment, so
+// that the air before a silhouette does not bleed across it.
+
+void main()
+{
+    vec2 p = gl_TexCoord[0].xy;
+
+    vec4  c = texture2DRect(color0, p);
+    float z = texture2DRect(depth0, p).r;
+
+    vec2 h = p / d - 0.5;
+    vec2 b = floor(h);
+    vec2 f = h - b;
+
+    float W = 0.0;
+    float T = 0.0;
+
+    for (int j = 0; j < 2; j++)
+        for (int i = 0; i < 2; i++)
+        {
+            vec2  o = vec2(float(i), float(j));
+            vec2  q = b + o + 0.5;
+            vec2  a = mix(1.0 - f, f, o);
+
+            float y = texture2DRect(depth0, q * d).r;
+            float w = a.x * a.y / (abs(y - z) * 1000.0 + 0.001);
+
+            T += w * texture2DRect(color1, q).r;
+            W += w;
+        }
+
+    gl_FragColor = vec4(mix(atmo_c, c.rgb, T / W), 1.0);
+}
@@ -0,0 +1,22 @@
+#extension GL_ARB_texture_rectangle : enable
+
+uniform sampler2DRect color0;
+
+uniform float k;
+
+// Upscale a frame rendered at reduced resolution, sharpening by k.
+
+void main()
+{
+    vec2 p = gl_TexCoord[0].xy;
+
+    vec4 c = texture2DRect(color0, p);
+    vec4 n = texture2DRect(color0, p + vec2(-1.0,  0.0))
+           + texture2DRect(color0, p + vec2( 1.0,  0.0))
+           + texture2DRect(color0, p + vec2( 0.0, -1.0))
+           + texture2DRect(color0, p + vec2( 0.0,  1.0));
+
+    vec3 s = c.rgb + k * (c.rgb - n.rgb / 4.0);
+
+    gl_FragColor = vec4(clamp(s, 0.0, 1.0), c.a);
+}
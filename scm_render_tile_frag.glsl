@@ -0,0 +1,37 @@
+#extension GL_ARB_texture_rectangle : enable
+
+uniform sampler2DRect depth0;
+uniform sampler2DRect depth1;
+
+uniform mat4  T;
+uniform float f;
+
+// Find the greatest motion in pixels of a sparse grid of samples of one tile,
+// of both depth buffers if fading. The result is scaled to fit a color byte.
+
+float motion(vec2 p, float d)
+{
+    vec4 q = T * vec4(p, d, 1.0);
+
+    return distance(p, q.xy / q.w);
+}
+
+void main()
+{
+    vec2 o = floor(gl_FragCoord.xy) * 16.0;
+
+    float L = 0.0;
+
+    for (int j = 0; j < 4; j++)
+        for (int i = 0; i < 4; i++)
+        {
+            vec2 p = o + vec2(float(i), float(j)) * 4.0 + 2.0;
+
+            L = max(L, motion(p, texture2DRect(depth0, p).r));
+
+            if (f > 0.0)
+                L = max(L, motion(p, texture2DRect(depth1, p).r));
+        }
+
+    gl_FragColor = vec4(min(L, 255.0) / 255.0);
+}